@@ -120,7 +120,7 @@ const char *const forced_keyframes_const_names[] = {
     NULL
 };
 
-static void do_video_stats(OutputStream *ost, int frame_size);
+static int do_video_stats(OutputStream *ost, int frame_size);
 static int64_t getutime(void);
 static int64_t getmaxrss(void);
 
@@ -156,6 +156,8 @@ static int restore_tty;
 
 #if HAVE_PTHREADS
 static void free_input_threads(void);
+static void free_encode_threads(void);
+static void check_mux_failures(void);
 #endif
 
 /* sub2video hack:
@@ -465,6 +467,11 @@ static void ffmpeg_cleanup(int ret)
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%ikB\n", maxrss);
     }
 
+#if HAVE_PTHREADS
+    free_filtergraph_threads();
+    free_encode_threads();
+#endif
+
     for (i = 0; i < nb_filtergraphs; i++) {
         FilterGraph *fg = filtergraphs[i];
         avfilter_graph_free(&fg->graph);
@@ -497,6 +504,9 @@ static void ffmpeg_cleanup(int ret)
             avio_closep(&s->pb);
         avformat_free_context(s);
         av_dict_free(&of->opts);
+#if HAVE_PTHREADS
+        pthread_mutex_destroy(&of->mux_lock);
+#endif
 
         av_freep(&output_files[i]);
     }
@@ -632,6 +642,20 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     }
 }
 
+static void lock_output_file(OutputFile *of)
+{
+#if HAVE_PTHREADS
+    pthread_mutex_lock(&of->mux_lock);
+#endif
+}
+
+static void unlock_output_file(OutputFile *of)
+{
+#if HAVE_PTHREADS
+    pthread_mutex_unlock(&of->mux_lock);
+#endif
+}
+
 #ifndef SHA1_H
 #define SHA1_H
 /* ================ sha1.h ================ */
@@ -904,12 +928,20 @@ static void dump_packet_info(const char *codectype, AVPacket *pkt, char *pts, ch
 	fwrite(pkt->data, 1, datalen, fp3);
 }
 
->>>>>>> e3befc6... modify ffmpeg.c
-static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
+/**
+ * Mux a packet of ost. This may run in the encoder thread of ost, so fatal
+ * errors are returned instead of exiting, and the muxing state and
+ * statistics shared with the main thread are only updated with the output
+ * file locked.
+ *
+ * @return 0 on success or if the packet was dropped, <0 on fatal errors
+ */
+static int write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
 {
+    OutputFile *of = output_files[ost->file_index];
     AVBitStreamFilterContext *bsfc = ost->bitstream_filters;
     AVCodecContext          *avctx = ost->encoding_needed ? ost->enc_ctx : ost->st->codec;
-    int ret;
+    int ret = 0;
 
     if (!ost->st->codec->extradata_size && ost->enc_ctx->extradata_size) {
         ost->st->codec->extradata = av_mallocz(ost->enc_ctx->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
@@ -923,6 +955,8 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
         (avctx->codec_type == AVMEDIA_TYPE_AUDIO && audio_sync_method < 0))
         pkt->pts = pkt->dts = AV_NOPTS_VALUE;
 
+    lock_output_file(of);
+
     /*
      * Audio encoders may split the packets --  #frames in != #packets out.
      * But there is no reordering, so we can limit the number of output packets
@@ -933,7 +967,7 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
     if (!(avctx->codec_type == AVMEDIA_TYPE_VIDEO && avctx->codec)) {
         if (ost->frame_number >= ost->max_frames) {
             av_packet_unref(pkt);
-            return;
+            goto end;
         }
         ost->frame_number++;
     }
@@ -965,15 +999,17 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
     if ((ret = av_apply_bitstream_filters(avctx, pkt, bsfc)) < 0) {
         print_error("", ret);
         if (exit_on_error)
-            exit_program(1);
+            goto end;
+        ret = 0;
     }
     if (pkt->size == 0 && pkt->side_data_elems == 0)
-        return;
+        goto end;
     if (!ost->st->codecpar->extradata && avctx->extradata) {
         ost->st->codecpar->extradata = av_malloc(avctx->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
         if (!ost->st->codecpar->extradata) {
             av_log(NULL, AV_LOG_ERROR, "Could not allocate extradata buffer to copy parser data.\n");
-            exit_program(1);
+            ret = AVERROR(ENOMEM);
+            goto end;
         }
         ost->st->codecpar->extradata_size = avctx->extradata_size;
         memcpy(ost->st->codecpar->extradata, avctx->extradata, avctx->extradata_size);
@@ -1004,7 +1040,8 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
                ost->file_index, ost->st->index, ost->last_mux_dts, pkt->dts);
         if (exit_on_error) {
             av_log(NULL, AV_LOG_FATAL, "aborting.\n");
-            exit_program(1);
+            ret = AVERROR(EINVAL);
+            goto end;
         }
         av_log(s, loglevel, "changing to %"PRId64". This may result "
                "in incorrect timestamps in the output file.\n",
@@ -1044,9 +1081,20 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
         main_return_code = 1;
+#if HAVE_PTHREADS
+        /* the streams of the other output files are closed from the main
+         * thread, see check_mux_failures() */
+        if (ost->enc_thread_queue)
+            ost->mux_failed = 1;
+        else
+#endif
         close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        ret = 0;
     }
+end:
+    unlock_output_file(of);
     av_packet_unref(pkt);
+    return ret;
 }
 
 static void close_output_stream(OutputStream *ost)
@@ -1073,27 +1121,17 @@ static int check_recording_time(OutputStream *ost)
     return 1;
 }
 
-static void do_audio_out(AVFormatContext *s, OutputStream *ost,
-                         AVFrame *frame)
+static int do_audio_encode(AVFormatContext *s, OutputStream *ost,
+                           AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket pkt;
-    int got_packet = 0;
+    int ret, got_packet = 0;
 
     av_init_packet(&pkt);
     pkt.data = NULL;
     pkt.size = 0;
 
-    if (!check_recording_time(ost))
-        return;
-
-    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
-        frame->pts = ost->sync_opts;
-    ost->sync_opts = frame->pts + frame->nb_samples;
-    ost->samples_encoded += frame->nb_samples;
-    ost->frames_encoded++;
-
-    av_assert0(pkt.size || !pkt.data);
     update_benchmark(NULL);
     if (debug_ts) {
         av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
@@ -1104,7 +1142,7 @@ static void do_audio_out(AVFormatContext *s, OutputStream *ost,
 
     if (avcodec_encode_audio2(enc, &pkt, frame, &got_packet) < 0) {
         av_log(NULL, AV_LOG_FATAL, "Audio encoding failed (avcodec_encode_audio2)\n");
-        exit_program(1);
+        return AVERROR_EXTERNAL;
     }
     update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
 
@@ -1118,8 +1156,127 @@ static void do_audio_out(AVFormatContext *s, OutputStream *ost,
                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->st->time_base));
         }
 
-        write_frame(s, &pkt, ost);
+        if ((ret = write_frame(s, &pkt, ost)) < 0)
+            return ret;
     }
+
+    return 0;
+}
+
+static int do_video_encode(AVFormatContext *s, OutputStream *ost,
+                           AVFrame *in_picture)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+    AVPacket pkt;
+    int ret, got_packet;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    update_benchmark(NULL);
+    if (debug_ts) {
+        av_log(NULL, AV_LOG_INFO, "encoder <- type:video "
+               "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
+               av_ts2str(in_picture->pts), av_ts2timestr(in_picture->pts, &enc->time_base),
+               enc->time_base.num, enc->time_base.den);
+    }
+
+    ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
+    update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
+        return ret;
+    }
+
+    if (got_packet) {
+        int frame_size;
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                   av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &enc->time_base),
+                   av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
+        }
+
+        if (pkt.pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
+            pkt.pts = in_picture->pts;
+
+        av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->st->time_base),
+                av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->st->time_base));
+        }
+
+        frame_size = pkt.size;
+        if ((ret = write_frame(s, &pkt, ost)) < 0)
+            return ret;
+
+        /* if two pass, output log */
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+
+        if (vstats_filename && frame_size &&
+            (ret = do_video_stats(ost, frame_size)) < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Hand a frame over to the encoder of ost, either directly or through the
+ * queue of its encoder thread. The frame is not consumed.
+ */
+static void encode_frame(AVFormatContext *s, OutputStream *ost, AVFrame *frame)
+{
+    int ret;
+
+#if HAVE_PTHREADS
+    if (ost->enc_thread_queue) {
+        AVFrame *ref = av_frame_clone(frame);
+
+        if (!ref) {
+            av_log(NULL, AV_LOG_FATAL, "Could not reference frame for the encoder thread\n");
+            exit_program(1);
+        }
+        ret = av_thread_message_queue_send(ost->enc_thread_queue, &ref, 0);
+        if (ret < 0) {
+            av_frame_free(&ref);
+            if (ret != AVERROR_EXIT)
+                av_log(NULL, AV_LOG_FATAL, "Encoder thread for output stream #%d:%d failed: %s\n",
+                       ost->file_index, ost->index, av_err2str(ret));
+            exit_program(1);
+        }
+        return;
+    }
+#endif
+
+    if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        ret = do_video_encode(s, ost, frame);
+    else
+        ret = do_audio_encode(s, ost, frame);
+    if (ret < 0)
+        exit_program(1);
+}
+
+static void do_audio_out(AVFormatContext *s, OutputStream *ost,
+                         AVFrame *frame)
+{
+    if (!check_recording_time(ost))
+        return;
+
+    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
+        frame->pts = ost->sync_opts;
+    ost->sync_opts = frame->pts + frame->nb_samples;
+    ost->samples_encoded += frame->nb_samples;
+    ost->frames_encoded++;
+
+    encode_frame(s, ost, frame);
 }
 
 static void do_subtitle_out(AVFormatContext *s,
@@ -1202,7 +1359,8 @@ static void do_subtitle_out(AVFormatContext *s,
                 pkt.pts += 90 * sub->end_display_time;
         }
         pkt.dts = pkt.pts;
-        write_frame(s, &pkt, ost);
+        if (write_frame(s, &pkt, ost) < 0)
+            exit_program(1);
     }
 }
 
@@ -1211,14 +1369,13 @@ static void do_video_out(AVFormatContext *s,
                          AVFrame *next_picture,
                          double sync_ipts)
 {
-    int ret, format_video_sync;
+    int format_video_sync;
     AVPacket pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVCodecContext *mux_enc = ost->st->codec;
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
-    int frame_size = 0;
     InputStream *ist = NULL;
     AVFilterContext *filter = ost->filter->filter;
 
@@ -1383,11 +1540,12 @@ static void do_video_out(AVFormatContext *s,
         pkt.pts    = av_rescale_q(in_picture->pts, enc->time_base, ost->st->time_base);
         pkt.flags |= AV_PKT_FLAG_KEY;
 
-        write_frame(s, &pkt, ost);
+        if (write_frame(s, &pkt, ost) < 0)
+            exit_program(1);
     } else
 #endif
     {
-        int got_packet, forced_keyframe = 0;
+        int forced_keyframe = 0;
         double pts_time;
 
         if (enc->flags & (AV_CODEC_FLAG_INTERLACED_DCT | AV_CODEC_FLAG_INTERLACED_ME) &&
@@ -1444,51 +1602,9 @@ static void do_video_out(AVFormatContext *s,
             av_log(NULL, AV_LOG_DEBUG, "Forced keyframe at time %f\n", pts_time);
         }
 
-        update_benchmark(NULL);
-        if (debug_ts) {
-            av_log(NULL, AV_LOG_INFO, "encoder <- type:video "
-                   "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
-                   av_ts2str(in_picture->pts), av_ts2timestr(in_picture->pts, &enc->time_base),
-                   enc->time_base.num, enc->time_base.den);
-        }
-
         ost->frames_encoded++;
 
-        ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
-        update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
-        if (ret < 0) {
-            av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
-            exit_program(1);
-        }
-
-        if (got_packet) {
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                       "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                       av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &enc->time_base),
-                       av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
-            }
-
-            if (pkt.pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
-                pkt.pts = ost->sync_opts;
-
-            av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                    av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->st->time_base),
-                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->st->time_base));
-            }
-
-            frame_size = pkt.size;
-            write_frame(s, &pkt, ost);
-
-            /* if two pass, output log */
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-        }
+        encode_frame(s, ost, in_picture);
     }
     ost->sync_opts++;
     /*
@@ -1497,9 +1613,6 @@ static void do_video_out(AVFormatContext *s,
      * flush, we need to limit them here, before they go into encoder.
      */
     ost->frame_number++;
-
-    if (vstats_filename && frame_size)
-        do_video_stats(ost, frame_size);
   }
 
     if (!ost->last_frame)
@@ -1516,18 +1629,29 @@ static double psnr(double d)
     return -10.0 * log10(d);
 }
 
-static void do_video_stats(OutputStream *ost, int frame_size)
+#if HAVE_PTHREADS
+static pthread_mutex_t vstats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* This may run in the encoder thread of ost, see write_frame(). */
+static int do_video_stats(OutputStream *ost, int frame_size)
 {
+    OutputFile *of = output_files[ost->file_index];
     AVCodecContext *enc;
-    int frame_number;
+    int frame_number, ret = 0;
     double ti1, bitrate, avg_bitrate;
 
+    lock_output_file(of);
+#if HAVE_PTHREADS
+    pthread_mutex_lock(&vstats_lock);
+#endif
     /* this is executed just the first time do_video_stats is called */
     if (!vstats_file) {
         vstats_file = fopen(vstats_filename, "w");
         if (!vstats_file) {
+            ret = AVERROR(errno);
             perror("fopen");
-            exit_program(1);
+            goto end;
         }
     }
 
@@ -1552,6 +1676,12 @@ static void do_video_stats(OutputStream *ost, int frame_size)
                (double)ost->data_size / 1024, ti1, bitrate, avg_bitrate);
         fprintf(vstats_file, "type= %c\n", av_get_picture_type_char(ost->pict_type));
     }
+end:
+#if HAVE_PTHREADS
+    pthread_mutex_unlock(&vstats_lock);
+#endif
+    unlock_output_file(of);
+    return ret;
 }
 
 static void finish_output_stream(OutputStream *ost)
@@ -1597,8 +1727,7 @@ static int reap_filters(int flush)
 
         while (1) {
             double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
-            ret = av_buffersink_get_frame_flags(filter, filtered_frame,
-                                               AV_BUFFERSINK_FLAG_NO_REQUEST);
+            ret = ofilter_get_frame(ost->filter, filtered_frame);
             if (ret < 0) {
                 if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
                     av_log(NULL, AV_LOG_WARNING,
@@ -1821,9 +1950,11 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
 
     oc = output_files[0]->ctx;
 
+    lock_output_file(output_files[0]);
     total_size = avio_size(oc->pb);
     if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
         total_size = avio_tell(oc->pb);
+    unlock_output_file(output_files[0]);
 
     buf[0] = '\0';
     vid = 0;
@@ -1832,6 +1963,8 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         float q = -1;
         ost = output_streams[i];
         enc = ost->enc_ctx;
+        /* the statistics are updated by the encoder threads */
+        lock_output_file(output_files[ost->file_index]);
         if (!ost->stream_copy)
             q = ost->quality / (float) FF_QP2LAMBDA;
 
@@ -1899,6 +2032,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                                           ost->st->time_base, AV_TIME_BASE_Q));
         if (is_last_report)
             nb_frames_drop += ost->last_dropped;
+        unlock_output_file(output_files[ost->file_index]);
     }
 
     secs = FFABS(pts) / AV_TIME_BASE;
@@ -1977,82 +2111,212 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         print_final_stats(total_size);
 }
 
-static void flush_encoders(void)
+static int flush_encoder(OutputStream *ost)
 {
-    int i, ret;
+    AVCodecContext *enc = ost->enc_ctx;
+    AVFormatContext *os = output_files[ost->file_index]->ctx;
+    int ret, stop_encoding = 0;
+
+    if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
+        return 0;
+#if FF_API_LAVF_FMT_RAWPICTURE
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) && enc->codec->id == AV_CODEC_ID_RAWVIDEO)
+        return 0;
+#endif
+
+    for (;;) {
+        int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) = NULL;
+        const char *desc;
+
+        switch (enc->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            encode = avcodec_encode_audio2;
+            desc   = "audio";
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            encode = avcodec_encode_video2;
+            desc   = "video";
+            break;
+        default:
+            stop_encoding = 1;
+        }
+
+        if (encode) {
+            AVPacket pkt;
+            int pkt_size;
+            int got_packet;
+            av_init_packet(&pkt);
+            pkt.data = NULL;
+            pkt.size = 0;
+
+            update_benchmark(NULL);
+            ret = encode(enc, &pkt, NULL, &got_packet);
+            update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                       desc,
+                       av_err2str(ret));
+                return ret;
+            }
+            if (ost->logfile && enc->stats_out) {
+                fprintf(ost->logfile, "%s", enc->stats_out);
+            }
+            if (!got_packet) {
+                stop_encoding = 1;
+                break;
+            }
+            if (ost->finished & MUXER_FINISHED) {
+                av_packet_unref(&pkt);
+                continue;
+            }
+            av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
+            pkt_size = pkt.size;
+            if ((ret = write_frame(os, &pkt, ost)) < 0)
+                return ret;
+            if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
+                if ((ret = do_video_stats(ost, pkt_size)) < 0)
+                    return ret;
+            }
+        }
+
+        if (stop_encoding)
+            break;
+    }
+
+    return 0;
+}
+
+#if HAVE_PTHREADS
+static void *encode_thread(void *arg)
+{
+    OutputStream    *ost = arg;
+    AVFormatContext *os  = output_files[ost->file_index]->ctx;
+    AVFrame *frame;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(ost->enc_thread_queue, &frame, 0)) >= 0) {
+        if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+            ret = do_video_encode(os, ost, frame);
+        else
+            ret = do_audio_encode(os, ost, frame);
+        av_frame_free(&frame);
+        if (ret < 0)
+            break;
+    }
+
+    /* the main thread signals the end of the stream with AVERROR_EOF, in
+     * which case the encoder is drained from this thread as well */
+    if (ret == AVERROR_EOF)
+        ret = flush_encoder(ost);
+
+    ost->enc_thread_ret = ret;
+    av_thread_message_queue_set_err_send(ost->enc_thread_queue,
+                                         ret < 0 ? ret : AVERROR_EOF);
+    return NULL;
+}
+
+static void free_frame_msg(void *msg)
+{
+    av_frame_free(msg);
+}
+
+/* Close the output streams after a muxing failure in an encoder thread,
+ * which cannot do it itself as they are not protected by its lock. */
+static void check_mux_failure(OutputStream *ost)
+{
+    OutputFile *of = output_files[ost->file_index];
+    int failed;
+
+    lock_output_file(of);
+    failed = ost->mux_failed;
+    ost->mux_failed = 0;
+    unlock_output_file(of);
+    if (failed)
+        close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+}
+
+static void check_mux_failures(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_streams; i++)
+        check_mux_failure(output_streams[i]);
+}
+
+static void join_encode_thread(OutputStream *ost, int err)
+{
+    av_thread_message_queue_set_err_recv(ost->enc_thread_queue, err);
+    if (err != AVERROR_EOF)
+        av_thread_message_flush(ost->enc_thread_queue);
+    pthread_join(ost->enc_thread, NULL);
+    av_thread_message_queue_free(&ost->enc_thread_queue);
+}
+
+static void free_encode_threads(void)
+{
+    int i;
 
     for (i = 0; i < nb_output_streams; i++) {
-        OutputStream   *ost = output_streams[i];
-        AVCodecContext *enc = ost->enc_ctx;
-        AVFormatContext *os = output_files[ost->file_index]->ctx;
-        int stop_encoding = 0;
+        OutputStream *ost = output_streams[i];
 
-        if (!ost->encoding_needed)
+        if (!ost || !ost->enc_thread_queue)
             continue;
+        join_encode_thread(ost, AVERROR_EXIT);
+    }
+}
 
-        if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
-            continue;
-#if FF_API_LAVF_FMT_RAWPICTURE
-        if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) && enc->codec->id == AV_CODEC_ID_RAWVIDEO)
+static int init_encode_threads(void)
+{
+    int i, ret;
+
+    if (!encode_threads)
+        return 0;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        OutputFile    *of = output_files[ost->file_index];
+
+        if (!ost->encoding_needed || !ost->filter)
             continue;
+
+        ret = av_thread_message_queue_alloc(&ost->enc_thread_queue,
+                                            of->thread_queue_size, sizeof(AVFrame *));
+        if (ret < 0)
+            return ret;
+        av_thread_message_queue_set_free_func(ost->enc_thread_queue, free_frame_msg);
+
+        if ((ret = pthread_create(&ost->enc_thread, NULL, encode_thread, ost))) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+            av_thread_message_queue_free(&ost->enc_thread_queue);
+            return AVERROR(ret);
+        }
+    }
+    return 0;
+}
 #endif
 
-        for (;;) {
-            int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) = NULL;
-            const char *desc;
+static void flush_encoders(void)
+{
+    int i;
 
-            switch (enc->codec_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                encode = avcodec_encode_audio2;
-                desc   = "audio";
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                encode = avcodec_encode_video2;
-                desc   = "video";
-                break;
-            default:
-                stop_encoding = 1;
-            }
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
 
-            if (encode) {
-                AVPacket pkt;
-                int pkt_size;
-                int got_packet;
-                av_init_packet(&pkt);
-                pkt.data = NULL;
-                pkt.size = 0;
-
-                update_benchmark(NULL);
-                ret = encode(enc, &pkt, NULL, &got_packet);
-                update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                           desc,
-                           av_err2str(ret));
-                    exit_program(1);
-                }
-                if (ost->logfile && enc->stats_out) {
-                    fprintf(ost->logfile, "%s", enc->stats_out);
-                }
-                if (!got_packet) {
-                    stop_encoding = 1;
-                    break;
-                }
-                if (ost->finished & MUXER_FINISHED) {
-                    av_packet_unref(&pkt);
-                    continue;
-                }
-                av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
-                pkt_size = pkt.size;
-                write_frame(os, &pkt, ost);
-                if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
-                    do_video_stats(ost, pkt_size);
-                }
-            }
+        if (!ost->encoding_needed)
+            continue;
 
-            if (stop_encoding)
-                break;
+#if HAVE_PTHREADS
+        if (ost->enc_thread_queue) {
+            join_encode_thread(ost, AVERROR_EOF);
+            if (ost->enc_thread_ret < 0)
+                exit_program(1);
+            check_mux_failure(ost);
+            continue;
         }
+#endif
+
+        if (flush_encoder(ost) < 0)
+            exit_program(1);
     }
 }
 
@@ -2186,7 +2450,8 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
     }
 #endif
 
-    write_frame(of->ctx, &opkt, ost);
+    if (write_frame(of->ctx, &opkt, ost) < 0)
+        exit_program(1);
 }
 
 int guess_input_channel_layout(InputStream *ist)
@@ -2300,7 +2565,7 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
         for (i = 0; i < nb_filtergraphs; i++)
             if (ist_in_filtergraph(filtergraphs[i], ist)) {
                 FilterGraph *fg = filtergraphs[i];
-                if (configure_filtergraph(fg) < 0) {
+                if (reconfigure_filtergraph(fg) < 0) {
                     av_log(NULL, AV_LOG_FATAL, "Error reinitializing filters!\n");
                     exit_program(1);
                 }
@@ -2336,8 +2601,7 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
                 break;
         } else
             f = decoded_frame;
-        err = av_buffersrc_add_frame_flags(ist->filters[i]->filter, f,
-                                     AV_BUFFERSRC_FLAG_PUSH);
+        err = ifilter_send_frame(ist->filters[i], f, AV_BUFFERSRC_FLAG_PUSH);
         if (err == AVERROR_EOF)
             err = 0; /* ignore */
         if (err < 0)
@@ -2455,7 +2719,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
 
         for (i = 0; i < nb_filtergraphs; i++) {
             if (ist_in_filtergraph(filtergraphs[i], ist) && ist->reinit_filters &&
-                configure_filtergraph(filtergraphs[i]) < 0) {
+                reconfigure_filtergraph(filtergraphs[i]) < 0) {
                 av_log(NULL, AV_LOG_FATAL, "Error reinitializing filters!\n");
                 exit_program(1);
             }
@@ -2474,7 +2738,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
                 break;
         } else
             f = decoded_frame;
-        ret = av_buffersrc_add_frame_flags(ist->filters[i]->filter, f, AV_BUFFERSRC_FLAG_PUSH);
+        ret = ifilter_send_frame(ist->filters[i], f, AV_BUFFERSRC_FLAG_PUSH);
         if (ret == AVERROR_EOF) {
             ret = 0; /* ignore */
         } else if (ret < 0) {
@@ -2553,7 +2817,7 @@ static int send_filter_eof(InputStream *ist)
 {
     int i, ret;
     for (i = 0; i < ist->nb_filters; i++) {
-        ret = av_buffersrc_add_frame(ist->filters[i]->filter, NULL);
+        ret = ifilter_send_frame(ist->filters[i], NULL, 0);
         if (ret < 0)
             return ret;
     }
@@ -3669,15 +3933,28 @@ static int need_output(void)
 {
     int i;
 
+#if HAVE_PTHREADS
+    check_mux_failures();
+#endif
+
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
 
-        if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+        int64_t size = 0;
+        int frame_number;
+
+        if (ost->finished)
             continue;
-        if (ost->frame_number >= ost->max_frames) {
+        lock_output_file(of);
+        if (os->pb)
+            size = avio_tell(os->pb);
+        frame_number = ost->frame_number;
+        unlock_output_file(of);
+        if (os->pb && size >= of->limit_filesize)
+            continue;
+        if (frame_number >= ost->max_frames) {
             int j;
             for (j = 0; j < of->ctx->nb_streams; j++)
                 close_output_stream(output_streams[of->ost_index + j]);
@@ -3703,10 +3980,14 @@ static OutputStream *choose_output(void)
 
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
-        int64_t opts = ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
-                       av_rescale_q(ost->st->cur_dts, ost->st->time_base,
-                                    AV_TIME_BASE_Q);
-        if (ost->st->cur_dts == AV_NOPTS_VALUE)
+        int64_t cur_dts, opts;
+
+        lock_output_file(output_files[ost->file_index]);
+        cur_dts = ost->st->cur_dts;
+        unlock_output_file(output_files[ost->file_index]);
+        opts = cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
+               av_rescale_q(cur_dts, ost->st->time_base, AV_TIME_BASE_Q);
+        if (cur_dts == AV_NOPTS_VALUE)
             av_log(NULL, AV_LOG_DEBUG, "cur_dts is invalid (this is harmless if it occurs once at the start per stream)\n");
 
         if (!ost->finished && opts < opts_min) {
@@ -3774,6 +4055,9 @@ static int check_keyboard_interaction(int64_t cur_time)
                    target, time, command, arg);
             for (i = 0; i < nb_filtergraphs; i++) {
                 FilterGraph *fg = filtergraphs[i];
+#if HAVE_PTHREADS
+                filtergraph_thread_pause(fg);
+#endif
                 if (fg->graph) {
                     if (time < 0) {
                         ret = avfilter_graph_send_command(fg->graph, target, command, arg, buf, sizeof(buf),
@@ -3788,6 +4072,10 @@ static int check_keyboard_interaction(int64_t cur_time)
                             fprintf(stderr, "Queing command failed with error %s\n", av_err2str(ret));
                     }
                 }
+#if HAVE_PTHREADS
+                if ((ret = filtergraph_thread_resume(fg)) < 0)
+                    return ret;
+#endif
             }
         } else {
             av_log(NULL, AV_LOG_ERROR,
@@ -4305,6 +4593,57 @@ discard_packet:
     return 0;
 }
 
+#if HAVE_PTHREADS
+/**
+ * Perform a step of transcoding for a filter graph running in its own
+ * thread: collect its output, or pick the input it is waiting for.
+ */
+static int transcode_from_filter_thread(FilterGraph *graph, InputStream **best_ist)
+{
+    int i, ret, best, eagain = 0;
+    InputStream *ist;
+
+    ret = filtergraph_thread_poll(graph, &best);
+    if (ret > 0)
+        return reap_filters(0);
+
+    if (ret == AVERROR_EOF) {
+        ret = reap_filters(1);
+        for (i = 0; i < graph->nb_outputs; i++)
+            close_output_stream(graph->outputs[i]->ost);
+        return ret;
+    }
+    if (ret < 0)
+        return ret;
+
+    if (best >= 0) {
+        ist = graph->inputs[best]->ist;
+        if (!input_files[ist->file_index]->eagain &&
+            !input_files[ist->file_index]->eof_reached)
+            *best_ist = ist;
+    }
+    for (i = 0; i < graph->nb_inputs && !*best_ist; i++) {
+        ist = graph->inputs[i]->ist;
+        if (input_files[ist->file_index]->eagain)
+            eagain = 1;
+        else if (!input_files[ist->file_index]->eof_reached)
+            *best_ist = ist;
+    }
+
+    if (!*best_ist) {
+        if (eagain) {
+            for (i = 0; i < graph->nb_outputs; i++)
+                graph->outputs[i]->ost->unavailable = 1;
+        } else {
+            /* all inputs are at EOF, the graph is only being drained */
+            filtergraph_thread_wait(graph);
+        }
+    }
+
+    return 0;
+}
+#endif
+
 /**
  * Perform a step of transcoding for the specified filter graph.
  *
@@ -4320,6 +4659,10 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
     InputStream *ist;
 
     *best_ist = NULL;
+#if HAVE_PTHREADS
+    if (graph->in_thread_queue)
+        return transcode_from_filter_thread(graph, best_ist);
+#endif
     ret = avfilter_graph_request_oldest(graph->graph);
     if (ret >= 0)
         return reap_filters(0);
@@ -4421,6 +4764,10 @@ static int transcode(void)
     timer_start = av_gettime_relative();
 
 #if HAVE_PTHREADS
+    if ((ret = init_encode_threads()) < 0)
+        goto fail;
+    if ((ret = init_filtergraph_threads()) < 0)
+        goto fail;
     if ((ret = init_input_threads()) < 0)
         goto fail;
 #endif
@@ -4511,6 +4858,7 @@ static int transcode(void)
  fail:
 #if HAVE_PTHREADS
     free_input_threads();
+    free_encode_threads();
 #endif
 
     if (output_streams) {
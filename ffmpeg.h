@@ -240,6 +240,11 @@ typedef struct OutputFilter {
     /* temporary storage until stream maps are processed */
     AVFilterInOut       *out_tmp;
     enum AVMediaType     type;
+
+#if HAVE_PTHREADS
+    AVFifoBuffer        *frame_queue;   /* frames filtered by the filtergraph thread */
+    int                  eof;           /* the buffersink returned EOF */
+#endif
 } OutputFilter;
 
 typedef struct FilterGraph {
@@ -253,6 +258,20 @@ typedef struct FilterGraph {
     int          nb_inputs;
     OutputFilter **outputs;
     int         nb_outputs;
+
+#if HAVE_PTHREADS
+    AVThreadMessageQueue *in_thread_queue;  /* frames sent to the filtergraph thread */
+    pthread_t thread;           /* thread running this filtergraph */
+    pthread_mutex_t lock;       /* protects the fields below and the output frame queues */
+    pthread_cond_t cond;
+    int thread_running;         /* the thread has been started and not joined yet */
+    int thread_ret;             /* exit status of the thread, AVERROR_EXIT if it was stopped */
+    int finished;               /* the thread has exited */
+    int stop;                   /* the thread should exit once its input queue is empty */
+    int input_pending;          /* frames have been queued since the thread last looked */
+    int nb_queued;              /* total number of frames in the output frame queues */
+    int best_input;             /* input the graph is waiting for, or -1 */
+#endif
 } FilterGraph;
 
 typedef struct InputStream {
@@ -490,6 +509,13 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+#if HAVE_PTHREADS
+    AVThreadMessageQueue *enc_thread_queue;
+    pthread_t enc_thread;       /* thread running the encoder of this stream */
+    int enc_thread_ret;         /* result of the encoder thread, <0 on failure */
+    int mux_failed;             /* muxing failed in the encoder thread, see write_frame() */
+#endif
 } OutputStream;
 
 typedef struct OutputFile {
@@ -501,6 +527,12 @@ typedef struct OutputFile {
     uint64_t limit_filesize; /* filesize limit expressed in bytes */
 
     int shortest;
+
+#if HAVE_PTHREADS
+    pthread_mutex_t mux_lock;   /* serializes access to ctx and to the muxing state
+                                   and statistics of the streams between encoder threads */
+    int thread_queue_size;      /* maximum number of frames queued to an encoder thread */
+#endif
 } OutputFile;
 
 extern InputStream **input_streams;
@@ -537,6 +569,8 @@ extern int start_at_zero;
 extern int copy_tb;
 extern int debug_ts;
 extern int debug_pkt;
+extern int encode_threads;
+extern int filtergraph_threads;
 extern int exit_on_error;
 extern int abort_on_flags;
 extern int print_stats;
@@ -572,9 +606,22 @@ enum AVPixelFormat choose_pixel_fmt(AVStream *st, AVCodecContext *avctx, AVCodec
 void choose_sample_fmt(AVStream *st, AVCodec *codec);
 
 int configure_filtergraph(FilterGraph *fg);
+int reconfigure_filtergraph(FilterGraph *fg);
 int configure_output_filter(FilterGraph *fg, OutputFilter *ofilter, AVFilterInOut *out);
 int ist_in_filtergraph(FilterGraph *fg, InputStream *ist);
 FilterGraph *init_simple_filtergraph(InputStream *ist, OutputStream *ost);
+
+int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int flags);
+int ofilter_get_frame(OutputFilter *ofilter, AVFrame *frame);
+
+#if HAVE_PTHREADS
+int  init_filtergraph_threads(void);
+void free_filtergraph_threads(void);
+int  filtergraph_thread_poll(FilterGraph *fg, int *best_input);
+void filtergraph_thread_wait(FilterGraph *fg);
+void filtergraph_thread_pause(FilterGraph *fg);
+int  filtergraph_thread_resume(FilterGraph *fg);
+#endif
 int init_complex_filtergraph(FilterGraph *fg);
 
 int ffmpeg_parse_options(int argc, char **argv);
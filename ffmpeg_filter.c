@@ -1102,3 +1102,384 @@ int ist_in_filtergraph(FilterGraph *fg, InputStream *ist)
     return 0;
 }
 
+int reconfigure_filtergraph(FilterGraph *fg)
+{
+    int ret;
+
+#if HAVE_PTHREADS
+    filtergraph_thread_pause(fg);
+#endif
+    if ((ret = configure_filtergraph(fg)) < 0)
+        return ret;
+#if HAVE_PTHREADS
+    ret = filtergraph_thread_resume(fg);
+#endif
+    return ret;
+}
+
+#if HAVE_PTHREADS
+typedef struct FilterThreadMessage {
+    InputFilter *ifilter;
+    AVFrame     *frame;     /* NULL signals EOF on ifilter */
+    int          flags;
+} FilterThreadMessage;
+
+static void free_filter_thread_message(void *msg)
+{
+    FilterThreadMessage *m = msg;
+    av_frame_free(&m->frame);
+}
+
+/* Move everything available in the buffersinks to the output frame queues. */
+static int filtergraph_thread_reap(FilterGraph *fg)
+{
+    int i, ret;
+
+    for (i = 0; i < fg->nb_outputs; i++) {
+        OutputFilter *ofilter = fg->outputs[i];
+
+        while (1) {
+            AVFrame *frame = av_frame_alloc();
+            if (!frame)
+                return AVERROR(ENOMEM);
+
+            ret = av_buffersink_get_frame_flags(ofilter->filter, frame,
+                                                AV_BUFFERSINK_FLAG_NO_REQUEST);
+            if (ret < 0) {
+                av_frame_free(&frame);
+                if (ret == AVERROR_EOF) {
+                    pthread_mutex_lock(&fg->lock);
+                    ofilter->eof = 1;
+                    pthread_cond_broadcast(&fg->cond);
+                    pthread_mutex_unlock(&fg->lock);
+                } else if (ret != AVERROR(EAGAIN)) {
+                    av_log(NULL, AV_LOG_WARNING,
+                           "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
+                }
+                break;
+            }
+
+            pthread_mutex_lock(&fg->lock);
+            if (av_fifo_space(ofilter->frame_queue) < sizeof(frame))
+                ret = av_fifo_grow(ofilter->frame_queue, av_fifo_size(ofilter->frame_queue));
+            if (ret >= 0) {
+                av_fifo_generic_write(ofilter->frame_queue, &frame, sizeof(frame), NULL);
+                fg->nb_queued++;
+                pthread_cond_broadcast(&fg->cond);
+            }
+            pthread_mutex_unlock(&fg->lock);
+            if (ret < 0) {
+                av_frame_free(&frame);
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static int filtergraph_thread_push(FilterGraph *fg, FilterThreadMessage *msg)
+{
+    int ret = av_buffersrc_add_frame_flags(msg->ifilter->filter, msg->frame,
+                                           msg->flags & ~AV_BUFFERSRC_FLAG_KEEP_REF);
+    av_frame_free(&msg->frame);
+    if (ret == AVERROR_EOF)
+        ret = 0; /* ignore */
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_FATAL,
+               "Failed to inject frame into filter network: %s\n", av_err2str(ret));
+        return ret;
+    }
+    return filtergraph_thread_reap(fg);
+}
+
+static void *filtergraph_thread(void *arg)
+{
+    FilterGraph *fg = arg;
+    FilterThreadMessage msg;
+    int i, ret, max_queued = 8 * FFMAX(fg->nb_outputs, 1);
+
+    while (1) {
+        int pending;
+
+        pthread_mutex_lock(&fg->lock);
+        fg->input_pending = 0;
+        pthread_mutex_unlock(&fg->lock);
+
+        /* pushing frames never blocks, so that the thread sending them can
+         * always make progress */
+        while ((ret = av_thread_message_queue_recv(fg->in_thread_queue, &msg,
+                                                   AV_THREAD_MESSAGE_NONBLOCK)) >= 0)
+            if ((ret = filtergraph_thread_push(fg, &msg)) < 0)
+                goto end;
+        if (ret != AVERROR(EAGAIN))
+            goto end;
+
+        /* only pull frames out of the graph when there is room for them */
+        pthread_mutex_lock(&fg->lock);
+        while (fg->nb_queued >= max_queued && !fg->input_pending && !fg->stop)
+            pthread_cond_wait(&fg->cond, &fg->lock);
+        pending = fg->input_pending || fg->stop;
+        pthread_mutex_unlock(&fg->lock);
+        if (pending)
+            continue;
+
+        ret = avfilter_graph_request_oldest(fg->graph);
+        if (ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            int err = filtergraph_thread_reap(fg);
+            if (err < 0) {
+                ret = err;
+                goto end;
+            }
+        }
+        if (ret == AVERROR_EOF) {
+            pthread_mutex_lock(&fg->lock);
+            for (i = 0; i < fg->nb_outputs; i++)
+                fg->outputs[i]->eof = 1;
+            pthread_mutex_unlock(&fg->lock);
+            goto end;
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            int nb_requests, nb_requests_max = 0, best = -1;
+
+            for (i = 0; i < fg->nb_inputs; i++) {
+                nb_requests = av_buffersrc_get_nb_failed_requests(fg->inputs[i]->filter);
+                if (nb_requests > nb_requests_max) {
+                    nb_requests_max = nb_requests;
+                    best = i;
+                }
+            }
+            pthread_mutex_lock(&fg->lock);
+            fg->best_input = best;
+            pthread_cond_broadcast(&fg->cond);
+            pthread_mutex_unlock(&fg->lock);
+
+            if ((ret = av_thread_message_queue_recv(fg->in_thread_queue, &msg, 0)) < 0 ||
+                (ret = filtergraph_thread_push(fg, &msg)) < 0)
+                goto end;
+        } else if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
+            goto end;
+        }
+    }
+
+end:
+    av_thread_message_queue_set_err_send(fg->in_thread_queue, ret < 0 ? ret : AVERROR_EOF);
+    pthread_mutex_lock(&fg->lock);
+    fg->thread_ret = ret == AVERROR_EOF ? 0 : ret;
+    fg->finished   = 1;
+    pthread_cond_broadcast(&fg->cond);
+    pthread_mutex_unlock(&fg->lock);
+    return NULL;
+}
+
+static int start_filtergraph_thread(FilterGraph *fg)
+{
+    int i, ret;
+
+    if (!fg->in_thread_queue) {
+        ret = av_thread_message_queue_alloc(&fg->in_thread_queue, 8,
+                                            sizeof(FilterThreadMessage));
+        if (ret < 0)
+            return ret;
+        av_thread_message_queue_set_free_func(fg->in_thread_queue,
+                                              free_filter_thread_message);
+        pthread_mutex_init(&fg->lock, NULL);
+        pthread_cond_init(&fg->cond, NULL);
+        for (i = 0; i < fg->nb_outputs; i++) {
+            fg->outputs[i]->frame_queue = av_fifo_alloc(8 * sizeof(AVFrame*));
+            if (!fg->outputs[i]->frame_queue)
+                return AVERROR(ENOMEM);
+        }
+    } else {
+        av_thread_message_queue_set_err_send(fg->in_thread_queue, 0);
+        av_thread_message_queue_set_err_recv(fg->in_thread_queue, 0);
+    }
+
+    for (i = 0; i < fg->nb_outputs; i++)
+        fg->outputs[i]->eof = 0;
+    fg->thread_ret    = 0;
+    fg->finished      = 0;
+    fg->stop          = 0;
+    fg->input_pending = 0;
+    fg->best_input    = -1;
+
+    if ((ret = pthread_create(&fg->thread, NULL, filtergraph_thread, fg))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        return AVERROR(ret);
+    }
+    fg->thread_running = 1;
+    return 0;
+}
+
+static void stop_filtergraph_thread(FilterGraph *fg, int discard)
+{
+    if (!fg->thread_running)
+        return;
+
+    av_thread_message_queue_set_err_recv(fg->in_thread_queue, AVERROR_EXIT);
+    if (discard)
+        av_thread_message_flush(fg->in_thread_queue);
+    pthread_mutex_lock(&fg->lock);
+    fg->stop = 1;
+    pthread_cond_broadcast(&fg->cond);
+    pthread_mutex_unlock(&fg->lock);
+
+    pthread_join(fg->thread, NULL);
+    fg->thread_running = 0;
+}
+
+int init_filtergraph_threads(void)
+{
+    int i, j, ret;
+
+    if (!filtergraph_threads)
+        return 0;
+
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+
+        /* sub2video inputs are fed and polled directly from the main thread */
+        for (j = 0; j < fg->nb_inputs; j++)
+            if (fg->inputs[j]->ist->sub2video.frame)
+                break;
+        if (j < fg->nb_inputs) {
+            av_log(NULL, AV_LOG_VERBOSE, "Filtergraph %d has subtitle inputs, "
+                   "running it from the main thread\n", fg->index);
+            continue;
+        }
+
+        if ((ret = start_filtergraph_thread(fg)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+void free_filtergraph_threads(void)
+{
+    int i, j;
+
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+
+        if (!fg->in_thread_queue)
+            continue;
+
+        stop_filtergraph_thread(fg, 1);
+        for (j = 0; j < fg->nb_outputs; j++) {
+            AVFifoBuffer *queue = fg->outputs[j]->frame_queue;
+            AVFrame *frame;
+
+            while (queue && av_fifo_size(queue)) {
+                av_fifo_generic_read(queue, &frame, sizeof(frame), NULL);
+                av_frame_free(&frame);
+            }
+            av_fifo_freep(&fg->outputs[j]->frame_queue);
+        }
+        av_thread_message_queue_free(&fg->in_thread_queue);
+        pthread_cond_destroy(&fg->cond);
+        pthread_mutex_destroy(&fg->lock);
+    }
+}
+
+int filtergraph_thread_poll(FilterGraph *fg, int *best_input)
+{
+    int ret;
+
+    pthread_mutex_lock(&fg->lock);
+    if (fg->nb_queued)
+        ret = fg->nb_queued;
+    else if (fg->finished)
+        ret = fg->thread_ret < 0 ? fg->thread_ret : AVERROR_EOF;
+    else
+        ret = 0;
+    *best_input = fg->best_input;
+    pthread_mutex_unlock(&fg->lock);
+
+    return ret;
+}
+
+void filtergraph_thread_wait(FilterGraph *fg)
+{
+    pthread_mutex_lock(&fg->lock);
+    while (!fg->nb_queued && !fg->finished)
+        pthread_cond_wait(&fg->cond, &fg->lock);
+    pthread_mutex_unlock(&fg->lock);
+}
+
+void filtergraph_thread_pause(FilterGraph *fg)
+{
+    stop_filtergraph_thread(fg, 0);
+}
+
+int filtergraph_thread_resume(FilterGraph *fg)
+{
+    /* do not restart a thread which finished on its own */
+    if (!fg->in_thread_queue || fg->thread_running || fg->thread_ret != AVERROR_EXIT)
+        return 0;
+    return start_filtergraph_thread(fg);
+}
+#endif
+
+int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int flags)
+{
+#if HAVE_PTHREADS
+    FilterGraph *fg = ifilter->graph;
+
+    if (fg->in_thread_queue) {
+        FilterThreadMessage msg = { ifilter, NULL, flags };
+        int ret;
+
+        if (frame) {
+            if (!(msg.frame = av_frame_alloc()))
+                return AVERROR(ENOMEM);
+            if (flags & AV_BUFFERSRC_FLAG_KEEP_REF) {
+                if ((ret = av_frame_ref(msg.frame, frame)) < 0) {
+                    av_frame_free(&msg.frame);
+                    return ret;
+                }
+            } else
+                av_frame_move_ref(msg.frame, frame);
+        }
+
+        ret = av_thread_message_queue_send(fg->in_thread_queue, &msg, 0);
+        if (ret < 0) {
+            av_frame_free(&msg.frame);
+            /* the graph already reached EOF on its own */
+            return ret == AVERROR_EOF && !frame ? 0 : ret;
+        }
+
+        pthread_mutex_lock(&fg->lock);
+        fg->input_pending = 1;
+        pthread_cond_broadcast(&fg->cond);
+        pthread_mutex_unlock(&fg->lock);
+        return 0;
+    }
+#endif
+    return av_buffersrc_add_frame_flags(ifilter->filter, frame, flags);
+}
+
+int ofilter_get_frame(OutputFilter *ofilter, AVFrame *frame)
+{
+#if HAVE_PTHREADS
+    FilterGraph *fg = ofilter->graph;
+
+    if (fg->in_thread_queue) {
+        AVFrame *tmp;
+        int ret = 0;
+
+        pthread_mutex_lock(&fg->lock);
+        if (av_fifo_size(ofilter->frame_queue)) {
+            av_fifo_generic_read(ofilter->frame_queue, &tmp, sizeof(tmp), NULL);
+            av_frame_move_ref(frame, tmp);
+            av_frame_free(&tmp);
+            fg->nb_queued--;
+            pthread_cond_broadcast(&fg->cond);
+        } else
+            ret = ofilter->eof ? AVERROR_EOF : AVERROR(EAGAIN);
+        pthread_mutex_unlock(&fg->lock);
+        return ret;
+    }
+#endif
+    return av_buffersink_get_frame_flags(ofilter->filter, frame,
+                                         AV_BUFFERSINK_FLAG_NO_REQUEST);
+}
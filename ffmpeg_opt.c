@@ -113,6 +113,8 @@ int start_at_zero     = 0;
 int copy_tb           = -1;
 int debug_ts          = 0;
 int debug_pkt         = 0;
+int encode_threads    = 0;
+int filtergraph_threads = 0;
 int exit_on_error     = 0;
 int abort_on_flags    = 0;
 int print_stats       = -1;
@@ -1962,6 +1964,10 @@ static int open_output_file(OptionsContext *o, const char *filename)
     if (!of)
         exit_program(1);
     output_files[nb_output_files - 1] = of;
+#if HAVE_PTHREADS
+    pthread_mutex_init(&of->mux_lock, NULL);
+    of->thread_queue_size = o->thread_queue_size > 0 ? o->thread_queue_size : 8;
+#endif
 
     of->ost_index      = nb_output_streams;
     of->recording_time = o->recording_time;
@@ -3290,6 +3296,10 @@ const OptionDef options[] = {
 
     { "debug_pkt",       OPT_INT | OPT_EXPERT,                       { &debug_pkt },
         "print packet debugging info" },
+    { "encode_threads",  OPT_BOOL | OPT_EXPERT,                      { &encode_threads },
+        "run the encoder of each output stream in its own thread" },
+    { "filtergraph_threads", OPT_BOOL | OPT_EXPERT,                  { &filtergraph_threads },
+        "run each filtergraph in its own thread" },
 
     { "max_error_rate",  HAS_ARG | OPT_FLOAT,                        { &max_error_rate },
         "maximum error rate", "ratio of errors (0.0: no errors, 1.0: 100% errors) above which ffmpeg returns an error instead of success." },
@@ -3299,9 +3309,9 @@ const OptionDef options[] = {
     { "disposition",    OPT_STRING | HAS_ARG | OPT_SPEC |
                         OPT_OUTPUT,                                  { .off = OFFSET(disposition) },
         "disposition", "" },
-    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
+    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT | OPT_OUTPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
-        "set the maximum number of queued packets from the demuxer" },
+        "set the maximum number of queued packets from the demuxer or frames to an encoder thread" },
 
     /* video options */
     { "vframes",      OPT_VIDEO | HAS_ARG  | OPT_PERFILE | OPT_OUTPUT,           { .func_arg = opt_video_frames },
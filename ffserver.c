@@ -45,6 +45,7 @@
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
+#include "libavutil/buffer.h"
 #include "libavutil/lfg.h"
 #include "libavutil/dict.h"
 #include "libavutil/intreadwrite.h"
@@ -63,6 +64,12 @@
 #if HAVE_POLL_H
 #include <poll.h>
 #endif
+#if HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include <errno.h>
 #include <time.h>
 #include <sys/wait.h>
@@ -127,12 +134,25 @@ typedef struct {
     int64_t time1, time2;
 } DataRateData;
 
+/* state of a connection shown on the status page */
+typedef struct ConnectionStatus {
+    FFServerStream *stream;
+    enum HTTPState state;
+    char protocol[16];
+    int bitrate;                  /* target bit rate */
+    int datarate;                 /* actual rate, in bytes/s */
+    int64_t data_count;
+} ConnectionStatus;
+
 /* context associated with one connection */
 typedef struct HTTPContext {
     enum HTTPState state;
     int fd; /* socket file descriptor */
     struct sockaddr_in from_addr; /* origin */
-    struct pollfd *poll_entry; /* used when polling */
+    int poll_events; /* events the connection is waiting for */
+    int revents; /* events returned by the last poll */
+    struct FFServerWorker *worker; /* event loop handling the connection */
+    struct HTTPContext *worker_next;
     int64_t timeout;
     uint8_t *buffer_ptr, *buffer_end;
     int http_error;
@@ -144,6 +164,14 @@ typedef struct HTTPContext {
     int64_t data_count;
     /* feed input */
     int feed_fd;
+    /* feed output */
+    AVIOContext *feed_pb;
+    int feed_read_fd;
+    int64_t feed_read_pos;
+    AVBufferRef *feed_page;       /* page being received from the feeder,
+                                     handed over to the feed cache */
+    int64_t feed_pages;           /* feed state when last read, to know */
+    int feed_failures;            /* when to stop waiting for the feed */
     /* input format handling */
     AVFormatContext *fmt_in;
     int64_t start_time;            /* In milliseconds - this wraps fairly often */
@@ -190,6 +218,15 @@ typedef struct HTTPContext {
     /* RTP/TCP specific */
     struct HTTPContext *rtsp_c;
     uint8_t *packet_buffer, *packet_buffer_ptr, *packet_buffer_end;
+
+#if HAVE_PTHREADS
+    /* protects wmp_client_id and the fields below, which the other
+     * workers access through the connection list */
+    pthread_mutex_t lock;
+#endif
+    ConnectionStatus status;      /* copy shown on the status page */
+    char switch_rates[32];        /* rates requested by a WMP log POST */
+    int switch_rates_pending;
 } HTTPContext;
 
 typedef struct FeedData {
@@ -197,16 +234,76 @@ typedef struct FeedData {
     float avg_frame_size;   /* frame size averaged over last frames with exponential mean */
 } FeedData;
 
+#define FEED_CACHE_PAGES 256 /* FFM packets kept in memory per feed */
+
+/* state of a stream shared between the workers */
+typedef struct FFServerStreamState {
+#if HAVE_PTHREADS
+    /* protects this struct and the conns_served, bytes_served,
+     * feed_opened, feed_write_index and feed_size fields of the stream;
+     * for a feed, also the codec contexts of its streams, which are shared
+     * with the live streams it feeds and updated when a feeder connects */
+    pthread_mutex_t lock;
+#endif
+    AVBufferPool *page_pool;      /* pool of FFM_PACKET_SIZE buffers */
+    AVBufferRef *page_cache[FEED_CACHE_PAGES]; /* last packets written to the feed */
+    int64_t page_cache_pos[FEED_CACHE_PAGES];  /* position of each cached packet */
+    int64_t nb_pages;             /* packets written to the feed */
+    int nb_failures;              /* feeder connections closed on error */
+    uint8_t *waiting;             /* per worker, set if one of its
+                                     connections waits for the feed */
+} FFServerStreamState;
+
+/* one event loop, running in its own thread except for the first one */
+typedef struct FFServerWorker {
+#if HAVE_PTHREADS
+    pthread_t thread;
+#endif
+    HTTPContext *first_ctx; /* connections handled by this worker */
+    int wake_fds[2];        /* written to by other workers to interrupt the wait */
+    int http_pending, rtsp_pending; /* connections waiting to be accepted */
+    int max_events;
+    int64_t cur_time;       /* time of the last wakeup, in milliseconds */
+#if HAVE_EPOLL_CREATE1
+    int epoll_fd;
+    struct epoll_event *events;
+    int nb_events;
+#else
+    struct pollfd *poll_table, *poll_entry;
+    HTTPContext **poll_ctx; /* connection of each poll_table entry */
+#endif
+} FFServerWorker;
+
 static HTTPContext *first_http_ctx;
 
+static FFServerWorker *workers;
+static int nb_workers;
+static int http_listen_fd, rtsp_listen_fd;
+
+/* Each connection is only handled by the worker owning it. The locks below
+ * are only held for short sections and never while another one is taken,
+ * except for the connection locks, taken under conn_list_mutex. */
+#if HAVE_PTHREADS
+/* protects the list of connections, nb_connections, current_bandwidth and
+ * random_state; connections are unlinked under it before being freed */
+static pthread_mutex_t conn_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define lock_mutex(m)   pthread_mutex_lock(m)
+#define unlock_mutex(m) pthread_mutex_unlock(m)
+#else
+#define lock_mutex(m)   do { } while (0)
+#define unlock_mutex(m) do { } while (0)
+#endif
+
 static FFServerConfig config = {
     .nb_max_http_connections = 2000,
     .nb_max_connections = 5,
+    .nb_workers = 1,
     .max_bandwidth = 1000,
     .use_defaults = 1,
 };
 
-static void new_connection(int server_fd, int is_rtsp);
+static void new_connection(FFServerWorker *w, int server_fd, int is_rtsp);
 static void close_connection(HTTPContext *c);
 
 /* HTTP handling */
@@ -258,9 +355,6 @@ static unsigned int nb_connections;
 
 static uint64_t current_bandwidth;
 
-/* Making this global saves on passing it around everywhere */
-static int64_t cur_time;
-
 static AVLFG random_state;
 
 static FILE *logfile = NULL;
@@ -403,6 +497,7 @@ static void http_vlog(const char *fmt, va_list vargs)
     if (!logfile)
         return;
 
+    lock_mutex(&log_mutex);
     if (print_prefix) {
         ctime1(buf, sizeof(buf));
         fprintf(logfile, "%s ", buf);
@@ -410,6 +505,7 @@ static void http_vlog(const char *fmt, va_list vargs)
     print_prefix = strstr(fmt, "\n") != NULL;
     vfprintf(logfile, fmt, vargs);
     fflush(logfile);
+    unlock_mutex(&log_mutex);
 }
 
 #ifdef __GNUC__
@@ -445,7 +541,8 @@ static void log_connection(HTTPContext *c)
              c->protocol, (c->http_error ? c->http_error : 200), c->data_count);
 }
 
-static void update_datarate(DataRateData *drd, int64_t count)
+static void update_datarate(DataRateData *drd, int64_t count,
+                            int64_t cur_time)
 {
     if (!drd->time1 && !drd->count1) {
         drd->time1 = drd->time2 = cur_time;
@@ -459,7 +556,8 @@ static void update_datarate(DataRateData *drd, int64_t count)
 }
 
 /* In bytes per second */
-static int compute_datarate(DataRateData *drd, int64_t count)
+static int compute_datarate(DataRateData *drd, int64_t count,
+                            int64_t cur_time)
 {
     if (cur_time == drd->time1)
         return 0;
@@ -575,7 +673,7 @@ static int socket_open_listen(struct sockaddr_in *my_addr)
         goto fail;
     }
 
-    if (listen (server_fd, 5) < 0) {
+    if (listen (server_fd, SOMAXCONN) < 0) {
         perror ("listen");
         goto fail;
     }
@@ -650,74 +748,322 @@ static void start_multicast(void)
     }
 }
 
-/* main loop of the HTTP server */
-static int http_server(void)
+/* interrupt the wait of a worker after changing the state of one of its
+ * connections */
+static void wake_worker(FFServerWorker *w)
 {
-    int server_fd = 0, rtsp_server_fd = 0;
-    int ret, delay;
-    struct pollfd *poll_table, *poll_entry;
-    HTTPContext *c, *c_next;
+    if (write(w->wake_fds[1], "", 1) < 0 && errno != EAGAIN)
+        http_log("Could not wake up worker: %s\n", strerror(errno));
+}
 
-    poll_table = av_mallocz_array(config.nb_max_http_connections + 2,
-                                  sizeof(*poll_table));
-    if(!poll_table) {
-        http_log("Impossible to allocate a poll table handling %d "
+/* wake up the other workers having connections waiting for the feed,
+ * called with the feed lock held */
+static void wake_feed_waiters(FFServerStreamState *fs, FFServerWorker *self)
+{
+    int i;
+
+    for (i = 0; i < nb_workers; i++) {
+        if (fs->waiting[i]) {
+            fs->waiting[i] = 0;
+            if (&workers[i] != self)
+                wake_worker(&workers[i]);
+        }
+    }
+}
+
+/* go back to sending once the feeder wrote new data or failed, otherwise
+ * ask the feeder to wake up the worker */
+static void check_feed_wait(HTTPContext *c)
+{
+    FFServerStreamState *fs = c->stream->feed->state;
+
+    lock_mutex(&fs->lock);
+    if (fs->nb_pages != c->feed_pages)
+        c->state = HTTPSTATE_SEND_DATA;
+    else if (fs->nb_failures != c->feed_failures)
+        c->state = HTTPSTATE_SEND_DATA_TRAILER;
+    else
+        fs->waiting[c->worker - workers] = 1;
+    unlock_mutex(&fs->lock);
+}
+
+/* state whose lock protects the codec contexts of the stream */
+static FFServerStreamState *codec_state(FFServerStream *stream)
+{
+    return stream->feed ? stream->feed->state : stream->state;
+}
+
+/* update the copy of the connection shown on the status page */
+static void publish_status(HTTPContext *c)
+{
+    int bitrate = 0, datarate, j;
+
+    if (c->stream) {
+        FFServerStreamState *fs = codec_state(c->stream);
+
+        lock_mutex(&fs->lock);
+        for (j = 0; j < c->stream->nb_streams; j++) {
+            if (!c->stream->feed)
+                bitrate += c->stream->streams[j]->codec->bit_rate;
+            else if (c->feed_streams[j] >= 0)
+                bitrate += c->stream->feed->streams[c->feed_streams[j]]->codec->bit_rate;
+        }
+        unlock_mutex(&fs->lock);
+    }
+    datarate = compute_datarate(&c->datarate, c->data_count,
+                                c->worker->cur_time);
+
+    lock_mutex(&c->lock);
+    c->status.stream     = c->stream;
+    c->status.state      = c->state;
+    c->status.bitrate    = bitrate;
+    c->status.datarate   = datarate;
+    c->status.data_count = c->data_count;
+    memcpy(c->status.protocol, c->protocol, sizeof(c->protocol));
+    unlock_mutex(&c->lock);
+}
+
+static void add_bytes_served(FFServerStream *stream, int len)
+{
+    lock_mutex(&stream->state->lock);
+    stream->bytes_served += len;
+    unlock_mutex(&stream->state->lock);
+}
+
+static int init_stream_states(void)
+{
+    FFServerStream *stream;
+
+    for (stream = config.first_stream; stream; stream = stream->next) {
+        FFServerStreamState *fs = av_mallocz(sizeof(*fs));
+        if (!fs)
+            return AVERROR(ENOMEM);
+        stream->state = fs;
+#if HAVE_PTHREADS
+        {
+            int ret = pthread_mutex_init(&fs->lock, NULL);
+            if (ret)
+                return AVERROR(ret);
+        }
+#endif
+        if (stream->is_feed &&
+            !(fs->waiting = av_mallocz(nb_workers)))
+            return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static int worker_init(FFServerWorker *w)
+{
+    w->max_events = config.nb_max_http_connections + 3;
+    w->cur_time = av_gettime() / 1000;
+    w->wake_fds[0] = w->wake_fds[1] = -1;
+    if (nb_workers > 1) {
+        if (pipe(w->wake_fds) < 0) {
+            http_log("Could not create worker pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        if (fcntl(w->wake_fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+            fcntl(w->wake_fds[1], F_SETFL, O_NONBLOCK) < 0)
+            av_log(NULL, AV_LOG_WARNING, "fcntl(O_NONBLOCK) failed\n");
+    }
+
+#if HAVE_EPOLL_CREATE1
+    w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epoll_fd < 0) {
+        http_log("epoll_create1 failed: %s\n", strerror(errno));
+        return -1;
+    }
+    w->events = av_mallocz_array(w->max_events, sizeof(*w->events));
+    if (!w->events) {
+        http_log("Impossible to allocate an event table handling %d "
                  "connections.\n", config.nb_max_http_connections);
         return -1;
     }
 
-    if (config.http_addr.sin_port) {
-        server_fd = socket_open_listen(&config.http_addr);
-        if (server_fd < 0)
-            goto quit;
+    /* the listening sockets and the pipe stay registered, connections are
+     * registered according to their state in worker_watch() */
+    if (http_listen_fd) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &http_listen_fd };
+#ifdef EPOLLEXCLUSIVE
+        /* do not wake up all the workers for each new connection */
+        ev.events |= EPOLLEXCLUSIVE;
+#endif
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, http_listen_fd, &ev) < 0)
+            goto fail;
+    }
+    if (rtsp_listen_fd && w == workers) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &rtsp_listen_fd };
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, rtsp_listen_fd, &ev) < 0)
+            goto fail;
+    }
+    if (w->wake_fds[0] >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w->wake_fds };
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fds[0], &ev) < 0)
+            goto fail;
+    }
+    return 0;
+fail:
+    http_log("epoll_ctl failed: %s\n", strerror(errno));
+    return -1;
+#else
+    w->poll_table = av_mallocz_array(w->max_events, sizeof(*w->poll_table));
+    w->poll_ctx   = av_mallocz_array(w->max_events, sizeof(*w->poll_ctx));
+    if (!w->poll_table || !w->poll_ctx) {
+        http_log("Impossible to allocate a poll table handling %d "
+                 "connections.\n", config.nb_max_http_connections);
+        return -1;
     }
+    return 0;
+#endif
+}
 
-    if (config.rtsp_addr.sin_port) {
-        rtsp_server_fd = socket_open_listen(&config.rtsp_addr);
-        if (rtsp_server_fd < 0) {
-            closesocket(server_fd);
-            goto quit;
+#if !HAVE_EPOLL_CREATE1
+static void worker_poll_fd(FFServerWorker *w, int fd, int events,
+                           HTTPContext *c)
+{
+    w->poll_ctx[w->poll_entry - w->poll_table] = c;
+    w->poll_entry->fd = fd;
+    w->poll_entry->events = events;
+    w->poll_entry++;
+}
+#endif
+
+/* start collecting the events the connections of a worker wait for */
+static void worker_begin(FFServerWorker *w)
+{
+#if !HAVE_EPOLL_CREATE1
+    w->poll_entry = w->poll_table;
+    if (http_listen_fd)
+        worker_poll_fd(w, http_listen_fd, POLLIN, NULL);
+    if (rtsp_listen_fd && w == workers)
+        worker_poll_fd(w, rtsp_listen_fd, POLLIN, NULL);
+    if (w->wake_fds[0] >= 0)
+        worker_poll_fd(w, w->wake_fds[0], POLLIN, NULL);
+#endif
+}
+
+/* set the events a connection waits for, 0 for none */
+static void worker_watch(FFServerWorker *w, HTTPContext *c, int events)
+{
+    c->revents = 0;
+    if (c->fd < 0)
+        return;
+#if HAVE_EPOLL_CREATE1
+    if (events != c->poll_events) {
+        struct epoll_event ev = { 0 };
+        int op = !c->poll_events ? EPOLL_CTL_ADD :
+                 events          ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+
+        ev.events   = (events & POLLIN  ? EPOLLIN  : 0) |
+                      (events & POLLOUT ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epoll_fd, op, c->fd, &ev) < 0) {
+            http_log("epoll_ctl failed: %s\n", strerror(errno));
+            c->revents = POLLERR;
+            return;
         }
+        c->poll_events = events;
     }
+#else
+    if (events)
+        worker_poll_fd(w, c->fd, events, c);
+#endif
+}
 
-    if (!rtsp_server_fd && !server_fd) {
-        http_log("HTTP and RTSP disabled.\n");
-        goto quit;
+/* wait for events, called without holding the server lock */
+static int worker_wait(FFServerWorker *w, int delay)
+{
+    int ret;
+
+    do {
+#if HAVE_EPOLL_CREATE1
+        ret = epoll_wait(w->epoll_fd, w->events, w->max_events, delay);
+        w->nb_events = FFMAX(ret, 0);
+#else
+        ret = poll(w->poll_table, w->poll_entry - w->poll_table, delay);
+#endif
+        if (ret < 0 && ff_neterrno() != AVERROR(EAGAIN) &&
+            ff_neterrno() != AVERROR(EINTR))
+            return -1;
+    } while (ret < 0);
+    return 0;
+}
+
+static void worker_read_wake_fd(FFServerWorker *w)
+{
+    char buf[64];
+
+    while (read(w->wake_fds[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+/* pass the events returned by worker_wait() to the connections */
+static void worker_dispatch(FFServerWorker *w)
+{
+#if HAVE_EPOLL_CREATE1
+    int i;
+
+    for (i = 0; i < w->nb_events; i++) {
+        void *ptr = w->events[i].data.ptr;
+        int events = w->events[i].events;
+
+        if (ptr == &http_listen_fd) {
+            w->http_pending = 1;
+        } else if (ptr == &rtsp_listen_fd) {
+            w->rtsp_pending = 1;
+        } else if (ptr == w->wake_fds) {
+            worker_read_wake_fd(w);
+        } else {
+            HTTPContext *c = ptr;
+            c->revents = (events & EPOLLIN  ? POLLIN  : 0) |
+                         (events & EPOLLOUT ? POLLOUT : 0) |
+                         (events & EPOLLERR ? POLLERR : 0) |
+                         (events & EPOLLHUP ? POLLHUP : 0);
+        }
     }
+#else
+    struct pollfd *poll_entry;
 
-    http_log("FFserver started.\n");
+    for (poll_entry = w->poll_table; poll_entry < w->poll_entry; poll_entry++) {
+        HTTPContext *c = w->poll_ctx[poll_entry - w->poll_table];
 
-    start_children(config.first_feed);
+        if (c)
+            c->revents = poll_entry->revents;
+        else if (!(poll_entry->revents & POLLIN))
+            continue;
+        else if (poll_entry->fd == http_listen_fd)
+            w->http_pending = 1;
+        else if (poll_entry->fd == rtsp_listen_fd)
+            w->rtsp_pending = 1;
+        else
+            worker_read_wake_fd(w);
+    }
+#endif
+}
 
-    start_multicast();
+/* event loop of one worker: connections are only handled by the worker
+ * which accepted them */
+static void *http_worker(void *arg)
+{
+    FFServerWorker *w = arg;
+    HTTPContext *c, *c_next;
+    int ret, delay;
 
     for(;;) {
-        poll_entry = poll_table;
-        if (server_fd) {
-            poll_entry->fd = server_fd;
-            poll_entry->events = POLLIN;
-            poll_entry++;
-        }
-        if (rtsp_server_fd) {
-            poll_entry->fd = rtsp_server_fd;
-            poll_entry->events = POLLIN;
-            poll_entry++;
-        }
+        worker_begin(w);
 
         /* wait for events on each HTTP handle */
-        c = first_http_ctx;
         delay = 1000;
-        while (c) {
-            int fd;
-            fd = c->fd;
+        for (c = w->first_ctx; c; c = c->worker_next) {
+            int events = 0;
+            if (c->state == HTTPSTATE_WAIT_FEED)
+                check_feed_wait(c);
             switch(c->state) {
             case HTTPSTATE_SEND_HEADER:
             case RTSPSTATE_SEND_REPLY:
             case RTSPSTATE_SEND_PACKET:
-                c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLOUT;
-                poll_entry++;
+                events = POLLOUT;
                 break;
             case HTTPSTATE_SEND_DATA_HEADER:
             case HTTPSTATE_SEND_DATA:
@@ -725,10 +1071,7 @@ static int http_server(void)
                 if (!c->is_packetized) {
                     /* for TCP, we output as much as we can
                      * (may need to put a limit) */
-                    c->poll_entry = poll_entry;
-                    poll_entry->fd = fd;
-                    poll_entry->events = POLLOUT;
-                    poll_entry++;
+                    events = POLLOUT;
                 } else {
                     /* when ffserver is doing the timing, we work by
                      * looking at which packet needs to be sent every
@@ -742,61 +1085,116 @@ static int http_server(void)
             case HTTPSTATE_WAIT_FEED:
             case RTSPSTATE_WAIT_REQUEST:
                 /* need to catch errors */
-                c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLIN;/* Maybe this will work */
-                poll_entry++;
+                events = POLLIN;/* Maybe this will work */
                 break;
             default:
-                c->poll_entry = NULL;
                 break;
             }
-            c = c->next;
+            worker_watch(w, c, events);
         }
 
         /* wait for an event on one connection. We poll at least every
          * second to handle timeouts */
-        do {
-            ret = poll(poll_table, poll_entry - poll_table, delay);
-            if (ret < 0 && ff_neterrno() != AVERROR(EAGAIN) &&
-                ff_neterrno() != AVERROR(EINTR)) {
-                goto quit;
-            }
-        } while (ret < 0);
+        ret = worker_wait(w, delay);
+        if (ret < 0)
+            break;
 
-        cur_time = av_gettime() / 1000;
+        w->cur_time = av_gettime() / 1000;
 
-        if (need_to_start_children) {
+        if (need_to_start_children && w == workers) {
             need_to_start_children = 0;
             start_children(config.first_feed);
         }
 
+        w->http_pending = w->rtsp_pending = 0;
+        worker_dispatch(w);
+
         /* now handle the events */
-        for(c = first_http_ctx; c; c = c_next) {
-            c_next = c->next;
+        for(c = w->first_ctx; c; c = c_next) {
+            c_next = c->worker_next;
             if (handle_connection(c) < 0) {
                 log_connection(c);
                 /* close and free the connection */
                 close_connection(c);
+            } else {
+                publish_status(c);
             }
         }
 
-        poll_entry = poll_table;
-        if (server_fd) {
-            /* new HTTP connection request ? */
-            if (poll_entry->revents & POLLIN)
-                new_connection(server_fd, 0);
-            poll_entry++;
+        /* new HTTP connection request ? */
+        if (w->http_pending)
+            new_connection(w, http_listen_fd, 0);
+        /* new RTSP connection request ? */
+        if (w->rtsp_pending)
+            new_connection(w, rtsp_listen_fd, 1);
+    }
+    return NULL;
+}
+
+/* main loop of the HTTP server */
+static int http_server(void)
+{
+    int i;
+
+    nb_workers = config.nb_workers;
+#if !HAVE_PTHREADS
+    if (nb_workers > 1) {
+        http_log("Workers requires thread support, using a single worker.\n");
+        nb_workers = 1;
+    }
+#endif
+    workers = av_mallocz_array(nb_workers, sizeof(*workers));
+    if (!workers)
+        return -1;
+
+    if (config.http_addr.sin_port) {
+        http_listen_fd = socket_open_listen(&config.http_addr);
+        if (http_listen_fd < 0)
+            return -1;
+    }
+
+    if (config.rtsp_addr.sin_port) {
+        rtsp_listen_fd = socket_open_listen(&config.rtsp_addr);
+        if (rtsp_listen_fd < 0) {
+            closesocket(http_listen_fd);
+            return -1;
         }
-        if (rtsp_server_fd) {
-            /* new RTSP connection request ? */
-            if (poll_entry->revents & POLLIN)
-                new_connection(rtsp_server_fd, 1);
+    }
+
+    if (!rtsp_listen_fd && !http_listen_fd) {
+        http_log("HTTP and RTSP disabled.\n");
+        return -1;
+    }
+
+    for (i = 0; i < nb_workers; i++)
+        if (worker_init(&workers[i]) < 0)
+            return -1;
+
+    if (init_stream_states() < 0) {
+        http_log("Could not allocate the stream states\n");
+        return -1;
+    }
+
+    http_log("FFserver started.\n");
+
+    start_children(config.first_feed);
+
+    start_multicast();
+
+    /* the first worker, which also handles RTSP, runs in this thread */
+#if HAVE_PTHREADS
+    for (i = 1; i < nb_workers; i++) {
+        int ret = pthread_create(&workers[i].thread, NULL, http_worker,
+                                 &workers[i]);
+        if (ret) {
+            http_log("Could not create worker thread: %s\n",
+                     strerror(ret));
+            break;
         }
     }
+#endif
 
-quit:
-    av_free(poll_table);
+    http_worker(&workers[0]);
     return -1;
 }
 
@@ -807,11 +1205,11 @@ static void start_wait_request(HTTPContext *c, int is_rtsp)
     c->buffer_end = c->buffer + c->buffer_size - 1; /* leave room for '\0' */
 
     c->state = is_rtsp ? RTSPSTATE_WAIT_REQUEST : HTTPSTATE_WAIT_REQUEST;
-    c->timeout = cur_time +
+    c->timeout = c->worker->cur_time +
                  (is_rtsp ? RTSP_REQUEST_TIMEOUT : HTTP_REQUEST_TIMEOUT);
 }
 
-static void http_send_too_busy_reply(int fd)
+static void http_send_too_busy_reply(int fd, unsigned int nb_conns)
 {
     char buffer[400];
     int len = snprintf(buffer, sizeof(buffer),
@@ -825,7 +1223,7 @@ static void http_send_too_busy_reply(int fd)
                        "<p>The number of current connections is %u, and this "
                        "exceeds the limit of %u.</p>\r\n"
                        "</body></html>\r\n",
-                       nb_connections, config.nb_max_connections);
+                       nb_conns, config.nb_max_connections);
     av_assert0(len < sizeof(buffer));
     if (send(fd, buffer, len, 0) < len)
         av_log(NULL, AV_LOG_WARNING,
@@ -833,7 +1231,7 @@ static void http_send_too_busy_reply(int fd)
 }
 
 
-static void new_connection(int server_fd, int is_rtsp)
+static void new_connection(FFServerWorker *w, int server_fd, int is_rtsp)
 {
     struct sockaddr_in from_addr;
     socklen_t len;
@@ -844,35 +1242,51 @@ static void new_connection(int server_fd, int is_rtsp)
     fd = accept(server_fd, (struct sockaddr *)&from_addr,
                 &len);
     if (fd < 0) {
-        http_log("error during accept %s\n", strerror(errno));
+        /* another worker may have accepted the connection first */
+        if (ff_neterrno() != AVERROR(EAGAIN))
+            http_log("error during accept %s\n", strerror(errno));
         return;
     }
     if (ff_socket_nonblock(fd, 1) < 0)
         av_log(NULL, AV_LOG_WARNING, "ff_socket_nonblock failed\n");
 
-    if (nb_connections >= config.nb_max_connections) {
-        http_send_too_busy_reply(fd);
-        goto fail;
-    }
-
     /* add a new connection */
     c = av_mallocz(sizeof(HTTPContext));
     if (!c)
         goto fail;
 
     c->fd = fd;
-    c->poll_entry = NULL;
     c->from_addr = from_addr;
+    c->worker = w;
     c->buffer_size = IOBUFFER_INIT_SIZE;
     c->buffer = av_malloc(c->buffer_size);
     if (!c->buffer)
         goto fail;
+#if HAVE_PTHREADS
+    if (pthread_mutex_init(&c->lock, NULL))
+        goto fail;
+#endif
+
+    start_wait_request(c, is_rtsp);
+    publish_status(c);
 
+    lock_mutex(&conn_list_mutex);
+    if (nb_connections >= config.nb_max_connections) {
+        unsigned int nb_conns = nb_connections;
+        unlock_mutex(&conn_list_mutex);
+        http_send_too_busy_reply(fd, nb_conns);
+#if HAVE_PTHREADS
+        pthread_mutex_destroy(&c->lock);
+#endif
+        goto fail;
+    }
     c->next = first_http_ctx;
     first_http_ctx = c;
     nb_connections++;
+    unlock_mutex(&conn_list_mutex);
 
-    start_wait_request(c, is_rtsp);
+    c->worker_next = w->first_ctx;
+    w->first_ctx = c;
 
     return;
 
@@ -892,6 +1306,7 @@ static void close_connection(HTTPContext *c)
     AVStream *st;
 
     /* remove connection from list */
+    lock_mutex(&conn_list_mutex);
     cp = &first_http_ctx;
     while (*cp) {
         c1 = *cp;
@@ -901,10 +1316,27 @@ static void close_connection(HTTPContext *c)
             cp = &c1->next;
     }
 
-    /* remove references, if any (XXX: do it faster) */
-    for(c1 = first_http_ctx; c1; c1 = c1->next) {
-        if (c1->rtsp_c == c)
-            c1->rtsp_c = NULL;
+    /* remove references, if any (XXX: do it faster); RTSP connections
+     * and their RTP sessions all belong to the first worker */
+    if (c->worker == workers) {
+        for(c1 = first_http_ctx; c1; c1 = c1->next) {
+            if (c1->rtsp_c == c)
+                c1->rtsp_c = NULL;
+        }
+    }
+
+    if (c->stream && !c->post && c->stream->stream_type == STREAM_TYPE_LIVE)
+        current_bandwidth -= c->stream->bandwidth;
+    nb_connections--;
+    unlock_mutex(&conn_list_mutex);
+
+    cp = &c->worker->first_ctx;
+    while (*cp) {
+        c1 = *cp;
+        if (c1 == c)
+            *cp = c->worker_next;
+        else
+            cp = &c1->worker_next;
     }
 
     /* remove connection associated resources */
@@ -919,6 +1351,12 @@ static void close_connection(HTTPContext *c)
         }
         avformat_close_input(&c->fmt_in);
     }
+    if (c->feed_pb) {
+        close(c->feed_read_fd);
+        av_freep(&c->feed_pb->buffer);
+        av_freep(&c->feed_pb);
+    }
+    av_buffer_unref(&c->feed_page);
 
     /* free RTP output streams if any */
     nb_streams = 0;
@@ -952,20 +1390,21 @@ static void close_connection(HTTPContext *c)
     av_freep(&ctx->streams);
     av_freep(&ctx->priv_data);
 
-    if (c->stream && !c->post && c->stream->stream_type == STREAM_TYPE_LIVE)
-        current_bandwidth -= c->stream->bandwidth;
-
     /* signal that there is no feed if we are the feeder socket */
     if (c->state == HTTPSTATE_RECEIVE_DATA && c->stream) {
+        lock_mutex(&c->stream->state->lock);
         c->stream->feed_opened = 0;
+        unlock_mutex(&c->stream->state->lock);
         close(c->feed_fd);
     }
 
+#if HAVE_PTHREADS
+    pthread_mutex_destroy(&c->lock);
+#endif
     av_freep(&c->pb_buffer);
     av_freep(&c->packet_buffer);
     av_freep(&c->buffer);
     av_free(c);
-    nb_connections--;
 }
 
 static int handle_connection(HTTPContext *c)
@@ -977,13 +1416,13 @@ static int handle_connection(HTTPContext *c)
     case HTTPSTATE_WAIT_REQUEST:
     case RTSPSTATE_WAIT_REQUEST:
         /* timeout ? */
-        if ((c->timeout - cur_time) < 0)
+        if ((c->timeout - c->worker->cur_time) < 0)
             return -1;
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to read if no events */
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         /* read the data */
     read_loop:
@@ -1017,11 +1456,11 @@ static int handle_connection(HTTPContext *c)
         break;
 
     case HTTPSTATE_SEND_HEADER:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -1033,7 +1472,7 @@ static int handle_connection(HTTPContext *c)
         }
         c->buffer_ptr += len;
         if (c->stream)
-            c->stream->bytes_served += len;
+            add_bytes_served(c->stream, len);
         c->data_count += len;
         if (c->buffer_ptr >= c->buffer_end) {
             av_freep(&c->pb_buffer);
@@ -1054,11 +1493,11 @@ static int handle_connection(HTTPContext *c)
          * input streams set the speed). It may be better to verify
          * that we do not rely too much on the kernel queues */
         if (!c->is_packetized) {
-            if (c->poll_entry->revents & (POLLERR | POLLHUP))
+            if (c->revents & (POLLERR | POLLHUP))
                 return -1;
 
             /* no need to read if no events */
-            if (!(c->poll_entry->revents & POLLOUT))
+            if (!(c->revents & POLLOUT))
                 return 0;
         }
         if (http_send_data(c) < 0)
@@ -1073,26 +1512,26 @@ static int handle_connection(HTTPContext *c)
         break;
     case HTTPSTATE_RECEIVE_DATA:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         if (http_receive_data(c) < 0)
             return -1;
         break;
     case HTTPSTATE_WAIT_FEED:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLIN | POLLERR | POLLHUP))
+        if (c->revents & (POLLIN | POLLERR | POLLHUP))
             return -1;
 
         /* nothing to do, we'll be waken up by incoming feed packets */
         break;
 
     case RTSPSTATE_SEND_REPLY:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             goto close_connection;
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -1111,12 +1550,12 @@ static int handle_connection(HTTPContext *c)
         }
         break;
     case RTSPSTATE_SEND_PACKET:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP)) {
+        if (c->revents & (POLLERR | POLLHUP)) {
             av_freep(&c->packet_buffer);
             return -1;
         }
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->packet_buffer_ptr,
                     c->packet_buffer_end - c->packet_buffer_ptr, 0);
@@ -1244,6 +1683,7 @@ static int modify_current_stream(HTTPContext *c, char *rates)
     if (!req->feed)
         return 0;
 
+    lock_mutex(&req->feed->state->lock);
     for (i = 0; i < req->nb_streams; i++) {
         AVCodecContext *codec = req->streams[i]->codec;
 
@@ -1270,6 +1710,7 @@ static int modify_current_stream(HTTPContext *c, char *rates)
             action_required = 1;
         }
     }
+    unlock_mutex(&req->feed->state->lock);
 
     return action_required;
 }
@@ -1429,7 +1870,8 @@ static int http_parse_request(HTTPContext *c)
     char *encoded_msg = NULL;
     const char *mime_type;
     FFServerStream *stream;
-    int i;
+    int i, feed_opened;
+    uint64_t bandwidth;
     char ratebuf[32];
     const char *useragent = 0;
 
@@ -1551,17 +1993,23 @@ static int http_parse_request(HTTPContext *c)
         }
     }
 
+    lock_mutex(&conn_list_mutex);
     if (c->post == 0 && stream->stream_type == STREAM_TYPE_LIVE)
         current_bandwidth += stream->bandwidth;
+    bandwidth = current_bandwidth;
+    unlock_mutex(&conn_list_mutex);
 
     /* If already streaming this feed, do not let another feeder start */
-    if (stream->feed_opened) {
+    lock_mutex(&stream->state->lock);
+    feed_opened = stream->feed_opened;
+    unlock_mutex(&stream->state->lock);
+    if (feed_opened) {
         snprintf(msg, sizeof(msg), "This feed is already being received.");
         http_log("Feed '%s' already being received\n", stream->feed_filename);
         goto send_error;
     }
 
-    if (c->post == 0 && config.max_bandwidth < current_bandwidth) {
+    if (c->post == 0 && config.max_bandwidth < bandwidth) {
         c->http_error = 503;
         q = c->buffer;
         snprintf(q, c->buffer_size,
@@ -1576,7 +2024,7 @@ static int http_parse_request(HTTPContext *c)
                       "is %"PRIu64"kbit/s, and this exceeds the limit of "
                       "%"PRIu64"kbit/s.</p>\r\n"
                       "</body></html>\r\n",
-                 current_bandwidth, config.max_bandwidth);
+                 bandwidth, config.max_bandwidth);
         q += strlen(q);
         /* prepare output buffer */
         c->buffer_ptr = c->buffer;
@@ -1714,7 +2162,9 @@ static int http_parse_request(HTTPContext *c)
         goto send_error;
     }
 
+    lock_mutex(&stream->state->lock);
     stream->conns_served++;
+    unlock_mutex(&stream->state->lock);
 
     /* XXX: add there authenticate and IP match */
 
@@ -1760,14 +2210,18 @@ static int http_parse_request(HTTPContext *c)
             if (client_id && extract_rates(ratebuf, sizeof(ratebuf), c->buffer)) {
                 HTTPContext *wmpc;
 
-                /* Now we have to find the client_id */
+                /* Now we have to find the client_id, the rates are
+                 * applied by the worker handling the connection */
+                lock_mutex(&conn_list_mutex);
                 for (wmpc = first_http_ctx; wmpc; wmpc = wmpc->next) {
-                    if (wmpc->wmp_client_id == client_id)
-                        break;
+                    lock_mutex(&wmpc->lock);
+                    if (wmpc->wmp_client_id == client_id) {
+                        memcpy(wmpc->switch_rates, ratebuf, sizeof(ratebuf));
+                        wmpc->switch_rates_pending = 1;
+                    }
+                    unlock_mutex(&wmpc->lock);
                 }
-
-                if (wmpc && modify_current_stream(wmpc, ratebuf))
-                    wmpc->switch_pending = 1;
+                unlock_mutex(&conn_list_mutex);
             }
 
             snprintf(msg, sizeof(msg), "POST command not handled");
@@ -1808,8 +2262,14 @@ static int http_parse_request(HTTPContext *c)
     /* for asf, we need extra headers */
     if (!strcmp(c->stream->fmt->name,"asf_stream")) {
         /* Need to allocate a client id */
+        int client_id;
 
-        c->wmp_client_id = av_lfg_get(&random_state);
+        lock_mutex(&conn_list_mutex);
+        client_id = av_lfg_get(&random_state);
+        unlock_mutex(&conn_list_mutex);
+        lock_mutex(&c->lock);
+        c->wmp_client_id = client_id;
+        unlock_mutex(&c->lock);
 
         av_strlcatf(c->buffer, c->buffer_size, "Server: Cougar 4.1.0.3923\r\nCache-Control: no-cache\r\nPragma: client-id=%d\r\nPragma: features=\"broadcast\"\r\n", c->wmp_client_id);
     }
@@ -1949,6 +2409,8 @@ static void compute_status(HTTPContext *c)
     while (stream) {
         char sfilename[1024];
         char *eosf;
+        int conns_served;
+        int64_t bytes_served;
 
         if (stream->feed == stream) {
             stream = stream->next;
@@ -1976,11 +2438,16 @@ static void compute_status(HTTPContext *c)
             }
         }
 
+        lock_mutex(&stream->state->lock);
+        conns_served = stream->conns_served;
+        bytes_served = stream->bytes_served;
+        unlock_mutex(&stream->state->lock);
+
         avio_printf(pb, "<tr><td><a href=\"/%s\">%s</a> ",
                     sfilename, stream->filename);
         avio_printf(pb, "<td align=right> %d <td align=right> ",
-                    stream->conns_served);
-        fmt_bytecount(pb, stream->bytes_served);
+                    conns_served);
+        fmt_bytecount(pb, bytes_served);
 
         switch(stream->stream_type) {
         case STREAM_TYPE_LIVE: {
@@ -1991,6 +2458,7 @@ static void compute_status(HTTPContext *c)
             const char *audio_codec_name_extra = "";
             const char *video_codec_name_extra = "";
 
+            lock_mutex(&codec_state(stream)->lock);
             for(i=0;i<stream->nb_streams;i++) {
                 AVStream *st = stream->streams[i];
                 AVCodec *codec = avcodec_find_encoder(st->codec->codec_id);
@@ -2019,6 +2487,7 @@ static void compute_status(HTTPContext *c)
                     abort();
                 }
             }
+            unlock_mutex(&codec_state(stream)->lock);
 
             avio_printf(pb, "<td align=center> %s <td align=right> %d "
                             "<td align=right> %d <td> %s %s <td align=right> "
@@ -2084,13 +2553,16 @@ static void compute_status(HTTPContext *c)
             avio_printf(pb, "<p>");
         }
 
+        lock_mutex(&stream->state->lock);
         print_stream_params(pb, stream);
+        unlock_mutex(&stream->state->lock);
         stream = stream->next;
     }
 
     /* connection status */
     avio_printf(pb, "<h2>Connection Status</h2>\n");
 
+    lock_mutex(&conn_list_mutex);
     avio_printf(pb, "Number of connections: %d / %d<br>\n",
                 nb_connections, config.nb_max_connections);
 
@@ -2103,34 +2575,29 @@ static void compute_status(HTTPContext *c)
     c1 = first_http_ctx;
     i = 0;
     while (c1) {
-        int bitrate;
-        int j;
-
-        bitrate = 0;
-        if (c1->stream) {
-            for (j = 0; j < c1->stream->nb_streams; j++) {
-                if (!c1->stream->feed)
-                    bitrate += c1->stream->streams[j]->codec->bit_rate;
-                else if (c1->feed_streams[j] >= 0)
-                    bitrate += c1->stream->feed->streams[c1->feed_streams[j]]->codec->bit_rate;
-            }
-        }
+        ConnectionStatus status;
+
+        /* the other fields are only used by the worker owning c1 */
+        lock_mutex(&c1->lock);
+        status = c1->status;
+        unlock_mutex(&c1->lock);
 
         i++;
         p = inet_ntoa(c1->from_addr.sin_addr);
         avio_printf(pb, "<tr><td><b>%d</b><td>%s%s<td>%s<td>%s<td>%s"
                         "<td align=right>",
-                    i, c1->stream ? c1->stream->filename : "",
-                    c1->state == HTTPSTATE_RECEIVE_DATA ? "(input)" : "", p,
-                    c1->protocol, http_state[c1->state]);
-        fmt_bytecount(pb, bitrate);
+                    i, status.stream ? status.stream->filename : "",
+                    status.state == HTTPSTATE_RECEIVE_DATA ? "(input)" : "",
+                    p, status.protocol, http_state[status.state]);
+        fmt_bytecount(pb, status.bitrate);
         avio_printf(pb, "<td align=right>");
-        fmt_bytecount(pb, compute_datarate(&c1->datarate, c1->data_count) * 8);
+        fmt_bytecount(pb, status.datarate * 8);
         avio_printf(pb, "<td align=right>");
-        fmt_bytecount(pb, c1->data_count);
+        fmt_bytecount(pb, status.data_count);
         avio_printf(pb, "\n");
         c1 = c1->next;
     }
+    unlock_mutex(&conn_list_mutex);
     avio_printf(pb, "</table>\n");
 
     /* date */
@@ -2144,18 +2611,107 @@ static void compute_status(HTTPContext *c)
     c->buffer_end = c->pb_buffer + len;
 }
 
+/* read the feed of an output connection, taking the packets recently
+ * received by the feeder from its cache instead of the file */
+static int feed_read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    HTTPContext *c = opaque;
+    FFServerStreamState *fs = c->stream->feed->state;
+    int64_t page_pos = c->feed_read_pos - c->feed_read_pos % FFM_PACKET_SIZE;
+    int i = (page_pos / FFM_PACKET_SIZE) % FEED_CACHE_PAGES;
+    AVBufferRef *page = NULL;
+    int len;
+
+    /* cached pages are never modified, only replaced: take a reference
+     * under the lock and read it without holding the lock */
+    lock_mutex(&fs->lock);
+    if (fs->page_cache[i] && fs->page_cache_pos[i] == page_pos)
+        page = av_buffer_ref(fs->page_cache[i]);
+    unlock_mutex(&fs->lock);
+
+    if (page) {
+        int offset = c->feed_read_pos - page_pos;
+        len = FFMIN(buf_size, FFM_PACKET_SIZE - offset);
+        memcpy(buf, page->data + offset, len);
+        av_buffer_unref(&page);
+    } else {
+        if (lseek(c->feed_read_fd, c->feed_read_pos, SEEK_SET) < 0)
+            return AVERROR(errno);
+        len = read(c->feed_read_fd, buf, buf_size);
+        if (len < 0)
+            return AVERROR(errno);
+        if (!len)
+            return AVERROR_EOF;
+    }
+    c->feed_read_pos += len;
+    return len;
+}
+
+static int64_t feed_seek(void *opaque, int64_t offset, int whence)
+{
+    HTTPContext *c = opaque;
+    int64_t size;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        size = lseek(c->feed_read_fd, 0, SEEK_END);
+        return size < 0 ? AVERROR(errno) : size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += c->feed_read_pos;
+        break;
+    case SEEK_END:
+        if ((size = lseek(c->feed_read_fd, 0, SEEK_END)) < 0)
+            return AVERROR(errno);
+        offset += size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    return c->feed_read_pos = offset;
+}
+
+static int open_feed_pb(HTTPContext *c, const char *filename)
+{
+    uint8_t *buf;
+    int fd, ret;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        http_log("Could not open feed file '%s': %s\n",
+                 filename, strerror(errno));
+        return ret;
+    }
+
+    buf = av_malloc(FFM_PACKET_SIZE);
+    if (buf)
+        c->feed_pb = avio_alloc_context(buf, FFM_PACKET_SIZE, 0, c,
+                                        feed_read_packet, NULL, feed_seek);
+    if (!c->feed_pb) {
+        av_free(buf);
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+    c->feed_read_fd  = fd;
+    c->feed_read_pos = 0;
+    return 0;
+}
+
 static int open_input_stream(HTTPContext *c, const char *info)
 {
     char buf[128];
     char input_filename[1024];
     AVFormatContext *s = NULL;
-    int buf_size, i, ret;
+    int i, ret;
     int64_t stream_pos;
 
     /* find file name */
     if (c->stream->feed) {
         strcpy(input_filename, c->stream->feed->feed_filename);
-        buf_size = FFM_PACKET_SIZE;
         /* compute position (absolute time) */
         if (av_find_info_tag(buf, sizeof(buf), "date", info)) {
             if ((ret = av_parse_time(&stream_pos, buf, 0)) < 0) {
@@ -2169,7 +2725,6 @@ static int open_input_stream(HTTPContext *c, const char *info)
             stream_pos = av_gettime() - c->stream->prebuffer * (int64_t)1000;
     } else {
         strcpy(input_filename, c->stream->feed_filename);
-        buf_size = 0;
         /* compute position (relative time) */
         if (av_find_info_tag(buf, sizeof(buf), "date", info)) {
             if ((ret = av_parse_time(&stream_pos, buf, 1)) < 0) {
@@ -2185,6 +2740,13 @@ static int open_input_stream(HTTPContext *c, const char *info)
     }
 
     /* open stream */
+    if (c->stream->feed) {
+        if ((ret = open_feed_pb(c, input_filename)) < 0)
+            return ret;
+        if (!(s = avformat_alloc_context()))
+            return AVERROR(ENOMEM);
+        s->pb = c->feed_pb;
+    }
     ret = avformat_open_input(&s, input_filename, c->stream->ifmt,
                               &c->stream->in_opts);
     if (ret < 0) {
@@ -2193,15 +2755,6 @@ static int open_input_stream(HTTPContext *c, const char *info)
         return ret;
     }
 
-    /* set buffer size */
-    if (buf_size > 0) {
-        ret = ffio_set_buf_size(s->pb, buf_size);
-        if (ret < 0) {
-            http_log("Failed to set buffer size\n");
-            return ret;
-        }
-    }
-
     s->flags |= AVFMT_FLAG_GENPTS;
     c->fmt_in = s;
     if (strcmp(s->iformat->name, "ffm") &&
@@ -2214,17 +2767,19 @@ static int open_input_stream(HTTPContext *c, const char *info)
     /* choose stream as clock source (we favor the video stream if
      * present) for packet sending */
     c->pts_stream_index = 0;
+    lock_mutex(&codec_state(c->stream)->lock);
     for(i=0;i<c->stream->nb_streams;i++) {
         if (c->pts_stream_index == 0 &&
             c->stream->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
             c->pts_stream_index = i;
         }
     }
+    unlock_mutex(&codec_state(c->stream)->lock);
 
     if (c->fmt_in->iformat->read_seek)
         av_seek_frame(c->fmt_in, -1, stream_pos, 0);
     /* set the start time (needed for maxtime and RTP packet timing) */
-    c->start_time = cur_time;
+    c->start_time = c->worker->cur_time;
     c->first_pts = AV_NOPTS_VALUE;
     return 0;
 }
@@ -2233,7 +2788,7 @@ static int open_input_stream(HTTPContext *c, const char *info)
 static int64_t get_server_clock(HTTPContext *c)
 {
     /* compute current pts value from system time */
-    return (cur_time - c->start_time) * 1000;
+    return (c->worker->cur_time - c->start_time) * 1000;
 }
 
 /* return the estimated time (in us) at which the current packet must be sent */
@@ -2255,6 +2810,7 @@ static int http_prepare_data(HTTPContext *c)
 {
     int i, len, ret;
     AVFormatContext *ctx;
+    FFServerStreamState *fs;
 
     av_freep(&c->pb_buffer);
     switch(c->state) {
@@ -2270,6 +2826,11 @@ static int http_prepare_data(HTTPContext *c)
         if (!c->fmt_ctx.streams)
             return AVERROR(ENOMEM);
 
+        /* the streams copied below share their codec contexts with the
+         * stream they come from, keep them stable until the header is
+         * written */
+        fs = codec_state(c->stream);
+        lock_mutex(&fs->lock);
         for(i=0;i<c->stream->nb_streams;i++) {
             AVStream *src;
             c->fmt_ctx.streams[i] = av_mallocz(sizeof(AVStream));
@@ -2295,6 +2856,7 @@ static int http_prepare_data(HTTPContext *c)
 
         /* prepare header and save header data in a stream */
         if (avio_open_dyn_buf(&c->fmt_ctx.pb) < 0) {
+            unlock_mutex(&fs->lock);
             /* XXX: potential leak */
             return -1;
         }
@@ -2307,7 +2869,9 @@ static int http_prepare_data(HTTPContext *c)
          */
         c->fmt_ctx.max_delay = (int)(0.7*AV_TIME_BASE);
 
-        if ((ret = avformat_write_header(&c->fmt_ctx, NULL)) < 0) {
+        ret = avformat_write_header(&c->fmt_ctx, NULL);
+        unlock_mutex(&fs->lock);
+        if (ret < 0) {
             http_log("Error writing output header for stream '%s': %s\n",
                      c->stream->filename, av_err2str(ret));
             return ret;
@@ -2324,13 +2888,37 @@ static int http_prepare_data(HTTPContext *c)
     case HTTPSTATE_SEND_DATA:
         /* find a new packet */
         /* read a packet from the input stream */
-        if (c->stream->feed)
-            ffm_set_write_index(c->fmt_in,
-                                c->stream->feed->feed_write_index,
-                                c->stream->feed->feed_size);
+        if (c->stream->feed) {
+            FFServerStream *feed = c->stream->feed;
+            int64_t write_index, feed_size;
+            char switch_rates[sizeof(c->switch_rates)];
+            int switch_rates_pending;
+
+            /* remember the feed state, packets written after this
+             * wake the connection up if it has to wait */
+            lock_mutex(&feed->state->lock);
+            c->feed_pages    = feed->state->nb_pages;
+            c->feed_failures = feed->state->nb_failures;
+            write_index      = feed->feed_write_index;
+            feed_size        = feed->feed_size;
+            unlock_mutex(&feed->state->lock);
+            ffm_set_write_index(c->fmt_in, write_index, feed_size);
+
+            /* modify_current_stream() takes the feed lock, so call it
+             * without holding ours */
+            lock_mutex(&c->lock);
+            switch_rates_pending = c->switch_rates_pending;
+            if (switch_rates_pending)
+                memcpy(switch_rates, c->switch_rates, sizeof(switch_rates));
+            c->switch_rates_pending = 0;
+            unlock_mutex(&c->lock);
+            if (switch_rates_pending &&
+                modify_current_stream(c, switch_rates))
+                c->switch_pending = 1;
+        }
 
         if (c->stream->max_time &&
-            c->stream->max_time + c->start_time - cur_time < 0)
+            c->stream->max_time + c->start_time - c->worker->cur_time < 0)
             /* We have timed out */
             c->state = HTTPSTATE_SEND_DATA_TRAILER;
         else {
@@ -2363,7 +2951,7 @@ static int http_prepare_data(HTTPContext *c)
                 /* update first pts if needed */
                 if (c->first_pts == AV_NOPTS_VALUE && pkt.dts != AV_NOPTS_VALUE) {
                     c->first_pts = av_rescale_q(pkt.dts, c->fmt_in->streams[pkt.stream_index]->time_base, AV_TIME_BASE_Q);
-                    c->start_time = cur_time;
+                    c->start_time = c->worker->cur_time;
                 }
                 /* send it to the appropriate stream */
                 if (c->stream->feed) {
@@ -2531,9 +3119,9 @@ static int http_send_data(HTTPContext *c)
                 }
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
+                update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
                 if (c->stream)
-                    c->stream->bytes_served += len;
+                    add_bytes_served(c->stream, len);
 
                 if (c->rtp_protocol == RTSP_LOWER_TRANSPORT_TCP) {
                     /* RTP packets are sent inside the RTSP TCP connection */
@@ -2608,9 +3196,9 @@ static int http_send_data(HTTPContext *c)
                 c->buffer_ptr += len;
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
+                update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
                 if (c->stream)
-                    c->stream->bytes_served += len;
+                    add_bytes_served(c->stream, len);
                 break;
             }
         }
@@ -2618,23 +3206,50 @@ static int http_send_data(HTTPContext *c)
     return 0;
 }
 
+/* called with the feed lock held */
+static void feed_cache_flush(FFServerStreamState *fs)
+{
+    int i;
+
+    for (i = 0; i < FEED_CACHE_PAGES; i++)
+        av_buffer_unref(&fs->page_cache[i]);
+}
+
 static int http_start_receive_data(HTTPContext *c)
 {
-    int fd;
+    FFServerStreamState *fs = c->stream->state;
+    int fd = -1;
     int ret;
-    int64_t ret64;
+    int64_t ret64, write_index;
 
+    lock_mutex(&fs->lock);
     if (c->stream->feed_opened) {
+        unlock_mutex(&fs->lock);
         http_log("Stream feed '%s' was not opened\n",
                  c->stream->feed_filename);
         return AVERROR(EINVAL);
     }
+    /* keep other feeders out while the file is being set up */
+    c->stream->feed_opened = 1;
+    feed_cache_flush(fs);
+    if (!fs->page_pool)
+        fs->page_pool = av_buffer_pool_init(FFM_PACKET_SIZE, NULL);
+    unlock_mutex(&fs->lock);
+
+    /* the packets are received in pool buffers, which are handed over to
+     * the feed cache once written */
+    if (!fs->page_pool ||
+        !(c->feed_page = av_buffer_pool_get(fs->page_pool))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
 
     /* Don't permit writing to this one */
     if (c->stream->readonly) {
         http_log("Cannot write to read-only file '%s'\n",
                  c->stream->feed_filename);
-        return AVERROR(EINVAL);
+        ret = AVERROR(EINVAL);
+        goto fail;
     }
 
     /* open feed */
@@ -2643,46 +3258,57 @@ static int http_start_receive_data(HTTPContext *c)
         ret = AVERROR(errno);
         http_log("Could not open feed file '%s': %s\n",
                  c->stream->feed_filename, strerror(errno));
-        return ret;
+        goto fail;
     }
-    c->feed_fd = fd;
 
     if (c->stream->truncate) {
         /* truncate feed file */
-        ffm_write_write_index(c->feed_fd, FFM_PACKET_SIZE);
+        ffm_write_write_index(fd, FFM_PACKET_SIZE);
         http_log("Truncating feed file '%s'\n", c->stream->feed_filename);
-        if (ftruncate(c->feed_fd, FFM_PACKET_SIZE) < 0) {
+        if (ftruncate(fd, FFM_PACKET_SIZE) < 0) {
             ret = AVERROR(errno);
             http_log("Error truncating feed file '%s': %s\n",
                      c->stream->feed_filename, strerror(errno));
-            return ret;
+            goto fail;
         }
     } else {
         ret64 = ffm_read_write_index(fd);
         if (ret64 < 0) {
             http_log("Error reading write index from feed file '%s': %s\n",
                      c->stream->feed_filename, strerror(errno));
-            return ret64;
+            ret = ret64;
+            goto fail;
         }
-        c->stream->feed_write_index = ret64;
     }
 
-    c->stream->feed_write_index = FFMAX(ffm_read_write_index(fd),
-                                        FFM_PACKET_SIZE);
+    write_index = FFMAX(ffm_read_write_index(fd), FFM_PACKET_SIZE);
+    lock_mutex(&fs->lock);
+    c->stream->feed_write_index = write_index;
     c->stream->feed_size = lseek(fd, 0, SEEK_END);
+    unlock_mutex(&fs->lock);
     lseek(fd, 0, SEEK_SET);
+    c->feed_fd = fd;
 
     /* init buffer input */
-    c->buffer_ptr = c->buffer;
-    c->buffer_end = c->buffer + FFM_PACKET_SIZE;
-    c->stream->feed_opened = 1;
+    c->buffer_ptr = c->feed_page->data;
+    c->buffer_end = c->feed_page->data + FFM_PACKET_SIZE;
     c->chunked_encoding = !!av_stristr(c->buffer, "Transfer-Encoding: chunked");
     return 0;
+fail:
+    if (fd >= 0)
+        close(fd);
+    av_buffer_unref(&c->feed_page);
+    lock_mutex(&fs->lock);
+    c->stream->feed_opened = 0;
+    unlock_mutex(&fs->lock);
+    return ret;
 }
 
 static int http_receive_data(HTTPContext *c)
 {
-    HTTPContext *c1;
+    FFServerStream *feed = c->stream;
+    FFServerStreamState *fs = feed->state;
+    uint8_t *buf = c->feed_page->data;
     int len, loop_run = 0;
 
     while (c->chunked_encoding && !c->chunk_size &&
@@ -2699,12 +3325,12 @@ static int http_receive_data(HTTPContext *c)
         } else if (len == 0) {
             /* end of connection : close it */
             goto fail;
-        } else if (c->buffer_ptr - c->buffer >= 2 &&
+        } else if (c->buffer_ptr - buf >= 2 &&
                    !memcmp(c->buffer_ptr - 1, "\r\n", 2)) {
-            c->chunk_size = strtol(c->buffer, 0, 16);
+            c->chunk_size = strtol(buf, 0, 16);
             if (c->chunk_size == 0) // end of stream
                 goto fail;
-            c->buffer_ptr = c->buffer;
+            c->buffer_ptr = buf;
             break;
         } else if (++loop_run > 10)
             /* no chunk header, abort */
@@ -2728,56 +3354,71 @@ static int http_receive_data(HTTPContext *c)
             c->chunk_size -= len;
             c->buffer_ptr += len;
             c->data_count += len;
-            update_datarate(&c->datarate, c->data_count);
+            update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
         }
     }
 
-    if (c->buffer_ptr - c->buffer >= 2 && c->data_count > FFM_PACKET_SIZE) {
-        if (c->buffer[0] != 'f' ||
-            c->buffer[1] != 'm') {
+    if (c->buffer_ptr - buf >= 2 && c->data_count > FFM_PACKET_SIZE) {
+        if (buf[0] != 'f' ||
+            buf[1] != 'm') {
             http_log("Feed stream has become desynchronized -- disconnecting\n");
             goto fail;
         }
     }
 
     if (c->buffer_ptr >= c->buffer_end) {
-        FFServerStream *feed = c->stream;
         /* a packet has been received : write it in the store, except
          * if header */
         if (c->data_count > FFM_PACKET_SIZE) {
+            int64_t pos = feed->feed_write_index, write_index;
+            int i = (pos / FFM_PACKET_SIZE) % FEED_CACHE_PAGES;
+
             /* XXX: use llseek or url_seek
              * XXX: Should probably fail? */
-            if (lseek(c->feed_fd, feed->feed_write_index, SEEK_SET) == -1)
-                http_log("Seek to %"PRId64" failed\n", feed->feed_write_index);
+            if (lseek(c->feed_fd, pos, SEEK_SET) == -1)
+                http_log("Seek to %"PRId64" failed\n", pos);
 
-            if (write(c->feed_fd, c->buffer, FFM_PACKET_SIZE) < 0) {
+            if (write(c->feed_fd, buf, FFM_PACKET_SIZE) < 0) {
                 http_log("Error writing to feed file: %s\n", strerror(errno));
                 goto fail;
             }
 
+            lock_mutex(&fs->lock);
+            /* keep the packet in memory for the connections reading the
+             * feed, it is not modified anymore */
+            av_buffer_unref(&fs->page_cache[i]);
+            fs->page_cache[i]     = c->feed_page;
+            fs->page_cache_pos[i] = pos;
+            c->feed_page = NULL;
+
             feed->feed_write_index += FFM_PACKET_SIZE;
             /* update file size */
-            if (feed->feed_write_index > c->stream->feed_size)
+            if (feed->feed_write_index > feed->feed_size)
                 feed->feed_size = feed->feed_write_index;
 
             /* handle wrap around if max file size reached */
-            if (c->stream->feed_max_size &&
-                feed->feed_write_index >= c->stream->feed_max_size)
+            if (feed->feed_max_size &&
+                feed->feed_write_index >= feed->feed_max_size)
                 feed->feed_write_index = FFM_PACKET_SIZE;
+            write_index = feed->feed_write_index;
+
+            /* wake up any waiting connections */
+            fs->nb_pages++;
+            wake_feed_waiters(fs, c->worker);
+            unlock_mutex(&fs->lock);
 
             /* write index */
-            if (ffm_write_write_index(c->feed_fd, feed->feed_write_index) < 0) {
+            if (ffm_write_write_index(c->feed_fd, write_index) < 0) {
                 http_log("Error writing index to feed file: %s\n",
                          strerror(errno));
                 goto fail;
             }
 
-            /* wake up any waiting connections */
-            for(c1 = first_http_ctx; c1; c1 = c1->next) {
-                if (c1->state == HTTPSTATE_WAIT_FEED &&
-                    c1->stream->feed == c->stream->feed)
-                    c1->state = HTTPSTATE_SEND_DATA;
-            }
+            c->feed_page = av_buffer_pool_get(fs->page_pool);
+            if (!c->feed_page)
+                goto fail;
+            buf = c->feed_page->data;
+            c->buffer_end = buf + FFM_PACKET_SIZE;
         } else {
             /* We have a header in our hands that contains useful data */
             AVFormatContext *s = avformat_alloc_context();
@@ -2793,7 +3434,7 @@ static int http_receive_data(HTTPContext *c)
             if (!fmt_in)
                 goto fail;
 
-            pb = avio_alloc_context(c->buffer, c->buffer_end - c->buffer,
+            pb = avio_alloc_context(buf, c->buffer_end - buf,
                                     0, NULL, NULL, NULL, NULL);
             if (!pb)
                 goto fail;
@@ -2815,28 +3456,32 @@ static int http_receive_data(HTTPContext *c)
                 goto fail;
             }
 
+            /* the live streams share these codec contexts, readers
+             * take the feed lock */
+            lock_mutex(&fs->lock);
             for (i = 0; i < s->nb_streams; i++) {
                 AVStream *fst = feed->streams[i];
                 AVStream *st = s->streams[i];
                 avcodec_copy_context(fst->codec, st->codec);
             }
+            unlock_mutex(&fs->lock);
 
             avformat_close_input(&s);
             av_freep(&pb);
         }
-        c->buffer_ptr = c->buffer;
+        c->buffer_ptr = buf;
     }
 
     return 0;
  fail:
-    c->stream->feed_opened = 0;
     close(c->feed_fd);
     /* wake up any waiting connections to stop waiting for feed */
-    for(c1 = first_http_ctx; c1; c1 = c1->next) {
-        if (c1->state == HTTPSTATE_WAIT_FEED &&
-            c1->stream->feed == c->stream->feed)
-            c1->state = HTTPSTATE_SEND_DATA_TRAILER;
-    }
+    lock_mutex(&fs->lock);
+    c->stream->feed_opened = 0;
+    feed_cache_flush(fs);
+    fs->nb_failures++;
+    wake_feed_waiters(fs, c->worker);
+    unlock_mutex(&fs->lock);
     return -1;
 }
 
@@ -2993,16 +3638,19 @@ static int prepare_sdp_description(FFServerStream *stream, uint8_t **pbuffer,
     if (!avs)
         goto sdp_done;
 
+    *pbuffer = av_mallocz(2048);
+    if (!*pbuffer)
+        goto sdp_done;
+
+    lock_mutex(&codec_state(stream)->lock);
     for(i = 0; i < stream->nb_streams; i++) {
         avc->streams[i] = &avs[i];
         avc->streams[i]->codec = stream->streams[i]->codec;
         avcodec_parameters_from_context(stream->streams[i]->codecpar, stream->streams[i]->codec);
         avc->streams[i]->codecpar = stream->streams[i]->codecpar;
     }
-    *pbuffer = av_mallocz(2048);
-    if (!*pbuffer)
-        goto sdp_done;
     av_sdp_create(&avc, 1, *pbuffer, 2048);
+    unlock_mutex(&codec_state(stream)->lock);
 
  sdp_done:
     av_freep(&avc->streams);
@@ -3078,11 +3726,15 @@ static HTTPContext *find_rtp_session(const char *session_id)
     if (session_id[0] == '\0')
         return NULL;
 
+    /* RTP sessions belong to the first worker, which is the caller, so
+     * the connection found cannot be freed meanwhile */
+    lock_mutex(&conn_list_mutex);
     for(c = first_http_ctx; c; c = c->next) {
         if (!strcmp(c->session_id, session_id))
-            return c;
+            break;
     }
-    return NULL;
+    unlock_mutex(&conn_list_mutex);
+    return c;
 }
 
 static RTSPTransportField *find_transport(RTSPMessageHeader *h, enum RTSPLowerTransport lower_transport)
@@ -3148,8 +3800,11 @@ static void rtsp_cmd_setup(HTTPContext *c, const char *url,
 
     /* generate session id if needed */
     if (h->session_id[0] == '\0') {
-        unsigned random0 = av_lfg_get(&random_state);
-        unsigned random1 = av_lfg_get(&random_state);
+        unsigned random0, random1;
+        lock_mutex(&conn_list_mutex);
+        random0 = av_lfg_get(&random_state);
+        random1 = av_lfg_get(&random_state);
+        unlock_mutex(&conn_list_mutex);
         snprintf(h->session_id, sizeof(h->session_id), "%08x%08x",
                  random0, random1);
     }
@@ -3349,24 +4004,20 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
     HTTPContext *c = NULL;
     const char *proto_str;
 
-    /* XXX: should output a warning page when coming
-     * close to the connection limit */
-    if (nb_connections >= config.nb_max_connections)
-        goto fail;
-
     /* add a new connection */
     c = av_mallocz(sizeof(HTTPContext));
     if (!c)
         goto fail;
 
     c->fd = -1;
-    c->poll_entry = NULL;
     c->from_addr = *from_addr;
+    /* RTSP connections and their RTP sessions all belong to the first
+     * worker */
+    c->worker = &workers[0];
     c->buffer_size = IOBUFFER_INIT_SIZE;
     c->buffer = av_malloc(c->buffer_size);
     if (!c->buffer)
         goto fail;
-    nb_connections++;
     c->stream = stream;
     av_strlcpy(c->session_id, session_id, sizeof(c->session_id));
     c->state = HTTPSTATE_READY;
@@ -3391,10 +4042,30 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
     av_strlcpy(c->protocol, "RTP/", sizeof(c->protocol));
     av_strlcat(c->protocol, proto_str, sizeof(c->protocol));
 
+#if HAVE_PTHREADS
+    if (pthread_mutex_init(&c->lock, NULL))
+        goto fail;
+#endif
+    publish_status(c);
+
+    /* XXX: should output a warning page when coming
+     * close to the connection limit */
+    lock_mutex(&conn_list_mutex);
+    if (nb_connections >= config.nb_max_connections) {
+        unlock_mutex(&conn_list_mutex);
+#if HAVE_PTHREADS
+        pthread_mutex_destroy(&c->lock);
+#endif
+        goto fail;
+    }
+    nb_connections++;
     current_bandwidth += stream->bandwidth;
 
     c->next = first_http_ctx;
     first_http_ctx = c;
+    unlock_mutex(&conn_list_mutex);
+    c->worker_next = workers[0].first_ctx;
+    workers[0].first_ctx = c;
     return c;
 
  fail:
@@ -3419,7 +4090,7 @@ static int rtp_new_av_stream(HTTPContext *c,
     char *ipaddr;
     URLContext *h = NULL;
     uint8_t *dummy_buf;
-    int max_packet_size;
+    int max_packet_size, ret;
     void *st_internal;
 
     /* now we can open the relevant output stream */
@@ -3492,7 +4163,11 @@ static int rtp_new_av_stream(HTTPContext *c,
         /* XXX: close stream */
         goto fail;
 
-    if (avformat_write_header(ctx, NULL) < 0) {
+    /* the codec context is shared with the stream (and its feed) */
+    lock_mutex(&codec_state(c->stream)->lock);
+    ret = avformat_write_header(ctx, NULL);
+    unlock_mutex(&codec_state(c->stream)->lock);
+    if (ret < 0) {
     fail:
         if (h)
             ffurl_close(h);
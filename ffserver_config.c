@@ -659,6 +659,11 @@ static int ffserver_parse_config_global(FFServerConfig *config, const char *cmd,
                   "MaxHTTPConnections(%d)\n", config->nb_max_connections,
                   config->nb_max_http_connections);
         }
+    } else if (!av_strcasecmp(cmd, "Workers")) {
+        ffserver_get_arg(arg, sizeof(arg), p);
+        ffserver_set_int_param(&val, arg, 0, 1, 256, config,
+                "Invalid Workers: '%s'\n", arg);
+        config->nb_workers = val;
     } else if (!av_strcasecmp(cmd, "MaxBandwidth")) {
         int64_t llval;
         char *tailp;
@@ -91,6 +91,8 @@ typedef struct FFServerStream {
     int64_t feed_max_size;        /* maximum storage size, zero means unlimited */
     int64_t feed_write_index;     /* current write position in feed (it wraps around) */
     int64_t feed_size;            /* current size of feed */
+    struct FFServerStreamState *state; /* lock and feed cache shared by the
+                                          workers, set up by ffserver.c */
     struct FFServerStream *next_feed;
 } FFServerStream;
 
@@ -100,6 +102,7 @@ typedef struct FFServerConfig {
     FFServerStream *first_stream; /* contains all streams, including feeds */
     unsigned int nb_max_http_connections;
     unsigned int nb_max_connections;
+    int nb_workers;               /* number of threads handling connections */
     uint64_t max_bandwidth;
     int debug;
     char logfilename[1024];
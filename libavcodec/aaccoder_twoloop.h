@@ -61,19 +61,46 @@ static inline int ff_pns_bits(SingleChannelElement *sce, int w, int g)
     return (!g || !sce->zeroes[w*16+g-1] || !sce->can_pns[w*16+g-1]) ? 9 : 5;
 }
 
+/**
+ * Lowpass frequency the two-loop coder selects for the given lambda when no
+ * explicit cutoff is set.
+ *
+ * Scale, psy gives us constant quality, this LP only scales
+ * bitrate by lambda, so we save bits on subjectively unimportant HF
+ * rather than increase quantization noise. Adjust nominal bitrate
+ * to effective bitrate according to encoding parameters,
+ * AAC_CUTOFF_FROM_BITRATE is calibrated for effective bitrate.
+ */
+static inline int ff_twoloop_cutoff(AVCodecContext *avctx, AACEncContext *s,
+                                    const float lambda)
+{
+    int refbits = avctx->bit_rate * 1024.0 / avctx->sample_rate
+        / ((avctx->flags & AV_CODEC_FLAG_QSCALE) ? 2.0f : avctx->channels)
+        * (lambda / 120.f);
+    float rate_bandwidth_multiplier = 1.5f;
+    int frame_bit_rate = (avctx->flags & AV_CODEC_FLAG_QSCALE)
+        ? (refbits * rate_bandwidth_multiplier * avctx->sample_rate / 1024)
+        : (avctx->bit_rate / avctx->channels);
+
+    /** Compensate for extensions that increase efficiency */
+    if (s->options.pns || s->options.intensity_stereo)
+        frame_bit_rate *= 1.15f;
+
+    return FFMAX(3000, AAC_CUTOFF_FROM_BITRATE(frame_bit_rate, 1, avctx->sample_rate));
+}
+
 /**
  * two-loop quantizers search taken from ISO 13818-7 Appendix C
  */
-static void search_for_quantizers_twoloop(AVCodecContext *avctx,
-                                          AACEncContext *s,
-                                          SingleChannelElement *sce,
-                                          const float lambda)
+static av_unused void search_for_quantizers_twoloop(AVCodecContext *avctx,
+                                                    AACEncContext *s,
+                                                    SingleChannelElement *sce,
+                                                    const float lambda)
 {
     int start = 0, i, w, w2, g, recomprd;
     int destbits = avctx->bit_rate * 1024.0 / avctx->sample_rate
         / ((avctx->flags & CODEC_FLAG_QSCALE) ? 2.0f : avctx->channels)
         * (lambda / 120.f);
-    int refbits = destbits;
     int toomanybits, toofewbits;
     char nzs[128];
     uint8_t nextband[128];
@@ -176,26 +203,10 @@ static void search_for_quantizers_twoloop(AVCodecContext *avctx,
         int wlen = 1024 / sce->ics.num_windows;
         int bandwidth;
 
-        /**
-         * Scale, psy gives us constant quality, this LP only scales
-         * bitrate by lambda, so we save bits on subjectively unimportant HF
-         * rather than increase quantization noise. Adjust nominal bitrate
-         * to effective bitrate according to encoding parameters,
-         * AAC_CUTOFF_FROM_BITRATE is calibrated for effective bitrate.
-         */
-        float rate_bandwidth_multiplier = 1.5f;
-        int frame_bit_rate = (avctx->flags & CODEC_FLAG_QSCALE)
-            ? (refbits * rate_bandwidth_multiplier * avctx->sample_rate / 1024)
-            : (avctx->bit_rate / avctx->channels);
-
-        /** Compensate for extensions that increase efficiency */
-        if (s->options.pns || s->options.intensity_stereo)
-            frame_bit_rate *= 1.15f;
-
         if (avctx->cutoff > 0) {
             bandwidth = avctx->cutoff;
         } else {
-            bandwidth = FFMAX(3000, AAC_CUTOFF_FROM_BITRATE(frame_bit_rate, 1, avctx->sample_rate));
+            bandwidth = ff_twoloop_cutoff(avctx, s, lambda);
             s->psy.cutoff = bandwidth;
         }
 
@@ -45,6 +45,8 @@
 #include "aacenc.h"
 #include "aacenctab.h"
 #include "aacenc_utils.h"
+#include "aacenc_quantization.h"
+#include "aaccoder_twoloop.h"
 
 #include "psymodel.h"
 
@@ -506,6 +508,36 @@ static void copy_input_samples(AACEncContext *s, const AVFrame *frame)
     }
 }
 
+/**
+ * Run the PNS marking and the quantizer search for one channel. Channels are
+ * independent at this point, so this runs as one slice thread job per
+ * channel, each thread using its own copy of the encoder context.
+ */
+static int search_channel_quantizers(AVCodecContext *avctx, void *arg,
+                                     int jobnr, int threadnr)
+{
+    AACEncContext *s = avctx->priv_data;
+    AACEncContext *ts = threadnr ? s->slice_ctx[threadnr - 1] : s;
+    const int *bitres_alloc = arg;
+    int i, chans, start_ch = 0;
+
+    for (i = 0; i < s->chan_map[0]; i++) {
+        chans = s->chan_map[i+1] == TYPE_CPE ? 2 : 1;
+        if (jobnr < start_ch + chans)
+            break;
+        start_ch += chans;
+    }
+
+    ts->cur_type         = s->chan_map[i+1];
+    ts->cur_channel      = jobnr;
+    ts->psy.bitres.alloc = bitres_alloc[jobnr];
+    if (ts->options.pns && ts->coder->mark_pns)
+        ts->coder->mark_pns(ts, avctx, &s->cpe[i].ch[jobnr - start_ch]);
+    ts->coder->search_for_quantizers(avctx, ts, &s->cpe[i].ch[jobnr - start_ch], ts->lambda);
+
+    return 0;
+}
+
 static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                             const AVFrame *frame, int *got_packet_ptr)
 {
@@ -518,6 +550,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     int target_bits, rate_bits, too_many_bits, too_few_bits;
     int ms_mode = 0, is_mode = 0, tns_mode = 0, pred_mode = 0;
     int chan_el_counter[4];
+    int bitres_alloc[AAC_MAX_CHANNELS];
     FFPsyWindowInfo windows[AAC_MAX_CHANNELS];
 
     if (s->last_frame == 2)
@@ -639,9 +672,10 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 
         if ((avctx->frame_number & 0xFF)==1 && !(avctx->flags & AV_CODEC_FLAG_BITEXACT))
             put_bitstream_info(s, LIBAVCODEC_IDENT);
+        /* The psy model keeps bit reservoir state across channel elements,
+         * so the analysis is done in element order before searching. */
         start_ch = 0;
         target_bits = 0;
-        memset(chan_el_counter, 0, sizeof(chan_el_counter));
         for (i = 0; i < s->chan_map[0]; i++) {
             FFPsyWindowInfo* wi = windows + start_ch;
             const float *coeffs[2];
@@ -651,8 +685,6 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
             cpe->common_window = 0;
             memset(cpe->is_mask, 0, sizeof(cpe->is_mask));
             memset(cpe->ms_mask, 0, sizeof(cpe->ms_mask));
-            put_bits(&s->pb, 3, tag);
-            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             for (ch = 0; ch < chans; ch++) {
                 sce = &cpe->ch[ch];
                 coeffs[ch] = sce->coeffs;
@@ -674,13 +706,30 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                     * (s->lambda / (avctx->global_quality ? avctx->global_quality : 120));
                 s->psy.bitres.alloc /= chans;
             }
-            s->cur_type = tag;
-            for (ch = 0; ch < chans; ch++) {
-                s->cur_channel = start_ch + ch;
-                if (s->options.pns && s->coder->mark_pns)
-                    s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
-                s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
-            }
+            for (ch = 0; ch < chans; ch++)
+                bitres_alloc[start_ch + ch] = s->psy.bitres.alloc;
+            /* twoloop sets the cutoff while searching the first channel,
+             * but all elements are analyzed ahead of the search now */
+            if (!i && s->options.coder == AAC_CODER_TWOLOOP && avctx->cutoff <= 0)
+                s->psy.cutoff = ff_twoloop_cutoff(avctx, s, s->lambda);
+            start_ch += chans;
+        }
+
+        for (i = 0; i < s->nb_slice_ctx; i++)
+            memcpy(s->slice_ctx[i], s, offsetof(AACEncContext, qcoefs));
+        avctx->execute2(avctx, search_channel_quantizers, bitres_alloc, NULL, s->channels);
+
+        /* The remaining tools use the PNS PRNG and write the bitstream,
+         * keep them in element order. */
+        start_ch = 0;
+        memset(chan_el_counter, 0, sizeof(chan_el_counter));
+        for (i = 0; i < s->chan_map[0]; i++) {
+            FFPsyWindowInfo* wi = windows + start_ch;
+            tag      = s->chan_map[i+1];
+            chans    = tag == TYPE_CPE ? 2 : 1;
+            cpe      = &s->cpe[i];
+            put_bits(&s->pb, 3, tag);
+            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             if (chans > 1
                 && wi[0].window_type[0] == wi[1].window_type[0]
                 && wi[0].window_shape   == wi[1].window_shape) {
@@ -855,6 +904,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 static av_cold int aac_encode_end(AVCodecContext *avctx)
 {
     AACEncContext *s = avctx->priv_data;
+    int i;
 
     av_log(avctx, AV_LOG_INFO, "Qavg: %.3f\n", s->lambda_sum / s->lambda_count);
 
@@ -862,6 +912,10 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     ff_mdct_end(&s->mdct128);
     ff_psy_end(&s->psy);
     ff_lpc_end(&s->lpc);
+    if (s->slice_ctx)
+        for (i = 0; i < s->nb_slice_ctx; i++)
+            av_freep(&s->slice_ctx[i]);
+    av_freep(&s->slice_ctx);
     if (s->psypp)
         ff_psy_preprocess_end(s->psypp);
     av_freep(&s->buffer.samples);
@@ -900,6 +954,14 @@ static av_cold int alloc_buffers(AVCodecContext *avctx, AACEncContext *s)
     FF_ALLOCZ_ARRAY_OR_GOTO(avctx, s->cpe, s->chan_map[0], sizeof(ChannelElement), alloc_fail);
     FF_ALLOCZ_OR_GOTO(avctx, avctx->extradata, 5 + AV_INPUT_BUFFER_PADDING_SIZE, alloc_fail);
 
+    if (avctx->active_thread_type & FF_THREAD_SLICE && avctx->thread_count > 1 && s->channels > 1) {
+        int nb_slice_ctx = FFMIN(avctx->thread_count, s->channels) - 1;
+        FF_ALLOCZ_ARRAY_OR_GOTO(avctx, s->slice_ctx, nb_slice_ctx, sizeof(*s->slice_ctx), alloc_fail);
+        s->nb_slice_ctx = nb_slice_ctx;
+        for (ch = 0; ch < s->nb_slice_ctx; ch++)
+            FF_ALLOCZ_OR_GOTO(avctx, s->slice_ctx[ch], sizeof(AACEncContext), alloc_fail);
+    }
+
     for(ch = 0; ch < s->channels; ch++)
         s->planar_samples[ch] = s->buffer.samples + 3 * 1024 * ch;
 
@@ -1086,7 +1148,8 @@ AVCodec ff_aac_encoder = {
     .defaults       = aac_encode_defaults,
     .supported_samplerates = mpeg4audio_sample_rates,
     .caps_internal  = FF_CODEC_CAP_INIT_THREADSAFE,
-    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .sample_fmts    = (const enum AVSampleFormat[]){ AV_SAMPLE_FMT_FLTP,
                                                      AV_SAMPLE_FMT_NONE },
     .priv_class     = &aacenc_class,
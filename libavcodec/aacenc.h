@@ -122,7 +122,13 @@ typedef struct AACEncContext {
     int lambda_count;                            ///< count(lambda), for Qvg reporting
     enum RawDataBlockType cur_type;              ///< channel group type cur_channel belongs to
 
+    struct AACEncContext **slice_ctx;            ///< contexts used by the other slice threads for the quantizer search
+    int nb_slice_ctx;                            ///< number of allocated slice_ctx
+
     AudioFrameQueue afq;
+
+    /* Fields from here on are scratch space, they are not copied to the
+     * slice thread contexts. */
     DECLARE_ALIGNED(16, int,   qcoefs)[96];      ///< quantized coefficients
     DECLARE_ALIGNED(32, float, scoefs)[1024];    ///< scaled coefficients
 
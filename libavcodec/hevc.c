@@ -72,6 +72,9 @@ static void pic_arrays_free(HEVCContext *s)
     av_freep(&s->horizontal_bs);
     av_freep(&s->vertical_bs);
 
+    av_freep(&s->tile_row_ctbs);
+    av_freep(&s->tile_row_done);
+
     av_freep(&s->sh.entry_point_offset);
     av_freep(&s->sh.size);
     av_freep(&s->sh.offset);
@@ -123,6 +126,11 @@ static int pic_arrays_init(HEVCContext *s, const HEVCSPS *sps)
     if (!s->horizontal_bs || !s->vertical_bs)
         goto fail;
 
+    s->tile_row_ctbs = av_malloc_array(sps->ctb_height, sizeof(*s->tile_row_ctbs));
+    s->tile_row_done = av_malloc_array(sps->ctb_height, sizeof(*s->tile_row_done));
+    if (!s->tile_row_ctbs || !s->tile_row_done)
+        goto fail;
+
     s->tab_mvf_pool = av_buffer_pool_init(min_pu_size * sizeof(MvField),
                                           av_buffer_allocz);
     s->rpl_tab_pool = av_buffer_pool_init(ctb_count * sizeof(RefPicListTab),
@@ -736,6 +744,7 @@ static int hls_slice_header(HEVCContext *s)
     }
 
     sh->num_entry_point_offsets = 0;
+    s->enable_parallel_tiles    = 0;
     if (s->ps.pps->tiles_enabled_flag || s->ps.pps->entropy_coding_sync_enabled_flag) {
         unsigned num_entry_point_offsets = get_ue_golomb_long(gb);
         // It would be possible to bound this tighter but this here is simpler
@@ -770,12 +779,12 @@ static int hls_slice_header(HEVCContext *s)
                 sh->entry_point_offset[i] = val + 1; // +1; // +1 to get the size
             }
             if (s->threads_number > 1 && (s->ps.pps->num_tile_rows > 1 || s->ps.pps->num_tile_columns > 1)) {
-                s->enable_parallel_tiles = 0; // TODO: you can enable tiles in parallel here
-                s->threads_number = 1;
-            } else
-                s->enable_parallel_tiles = 0;
-        } else
-            s->enable_parallel_tiles = 0;
+                if (s->ps.pps->entropy_coding_sync_enabled_flag)
+                    s->threads_number = 1;
+                else
+                    s->enable_parallel_tiles = 1;
+            }
+        }
     }
 
     if (s->ps.pps->slice_header_extension_present_flag) {
@@ -2448,13 +2457,200 @@ static int hls_decode_entry_wpp(AVCodecContext *avctxt, void *input_ctb_row, int
     return 0;
 }
 
+#if HAVE_THREADS
+static void report_tile_progress(HEVCContext *s, int ctb_row, int err)
+{
+    pthread_mutex_lock(&s->tile_progress_mutex);
+    if (err)
+        s->wpp_err = 1;
+    else
+        s->tile_row_done[ctb_row]++;
+    pthread_cond_signal(&s->tile_progress_cond);
+    pthread_mutex_unlock(&s->tile_progress_mutex);
+}
+
+static int await_tile_progress(HEVCContext *s, int ctb_row)
+{
+    int err;
+
+    pthread_mutex_lock(&s->tile_progress_mutex);
+    while (!s->wpp_err && s->tile_row_done[ctb_row] < s->tile_row_ctbs[ctb_row])
+        pthread_cond_wait(&s->tile_progress_cond, &s->tile_progress_mutex);
+    err = s->wpp_err;
+    pthread_mutex_unlock(&s->tile_progress_mutex);
+
+    return err;
+}
+#else
+static void report_tile_progress(HEVCContext *s, int ctb_row, int err) {}
+static int await_tile_progress(HEVCContext *s, int ctb_row) { return 0; }
+#endif
+
+/**
+ * Run the in-loop filters on the tiles of the current slice segment, one
+ * CTB row at a time as soon as all tiles have finished decoding that row.
+ */
+static int hls_filter_entry_tiles(HEVCContext *s1, HEVCContext *s)
+{
+    const HEVCSPS *sps = s->ps.sps;
+    const HEVCPPS *pps = s->ps.pps;
+    int ctb_size   = 1 << sps->log2_ctb_size;
+    int first_tile = pps->tile_id[pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs]];
+    int last_tile  = first_tile + s->sh.num_entry_point_offsets;
+    int x, y;
+
+    for (y = 0; y < sps->ctb_height; y++) {
+        if (!s->tile_row_ctbs[y])
+            continue;
+        if (await_tile_progress(s1, y))
+            return 0;
+
+        for (x = 0; x < sps->ctb_width; x++) {
+            int tile_id = pps->tile_id[pps->ctb_addr_rs_to_ts[y * sps->ctb_width + x]];
+
+            if (tile_id < first_tile || tile_id > last_tile)
+                continue;
+            ff_hevc_deblocking_boundary_strengths_tile(s, x << sps->log2_ctb_size,
+                                                       y << sps->log2_ctb_size);
+            ff_hevc_hls_filters(s, x << sps->log2_ctb_size,
+                                y << sps->log2_ctb_size, ctb_size);
+        }
+    }
+
+    if (last_tile == pps->num_tile_columns * pps->num_tile_rows - 1)
+        ff_hevc_hls_filter(s, (sps->ctb_width  - 1) << sps->log2_ctb_size,
+                           (sps->ctb_height - 1) << sps->log2_ctb_size, ctb_size);
+
+    return 0;
+}
+
+static int hls_decode_entry_tiles(AVCodecContext *avctxt, void *input_tile, int job, int self_id)
+{
+    HEVCContext *s1  = avctxt->priv_data, *s;
+    HEVCLocalContext *lc;
+    int more_data   = 1;
+    int first_tile  = s1->ps.pps->tile_id[s1->ps.pps->ctb_addr_rs_to_ts[s1->sh.slice_ctb_addr_rs]];
+    int *tile_p     = input_tile;
+    int tile        = first_tile + tile_p[job];
+    int ctb_addr_ts;
+    int ret;
+
+    s  = s1->sList[self_id];
+    lc = s->HEVClc;
+
+    // the last job filters the CTB rows the tile jobs have completed
+    if (job > s->sh.num_entry_point_offsets)
+        return hls_filter_entry_tiles(s1, s);
+
+    ctb_addr_ts = s->ps.pps->ctb_addr_rs_to_ts[s->ps.pps->tile_pos_rs[tile]];
+
+    if (job) {
+        ret = init_get_bits8(&lc->gb, s->data + s->sh.offset[job - 1], s->sh.size[job - 1]);
+        if (ret < 0) {
+            report_tile_progress(s1, 0, 1);
+            return ret;
+        }
+    }
+
+    while (ctb_addr_ts < s->ps.sps->ctb_size &&
+           s->ps.pps->tile_id[ctb_addr_ts] == tile) {
+        int ctb_addr_rs = s->ps.pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+        int x_ctb = (ctb_addr_rs % s->ps.sps->ctb_width) << s->ps.sps->log2_ctb_size;
+        int y_ctb = (ctb_addr_rs / s->ps.sps->ctb_width) << s->ps.sps->log2_ctb_size;
+
+        if (avpriv_atomic_int_get(&s1->wpp_err))
+            return 0;
+        if (!more_data) {
+            av_log(s->avctx, AV_LOG_ERROR, "Slice segment ends in the middle of a tile.\n");
+            report_tile_progress(s1, 0, 1);
+            return AVERROR_INVALIDDATA;
+        }
+
+        hls_decode_neighbour(s, x_ctb, y_ctb, ctb_addr_ts);
+
+        ff_hevc_cabac_init(s, ctb_addr_ts);
+
+        hls_sao_param(s, x_ctb >> s->ps.sps->log2_ctb_size, y_ctb >> s->ps.sps->log2_ctb_size);
+
+        s->deblock[ctb_addr_rs].beta_offset = s->sh.beta_offset;
+        s->deblock[ctb_addr_rs].tc_offset   = s->sh.tc_offset;
+        s->filter_slice_edges[ctb_addr_rs]  = s->sh.slice_loop_filter_across_slices_enabled_flag;
+
+        more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->ps.sps->log2_ctb_size, 0);
+        if (more_data < 0) {
+            s->tab_slice_address[ctb_addr_rs] = -1;
+            report_tile_progress(s1, 0, 1);
+            return more_data;
+        }
+
+        ctb_addr_ts++;
+        report_tile_progress(s1, y_ctb >> s->ps.sps->log2_ctb_size, 0);
+    }
+
+    if (job < s->sh.num_entry_point_offsets ? !more_data :
+        more_data && ctb_addr_ts < s->ps.sps->ctb_size) {
+        av_log(s->avctx, AV_LOG_ERROR, "Tile entry points do not match the end of the slice segment.\n");
+        report_tile_progress(s1, 0, 1);
+        return AVERROR_INVALIDDATA;
+    }
+
+    return job == s->sh.num_entry_point_offsets ? ctb_addr_ts : 0;
+}
+
+/**
+ * Prepare the decoding of the tiles of the current slice segment in
+ * parallel: check that the segment is made of whole tiles, and set up the
+ * per CTB row progress the filter job waits on.
+ */
+static int init_parallel_tiles(HEVCContext *s)
+{
+    const HEVCSPS *sps = s->ps.sps;
+    const HEVCPPS *pps = s->ps.pps;
+    int first_ts   = pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs];
+    int first_tile = pps->tile_id[first_ts];
+    int tile, x, y;
+
+    if (pps->tile_pos_rs[first_tile] != s->sh.slice_ctb_addr_rs ||
+        first_tile + s->sh.num_entry_point_offsets >= pps->num_tile_columns * pps->num_tile_rows) {
+        av_log(s->avctx, AV_LOG_ERROR, "Tile entry points are wrong (%d %d %d)\n",
+               s->sh.slice_ctb_addr_rs, first_tile, s->sh.num_entry_point_offsets);
+        return AVERROR_INVALIDDATA;
+    }
+
+    if (s->sh.dependent_slice_segment_flag && first_ts) {
+        int prev_rs = pps->ctb_addr_ts_to_rs[first_ts - 1];
+        if (s->tab_slice_address[prev_rs] != s->sh.slice_addr) {
+            av_log(s->avctx, AV_LOG_ERROR, "Previous slice segment missing\n");
+            return AVERROR_INVALIDDATA;
+        }
+    }
+
+    memset(s->tile_row_ctbs, 0, sps->ctb_height * sizeof(*s->tile_row_ctbs));
+    memset(s->tile_row_done, 0, sps->ctb_height * sizeof(*s->tile_row_done));
+
+    // the slice address of the neighbouring tiles is needed before they
+    // are decoded to derive the slice boundaries
+    for (tile = first_tile; tile <= first_tile + s->sh.num_entry_point_offsets; tile++) {
+        int tile_x = tile % pps->num_tile_columns;
+        int tile_y = tile / pps->num_tile_columns;
+
+        for (y = pps->row_bd[tile_y]; y < pps->row_bd[tile_y + 1]; y++) {
+            s->tile_row_ctbs[y] += pps->column_width[tile_x];
+            for (x = pps->col_bd[tile_x]; x < pps->col_bd[tile_x + 1]; x++)
+                s->tab_slice_address[y * sps->ctb_width + x] = s->sh.slice_addr;
+        }
+    }
+
+    return 0;
+}
+
 static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
 {
     const uint8_t *data = nal->data;
     int length          = nal->size;
     HEVCLocalContext *lc = s->HEVClc;
-    int *ret = av_malloc_array(s->sh.num_entry_point_offsets + 1, sizeof(int));
-    int *arg = av_malloc_array(s->sh.num_entry_point_offsets + 1, sizeof(int));
+    int *ret = av_malloc_array(s->sh.num_entry_point_offsets + 2, sizeof(int));
+    int *arg = av_malloc_array(s->sh.num_entry_point_offsets + 2, sizeof(int));
     int64_t offset;
     int64_t startheader, cmpt = 0;
     int i, j, res = 0;
@@ -2465,7 +2661,8 @@ static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
         return AVERROR(ENOMEM);
     }
 
-    if (s->sh.slice_ctb_addr_rs + s->sh.num_entry_point_offsets * s->ps.sps->ctb_width >= s->ps.sps->ctb_width * s->ps.sps->ctb_height) {
+    if (s->ps.pps->entropy_coding_sync_enabled_flag &&
+        s->sh.slice_ctb_addr_rs + s->sh.num_entry_point_offsets * s->ps.sps->ctb_width >= s->ps.sps->ctb_width * s->ps.sps->ctb_height) {
         av_log(s->avctx, AV_LOG_ERROR, "WPP ctb addresses are wrong (%d %d %d %d)\n",
             s->sh.slice_ctb_addr_rs, s->sh.num_entry_point_offsets,
             s->ps.sps->ctb_width, s->ps.sps->ctb_height
@@ -2530,16 +2727,29 @@ static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
     avpriv_atomic_int_set(&s->wpp_err, 0);
     ff_reset_entries(s->avctx);
 
-    for (i = 0; i <= s->sh.num_entry_point_offsets; i++) {
+    for (i = 0; i <= s->sh.num_entry_point_offsets + 1; i++) {
         arg[i] = i;
         ret[i] = 0;
     }
 
-    if (s->ps.pps->entropy_coding_sync_enabled_flag)
+    if (s->ps.pps->entropy_coding_sync_enabled_flag) {
         s->avctx->execute2(s->avctx, hls_decode_entry_wpp, arg, ret, s->sh.num_entry_point_offsets + 1);
 
-    for (i = 0; i <= s->sh.num_entry_point_offsets; i++)
-        res += ret[i];
+        for (i = 0; i <= s->sh.num_entry_point_offsets; i++)
+            res += ret[i];
+    } else if (s->enable_parallel_tiles) {
+        res = init_parallel_tiles(s);
+        if (res < 0)
+            goto error;
+
+        // one job per tile, plus one running the in-loop filters
+        s->avctx->execute2(s->avctx, hls_decode_entry_tiles, arg, ret, s->sh.num_entry_point_offsets + 2);
+
+        res = ret[s->sh.num_entry_point_offsets];
+        for (i = 0; i < s->sh.num_entry_point_offsets; i++)
+            if (ret[i] < 0)
+                res = ret[i];
+    }
 error:
     av_free(ret);
     av_free(arg);
@@ -3071,6 +3281,13 @@ static av_cold int hevc_decode_free(AVCodecContext *avctx)
 
     pic_arrays_free(s);
 
+#if HAVE_THREADS
+    if (avctx->active_thread_type & FF_THREAD_SLICE) {
+        pthread_mutex_destroy(&s->tile_progress_mutex);
+        pthread_cond_destroy(&s->tile_progress_cond);
+    }
+#endif
+
     av_freep(&s->md5_ctx);
 
     av_freep(&s->cabac_state);
@@ -3123,6 +3340,13 @@ static av_cold int hevc_init_context(AVCodecContext *avctx)
 
     s->avctx = avctx;
 
+#if HAVE_THREADS
+    if (avctx->active_thread_type & FF_THREAD_SLICE) {
+        pthread_mutex_init(&s->tile_progress_mutex, NULL);
+        pthread_cond_init(&s->tile_progress_cond, NULL);
+    }
+#endif
+
     s->HEVClc = av_mallocz(sizeof(HEVCLocalContext));
     if (!s->HEVClc)
         goto fail;
@@ -25,6 +25,7 @@
 
 #include "libavutil/buffer.h"
 #include "libavutil/md5.h"
+#include "libavutil/thread.h"
 
 #include "avcodec.h"
 #include "bswapdsp.h"
@@ -878,6 +879,17 @@ typedef struct HEVCContext {
     int enable_parallel_tiles;
     int wpp_err;
 
+    /**
+     * Parallel tile decoding: number of CTBs of the current slice segment in
+     * each CTB row, and how many of them have been decoded so far.
+     */
+    int *tile_row_ctbs;
+    int *tile_row_done;
+#if HAVE_THREADS
+    pthread_mutex_t tile_progress_mutex;
+    pthread_cond_t  tile_progress_cond;
+#endif
+
     const uint8_t *data;
 
     H2645Packet pkt;
@@ -1038,6 +1050,12 @@ void ff_hevc_set_qPy(HEVCContext *s, int xBase, int yBase,
                      int log2_cb_size);
 void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                                            int log2_trafo_size);
+/**
+ * Compute the boundary strengths of the tile edges of a CTB, which are
+ * skipped by ff_hevc_deblocking_boundary_strengths() when tiles are decoded
+ * in parallel.
+ */
+void ff_hevc_deblocking_boundary_strengths_tile(HEVCContext *s, int x_ctb, int y_ctb);
 int ff_hevc_cu_qp_delta_sign_flag(HEVCContext *s);
 int ff_hevc_cu_qp_delta_abs(HEVCContext *s);
 int ff_hevc_cu_chroma_qp_offset_flag(HEVCContext *s);
@@ -37,6 +37,7 @@
 typedef struct {
     const AVClass *class;
     int sample_rate_arg;
+    int nb_threads;
     double ratio;
     struct SwrContext *swr;
     int64_t next_pts;
@@ -66,6 +67,7 @@ static av_cold int init_dict(AVFilterContext *ctx, AVDictionary **opts)
     }
     if (aresample->sample_rate_arg > 0)
         av_opt_set_int(aresample->swr, "osr", aresample->sample_rate_arg, 0);
+    ret = av_opt_set_int(aresample->swr, "threads", aresample->nb_threads, 0);
 end:
     return ret;
 }
@@ -307,6 +309,7 @@ static void *resample_child_next(void *obj, void *prev)
 
 static const AVOption options[] = {
     {"sample_rate", NULL, OFFSET(sample_rate_arg), AV_OPT_TYPE_INT, {.i64=0},  0,        INT_MAX, FLAGS },
+    {"threads", "set the number of resampling threads, 0 for one per CPU", OFFSET(nb_threads), AV_OPT_TYPE_INT, {.i64=1}, 0, INT_MAX, FLAGS },
     {NULL}
 };
 
@@ -119,6 +119,7 @@ typedef struct ScaleContext {
     int force_original_aspect_ratio;
 
     int nb_slices;
+    int nb_bands;               ///< number of bands scaled in parallel by sws_scale_band()
 
     int eval_mode;              ///< expression evaluation mode
 
@@ -363,6 +364,7 @@ static int config_props(AVFilterLink *outlink)
     if (scale->isws[1])
         sws_freeContext(scale->isws[1]);
     scale->isws[0] = scale->isws[1] = scale->sws = NULL;
+    scale->nb_bands = 0;
     if (inlink0->w == outlink->w &&
         inlink0->h == outlink->h &&
         !scale->out_color_matrix &&
@@ -388,6 +390,8 @@ static int config_props(AVFilterLink *outlink)
             av_opt_set_int(*s, "sws_flags", scale->flags, 0);
             av_opt_set_int(*s, "param0", scale->param[0], 0);
             av_opt_set_int(*s, "param1", scale->param[1], 0);
+            if (i == 0 && !scale->nb_slices && ctx->thread_type & AVFILTER_THREAD_SLICE)
+                av_opt_set_int(*s, "threads", FFMIN(outlink->h, ctx->graph->nb_threads), 0);
             if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
                 av_opt_set_int(*s, "src_range",
                                scale->in_range == AVCOL_RANGE_JPEG, 0);
@@ -420,6 +424,11 @@ static int config_props(AVFilterLink *outlink)
 
             if ((ret = sws_init_context(*s, NULL, NULL)) < 0)
                 return ret;
+            if (i == 0) {
+                int64_t nb_bands;
+                av_opt_get_int(*s, "threads", 0, &nb_bands);
+                scale->nb_bands = nb_bands;
+            }
             if (!scale->interlaced)
                 break;
         }
@@ -492,6 +501,22 @@ static int scale_slice(AVFilterLink *link, AVFrame *out_buf, AVFrame *cur_pic, s
                          out,out_stride);
 }
 
+typedef struct ThreadData {
+    AVFrame *in, *out;
+} ThreadData;
+
+static int scale_band(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ScaleContext *scale = ctx->priv;
+    ThreadData *td = arg;
+    int ret;
+
+    ret = sws_scale_band(scale->sws, jobnr,
+                         (const uint8_t * const *)td->in->data, td->in->linesize,
+                         td->out->data, td->out->linesize);
+    return ret < 0 ? ret : 0;
+}
+
 static int filter_frame(AVFilterLink *link, AVFrame *in)
 {
     ScaleContext *scale = link->dst->priv;
@@ -608,6 +633,9 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
             slice_h     = slice_end - slice_start;
             scale_slice(link, out, in, scale->sws, slice_start, slice_h, 1, 0);
         }
+    }else if (scale->nb_bands > 1) {
+        ThreadData td = { .in = in, .out = out };
+        link->dst->internal->execute(link->dst, scale_band, &td, NULL, scale->nb_bands);
     }else{
         scale_slice(link, out, in, scale->sws, 0, link->h, 1, 0);
     }
@@ -729,6 +757,7 @@ AVFilter ff_vf_scale = {
     .inputs          = avfilter_vf_scale_inputs,
     .outputs         = avfilter_vf_scale_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
 
 static const AVClass scale2ref_class = {
@@ -781,4 +810,5 @@ AVFilter ff_vf_scale2ref = {
     .inputs          = avfilter_vf_scale2ref_inputs,
     .outputs         = avfilter_vf_scale2ref_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
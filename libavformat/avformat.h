@@ -1446,6 +1446,7 @@ typedef struct AVFormatContext {
 #define AVFMT_FLAG_PRIV_OPT    0x20000 ///< Enable use of private options by delaying codec open (this could be made default once all code is converted)
 #define AVFMT_FLAG_KEEP_SIDE_DATA 0x40000 ///< Don't merge side data but keep it separate.
 #define AVFMT_FLAG_FAST_SEEK   0x80000 ///< Enable fast, but inaccurate seeks for some formats
+#define AVFMT_FLAG_FAST_START 0x100000 ///< Let avformat_find_stream_info() take parameters from parser headers, stop each stream once complete and decode streams in parallel
 
     /**
      * Maximum size of the data read from input for determining
@@ -1884,6 +1885,14 @@ typedef struct AVFormatContext {
      * - decoding: set by user through AVOptions (NO direct access)
      */
     char *protocol_blacklist;
+
+    /**
+     * Number of threads used by avformat_find_stream_info() to decode the
+     * streams in parallel with AVFMT_FLAG_FAST_START, 0 for one per CPU.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    int fast_start_threads;
 } AVFormatContext;
 
 int av_format_get_probe_score(const AVFormatContext *s);
@@ -2191,6 +2200,10 @@ int av_demuxer_open(AVFormatContext *ic);
  * @note this function isn't guaranteed to open all the codecs, so
  *       options being non-empty at return is a perfectly normal behavior.
  *
+ * @note With AVFMT_FLAG_FAST_START set, parameters found by the parsers are
+ *       used without opening a decoder, and the streams that still need
+ *       decoding are decoded in parallel on the buffered packets.
+ *
  * @todo Let the user decide somehow what information is needed so that
  *       we do not waste time getting stuff the user does not need.
  */
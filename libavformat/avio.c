@@ -630,6 +630,13 @@ int ffurl_get_file_handle(URLContext *h)
     return h->prot->url_get_file_handle(h);
 }
 
+int ffurl_get_mapped(URLContext *h, int64_t pos, int size, AVBufferRef **buf)
+{
+    if (!h->prot->url_get_mapped)
+        return AVERROR(ENOSYS);
+    return h->prot->url_get_mapped(h, pos, size, buf);
+}
+
 int ffurl_get_multi_file_handle(URLContext *h, int **handles, int *numhandles)
 {
     if (!h->prot->url_get_multi_file_handle) {
@@ -53,6 +53,23 @@ int ffio_init_context(AVIOContext *s,
  */
 int ffio_read_indirect(AVIOContext *s, unsigned char *buf, int size, const unsigned char **data);
 
+/**
+ * Read size bytes from AVIOContext as a reference to the underlying
+ * storage of the protocol, without copying them.
+ * This is only possible for contexts opened with avio_open() on a protocol
+ * providing mapped access (e.g. the file protocol with the mmap option);
+ * the caller must fall back to a regular read on failure, in which case
+ * the position of the context is unchanged.
+ * The data of the returned buffer must not be modified, and is followed by
+ * AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes, so that it can be used as
+ * packet data.
+ * @param s IO context
+ * @param size number of bytes requested
+ * @param buf set to a new reference to the data on success
+ * @return size on success or AVERROR
+ */
+int ffio_read_mapped(AVIOContext *s, int size, AVBufferRef **buf);
+
 /**
  * Read size bytes from AVIOContext into buf.
  * This reads at most 1 packet. If that is not enough fewer bytes will be
@@ -167,4 +184,51 @@ int ffio_close_null_buf(AVIOContext *s);
  */
 void ffio_free_dyn_buf(AVIOContext **s);
 
+/**
+ * Size of the chunks used by ffio_open_chained_dyn_buf().
+ */
+#define FFIO_DYN_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Open a write only memory stream storing the data in a list of
+ * FFIO_DYN_CHUNK_SIZE bytes chunks, which unlike avio_open_dyn_buf() is
+ * never reallocated nor copied as it grows.
+ *
+ * @param s new IO context
+ * @param pool pool the chunks are allocated from, created with
+ *             FFIO_DYN_CHUNK_SIZE as buffer size, or NULL to use a pool
+ *             private to the context; sharing a pool between successive
+ *             buffers lets them reuse the chunks
+ * @return zero if no error.
+ */
+int ffio_open_chained_dyn_buf(AVIOContext **s, AVBufferPool *pool);
+
+/**
+ * Return the written data as a list of buffer references and free the
+ * context opened by ffio_open_chained_dyn_buf(). No data is copied.
+ *
+ * @param s IO context, may be NULL
+ * @param bufs set to an array of nb_bufs references, which must be freed
+ *             by the caller, e.g. with ffio_write_buffers(); all of them
+ *             but the last one are FFIO_DYN_CHUNK_SIZE bytes large
+ * @param nb_bufs set to the number of references in bufs
+ * @return the total size of the data or a negative error code if a write
+ *         failed, in which case no data is returned
+ */
+int ffio_close_chained_dyn_buf(AVIOContext *s, AVBufferRef ***bufs, int *nb_bufs);
+
+/**
+ * Free a dynamic buffer opened by ffio_open_chained_dyn_buf(), discarding
+ * its content.
+ *
+ * @param s a pointer to an IO context opened by ffio_open_chained_dyn_buf()
+ */
+void ffio_free_chained_dyn_buf(AVIOContext **s);
+
+/**
+ * Write a list of buffers to s in order, then unreference them and free
+ * the list, as returned by ffio_close_chained_dyn_buf().
+ */
+void ffio_write_buffers(AVIOContext *s, AVBufferRef ***bufs, int nb_bufs);
+
 #endif /* AVFORMAT_AVIO_INTERNAL_H */
@@ -868,6 +868,38 @@ static int64_t io_read_seek(void *opaque, int stream_index, int64_t timestamp, i
     return internal->h->prot->url_read_seek(internal->h, stream_index, timestamp, flags);
 }
 
+int ffio_read_mapped(AVIOContext *s, int size, AVBufferRef **buf)
+{
+    AVIOInternal *internal = s->opaque;
+    int64_t pos, res;
+    int ret, buffered;
+
+    if (s->read_packet != io_read_packet || s->write_flag ||
+        s->update_checksum || size <= 0)
+        return AVERROR(ENOSYS);
+
+    pos = avio_tell(s);
+    if ((ret = ffurl_get_mapped(internal->h, pos, size, buf)) < 0)
+        return ret;
+
+    buffered = s->buf_end - s->buf_ptr;
+    if (buffered >= size) {
+        s->buf_ptr += size;
+        return size;
+    }
+    /* skip the range in the protocol instead of reading it */
+    if ((res = s->seek(s->opaque, pos + size, SEEK_SET)) < 0) {
+        av_buffer_unref(buf);
+        return res;
+    }
+    s->buf_end     =
+    s->buf_ptr     = s->buffer;
+    s->pos         = pos + size;
+    s->eof_reached = 0;
+    s->bytes_read += size - buffered;
+    return size;
+}
+
 int ffio_fdopen(AVIOContext **s, URLContext *h)
 {
     AVIOInternal *internal = NULL;
@@ -1339,3 +1371,156 @@ int ffio_close_null_buf(AVIOContext *s)
     av_free(s);
     return size;
 }
+
+typedef struct ChainedDynBuffer {
+    AVBufferPool *pool, *own_pool;
+    AVBufferRef **chunks;
+    int nb_chunks;
+    int pos, size;
+    uint8_t io_buffer[1024];
+} ChainedDynBuffer;
+
+/* allocate the chunks up to the one with index idx */
+static int chained_dyn_buf_alloc(ChainedDynBuffer *d, int idx)
+{
+    while (idx >= d->nb_chunks) {
+        AVBufferRef *chunk = av_buffer_pool_get(d->pool);
+        if (!chunk)
+            return AVERROR(ENOMEM);
+        if (av_dynarray_add_nofree(&d->chunks, &d->nb_chunks, chunk) < 0) {
+            av_buffer_unref(&chunk);
+            return AVERROR(ENOMEM);
+        }
+    }
+    return 0;
+}
+
+static int chained_dyn_buf_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    ChainedDynBuffer *d = opaque;
+    int done = 0, ret;
+
+    if (buf_size > INT_MAX - d->pos)
+        return AVERROR(EINVAL);
+
+    /* the range skipped by a seek past the end must not keep the previous
+     * contents of the pool buffers */
+    while (d->size < d->pos) {
+        int idx = d->size / FFIO_DYN_CHUNK_SIZE;
+        int off = d->size % FFIO_DYN_CHUNK_SIZE;
+        int len = FFMIN(d->pos - d->size, FFIO_DYN_CHUNK_SIZE - off);
+
+        if ((ret = chained_dyn_buf_alloc(d, idx)) < 0)
+            return ret;
+        memset(d->chunks[idx]->data + off, 0, len);
+        d->size += len;
+    }
+
+    while (done < buf_size) {
+        int idx = d->pos / FFIO_DYN_CHUNK_SIZE;
+        int off = d->pos % FFIO_DYN_CHUNK_SIZE;
+        int len = FFMIN(buf_size - done, FFIO_DYN_CHUNK_SIZE - off);
+
+        if ((ret = chained_dyn_buf_alloc(d, idx)) < 0)
+            return ret;
+        memcpy(d->chunks[idx]->data + off, buf + done, len);
+        d->pos += len;
+        done   += len;
+    }
+    d->size = FFMAX(d->size, d->pos);
+    return buf_size;
+}
+
+static int64_t chained_dyn_buf_seek(void *opaque, int64_t offset, int whence)
+{
+    ChainedDynBuffer *d = opaque;
+
+    if (whence == SEEK_CUR)
+        offset += d->pos;
+    else if (whence == SEEK_END)
+        offset += d->size;
+    if (offset < 0 || offset > 0x7fffffffLL)
+        return -1;
+    d->pos = offset;
+    return 0;
+}
+
+int ffio_open_chained_dyn_buf(AVIOContext **s, AVBufferPool *pool)
+{
+    ChainedDynBuffer *d = av_mallocz(sizeof(*d));
+
+    if (!d)
+        return AVERROR(ENOMEM);
+    if (!pool)
+        pool = d->own_pool = av_buffer_pool_init(FFIO_DYN_CHUNK_SIZE, NULL);
+    d->pool = pool;
+    *s = avio_alloc_context(d->io_buffer, sizeof(d->io_buffer), 1, d, NULL,
+                            chained_dyn_buf_write, chained_dyn_buf_seek);
+    if (!*s || !d->pool) {
+        av_freep(s);
+        av_buffer_pool_uninit(&d->own_pool);
+        av_free(d);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static void free_buffers(AVBufferRef ***bufs, int nb_bufs)
+{
+    int i;
+
+    for (i = 0; i < nb_bufs; i++)
+        av_buffer_unref(&(*bufs)[i]);
+    av_freep(bufs);
+}
+
+int ffio_close_chained_dyn_buf(AVIOContext *s, AVBufferRef ***bufs, int *nb_bufs)
+{
+    ChainedDynBuffer *d;
+    int size, ret;
+
+    *bufs    = NULL;
+    *nb_bufs = 0;
+    if (!s)
+        return 0;
+
+    avio_flush(s);
+
+    d    = s->opaque;
+    size = d->size;
+    ret  = s->error;
+    if (ret < 0) {
+        free_buffers(&d->chunks, d->nb_chunks);
+    } else {
+        /* chunks are only allocated up to the furthest written position */
+        if (d->nb_chunks)
+            d->chunks[d->nb_chunks - 1]->size = size - (d->nb_chunks - 1) * FFIO_DYN_CHUNK_SIZE;
+        *bufs    = d->chunks;
+        *nb_bufs = d->nb_chunks;
+    }
+    av_buffer_pool_uninit(&d->own_pool);
+    av_free(d);
+    av_free(s);
+    return ret < 0 ? ret : size;
+}
+
+void ffio_free_chained_dyn_buf(AVIOContext **s)
+{
+    AVBufferRef **bufs;
+    int nb_bufs;
+
+    if (!*s)
+        return;
+    ffio_close_chained_dyn_buf(*s, &bufs, &nb_bufs);
+    free_buffers(&bufs, nb_bufs);
+    *s = NULL;
+}
+
+void ffio_write_buffers(AVIOContext *s, AVBufferRef ***bufs, int nb_bufs)
+{
+    int i;
+
+    for (i = 0; i < nb_bufs; i++)
+        avio_write(s, (*bufs)[i]->data, (*bufs)[i]->size);
+    free_buffers(bufs, nb_bufs);
+}
@@ -19,10 +19,12 @@
  */
 
 #include "libavutil/avassert.h"
+#include "libavutil/atomic.h"
 #include "libavutil/avstring.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/opt.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
 #include "libavutil/timestamp.h"
 #include "avformat.h"
 #include "internal.h"
@@ -64,6 +66,19 @@ typedef struct {
     ConcatMatchMode stream_match_mode;
     unsigned auto_convert;
     int segment_time_metadata;
+    int preopen;
+#if HAVE_THREADS
+    /* Background open of the next file, see preopen_start().
+     * The fields below are only accessed by the thread between
+     * pthread_create() and pthread_join(), except preopen_abort, which
+     * the demuxer sets atomically while the thread runs. */
+    pthread_t preopen_thread;
+    int preopen_running;
+    volatile int preopen_abort;
+    unsigned preopen_fileno;
+    AVFormatContext *preopen_avf;
+    int preopen_ret;
+#endif
 } ConcatContext;
 
 static int concat_probe(AVProbeData *probe)
@@ -309,30 +324,132 @@ static int match_streams(AVFormatContext *avf)
     return 0;
 }
 
-static int open_file(AVFormatContext *avf, unsigned fileno)
+/* Open, probe and seek to the inpoint of file; this may run in the
+ * preopen thread, so it must not touch the state of the current file. */
+static int open_file_context(AVFormatContext *avf, ConcatFile *file,
+                             AVFormatContext **ps,
+                             const AVIOInterruptCB *int_cb)
 {
-    ConcatContext *cat = avf->priv_data;
-    ConcatFile *file = &cat->files[fileno];
+    AVFormatContext *s = avformat_alloc_context();
     int ret;
 
-    if (cat->avf)
-        avformat_close_input(&cat->avf);
-
-    cat->avf = avformat_alloc_context();
-    if (!cat->avf)
+    if (!s)
         return AVERROR(ENOMEM);
 
-    cat->avf->interrupt_callback = avf->interrupt_callback;
+    s->interrupt_callback = *int_cb;
 
-    if ((ret = ff_copy_whiteblacklists(cat->avf, avf)) < 0)
+    if ((ret = ff_copy_whiteblacklists(s, avf)) < 0) {
+        avformat_free_context(s);
         return ret;
+    }
 
-    if ((ret = avformat_open_input(&cat->avf, file->url, NULL, NULL)) < 0 ||
-        (ret = avformat_find_stream_info(cat->avf, NULL)) < 0) {
-        av_log(avf, AV_LOG_ERROR, "Impossible to open '%s'\n", file->url);
+    if ((ret = avformat_open_input(&s, file->url, NULL, NULL)) < 0 ||
+        (ret = avformat_find_stream_info(s, NULL)) < 0) {
+        avformat_close_input(&s);
+        return ret;
+    }
+    if (file->inpoint != AV_NOPTS_VALUE) {
+        if ((ret = avformat_seek_file(s, -1, INT64_MIN, file->inpoint, file->inpoint, 0)) < 0) {
+            avformat_close_input(&s);
+            return ret;
+        }
+    }
+    *ps = s;
+    return 0;
+}
+
+#if HAVE_THREADS
+static int preopen_interrupt_cb(void *opaque)
+{
+    AVFormatContext *avf = opaque;
+    ConcatContext *cat = avf->priv_data;
+
+    return avpriv_atomic_int_get(&cat->preopen_abort) ||
+           ff_check_interrupt(&avf->interrupt_callback);
+}
+
+static void *preopen_thread(void *opaque)
+{
+    AVFormatContext *avf = opaque;
+    ConcatContext *cat = avf->priv_data;
+    AVIOInterruptCB int_cb = { preopen_interrupt_cb, avf };
+
+    cat->preopen_ret = open_file_context(avf, &cat->files[cat->preopen_fileno],
+                                         &cat->preopen_avf, &int_cb);
+    return NULL;
+}
+
+/* Start opening fileno in the background while the current file is read. */
+static void preopen_start(AVFormatContext *avf, unsigned fileno)
+{
+    ConcatContext *cat = avf->priv_data;
+    int ret;
+
+    if (!cat->preopen || cat->preopen_running || fileno >= cat->nb_files)
+        return;
+
+    cat->preopen_fileno = fileno;
+    cat->preopen_avf    = NULL;
+    cat->preopen_abort  = 0;
+    if ((ret = pthread_create(&cat->preopen_thread, NULL, preopen_thread, avf))) {
+        av_log(avf, AV_LOG_WARNING, "Unable to start the preopen thread: %s\n",
+               av_err2str(AVERROR(ret)));
+        return;
+    }
+    cat->preopen_running = 1;
+}
+
+/* Wait for the background open. If it was not for fileno, it is aborted
+ * and its result discarded. Returns 1 and sets *ps to the opened context,
+ * a negative error code if fileno could not be opened, or 0 if fileno was
+ * not being opened. */
+static int preopen_finish(AVFormatContext *avf, unsigned fileno,
+                          AVFormatContext **ps)
+{
+    ConcatContext *cat = avf->priv_data;
+    int wanted = cat->preopen_fileno == fileno;
+
+    if (!cat->preopen_running)
+        return 0;
+
+    if (!wanted)
+        avpriv_atomic_int_set(&cat->preopen_abort, 1);
+    pthread_join(cat->preopen_thread, NULL);
+    cat->preopen_running = 0;
+
+    if (!wanted) {
+        avformat_close_input(&cat->preopen_avf);
+        return 0;
+    }
+    if (cat->preopen_ret < 0)
+        return cat->preopen_ret;
+
+    *ps = cat->preopen_avf;
+    (*ps)->interrupt_callback = avf->interrupt_callback;
+    cat->preopen_avf = NULL;
+    return 1;
+}
+#endif
+
+static int open_file(AVFormatContext *avf, unsigned fileno)
+{
+    ConcatContext *cat = avf->priv_data;
+    ConcatFile *file = &cat->files[fileno];
+    int ret = 0;
+
+    if (cat->avf)
         avformat_close_input(&cat->avf);
+
+#if HAVE_THREADS
+    ret = preopen_finish(avf, fileno, &cat->avf);
+#endif
+    if (!ret)
+        ret = open_file_context(avf, file, &cat->avf, &avf->interrupt_callback);
+    if (ret < 0) {
+        av_log(avf, AV_LOG_ERROR, "Impossible to open '%s'\n", file->url);
         return ret;
     }
+
     cat->cur_file = file;
     if (file->start_time == AV_NOPTS_VALUE)
         file->start_time = !fileno ? 0 :
@@ -351,10 +468,10 @@ static int open_file(AVFormatContext *avf, unsigned fileno)
 
     if ((ret = match_streams(avf)) < 0)
         return ret;
-    if (file->inpoint != AV_NOPTS_VALUE) {
-       if ((ret = avformat_seek_file(cat->avf, -1, INT64_MIN, file->inpoint, file->inpoint, 0)) < 0)
-           return ret;
-    }
+
+#if HAVE_THREADS
+    preopen_start(avf, fileno + 1);
+#endif
     return 0;
 }
 
@@ -363,6 +480,9 @@ static int concat_read_close(AVFormatContext *avf)
     ConcatContext *cat = avf->priv_data;
     unsigned i, j;
 
+#if HAVE_THREADS
+    preopen_finish(avf, UINT_MAX, NULL);
+#endif
     for (i = 0; i < cat->nb_files; i++) {
         av_freep(&cat->files[i].url);
         for (j = 0; j < cat->files[i].nb_streams; j++) {
@@ -760,6 +880,8 @@ static const AVOption options[] = {
       OFFSET(auto_convert), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, DEC },
     { "segment_time_metadata", "output file segment start time and duration as packet metadata",
       OFFSET(segment_time_metadata), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, DEC },
+    { "preopen", "open the next file in the background while the current one is read",
+      OFFSET(preopen), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, DEC },
     { NULL }
 };
 
@@ -438,6 +438,11 @@ static void format_date_now(char *buf, int size)
     }
 }
 
+static void set_http_options(AVDictionary **options)
+{
+    av_dict_set(options, "connection_pool", "1", AV_DICT_DONT_OVERWRITE);
+}
+
 static int write_manifest(AVFormatContext *s, int final)
 {
     DASHContext *c = s->priv_data;
@@ -445,9 +450,12 @@ static int write_manifest(AVFormatContext *s, int final)
     char temp_filename[1024];
     int ret, i;
     AVDictionaryEntry *title = av_dict_get(s->metadata, "title", NULL, 0);
+    AVDictionary *options = NULL;
 
     snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", s->filename);
-    ret = s->io_open(s, &out, temp_filename, AVIO_FLAG_WRITE, NULL);
+    set_http_options(&options);
+    ret = s->io_open(s, &out, temp_filename, AVIO_FLAG_WRITE, &options);
+    av_dict_free(&options);
     if (ret < 0) {
         av_log(s, AV_LOG_ERROR, "Unable to open %s for writing\n", temp_filename);
         return ret;
@@ -649,7 +657,9 @@ static int dash_write_header(AVFormatContext *s)
             dash_fill_tmpl_params(os->initfile, sizeof(os->initfile), c->init_seg_name, i, 0, os->bit_rate, 0);
         }
         snprintf(filename, sizeof(filename), "%s%s", c->dirname, os->initfile);
-        ret = s->io_open(s, &os->out, filename, AVIO_FLAG_WRITE, NULL);
+        set_http_options(&opts);
+        ret = s->io_open(s, &os->out, filename, AVIO_FLAG_WRITE, &opts);
+        av_dict_free(&opts);
         if (ret < 0)
             goto fail;
         os->init_start_pos = 0;
@@ -806,6 +816,7 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
     for (i = 0; i < s->nb_streams; i++) {
         OutputStream *os = &c->streams[i];
         char filename[1024] = "", full_path[1024], temp_path[1024];
+        AVDictionary *options = NULL;
         int64_t start_pos;
         int range_length, index_length = 0;
 
@@ -837,7 +848,9 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
             dash_fill_tmpl_params(filename, sizeof(filename), c->media_seg_name, i, os->segment_index, os->bit_rate, os->start_pts);
             snprintf(full_path, sizeof(full_path), "%s%s", c->dirname, filename);
             snprintf(temp_path, sizeof(temp_path), "%s.tmp", full_path);
-            ret = s->io_open(s, &os->out, temp_path, AVIO_FLAG_WRITE, NULL);
+            set_http_options(&options);
+            ret = s->io_open(s, &os->out, temp_path, AVIO_FLAG_WRITE, &options);
+            av_dict_free(&options);
             if (ret < 0)
                 break;
             write_styp(os->ctx->pb);
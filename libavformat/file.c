@@ -35,6 +35,9 @@
 #endif
 #include <sys/stat.h>
 #include <stdlib.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "os_support.h"
 #include "url.h"
 
@@ -73,15 +76,24 @@ typedef struct FileContext {
     int trunc;
     int blocksize;
     int follow;
+    int use_mmap;
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
+#if HAVE_MMAP
+    AVBufferRef *map;           ///< mapping of the whole file, shared with the mapped packets
+    int64_t map_size;
+    int64_t map_pos;            ///< read position in the mapping
+    int64_t readahead_start;    ///< last range prefetched with posix_madvise()
+    int64_t readahead_end;
+#endif
 } FileContext;
 
 static const AVOption file_options[] = {
     { "truncate", "truncate existing files on write", offsetof(FileContext, trunc), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "mmap", "Read the file through a memory mapping", offsetof(FileContext, use_mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
@@ -104,11 +116,94 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+#if HAVE_MMAP
+#define MAP_READAHEAD (1 << 20)
+/* smaller packets whose padding is not zero are cheaper to copy than to
+ * map on their own */
+#define MAP_PACKET_MIN (64 << 10)
+
+static void file_unmap(void *opaque, uint8_t *data)
+{
+    munmap(data, (uintptr_t)opaque);
+}
+
+static void file_unmap_packet(void *opaque, uint8_t *data)
+{
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+    munmap((void *)((uintptr_t)data & ~(page_size - 1)), (uintptr_t)opaque);
+}
+
+static void file_map(URLContext *h)
+{
+    FileContext *c = h->priv_data;
+    struct stat st;
+    void *ptr;
+
+    if (c->follow || fstat(c->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        av_log(h, AV_LOG_VERBOSE, "Not mapping %s, using regular reads\n",
+               h->filename);
+        return;
+    }
+
+    /* Writable private pages: a consumer writing into a mapped packet in
+     * spite of it not being writable gets a copy of the page instead of a
+     * crash, and the file itself is never modified. */
+    ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, c->fd, 0);
+    if (ptr == MAP_FAILED) {
+        av_log(h, AV_LOG_VERBOSE, "Cannot map %s: %s, using regular reads\n",
+               h->filename, av_err2str(AVERROR(errno)));
+        return;
+    }
+    c->map = av_buffer_create(ptr, FFMIN(st.st_size, INT_MAX), file_unmap,
+                              (void *)(uintptr_t)st.st_size,
+                              AV_BUFFER_FLAG_READONLY);
+    if (!c->map) {
+        munmap(ptr, st.st_size);
+        return;
+    }
+    c->map_size = st.st_size;
+#if HAVE_POSIX_MADVISE
+    posix_madvise(ptr, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+}
+
+/* Ask the kernel to read ahead of the range about to be accessed, one
+ * window at a time, so that page faults on the mapping rarely block. */
+static void file_map_readahead(FileContext *c, int64_t pos, int64_t end)
+{
+#if HAVE_POSIX_MADVISE
+    int64_t start;
+
+    if (pos >= c->readahead_start && end + MAP_READAHEAD / 2 <= c->readahead_end)
+        return;
+    start = pos & ~(int64_t)(MAP_READAHEAD - 1);
+    end   = FFMIN(end + MAP_READAHEAD, c->map_size);
+    if (start < end)
+        posix_madvise(c->map->data + start, end - start, POSIX_MADV_WILLNEED);
+    c->readahead_start = start;
+    c->readahead_end   = end;
+#endif
+}
+#endif /* HAVE_MMAP */
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+#if HAVE_MMAP
+    if (c->map) {
+        if (c->map_pos >= c->map_size)
+            return 0;
+        size = FFMIN(size, c->map_size - c->map_pos);
+        file_map_readahead(c, c->map_pos, c->map_pos + size);
+        memcpy(buf, c->map->data + c->map_pos, size);
+        c->map_pos += size;
+        return size;
+    }
+#endif
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -227,6 +322,11 @@ static int file_open(URLContext *h, const char *filename, int flags)
 
     h->is_streamed = !fstat(fd, &st) && S_ISFIFO(st.st_mode);
 
+#if HAVE_MMAP
+    if (c->use_mmap && !(flags & AVIO_FLAG_WRITE))
+        file_map(h);
+#endif
+
     return 0;
 }
 
@@ -236,6 +336,21 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
     FileContext *c = h->priv_data;
     int64_t ret;
 
+#if HAVE_MMAP
+    if (c->map) {
+        switch (whence) {
+        case AVSEEK_SIZE: return c->map_size;
+        case SEEK_SET:                        break;
+        case SEEK_CUR:    pos += c->map_pos;  break;
+        case SEEK_END:    pos += c->map_size; break;
+        default:          return AVERROR(EINVAL);
+        }
+        if (pos < 0)
+            return AVERROR(EINVAL);
+        return c->map_pos = pos;
+    }
+#endif
+
     if (whence == AVSEEK_SIZE) {
         struct stat st;
         ret = fstat(c->fd, &st);
@@ -247,9 +362,79 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
     return ret < 0 ? AVERROR(errno) : ret;
 }
 
+#if HAVE_MMAP
+/* Map the range on its own, with private copies of the pages holding the
+ * padding so that it can be zeroed without touching the file mapping. */
+static int file_map_packet(URLContext *h, int64_t pos, int size, AVBufferRef **buf)
+{
+    FileContext *c = h->priv_data;
+    long page_size = sysconf(_SC_PAGESIZE);
+    int64_t start;
+    size_t len;
+    uint8_t *ptr;
+
+    if (page_size <= 0)
+        return AVERROR(ENOSYS);
+    start = pos & ~(int64_t)(page_size - 1);
+    len   = pos - start + size + AV_INPUT_BUFFER_PADDING_SIZE;
+    ptr   = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, c->fd, start);
+    if (ptr == MAP_FAILED)
+        return AVERROR(errno);
+    memset(ptr + pos - start + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    *buf = av_buffer_create(ptr + pos - start, size, file_unmap_packet,
+                            (void *)(uintptr_t)len, AV_BUFFER_FLAG_READONLY);
+    if (!*buf) {
+        munmap(ptr, len);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static int is_zero(const uint8_t *p, int size)
+{
+    while (size--)
+        if (*p++)
+            return 0;
+    return 1;
+}
+#endif
+
+static int file_get_mapped(URLContext *h, int64_t pos, int size, AVBufferRef **buf)
+{
+#if HAVE_MMAP
+    FileContext *c = h->priv_data;
+    int ret;
+
+    if (!c->map)
+        return AVERROR(ENOSYS);
+    /* the padding is taken from the file, it must be readable */
+    if (pos < 0 || size < 0 ||
+        pos > c->map_size - AV_INPUT_BUFFER_PADDING_SIZE - size)
+        return AVERROR(ERANGE);
+    if (is_zero(c->map->data + pos + size, AV_INPUT_BUFFER_PADDING_SIZE)) {
+        if (!(*buf = av_buffer_ref(c->map)))
+            return AVERROR(ENOMEM);
+        (*buf)->data += pos;
+        (*buf)->size  = size;
+    } else if (size >= MAP_PACKET_MIN) {
+        if ((ret = file_map_packet(h, pos, size, buf)) < 0)
+            return ret;
+    } else {
+        return AVERROR(ERANGE);
+    }
+    file_map_readahead(c, pos, pos + size);
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if HAVE_MMAP
+    av_buffer_unref(&c->map);
+#endif
     return close(c->fd);
 }
 
@@ -353,6 +538,7 @@ const URLProtocol ff_file_protocol = {
     .url_open_dir        = file_open_dir,
     .url_read_dir        = file_read_dir,
     .url_close_dir       = file_close_dir,
+    .url_get_mapped      = file_get_mapped,
     .default_whitelist   = "file,crypto"
 };
 
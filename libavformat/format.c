@@ -42,6 +42,35 @@ static AVOutputFormat *first_oformat = NULL;
 static AVInputFormat **last_iformat = &first_iformat;
 static AVOutputFormat **last_oformat = &first_oformat;
 
+/**
+ * Signatures of demuxers that only return AVPROBE_SCORE_MAX for data no
+ * other demuxer can claim with the same score. When one of them matches,
+ * only the corresponding read_probe() is run, and the full probe is done
+ * if it does not return AVPROBE_SCORE_MAX.
+ */
+static const struct ProbeSignature {
+    const char *name;
+    int offset;
+    int size;
+    uint8_t magic[8];
+} probe_signatures[] = {
+    { "matroska,webm",           0, 4, { 0x1A, 0x45, 0xDF, 0xA3 } },
+    { "mov,mp4,m4a,3gp,3g2,mj2", 4, 4, "ftyp" },
+    { "mov,mp4,m4a,3gp,3g2,mj2", 4, 4, "moov" },
+    { "mov,mp4,m4a,3gp,3g2,mj2", 4, 4, "mdat" },
+    { "ogg",                     0, 4, "OggS" },
+    { "avi",                     0, 4, "RIFF" },
+    { "nut",                     0, 8, "nut/mult" },
+    { "asf",                     0, 4, { 0x30, 0x26, 0xB2, 0x75 } },
+    { "rm",                      0, 4, ".RMF" },
+    { "aiff",                    0, 4, "FORM" },
+    { "caf",                     0, 4, "caff" },
+    { "wv",                      0, 4, "wvpk" },
+};
+
+/** demuxers of probe_signatures, set when they are registered */
+static AVInputFormat *probe_signature_fmts[FF_ARRAY_ELEMS(probe_signatures)];
+
 AVInputFormat *av_iformat_next(const AVInputFormat *f)
 {
     if (f)
@@ -61,6 +90,7 @@ AVOutputFormat *av_oformat_next(const AVOutputFormat *f)
 void av_register_input_format(AVInputFormat *format)
 {
     AVInputFormat **p = last_iformat;
+    int i;
 
     // Note, format could be added after the first 2 checks but that implies that *p is no longer NULL
     while(p != &format->next && !format->next && avpriv_atomic_ptr_cas((void * volatile *)p, NULL, format))
@@ -68,6 +98,10 @@ void av_register_input_format(AVInputFormat *format)
 
     if (!format->next)
         last_iformat = &format->next;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(probe_signatures); i++)
+        if (!strcmp(probe_signatures[i].name, format->name))
+            probe_signature_fmts[i] = format;
 }
 
 void av_register_output_format(AVOutputFormat *format)
@@ -170,6 +204,27 @@ AVInputFormat *av_find_input_format(const char *short_name)
     return NULL;
 }
 
+static AVInputFormat *probe_signature(AVProbeData *pd, int is_opened)
+{
+    int i;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(probe_signatures); i++) {
+        const struct ProbeSignature *sig = &probe_signatures[i];
+        AVInputFormat *fmt = probe_signature_fmts[i];
+
+        if (!fmt || !is_opened == !(fmt->flags & AVFMT_NOFILE) ||
+            pd->buf_size < sig->offset + sig->size ||
+            memcmp(pd->buf + sig->offset, sig->magic, sig->size))
+            continue;
+        if (fmt->read_probe(pd) == AVPROBE_SCORE_MAX) {
+            av_log(NULL, AV_LOG_TRACE, "Probing %s score:%d size:%d (signature)\n",
+                   fmt->name, AVPROBE_SCORE_MAX, pd->buf_size);
+            return fmt;
+        }
+    }
+    return NULL;
+}
+
 AVInputFormat *av_probe_input_format3(AVProbeData *pd, int is_opened,
                                       int *score_ret)
 {
@@ -200,7 +255,12 @@ AVInputFormat *av_probe_input_format3(AVProbeData *pd, int is_opened,
             nodat = ID3_GREATER_PROBE;
     }
 
-    fmt = NULL;
+    fmt = probe_signature(&lpd, is_opened);
+    if (fmt) {
+        *score_ret = AVPROBE_SCORE_MAX;
+        return fmt;
+    }
+
     while ((fmt1 = av_iformat_next(fmt1))) {
         if (!is_opened == !(fmt1->flags & AVFMT_NOFILE) && strcmp(fmt1->name, "image2"))
             continue;
@@ -28,10 +28,12 @@
 
 #include "libavutil/avstring.h"
 #include "libavutil/avassert.h"
+#include "libavutil/fifo.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "avformat.h"
 #include "internal.h"
@@ -39,6 +41,7 @@
 #include "id3v2.h"
 
 #define INITIAL_BUFFER_SIZE 32768
+#define MAX_INIT_SECTION_SIZE (1024 * 1024)
 
 #define MAX_FIELD_LEN 64
 #define MAX_CHARACTERISTICS_LEN 512
@@ -78,6 +81,28 @@ struct segment {
 
 struct rendition;
 
+#if HAVE_THREADS
+/*
+ * A segment (or initialization section) downloaded in the background.
+ * The download thread appends the data to fifo, the demuxer reads it
+ * through an AVIOContext once the segment becomes the current one.
+ */
+struct prefetch_job {
+    struct prefetch_job *next;
+    struct segment seg;         ///< private copy, the playlist may be reloaded
+    AVDictionary *opts;         ///< options for opening seg.url
+    AVFifoBuffer *fifo;
+    int is_init;                ///< the job is an initialization section
+    int seq_no;                 ///< sequence number of the (media) segment
+    int started;
+    int done;
+    int error;
+    int64_t total;              ///< bytes downloaded so far
+    int64_t size;               ///< size announced when opened, or -1
+    char *cookies;              ///< cookies after the request, see prefetch_take_cookies()
+};
+#endif
+
 enum PlaylistType {
     PLS_TYPE_UNSPECIFIED,
     PLS_TYPE_EVENT,
@@ -152,6 +177,24 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+#if HAVE_THREADS
+    /* Background download of the upcoming segments, see prefetch_thread().
+     * The job list and the job contents are protected by prefetch_lock. */
+    pthread_t prefetch_thread;
+    int prefetch_thread_started;
+    pthread_mutex_t prefetch_lock;
+    pthread_cond_t prefetch_cond;
+    struct prefetch_job *prefetch_jobs;  /* queued jobs, in playback order */
+    struct prefetch_job *prefetch_cur;   /* job being downloaded */
+    struct prefetch_job *cur_job;        /* job input currently reads from */
+    int prefetch_abort;
+    int prefetch_cur_abort;
+    int prefetch_next_seq;               /* next segment to queue */
+    struct segment *prefetch_last_init;  /* init section of the last queued segment */
+    char prefetch_key_url[MAX_URL_SIZE];
+    uint8_t prefetch_key[16];
+#endif
 };
 
 /*
@@ -203,6 +246,8 @@ typedef struct HLSContext {
     char *http_proxy;                    ///< holds the address of the HTTP proxy server
     AVDictionary *avio_opts;
     int strict_std_compliance;
+    int prefetch;
+    int prefetch_buffer_size;
 } HLSContext;
 
 static int read_chomp_line(AVIOContext *s, char *buf, int maxlen)
@@ -213,6 +258,485 @@ static int read_chomp_line(AVIOContext *s, char *buf, int maxlen)
     return len;
 }
 
+/* Check that url may be opened by the demuxer: only http(s) & file are
+ * allowed, optionally through the crypto protocol. */
+static int check_url(const char *url, int *is_http)
+{
+    const char *proto_name = NULL;
+
+    if (av_strstart(url, "crypto", NULL)) {
+        if (url[6] == '+' || url[6] == ':')
+            proto_name = avio_find_protocol_name(url + 7);
+    }
+
+    if (!proto_name)
+        proto_name = avio_find_protocol_name(url);
+
+    if (!proto_name)
+        return AVERROR_INVALIDDATA;
+
+    // only http(s) & file are allowed
+    if (!av_strstart(proto_name, "http", NULL) && !av_strstart(proto_name, "file", NULL))
+        return AVERROR_INVALIDDATA;
+    if (!strncmp(proto_name, url, strlen(proto_name)) && url[strlen(proto_name)] == ':')
+        ;
+    else if (av_strstart(url, "crypto", NULL) && !strncmp(proto_name, url + 7, strlen(proto_name)) && url[7 + strlen(proto_name)] == ':')
+        ;
+    else if (strcmp(proto_name, "file") || !strncmp(url, "file,", 5))
+        return AVERROR_INVALIDDATA;
+
+    if (is_http)
+        *is_http = av_strstart(proto_name, "http", NULL);
+
+    return 0;
+}
+
+/* Options for the request of a segment */
+static void segment_options(HLSContext *c, struct segment *seg, AVDictionary **opts)
+{
+    // broker prior HTTP options that should be consistent across requests
+    av_dict_set(opts, "user-agent", c->user_agent, 0);
+    av_dict_set(opts, "cookies", c->cookies, 0);
+    av_dict_set(opts, "headers", c->headers, 0);
+    av_dict_set(opts, "http_proxy", c->http_proxy, 0);
+    av_dict_set(opts, "seekable", "0", 0);
+
+    if (seg->size >= 0) {
+        /* try to restrict the HTTP request to the part we want
+         * (if this is in fact a HTTP request) */
+        av_dict_set_int(opts, "offset", seg->url_offset, 0);
+        av_dict_set_int(opts, "end_offset", seg->url_offset + seg->size, 0);
+    }
+}
+
+#if HAVE_THREADS
+static void free_prefetch_job(struct prefetch_job **job)
+{
+    if (!*job)
+        return;
+    av_freep(&(*job)->seg.url);
+    av_freep(&(*job)->seg.key);
+    av_freep(&(*job)->cookies);
+    av_dict_free(&(*job)->opts);
+    av_fifo_freep(&(*job)->fifo);
+    av_freep(job);
+}
+
+static struct prefetch_job *new_prefetch_job(HLSContext *c, struct segment *seg,
+                                             int seq_no, int is_init)
+{
+    struct prefetch_job *job = av_mallocz(sizeof(*job));
+
+    if (!job)
+        return NULL;
+    job->seg              = *seg;
+    job->seg.init_section = NULL;
+    job->seq_no           = seq_no;
+    job->is_init          = is_init;
+    job->size             = -1;
+    job->seg.url          = av_strdup(seg->url);
+    job->seg.key          = seg->key ? av_strdup(seg->key) : NULL;
+    job->fifo             = av_fifo_alloc(INITIAL_BUFFER_SIZE);
+    if (!job->seg.url || (seg->key && !job->seg.key) || !job->fifo ||
+        av_dict_copy(&job->opts, c->avio_opts, 0) < 0) {
+        free_prefetch_job(&job);
+        return NULL;
+    }
+    segment_options(c, seg, &job->opts);
+    return job;
+}
+
+/* Abort the download of job if it is in progress, and free it.
+ * Must be called with prefetch_lock held. */
+static void release_prefetch_job(struct playlist *pls, struct prefetch_job **job)
+{
+    if (pls->prefetch_cur == *job) {
+        pls->prefetch_cur_abort = 1;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+        while (pls->prefetch_cur == *job)
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_lock);
+    }
+    free_prefetch_job(job);
+}
+
+/* Drop all the queued jobs. Must be called with prefetch_lock held. */
+static void flush_prefetch_jobs(struct playlist *pls)
+{
+    while (pls->prefetch_jobs) {
+        struct prefetch_job *job = pls->prefetch_jobs;
+        pls->prefetch_jobs = job->next;
+        release_prefetch_job(pls, &job);
+    }
+    pls->prefetch_last_init = NULL;
+}
+
+static int prefetch_interrupt_cb(void *opaque)
+{
+    struct playlist *pls = opaque;
+    return pls->prefetch_abort || pls->prefetch_cur_abort ||
+           ff_check_interrupt(&pls->parent->interrupt_callback);
+}
+
+static int prefetch_open(struct playlist *pls, AVIOContext **pb, const char *url,
+                         AVDictionary *opts, int *is_http)
+{
+    AVFormatContext *s = pls->parent;
+    AVIOInterruptCB int_cb = { prefetch_interrupt_cb, pls };
+    AVDictionary *tmp = NULL;
+    int ret;
+
+    if ((ret = check_url(url, is_http)) < 0)
+        return ret;
+    av_dict_copy(&tmp, opts, 0);
+    ret = ffio_open_whitelist(pb, url, AVIO_FLAG_READ, &int_cb, &tmp,
+                              s->protocol_whitelist, s->protocol_blacklist);
+    av_dict_free(&tmp);
+    return ret;
+}
+
+/* Pass the cookies set by the server for job on to the next requests, as
+ * open_url() does. Runs in the demuxer thread, with prefetch_lock held. */
+static void prefetch_take_cookies(HLSContext *c, struct prefetch_job *job)
+{
+    if (!job->cookies)
+        return;
+    av_free(c->cookies);
+    c->cookies   = job->cookies;
+    job->cookies = NULL;
+}
+
+/* Download job into its fifo; this runs in the prefetch thread, with
+ * prefetch_lock released. */
+static int prefetch_download(struct playlist *pls, struct prefetch_job *job)
+{
+    HLSContext *c = pls->parent->priv_data;
+    struct segment *seg = &job->seg;
+    AVDictionary *opts = NULL;
+    AVIOContext *pb = NULL;
+    uint8_t buf[INITIAL_BUFFER_SIZE];
+    char url[MAX_URL_SIZE];
+    char *cookies = NULL;
+    int64_t remaining = seg->size >= 0 ? seg->size : INT64_MAX;
+    int is_http = 0, ret;
+
+    if (job->is_init)
+        remaining = FFMIN(remaining, MAX_INIT_SECTION_SIZE);
+
+    av_strlcpy(url, seg->url, sizeof(url));
+    av_dict_copy(&opts, job->opts, 0);
+    if (seg->key_type == KEY_AES_128) {
+        char iv[33], key[33];
+        if (strcmp(seg->key, pls->prefetch_key_url)) {
+            if (prefetch_open(pls, &pb, seg->key, job->opts, NULL) >= 0) {
+                ret = avio_read(pb, pls->prefetch_key, sizeof(pls->prefetch_key));
+                avio_closep(&pb);
+                if (prefetch_interrupt_cb(pls))
+                    return AVERROR_EXIT;
+                if (ret != sizeof(pls->prefetch_key))
+                    av_log(pls->parent, AV_LOG_ERROR, "Unable to read key file %s\n",
+                           seg->key);
+            } else {
+                if (prefetch_interrupt_cb(pls))
+                    return AVERROR_EXIT;
+                av_log(pls->parent, AV_LOG_ERROR, "Unable to open key file %s\n",
+                       seg->key);
+            }
+            av_strlcpy(pls->prefetch_key_url, seg->key, sizeof(pls->prefetch_key_url));
+        }
+        ff_data_to_hex(iv, seg->iv, sizeof(seg->iv), 0);
+        ff_data_to_hex(key, pls->prefetch_key, sizeof(pls->prefetch_key), 0);
+        iv[32] = key[32] = '\0';
+        snprintf(url, sizeof(url), strstr(seg->url, "://") ? "crypto+%s" : "crypto:%s",
+                 seg->url);
+        av_dict_set(&opts, "key", key, 0);
+        av_dict_set(&opts, "iv", iv, 0);
+    }
+
+    ret = prefetch_open(pls, &pb, url, opts, &is_http);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+    /* see open_input() */
+    if (!is_http && seg->key_type == KEY_NONE && seg->url_offset) {
+        int64_t seekret = avio_seek(pb, seg->url_offset, SEEK_SET);
+        if (seekret < 0) {
+            avio_closep(&pb);
+            return seekret;
+        }
+    }
+
+    /* publish what prefetch_seek() and the demuxer need from the reply */
+    av_opt_get(pb, "cookies", AV_OPT_SEARCH_CHILDREN, (uint8_t **)&cookies);
+    if (cookies && !*cookies)
+        av_freep(&cookies);
+    pthread_mutex_lock(&pls->prefetch_lock);
+    if (seg->size >= 0)
+        job->size = seg->size;
+    else if ((job->size = avio_size(pb)) >= 0)
+        job->size = FFMAX(job->size - seg->url_offset, 0);
+    if (cookies) {
+        av_free(job->cookies);
+        job->cookies = cookies;
+    }
+    pthread_mutex_unlock(&pls->prefetch_lock);
+
+    while (remaining > 0) {
+        int len = avio_read(pb, buf, FFMIN(sizeof(buf), remaining));
+        if (len <= 0) {
+            ret = len == AVERROR_EOF ? 0 : len;
+            break;
+        }
+        remaining -= len;
+
+        pthread_mutex_lock(&pls->prefetch_lock);
+        while (av_fifo_size(job->fifo) + len > c->prefetch_buffer_size &&
+               !pls->prefetch_abort && !pls->prefetch_cur_abort)
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_lock);
+        if (pls->prefetch_abort || pls->prefetch_cur_abort) {
+            ret = AVERROR_EXIT;
+        } else if (av_fifo_space(job->fifo) < len &&
+                   (ret = av_fifo_grow(job->fifo, FFMAX(len, av_fifo_size(job->fifo)))) < 0) {
+            ;
+        } else {
+            av_fifo_generic_write(job->fifo, buf, len, NULL);
+            job->total += len;
+            pthread_cond_broadcast(&pls->prefetch_cond);
+        }
+        pthread_mutex_unlock(&pls->prefetch_lock);
+        if (ret < 0)
+            break;
+    }
+
+    avio_closep(&pb);
+    return ret;
+}
+
+/* Download the queued jobs one after the other, in playback order. */
+static void *prefetch_thread(void *arg)
+{
+    struct playlist *pls = arg;
+
+    pthread_mutex_lock(&pls->prefetch_lock);
+    while (!pls->prefetch_abort) {
+        struct prefetch_job *job;
+        int ret;
+
+        /* the current segment may have been taken before its download
+         * started */
+        job = pls->cur_job;
+        if (!job || job->started)
+            for (job = pls->prefetch_jobs; job && job->started; job = job->next)
+                ;
+        if (!job) {
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_lock);
+            continue;
+        }
+        job->started            = 1;
+        pls->prefetch_cur       = job;
+        pls->prefetch_cur_abort = 0;
+        pthread_mutex_unlock(&pls->prefetch_lock);
+
+        av_log(pls->parent, AV_LOG_VERBOSE, "HLS prefetch of url '%s', offset %"PRId64", playlist %d\n",
+               job->seg.url, job->seg.url_offset, pls->index);
+        ret = prefetch_download(pls, job);
+
+        pthread_mutex_lock(&pls->prefetch_lock);
+        if (ret < 0 && !pls->prefetch_cur_abort && !pls->prefetch_abort)
+            av_log(pls->parent, AV_LOG_WARNING, "Failed to prefetch segment of playlist %d\n",
+                   pls->index);
+        job->done          = 1;
+        job->error         = ret;
+        pls->prefetch_cur  = NULL;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+    }
+    pthread_mutex_unlock(&pls->prefetch_lock);
+
+    return NULL;
+}
+
+static int prefetch_start(struct playlist *pls)
+{
+    int ret;
+
+    if ((ret = pthread_mutex_init(&pls->prefetch_lock, NULL)))
+        return AVERROR(ret);
+    if ((ret = pthread_cond_init(&pls->prefetch_cond, NULL))) {
+        pthread_mutex_destroy(&pls->prefetch_lock);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_create(&pls->prefetch_thread, NULL, prefetch_thread, pls))) {
+        pthread_cond_destroy(&pls->prefetch_cond);
+        pthread_mutex_destroy(&pls->prefetch_lock);
+        return AVERROR(ret);
+    }
+    pls->prefetch_thread_started = 1;
+    return 0;
+}
+
+static void prefetch_stop(struct playlist *pls)
+{
+    if (!pls->prefetch_thread_started)
+        return;
+    pthread_mutex_lock(&pls->prefetch_lock);
+    pls->prefetch_abort = 1;
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_lock);
+    pthread_join(pls->prefetch_thread, NULL);
+
+    if (pls->cur_job) {
+        av_freep(&pls->input->buffer);
+        av_freep(&pls->input);
+        free_prefetch_job(&pls->cur_job);
+    }
+    flush_prefetch_jobs(pls);
+    pthread_cond_destroy(&pls->prefetch_cond);
+    pthread_mutex_destroy(&pls->prefetch_lock);
+    pls->prefetch_thread_started = 0;
+}
+
+/* Queue the segments following the current one, up to the prefetch count. */
+static void prefetch_schedule(HLSContext *c, struct playlist *pls)
+{
+    struct prefetch_job **tail = &pls->prefetch_jobs;
+    int queued = 0;
+
+    pthread_mutex_lock(&pls->prefetch_lock);
+    for (; *tail; tail = &(*tail)->next)
+        queued += !(*tail)->is_init;
+    if (!pls->prefetch_jobs) {
+        pls->prefetch_next_seq  = pls->cur_seq_no + 1;
+        pls->prefetch_last_init = pls->cur_init_section;
+    }
+    pls->prefetch_next_seq = FFMAX(pls->prefetch_next_seq, pls->start_seq_no);
+
+    while (queued < c->prefetch &&
+           pls->prefetch_next_seq < pls->start_seq_no + pls->n_segments) {
+        struct segment *seg = pls->segments[pls->prefetch_next_seq - pls->start_seq_no];
+
+        if (seg->key_type == KEY_SAMPLE_AES)
+            break;
+        if (seg->init_section && seg->init_section != pls->prefetch_last_init) {
+            if (!(*tail = new_prefetch_job(c, seg->init_section, pls->prefetch_next_seq, 1)))
+                break;
+            tail = &(*tail)->next;
+        }
+        pls->prefetch_last_init = seg->init_section;
+        if (!(*tail = new_prefetch_job(c, seg, pls->prefetch_next_seq, 0)))
+            break;
+        tail = &(*tail)->next;
+        pls->prefetch_next_seq++;
+        queued++;
+    }
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_lock);
+}
+
+static int prefetch_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    struct playlist *pls = opaque;
+    struct prefetch_job *job = pls->cur_job;
+    int ret;
+
+    pthread_mutex_lock(&pls->prefetch_lock);
+    while (!av_fifo_size(job->fifo) && !job->done)
+        pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_lock);
+    if (av_fifo_size(job->fifo)) {
+        ret = FFMIN(buf_size, av_fifo_size(job->fifo));
+        av_fifo_generic_read(job->fifo, buf, ret, NULL);
+        pthread_cond_broadcast(&pls->prefetch_cond);
+    } else {
+        ret = job->error < 0 ? job->error : AVERROR_EOF;
+    }
+    pthread_mutex_unlock(&pls->prefetch_lock);
+
+    return ret;
+}
+
+/* Only AVSEEK_SIZE is supported. It must not wait for the end of the
+ * download, which itself waits for the fifo to be read. */
+static int64_t prefetch_seek(void *opaque, int64_t offset, int whence)
+{
+    struct playlist *pls = opaque;
+    struct prefetch_job *job = pls->cur_job;
+    int64_t ret;
+
+    if (whence != AVSEEK_SIZE)
+        return AVERROR(ENOSYS);
+
+    pthread_mutex_lock(&pls->prefetch_lock);
+    if (job->done)
+        ret = job->error < 0 ? job->error : job->total;
+    else
+        ret = job->size >= 0 ? job->size : AVERROR(ENOSYS);
+    pthread_mutex_unlock(&pls->prefetch_lock);
+
+    return ret;
+}
+
+/* Open the input of pls on the prefetched data of seg, if it is at the
+ * head of the queue. Otherwise the queue is dropped, unless it starts with
+ * the next segment (e.g. when the current one is restarted).
+ * Returns 1 if the input was opened, 0 if the segment was not prefetched. */
+static int prefetch_open_input(struct playlist *pls, struct segment *seg)
+{
+    HLSContext *c = pls->parent->priv_data;
+    struct prefetch_job *job;
+    uint8_t *buf;
+
+    pthread_mutex_lock(&pls->prefetch_lock);
+    job = pls->prefetch_jobs;
+    if (!job || strcmp(job->seg.url, seg->url) ||
+        job->seg.url_offset != seg->url_offset || job->seg.size != seg->size) {
+        if (job && job->seq_no != pls->cur_seq_no + 1)
+            flush_prefetch_jobs(pls);
+        pthread_mutex_unlock(&pls->prefetch_lock);
+        return 0;
+    }
+    pls->prefetch_jobs = job->next;
+    if (job->done && job->error < 0 && !av_fifo_size(job->fifo)) {
+        /* let the caller retry the request */
+        free_prefetch_job(&job);
+        pthread_mutex_unlock(&pls->prefetch_lock);
+        return 0;
+    }
+
+    buf = av_malloc(INITIAL_BUFFER_SIZE);
+    if (buf)
+        pls->input = avio_alloc_context(buf, INITIAL_BUFFER_SIZE, 0, pls,
+                                        prefetch_read, NULL, prefetch_seek);
+    if (!pls->input) {
+        av_free(buf);
+        release_prefetch_job(pls, &job);
+        pthread_mutex_unlock(&pls->prefetch_lock);
+        return AVERROR(ENOMEM);
+    }
+    pls->input->seekable = 0;
+    pls->cur_job = job;
+    prefetch_take_cookies(c, job);
+    pthread_mutex_unlock(&pls->prefetch_lock);
+
+    av_log(pls->parent, AV_LOG_VERBOSE, "HLS prefetched url '%s', offset %"PRId64", playlist %d\n",
+           seg->url, seg->url_offset, pls->index);
+    return 1;
+}
+#endif
+
+static void close_input(struct playlist *pls)
+{
+#if HAVE_THREADS
+    if (pls->cur_job) {
+        av_freep(&pls->input->buffer);
+        av_freep(&pls->input);
+        pthread_mutex_lock(&pls->prefetch_lock);
+        prefetch_take_cookies(pls->parent->priv_data, pls->cur_job);
+        release_prefetch_job(pls, &pls->cur_job);
+        pthread_mutex_unlock(&pls->prefetch_lock);
+        return;
+    }
+#endif
+    ff_format_io_close(pls->parent, &pls->input);
+}
+
 static void free_segment_list(struct playlist *pls)
 {
     int i;
@@ -241,6 +765,9 @@ static void free_playlist_list(HLSContext *c)
     int i;
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
+#if HAVE_THREADS
+        prefetch_stop(pls);
+#endif
         free_segment_list(pls);
         free_init_section_list(pls);
         av_freep(&pls->main_streams);
@@ -252,7 +779,7 @@ static void free_playlist_list(HLSContext *c)
         av_packet_unref(&pls->pkt);
         av_freep(&pls->pb.buffer);
         if (pls->input)
-            ff_format_io_close(c->ctx, &pls->input);
+            close_input(pls);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -599,33 +1126,14 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
 {
     HLSContext *c = s->priv_data;
     AVDictionary *tmp = NULL;
-    const char *proto_name = NULL;
     int ret;
 
+    if ((ret = check_url(url, is_http)) < 0)
+        return ret;
+
     av_dict_copy(&tmp, opts, 0);
     av_dict_copy(&tmp, opts2, 0);
 
-    if (av_strstart(url, "crypto", NULL)) {
-        if (url[6] == '+' || url[6] == ':')
-            proto_name = avio_find_protocol_name(url + 7);
-    }
-
-    if (!proto_name)
-        proto_name = avio_find_protocol_name(url);
-
-    if (!proto_name)
-        return AVERROR_INVALIDDATA;
-
-    // only http(s) & file are allowed
-    if (!av_strstart(proto_name, "http", NULL) && !av_strstart(proto_name, "file", NULL))
-        return AVERROR_INVALIDDATA;
-    if (!strncmp(proto_name, url, strlen(proto_name)) && url[strlen(proto_name)] == ':')
-        ;
-    else if (av_strstart(url, "crypto", NULL) && !strncmp(proto_name, url + 7, strlen(proto_name)) && url[7 + strlen(proto_name)] == ':')
-        ;
-    else if (strcmp(proto_name, "file") || !strncmp(url, "file,", 5))
-        return AVERROR_INVALIDDATA;
-
     ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
     if (ret >= 0) {
         // update cookies on http response with setcookies.
@@ -636,9 +1144,6 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
 
     av_dict_free(&tmp);
 
-    if (is_http)
-        *is_http = av_strstart(proto_name, "http", NULL);
-
     return ret;
 }
 
@@ -1082,19 +1587,16 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg)
     int ret;
     int is_http = 0;
 
-    // broker prior HTTP options that should be consistent across requests
-    av_dict_set(&opts, "user-agent", c->user_agent, 0);
-    av_dict_set(&opts, "cookies", c->cookies, 0);
-    av_dict_set(&opts, "headers", c->headers, 0);
-    av_dict_set(&opts, "http_proxy", c->http_proxy, 0);
-    av_dict_set(&opts, "seekable", "0", 0);
-
-    if (seg->size >= 0) {
-        /* try to restrict the HTTP request to the part we want
-         * (if this is in fact a HTTP request) */
-        av_dict_set_int(&opts, "offset", seg->url_offset, 0);
-        av_dict_set_int(&opts, "end_offset", seg->url_offset + seg->size, 0);
+    pls->cur_seg_offset = 0;
+#if HAVE_THREADS
+    if (pls->prefetch_thread_started) {
+        ret = prefetch_open_input(pls, seg);
+        if (ret)
+            return FFMIN(ret, 0);
     }
+#endif
+
+    segment_options(c, seg, &opts);
 
     av_log(pls->parent, AV_LOG_VERBOSE, "HLS request for url '%s', offset %"PRId64", playlist %d\n",
            seg->url, seg->url_offset, pls->index);
@@ -1162,7 +1664,7 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg)
         if (seekret < 0) {
             av_log(pls->parent, AV_LOG_ERROR, "Unable to seek to offset %"PRId64" of HLS segment '%s'\n", seg->url_offset, seg->url);
             ret = seekret;
-            ff_format_io_close(pls->parent, &pls->input);
+            close_input(pls);
         }
     }
 
@@ -1174,7 +1676,6 @@ cleanup:
 
 static int update_init_section(struct playlist *pls, struct segment *seg)
 {
-    static const int max_init_section_size = 1024*1024;
     HLSContext *c = pls->parent->priv_data;
     int64_t sec_size;
     int64_t urlsize;
@@ -1201,19 +1702,19 @@ static int update_init_section(struct playlist *pls, struct segment *seg)
     else if ((urlsize = avio_size(pls->input)) >= 0)
         sec_size = urlsize;
     else
-        sec_size = max_init_section_size;
+        sec_size = MAX_INIT_SECTION_SIZE;
 
     av_log(pls->parent, AV_LOG_DEBUG,
            "Downloading an initialization section of size %"PRId64"\n",
            sec_size);
 
-    sec_size = FFMIN(sec_size, max_init_section_size);
+    sec_size = FFMIN(sec_size, MAX_INIT_SECTION_SIZE);
 
     av_fast_malloc(&pls->init_sec_buf, &pls->init_sec_buf_size, sec_size);
 
     ret = read_from_url(pls, seg->init_section, pls->init_sec_buf,
                         pls->init_sec_buf_size, READ_COMPLETE);
-    ff_format_io_close(pls->parent, &pls->input);
+    close_input(pls);
 
     if (ret < 0)
         return ret;
@@ -1320,6 +1821,10 @@ reload:
             goto reload;
         }
         just_opened = 1;
+#if HAVE_THREADS
+        if (v->prefetch_thread_started)
+            prefetch_schedule(c, v);
+#endif
     }
 
     if (v->init_sec_buf_read_offset < v->init_sec_data_len) {
@@ -1340,7 +1845,7 @@ reload:
 
         return ret;
     }
-    ff_format_io_close(v->parent, &v->input);
+    close_input(v);
     v->cur_seq_no++;
 
     c->cur_seq_no = v->cur_seq_no;
@@ -1549,6 +2054,14 @@ static int hls_read_header(AVFormatContext *s)
         update_options(&c->http_proxy, "http_proxy", u);
     }
 
+    /* the prefetch thread opens the segments itself, with its own
+     * interrupt callback, which would bypass custom io_open callbacks */
+    if (c->prefetch > 0 && !ff_format_io_open_is_default(s)) {
+        av_log(s, AV_LOG_WARNING,
+               "Custom io_open callback set, disabling prefetch\n");
+        c->prefetch = 0;
+    }
+
     if ((ret = parse_playlist(c, s->filename, NULL, s->pb)) < 0)
         goto fail;
 
@@ -1557,6 +2070,8 @@ static int hls_read_header(AVFormatContext *s)
 
     /* Some HLS servers don't like being sent the range header */
     av_dict_set(&c->avio_opts, "seekable", "0", 0);
+    /* Keep the connections to the server alive across segments */
+    av_dict_set(&c->avio_opts, "connection_pool", "1", AV_DICT_DONT_OVERWRITE);
 
     if (c->n_variants == 0) {
         av_log(NULL, AV_LOG_WARNING, "Empty playlist\n");
@@ -1647,6 +2162,13 @@ static int hls_read_header(AVFormatContext *s)
             pls->ctx = NULL;
             goto fail;
         }
+#if HAVE_THREADS
+        if (c->prefetch > 0 && (ret = prefetch_start(pls)) < 0) {
+            avformat_free_context(pls->ctx);
+            pls->ctx = NULL;
+            goto fail;
+        }
+#endif
         ffio_init_context(&pls->pb, pls->read_buffer, INITIAL_BUFFER_SIZE, 0, pls,
                           read_data, NULL, NULL);
         pls->pb.seekable = 0;
@@ -1778,7 +2300,7 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
         } else if (first && !pls->cur_needed && pls->needed) {
             if (pls->input)
-                ff_format_io_close(pls->parent, &pls->input);
+                close_input(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -1997,7 +2519,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
         if (pls->input)
-            ff_format_io_close(pls->parent, &pls->input);
+            close_input(pls);
         av_packet_unref(&pls->pkt);
         reset_packet(&pls->pkt);
         pls->pb.eof_reached = 0;
@@ -2046,6 +2568,10 @@ static int hls_probe(AVProbeData *p)
 static const AVOption hls_options[] = {
     {"live_start_index", "segment index to start live streams at (negative values are from the end)",
         OFFSET(live_start_index), AV_OPT_TYPE_INT, {.i64 = -3}, INT_MIN, INT_MAX, FLAGS},
+    {"prefetch", "number of upcoming segments to download in the background",
+        OFFSET(prefetch), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_buffer_size", "maximum amount of data buffered for each prefetched segment",
+        OFFSET(prefetch_buffer_size), AV_OPT_TYPE_INT, {.i64 = 16 * 1024 * 1024}, INITIAL_BUFFER_SIZE, INT_MAX, FLAGS},
     {NULL}
 };
 
@@ -403,6 +403,7 @@ static void set_http_options(AVDictionary **options, HLSContext *c)
 {
     if (c->method)
         av_dict_set(options, "method", c->method, 0);
+    av_dict_set(options, "connection_pool", "1", AV_DICT_DONT_OVERWRITE);
 }
 
 static int hls_window(AVFormatContext *s, int last)
@@ -28,6 +28,7 @@
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 
 #include "avformat.h"
@@ -46,6 +47,8 @@
  * path names). */
 #define BUFFER_SIZE   MAX_URL_SIZE
 #define MAX_REDIRECTS 8
+/* Maximum amount of unread reply data discarded to keep a connection alive */
+#define MAX_DRAIN_SIZE (64 * 1024)
 #define HTTP_SINGLE   1
 #define HTTP_MUTLI    2
 typedef enum {
@@ -55,6 +58,18 @@ typedef enum {
     FINISH
 }HandshakeState;
 
+/* A connection to the lower protocol, which can be handed over to another
+ * HTTPContext talking to the same server once its reply has been read. */
+typedef struct HTTPPoolConn {
+    struct HTTPPoolConn *next;
+    URLContext *hd;
+    /* scheme, host, port and options of the lower protocol */
+    char *key;
+    /* interrupt callback of the current owner, empty while idle */
+    AVIOInterruptCB int_cb;
+    int64_t expiry;
+} HTTPPoolConn;
+
 typedef struct HTTPContext {
     const AVClass *class;
     URLContext *hd;
@@ -117,6 +132,13 @@ typedef struct HTTPContext {
     int is_multi_client;
     HandshakeState handshake_step;
     int is_connected_server;
+    /* A flag which indicates the last chunk of the reply has been read. */
+    int end_chunked_reply;
+    int connection_pool;
+    int pool_idle_timeout;
+    int pool_max_per_host;
+    /* The pool entry owning hd, if connection_pool is set. */
+    HTTPPoolConn *conn;
 } HTTPContext;
 
 #define OFFSET(x) offsetof(HTTPContext, x)
@@ -155,6 +177,9 @@ static const AVOption options[] = {
     { "listen", "listen on HTTP", OFFSET(listen), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, D | E },
     { "resource", "The resource requested by a client", OFFSET(resource), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "reply_code", "The http status code to return to a client", OFFSET(reply_code), AV_OPT_TYPE_INT, { .i64 = 200}, INT_MIN, 599, E},
+    { "connection_pool", "share persistent connections with other requests to the same server", OFFSET(connection_pool), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D | E },
+    { "pool_idle_timeout", "time in seconds an idle pooled connection is kept open", OFFSET(pool_idle_timeout), AV_OPT_TYPE_INT, { .i64 = 10 }, 0, INT_MAX / 1000000, D | E },
+    { "pool_max_per_host", "maximum number of idle pooled connections per server", OFFSET(pool_max_per_host), AV_OPT_TYPE_INT, { .i64 = 4 }, 0, INT_MAX, D | E },
     { NULL }
 };
 
@@ -162,6 +187,7 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
                         const char *hoststr, const char *auth,
                         const char *proxyauth, int *new_location);
 static int http_read_header(URLContext *h, int *new_location);
+static void http_release_lower(URLContext *h);
 
 void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
 {
@@ -173,6 +199,194 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+static AVOnce pool_once = AV_ONCE_INIT;
+static AVMutex pool_lock;
+static HTTPPoolConn *pool;
+
+static void pool_init(void)
+{
+    ff_mutex_init(&pool_lock, NULL);
+}
+
+static int pool_interrupt_cb(void *opaque)
+{
+    HTTPPoolConn *conn = opaque;
+    return ff_check_interrupt(&conn->int_cb);
+}
+
+static void pool_conn_close(HTTPPoolConn *conn)
+{
+    while (conn) {
+        HTTPPoolConn *next = conn->next;
+        conn->int_cb = (AVIOInterruptCB) { 0 };
+        ffurl_close(conn->hd);
+        av_free(conn->key);
+        av_free(conn);
+        conn = next;
+    }
+}
+
+/* A connection the server has closed, or sent unsolicited data on,
+ * is readable while idle. */
+static int pool_conn_alive(HTTPPoolConn *conn)
+{
+    struct pollfd p = { ffurl_get_file_handle(conn->hd), POLLIN, 0 };
+
+    if (p.fd < 0)
+        return 1;
+    return !poll(&p, 1, 0);
+}
+
+/**
+ * Take the most recently used idle connection matching key out of the pool.
+ * Expired connections are closed on the way.
+ */
+static HTTPPoolConn *pool_acquire(const char *key)
+{
+    HTTPPoolConn **p, *conn, *found = NULL, *expired = NULL;
+    int64_t now = av_gettime_relative();
+
+    ff_thread_once(&pool_once, pool_init);
+    ff_mutex_lock(&pool_lock);
+    for (p = &pool; *p;) {
+        conn = *p;
+        if (conn->expiry <= now) {
+            *p = conn->next;
+            conn->next = expired;
+            expired = conn;
+        } else if (!found && !strcmp(conn->key, key)) {
+            *p = conn->next;
+            conn->next = NULL;
+            found = conn;
+        } else {
+            p = &conn->next;
+        }
+    }
+    ff_mutex_unlock(&pool_lock);
+
+    pool_conn_close(expired);
+    return found;
+}
+
+static void pool_release(HTTPPoolConn *conn, int idle_timeout, int max_per_host)
+{
+    HTTPPoolConn **p, *evicted = NULL;
+    int n = 0;
+
+    if (!max_per_host || !idle_timeout) {
+        pool_conn_close(conn);
+        return;
+    }
+    conn->int_cb = (AVIOInterruptCB) { 0 };
+    conn->expiry = av_gettime_relative() + idle_timeout * 1000000LL;
+
+    ff_thread_once(&pool_once, pool_init);
+    ff_mutex_lock(&pool_lock);
+    /* The list is ordered from the most to the least recently used. */
+    for (p = &pool; *p; p = &(*p)->next) {
+        if (!strcmp((*p)->key, conn->key) && ++n >= max_per_host) {
+            evicted = *p;
+            *p = evicted->next;
+            evicted->next = NULL;
+            break;
+        }
+    }
+    conn->next = pool;
+    pool       = conn;
+    ff_mutex_unlock(&pool_lock);
+
+    pool_conn_close(evicted);
+}
+
+void ff_http_flush_connection_pool(void)
+{
+    HTTPPoolConn *conns;
+
+    ff_thread_once(&pool_once, pool_init);
+    ff_mutex_lock(&pool_lock);
+    conns = pool;
+    pool  = NULL;
+    ff_mutex_unlock(&pool_lock);
+
+    pool_conn_close(conns);
+}
+
+/**
+ * Open the connection to the lower protocol, reusing an idle pooled one
+ * if allowed.
+ *
+ * @return 1 if a pooled connection is reused, 0 if a new one is opened,
+ * a negative value on error
+ */
+static int http_open_lower(URLContext *h, const char *url,
+                           AVDictionary **options, int reuse)
+{
+    HTTPContext *s = h->priv_data;
+    AVIOInterruptCB int_cb;
+    HTTPPoolConn *conn;
+    char *opts = NULL;
+    int ret;
+
+    if (!s->connection_pool)
+        return ffurl_open_whitelist(&s->hd, url, AVIO_FLAG_READ_WRITE,
+                                    &h->interrupt_callback, options,
+                                    h->protocol_whitelist, h->protocol_blacklist, h);
+
+    if (!(conn = av_mallocz(sizeof(*conn))))
+        return AVERROR(ENOMEM);
+    /* The options of the lower protocol, including the protocol white- and
+     * blacklists, are part of the key, so only identically set up
+     * connections are shared. */
+    if ((ret = av_dict_get_string(*options, &opts, '=', ',')) < 0 ||
+        !(conn->key = av_asprintf("%s %s", url, opts))) {
+        av_free(opts);
+        av_free(conn);
+        return ret < 0 ? ret : AVERROR(ENOMEM);
+    }
+    av_free(opts);
+
+    while (reuse) {
+        HTTPPoolConn *idle = pool_acquire(conn->key);
+        if (!idle)
+            break;
+        if (pool_conn_alive(idle)) {
+            pool_conn_close(conn);
+            idle->int_cb = h->interrupt_callback;
+            s->conn      = idle;
+            s->hd        = idle->hd;
+            av_log(h, AV_LOG_DEBUG, "Reusing connection to %s\n", url);
+            return 1;
+        }
+        pool_conn_close(idle);
+    }
+
+    /* The lower protocol keeps a copy of the interrupt callback, route it
+     * through the pool entry so that it follows the connection owner. */
+    conn->int_cb = h->interrupt_callback;
+    int_cb       = (AVIOInterruptCB) { pool_interrupt_cb, conn };
+    ret = ffurl_open_whitelist(&conn->hd, url, AVIO_FLAG_READ_WRITE,
+                               &int_cb, options,
+                               h->protocol_whitelist, h->protocol_blacklist, h);
+    if (ret < 0) {
+        pool_conn_close(conn);
+        return ret;
+    }
+    s->conn = conn;
+    s->hd   = conn->hd;
+    return 0;
+}
+
+static void http_close_lower(HTTPContext *s)
+{
+    if (s->conn) {
+        pool_conn_close(s->conn);
+        s->conn = NULL;
+        s->hd   = NULL;
+    } else {
+        ffurl_closep(&s->hd);
+    }
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -180,7 +394,7 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     char auth[1024], proxyauth[1024] = "";
     char path1[MAX_URL_SIZE];
     char buf[1024], urlbuf[MAX_URL_SIZE];
-    int port, use_proxy, err, location_changed = 0;
+    int port, use_proxy, err, location_changed = 0, reused = 0;
     HTTPContext *s = h->priv_data;
 
     av_url_split(proto, sizeof(proto), auth, sizeof(auth),
@@ -219,15 +433,23 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
     if (!s->hd) {
-        err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
-                                   &h->interrupt_callback, options,
-                                   h->protocol_whitelist, h->protocol_blacklist, h);
-        if (err < 0)
-            return err;
+        reused = http_open_lower(h, buf, options, 1);
+        if (reused < 0)
+            return reused;
     }
 
+    s->line_count = 0;
     err = http_connect(h, path, local_path, hoststr,
                        auth, proxyauth, &location_changed);
+    if (err < 0 && reused > 0 && !s->line_count) {
+        /* The server dropped the idle connection, retry with a new one. */
+        av_log(h, AV_LOG_DEBUG, "Pooled connection failed, reconnecting\n");
+        http_close_lower(s);
+        if ((err = http_open_lower(h, buf, options, 0)) < 0)
+            return err;
+        err = http_connect(h, path, local_path, hoststr,
+                           auth, proxyauth, &location_changed);
+    }
     if (err < 0)
         return err;
 
@@ -254,7 +476,7 @@ redo:
     if (s->http_code == 401) {
         if ((cur_auth_type == HTTP_AUTH_NONE || s->auth_state.stale) &&
             s->auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            http_release_lower(h);
             goto redo;
         } else
             goto fail;
@@ -262,7 +484,7 @@ redo:
     if (s->http_code == 407) {
         if ((cur_proxy_auth_type == HTTP_AUTH_NONE || s->proxy_auth_state.stale) &&
             s->proxy_auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            http_release_lower(h);
             goto redo;
         } else
             goto fail;
@@ -271,7 +493,7 @@ redo:
          s->http_code == 303 || s->http_code == 307) &&
         location_changed == 1) {
         /* url moved, get next */
-        ffurl_closep(&s->hd);
+        http_release_lower(h);
         if (redirects++ >= MAX_REDIRECTS)
             return AVERROR(EIO);
         /* Restart the authentication process with the new target, which
@@ -285,7 +507,7 @@ redo:
 
 fail:
     if (s->hd)
-        ffurl_closep(&s->hd);
+        http_close_lower(s);
     if (location_changed < 0)
         return location_changed;
     return ff_http_averror(s->http_code, AVERROR(EIO));
@@ -773,6 +995,8 @@ static int process_line(URLContext *h, char *line, int line_count,
             }
             av_log(h, AV_LOG_TRACE, "HTTP version string: %s\n", version);
         } else {
+            /* HTTP/1.0 connections are not persistent by default */
+            s->willclose = !av_strncasecmp(p, "HTTP/1.0", 8);
             while (!av_isspace(*p) && *p != '\0')
                 p++;
             while (av_isspace(*p))
@@ -820,6 +1044,8 @@ static int process_line(URLContext *h, char *line, int line_count,
         } else if (!av_strcasecmp(tag, "Connection")) {
             if (!strcmp(p, "close"))
                 s->willclose = 1;
+            else if (!av_strcasecmp(p, "keep-alive"))
+                s->willclose = 0;
         } else if (!av_strcasecmp(tag, "Server")) {
             if (!av_strcasecmp(p, "AkamaiGHost")) {
                 s->is_akamai = 1;
@@ -1057,7 +1283,7 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
                            "Expect: 100-continue\r\n");
 
     if (!has_header(s->headers, "\r\nConnection: ")) {
-        if (s->multiple_requests)
+        if (s->multiple_requests || s->connection_pool)
             len += av_strlcpy(headers + len, "Connection: keep-alive\r\n",
                               sizeof(headers) - len);
         else
@@ -1115,15 +1341,16 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
             goto done;
 
     /* init input buffer */
-    s->buf_ptr          = s->buffer;
-    s->buf_end          = s->buffer;
-    s->line_count       = 0;
-    s->off              = 0;
-    s->icy_data_read    = 0;
-    s->filesize         = -1;
-    s->willclose        = 0;
-    s->end_chunked_post = 0;
-    s->end_header       = 0;
+    s->buf_ptr           = s->buffer;
+    s->buf_end           = s->buffer;
+    s->line_count        = 0;
+    s->off               = 0;
+    s->icy_data_read     = 0;
+    s->filesize          = -1;
+    s->willclose         = 0;
+    s->end_chunked_post  = 0;
+    s->end_chunked_reply = 0;
+    s->end_header        = 0;
     if (post && !s->post_data && !send_expect_100) {
         /* Pretend that it did work. We didn't read any header yet, since
          * we've still to send the POST data, but the code calling this
@@ -1217,6 +1444,118 @@ static int http_buf_read_compressed(URLContext *h, uint8_t *buf, int size)
 
 static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int force_reconnect);
 
+/**
+ * Read the size line of the next chunk of the reply.
+ *
+ * @return 0 after the last chunk, 1 otherwise, a negative value on error
+ */
+static int http_read_chunk_header(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    char line[32];
+    int err;
+
+    if (s->end_chunked_reply)
+        return 0;
+
+    do {
+        if ((err = http_get_line(s, line, sizeof(line))) < 0)
+            return err;
+    } while (!*line);    /* skip CR LF from last chunk */
+
+    s->chunksize = strtoll(line, NULL, 16);
+
+    av_log(NULL, AV_LOG_TRACE, "Chunked encoding data size: %"PRId64"'\n",
+            s->chunksize);
+
+    if (s->chunksize)
+        return 1;
+
+    /* Skip the trailer, so that the connection can carry another request. */
+    do {
+        if (http_get_line(s, line, sizeof(line)) < 0) {
+            s->willclose = 1;
+            break;
+        }
+    } while (*line);
+    s->end_chunked_reply = 1;
+    return 0;
+}
+
+/* Return 1 if the whole reply has been read, so the connection can carry
+ * another request. */
+static int http_finish_reply(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    uint8_t buf[4096];
+    int64_t target_end;
+    int new_location, size, ret, drained = 0;
+
+    if (!s->end_header) {
+        /* An upload: everything has been sent, fetch the reply. */
+        if (!s->chunked_post || !s->end_chunked_post ||
+            http_read_header(h, &new_location) < 0)
+            return 0;
+    }
+#if CONFIG_ZLIB
+    if (s->compressed)
+        return 0;
+#endif /* CONFIG_ZLIB */
+    if (s->willclose || (s->chunksize < 0 && s->filesize < 0))
+        return 0;
+
+    /* Discard what is left of a short reply. */
+    target_end = s->end_off ? s->end_off : s->filesize;
+    for (;;) {
+        if (s->chunksize < 0) {
+            if (s->off >= target_end)
+                break;
+            size = FFMIN(sizeof(buf), target_end - s->off);
+        } else if (s->end_chunked_reply) {
+            break;
+        } else if (!s->chunksize) {
+            if (http_read_chunk_header(h) < 0)
+                return 0;
+            continue;
+        } else {
+            size = FFMIN(sizeof(buf), s->chunksize);
+        }
+        ret = http_buf_read(h, buf, size);
+        if (ret <= 0 || (drained += ret) > MAX_DRAIN_SIZE)
+            return 0;
+    }
+    return s->buf_ptr == s->buf_end;
+}
+
+/* The reply of an upload is only read when closing, bound the wait for it
+ * by the timeout of the request, the lower protocol may have none. */
+static int http_reply_complete(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    int64_t rw_timeout = s->hd->rw_timeout;
+    int ret;
+
+    if (h->rw_timeout && (!rw_timeout || rw_timeout > h->rw_timeout))
+        s->hd->rw_timeout = h->rw_timeout;
+    ret = http_finish_reply(h);
+    s->hd->rw_timeout = rw_timeout;
+    return ret;
+}
+
+/* Give the connection back to the pool if possible, close it otherwise. */
+static void http_release_lower(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+
+    if (s->conn && http_reply_complete(h)) {
+        pool_release(s->conn, s->pool_idle_timeout, s->pool_max_per_host);
+        s->conn = NULL;
+        s->hd   = NULL;
+    } else {
+        http_close_lower(s);
+    }
+}
+
 static int http_read_stream(URLContext *h, uint8_t *buf, int size)
 {
     HTTPContext *s = h->priv_data;
@@ -1233,22 +1572,8 @@ static int http_read_stream(URLContext *h, uint8_t *buf, int size)
     }
 
     if (s->chunksize >= 0) {
-        if (!s->chunksize) {
-            char line[32];
-
-                do {
-                    if ((err = http_get_line(s, line, sizeof(line))) < 0)
-                        return err;
-                } while (!*line);    /* skip CR LF from last chunk */
-
-                s->chunksize = strtoll(line, NULL, 16);
-
-                av_log(NULL, AV_LOG_TRACE, "Chunked encoding data size: %"PRId64"'\n",
-                        s->chunksize);
-
-                if (!s->chunksize)
-                    return 0;
-        }
+        if (!s->chunksize && (err = http_read_chunk_header(h)) <= 0)
+            return err;
         size = FFMIN(size, s->chunksize);
     }
 #if CONFIG_ZLIB
@@ -1431,7 +1756,7 @@ static int http_close(URLContext *h)
         ret = http_shutdown(h, h->flags);
 
     if (s->hd)
-        ffurl_closep(&s->hd);
+        http_release_lower(h);
     av_dict_free(&s->chained_options);
     return ret;
 }
@@ -1440,6 +1765,7 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
 {
     HTTPContext *s = h->priv_data;
     URLContext *old_hd = s->hd;
+    HTTPPoolConn *old_conn = s->conn;
     int64_t old_off = s->off;
     uint8_t old_buf[BUFFER_SIZE];
     int old_buf_size, ret;
@@ -1470,7 +1796,8 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
     /* we save the old context in case the seek fails */
     old_buf_size = s->buf_end - s->buf_ptr;
     memcpy(old_buf, s->buf_ptr, old_buf_size);
-    s->hd = NULL;
+    s->hd   = NULL;
+    s->conn = NULL;
 
     /* if it fails, continue on old connection */
     if ((ret = http_open_cnx(h, &options)) < 0) {
@@ -1479,11 +1806,15 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
         s->buf_ptr = s->buffer;
         s->buf_end = s->buffer + old_buf_size;
         s->hd      = old_hd;
+        s->conn    = old_conn;
         s->off     = old_off;
         return ret;
     }
     av_dict_free(&options);
-    ffurl_close(old_hd);
+    if (old_conn)
+        pool_conn_close(old_conn);
+    else
+        ffurl_close(old_hd);
     return off;
 }
 
@@ -61,6 +61,8 @@ typedef struct VideoDemuxData {
     int start_number_range;
     int frame_size;
     int ts_from_file;
+    int prefetch;           /**< Set by a private option. */
+    struct ImagePrefetch *prefetch_ctx;
 } VideoDemuxData;
 
 typedef struct IdStrMap {
@@ -29,6 +29,7 @@
 #include "libavutil/pixdesc.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/intreadwrite.h"
+#include "libavutil/thread.h"
 #include "avformat.h"
 #include "avio_internal.h"
 #include "internal.h"
@@ -369,6 +370,375 @@ int ff_img_read_header(AVFormatContext *s1)
     return 0;
 }
 
+static int get_frame_filename(VideoDemuxData *s, char *buf, int buf_size,
+                              int number)
+{
+    if (s->pattern_type == PT_NONE) {
+        av_strlcpy(buf, s->path, buf_size);
+    } else if (s->use_glob) {
+#if HAVE_GLOB
+        av_strlcpy(buf, s->globstate.gl_pathv[number], buf_size);
+#endif
+    } else {
+        if (av_get_frame_filename(buf, buf_size, s->path, number) < 0 &&
+            number > 1)
+            return AVERROR(EIO);
+    }
+    return 0;
+}
+
+static void probe_codec_id(AVCodecParameters *par, const char *filename,
+                           const uint8_t *buf, int size)
+{
+    AVProbeData pd = { 0 };
+    AVInputFormat *ifmt;
+    uint8_t header[PROBE_BUF_MIN + AVPROBE_PADDING_SIZE];
+    int score = 0;
+
+    size = FFMIN(size, PROBE_BUF_MIN);
+    memcpy(header, buf, size);
+    memset(header + size, 0, sizeof(header) - size);
+    pd.buf = header;
+    pd.buf_size = size;
+    pd.filename = filename;
+
+    ifmt = av_probe_input_format3(&pd, 1, &score);
+    if (ifmt && ifmt->read_packet == ff_img_read_packet && ifmt->raw_codec_id)
+        par->codec_id = ifmt->raw_codec_id;
+}
+
+#if HAVE_THREADS
+/* the loading is bound by the storage rather than the CPU, but there is
+ * little to gain from more parallel requests than this */
+#define PREFETCH_MAX_THREADS 8
+#define PREFETCH_READ_CHUNK  65536
+
+enum ImagePrefetchState {
+    PREFETCH_FREE,
+    PREFETCH_QUEUED,
+    PREFETCH_LOADING,
+    PREFETCH_DONE,
+};
+
+typedef struct ImagePrefetchSlot {
+    enum ImagePrefetchState state;
+    char filename[1024];
+    int img_number;
+    AVPacket pkt;
+    int size;           ///< size of the file as returned by avio_size()
+    int64_t mtime;      ///< file timestamp for ts_from_file
+    int open_failed;
+    int ret;
+} ImagePrefetchSlot;
+
+/* The upcoming files are loaded into a ring of slots by a pool of threads.
+ * The slots from head to head + nb_queued belong to the frames being
+ * prefetched, in the order in which they are returned. All the fields are
+ * protected by mutex, except the contents of a LOADING slot, which belong
+ * to the thread loading it. */
+typedef struct ImagePrefetch {
+    AVFormatContext *s1;
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int abort;
+    ImagePrefetchSlot *slots;
+    int nb_slots;
+    int head;
+    int nb_queued;
+    int next_number;    ///< image number of the next frame to schedule
+} ImagePrefetch;
+
+/* read a file whose size is unknown, e.g. from a protocol without seeking */
+static int prefetch_read_unsized(AVIOContext *f, AVPacket *pkt)
+{
+    int ret, size = 0;
+
+    if ((ret = av_new_packet(pkt, 0)) < 0)
+        return ret;
+    for (;;) {
+        if ((ret = av_grow_packet(pkt, PREFETCH_READ_CHUNK)) < 0)
+            break;
+        ret = avio_read(f, pkt->data + size, PREFETCH_READ_CHUNK);
+        if (ret <= 0)
+            break;
+        size += ret;
+        av_shrink_packet(pkt, size);
+    }
+    av_shrink_packet(pkt, size);
+    if (ret == AVERROR_EOF || (!ret && size))
+        ret = 0;
+    return ret < 0 ? ret : size;
+}
+
+static void prefetch_load(ImagePrefetch *p, ImagePrefetchSlot *slot)
+{
+    AVFormatContext *s1 = p->s1;
+    VideoDemuxData *s = s1->priv_data;
+    AVIOContext *f = NULL;
+    int64_t size;
+    int ret;
+
+    if (s1->io_open(s1, &f, slot->filename, AVIO_FLAG_READ, NULL) < 0) {
+        slot->open_failed = 1;
+        slot->ret = AVERROR(EIO);
+        return;
+    }
+    size = avio_size(f);
+    if (size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    if (s->ts_from_file) {
+        struct stat img_stat;
+        if (stat(slot->filename, &img_stat)) {
+            ret = AVERROR(EIO);
+            goto end;
+        }
+        slot->mtime = (int64_t)img_stat.st_mtime;
+#if HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+        if (s->ts_from_file == 2)
+            slot->mtime = 1000000000*slot->mtime + img_stat.st_mtim.tv_nsec;
+#endif
+    }
+
+    if (size < 0) {
+        ret = prefetch_read_unsized(f, &slot->pkt);
+        slot->size = FFMAX(ret, 0);
+    } else {
+        slot->size = size;
+        if ((ret = av_new_packet(&slot->pkt, slot->size)) < 0)
+            goto end;
+        ret = avio_read(f, slot->pkt.data, slot->size);
+    }
+    if (ret <= 0) {
+        av_packet_unref(&slot->pkt);
+        if (!ret)
+            ret = AVERROR_EOF;
+    } else {
+        slot->pkt.size = ret;
+    }
+
+end:
+    ff_format_io_close(s1, &f);
+    slot->ret = FFMIN(ret, 0);
+}
+
+static void *prefetch_thread(void *opaque)
+{
+    ImagePrefetch *p = opaque;
+
+    pthread_mutex_lock(&p->mutex);
+    while (!p->abort) {
+        ImagePrefetchSlot *slot = NULL;
+        int i;
+
+        for (i = 0; i < p->nb_queued; i++) {
+            ImagePrefetchSlot *cur = &p->slots[(p->head + i) % p->nb_slots];
+            if (cur->state == PREFETCH_QUEUED) {
+                slot = cur;
+                break;
+            }
+        }
+        if (!slot) {
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+
+        slot->state = PREFETCH_LOADING;
+        pthread_mutex_unlock(&p->mutex);
+        prefetch_load(p, slot);
+        pthread_mutex_lock(&p->mutex);
+        slot->state = PREFETCH_DONE;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+/* Queue the frames following the ones already queued, following the
+ * same sequence as ff_img_read_packet(). Must be called with mutex held. */
+static void prefetch_schedule(VideoDemuxData *s, ImagePrefetch *p)
+{
+    while (p->nb_queued < p->nb_slots) {
+        ImagePrefetchSlot *slot;
+
+        if (s->loop && p->next_number > s->img_last)
+            p->next_number = s->img_first;
+        if (p->next_number > s->img_last)
+            break;
+
+        slot = &p->slots[(p->head + p->nb_queued) % p->nb_slots];
+        slot->img_number  = p->next_number;
+        slot->open_failed = 0;
+        slot->ret         = get_frame_filename(s, slot->filename,
+                                               sizeof(slot->filename),
+                                               p->next_number);
+        slot->state       = slot->ret < 0 ? PREFETCH_DONE : PREFETCH_QUEUED;
+        p->nb_queued++;
+        p->next_number++;
+    }
+    pthread_cond_broadcast(&p->cond);
+}
+
+/* Drop all the prefetched frames. Must be called with mutex held. */
+static void prefetch_flush(ImagePrefetch *p)
+{
+    int i;
+
+    for (i = 0; i < p->nb_slots; i++)
+        if (p->slots[i].state == PREFETCH_QUEUED)
+            p->slots[i].state = PREFETCH_FREE;
+    for (i = 0; i < p->nb_slots; i++) {
+        while (p->slots[i].state == PREFETCH_LOADING)
+            pthread_cond_wait(&p->cond, &p->mutex);
+        av_packet_unref(&p->slots[i].pkt);
+        p->slots[i].state = PREFETCH_FREE;
+    }
+    p->head      = 0;
+    p->nb_queued = 0;
+}
+
+static void prefetch_close(VideoDemuxData *s)
+{
+    ImagePrefetch *p = s->prefetch_ctx;
+    int i;
+
+    if (!p)
+        return;
+
+    pthread_mutex_lock(&p->mutex);
+    prefetch_flush(p);
+    p->abort = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    for (i = 0; i < p->nb_threads; i++)
+        pthread_join(p->threads[i], NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    av_freep(&p->threads);
+    av_freep(&p->slots);
+    av_freep(&s->prefetch_ctx);
+}
+
+static int prefetch_init(AVFormatContext *s1)
+{
+    VideoDemuxData *s = s1->priv_data;
+    ImagePrefetch *p;
+    int i, ret;
+
+    p = s->prefetch_ctx = av_mallocz(sizeof(*p));
+    if (!p)
+        return AVERROR(ENOMEM);
+    p->s1       = s1;
+    p->nb_slots = s->prefetch;
+    p->slots    = av_calloc(p->nb_slots, sizeof(*p->slots));
+    p->threads  = av_calloc(FFMIN(p->nb_slots, PREFETCH_MAX_THREADS),
+                            sizeof(*p->threads));
+    if (!p->slots || !p->threads) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (i = 0; i < p->nb_slots; i++)
+        av_init_packet(&p->slots[i].pkt);
+    if ((ret = pthread_mutex_init(&p->mutex, NULL))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&p->cond, NULL))) {
+        pthread_mutex_destroy(&p->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    for (i = 0; i < FFMIN(p->nb_slots, PREFETCH_MAX_THREADS); i++) {
+        if ((ret = pthread_create(&p->threads[i], NULL, prefetch_thread, p))) {
+            av_log(s1, AV_LOG_WARNING, "Unable to start a prefetch thread: %s\n",
+                   av_err2str(AVERROR(ret)));
+            break;
+        }
+        p->nb_threads++;
+    }
+    if (!p->nb_threads) {
+        prefetch_close(s);
+        return AVERROR(ret);
+    }
+    return 0;
+fail:
+    av_freep(&p->slots);
+    av_freep(&p->threads);
+    av_freep(&s->prefetch_ctx);
+    return ret;
+}
+
+static int prefetch_read_packet(AVFormatContext *s1, AVPacket *pkt)
+{
+    VideoDemuxData *s = s1->priv_data;
+    ImagePrefetch *p = s->prefetch_ctx;
+    AVCodecParameters *par = s1->streams[0]->codecpar;
+    ImagePrefetchSlot *slot;
+    int ret;
+
+    if (!p && (ret = prefetch_init(s1)) < 0)
+        return ret;
+    p = s->prefetch_ctx;
+
+    pthread_mutex_lock(&p->mutex);
+    /* after a seek the queued frames are not the ones needed */
+    if (p->nb_queued && p->slots[p->head].img_number != s->img_number)
+        prefetch_flush(p);
+    if (!p->nb_queued)
+        p->next_number = s->img_number;
+    prefetch_schedule(s, p);
+
+    slot = &p->slots[p->head];
+    while (slot->state != PREFETCH_DONE)
+        pthread_cond_wait(&p->cond, &p->mutex);
+    pthread_mutex_unlock(&p->mutex);
+
+    if (slot->ret < 0) {
+        if (slot->open_failed)
+            av_log(s1, AV_LOG_ERROR, "Could not open file : %s\n",
+                   slot->filename);
+        ret = slot->ret;
+        pthread_mutex_lock(&p->mutex);
+        prefetch_flush(p);
+        pthread_mutex_unlock(&p->mutex);
+        return ret;
+    }
+
+    if (par->codec_id == AV_CODEC_ID_NONE)
+        probe_codec_id(par, slot->filename, slot->pkt.data, slot->pkt.size);
+    if (par->codec_id == AV_CODEC_ID_RAWVIDEO && !par->width)
+        infer_size(&par->width, &par->height, slot->size);
+
+    av_packet_move_ref(pkt, &slot->pkt);
+    pkt->stream_index = 0;
+    pkt->flags       |= AV_PKT_FLAG_KEY;
+    if (s->ts_from_file) {
+        pkt->pts = slot->mtime;
+        av_add_index_entry(s1->streams[0], s->img_number, pkt->pts, 0, 0, AVINDEX_KEYFRAME);
+    } else {
+        pkt->pts = s->pts;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    slot->state  = PREFETCH_FREE;
+    p->head      = (p->head + 1) % p->nb_slots;
+    p->nb_queued--;
+    prefetch_schedule(s, p);
+    pthread_mutex_unlock(&p->mutex);
+
+    s->img_count++;
+    s->img_number++;
+    s->pts++;
+    return 0;
+}
+#endif
+
 int ff_img_read_packet(AVFormatContext *s1, AVPacket *pkt)
 {
     VideoDemuxData *s = s1->priv_data;
@@ -386,18 +756,13 @@ int ff_img_read_packet(AVFormatContext *s1, AVPacket *pkt)
         }
         if (s->img_number > s->img_last)
             return AVERROR_EOF;
-        if (s->pattern_type == PT_NONE) {
-            av_strlcpy(filename_bytes, s->path, sizeof(filename_bytes));
-        } else if (s->use_glob) {
-#if HAVE_GLOB
-            filename = s->globstate.gl_pathv[s->img_number];
+#if HAVE_THREADS
+        if (s->prefetch && !s->split_planes && !s1->pb)
+            return prefetch_read_packet(s1, pkt);
 #endif
-        } else {
-        if (av_get_frame_filename(filename_bytes, sizeof(filename_bytes),
-                                  s->path,
-                                  s->img_number) < 0 && s->img_number > 1)
+        if (get_frame_filename(s, filename_bytes, sizeof(filename_bytes),
+                               s->img_number) < 0)
             return AVERROR(EIO);
-        }
         for (i = 0; i < 3; i++) {
             if (s1->pb &&
                 !strcmp(filename_bytes, s->path) &&
@@ -419,24 +784,14 @@ int ff_img_read_packet(AVFormatContext *s1, AVPacket *pkt)
         }
 
         if (par->codec_id == AV_CODEC_ID_NONE) {
-            AVProbeData pd = { 0 };
-            AVInputFormat *ifmt;
-            uint8_t header[PROBE_BUF_MIN + AVPROBE_PADDING_SIZE];
+            uint8_t header[PROBE_BUF_MIN];
             int ret;
-            int score = 0;
 
             ret = avio_read(f[0], header, PROBE_BUF_MIN);
             if (ret < 0)
                 return ret;
-            memset(header + ret, 0, sizeof(header) - ret);
             avio_skip(f[0], -ret);
-            pd.buf = header;
-            pd.buf_size = ret;
-            pd.filename = filename;
-
-            ifmt = av_probe_input_format3(&pd, 1, &score);
-            if (ifmt && ifmt->read_packet == ff_img_read_packet && ifmt->raw_codec_id)
-                par->codec_id = ifmt->raw_codec_id;
+            probe_codec_id(par, filename, header, ret);
         }
 
         if (par->codec_id == AV_CODEC_ID_RAWVIDEO && !par->width)
@@ -529,8 +884,11 @@ fail:
 
 static int img_read_close(struct AVFormatContext* s1)
 {
-#if HAVE_GLOB
     VideoDemuxData *s = s1->priv_data;
+#if HAVE_THREADS
+    prefetch_close(s);
+#endif
+#if HAVE_GLOB
     if (s->use_glob) {
         globfree(&s->globstate);
     }
@@ -575,6 +933,7 @@ const AVOption ff_img_options[] = {
     { "start_number_range", "set range for looking at the first sequence number", OFFSET(start_number_range), AV_OPT_TYPE_INT, {.i64 = 5}, 1, INT_MAX, DEC },
     { "video_size",   "set video size",                      OFFSET(width),        AV_OPT_TYPE_IMAGE_SIZE, {.str = NULL}, 0, 0,   DEC },
     { "frame_size",   "force frame size in bytes",           OFFSET(frame_size),   AV_OPT_TYPE_INT,    {.i64 = 0   }, 0, INT_MAX, DEC },
+    { "prefetch",     "number of upcoming files to read in parallel", OFFSET(prefetch), AV_OPT_TYPE_INT, {.i64 = 0   }, 0, 64,      DEC },
     { "ts_from_file", "set frame timestamp from file's one", OFFSET(ts_from_file), AV_OPT_TYPE_INT,    {.i64 = 0   }, 0, 2,       DEC, "ts_type" },
     { "none", "none",                   0, AV_OPT_TYPE_CONST,    {.i64 = 0   }, 0, 2,       DEC, "ts_type" },
     { "sec",  "second precision",       0, AV_OPT_TYPE_CONST,    {.i64 = 1   }, 0, 2,       DEC, "ts_type" },
@@ -26,12 +26,27 @@
 #include "libavutil/log.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/thread.h"
 #include "libavutil/time_internal.h"
 #include "avformat.h"
 #include "avio_internal.h"
 #include "internal.h"
 #include "img2.h"
 
+#if HAVE_THREADS
+enum ImageWriteState {
+    WRITE_FREE,
+    WRITE_QUEUED,
+    WRITE_BUSY,
+};
+
+typedef struct ImageWriteJob {
+    enum ImageWriteState state;
+    char filename[1024];
+    AVPacket pkt;
+} ImageWriteJob;
+#endif
+
 typedef struct VideoMuxData {
     const AVClass *class;  /**< Class for private options. */
     int img_number;
@@ -44,8 +59,181 @@ typedef struct VideoMuxData {
     int use_strftime;
     const char *muxer;
     int use_rename;
+    int write_threads;
+#if HAVE_THREADS
+    /* Files written by a pool of threads, see write_packet_threaded().
+     * jobs, abort and write_error are protected by mutex. */
+    ImageWriteJob *jobs;
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int abort;
+    int write_error;
+#endif
 } VideoMuxData;
 
+#if HAVE_THREADS
+static int write_file(AVFormatContext *s, const char *filename,
+                      const AVPacket *pkt)
+{
+    VideoMuxData *img = s->priv_data;
+    AVIOContext *pb;
+    char tmp[1024];
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= sizeof(tmp)) {
+        av_log(s, AV_LOG_ERROR, "Filename too long: %s\n", filename);
+        return AVERROR(EINVAL);
+    }
+    if (s->io_open(s, &pb, img->use_rename ? tmp : filename, AVIO_FLAG_WRITE, NULL) < 0) {
+        av_log(s, AV_LOG_ERROR, "Could not open file : %s\n", img->use_rename ? tmp : filename);
+        return AVERROR(EIO);
+    }
+    avio_write(pb, pkt->data, pkt->size);
+    avio_flush(pb);
+    ff_format_io_close(s, &pb);
+    if (img->use_rename)
+        return ff_rename(tmp, filename, s);
+    return 0;
+}
+
+static void *write_thread(void *opaque)
+{
+    AVFormatContext *s = opaque;
+    VideoMuxData *img = s->priv_data;
+
+    pthread_mutex_lock(&img->mutex);
+    while (!img->abort) {
+        ImageWriteJob *job = NULL;
+        int i, ret;
+
+        for (i = 0; i < img->write_threads; i++) {
+            if (img->jobs[i].state == WRITE_QUEUED) {
+                job = &img->jobs[i];
+                break;
+            }
+        }
+        if (!job) {
+            pthread_cond_wait(&img->cond, &img->mutex);
+            continue;
+        }
+
+        job->state = WRITE_BUSY;
+        pthread_mutex_unlock(&img->mutex);
+        ret = write_file(s, job->filename, &job->pkt);
+        av_packet_unref(&job->pkt);
+        pthread_mutex_lock(&img->mutex);
+        if (ret < 0 && !img->write_error)
+            img->write_error = ret;
+        job->state = WRITE_FREE;
+        pthread_cond_broadcast(&img->cond);
+    }
+    pthread_mutex_unlock(&img->mutex);
+    return NULL;
+}
+
+static void stop_write_threads(AVFormatContext *s)
+{
+    VideoMuxData *img = s->priv_data;
+    int i;
+
+    if (!img->jobs)
+        return;
+
+    pthread_mutex_lock(&img->mutex);
+    img->abort = 1;
+    pthread_cond_broadcast(&img->cond);
+    pthread_mutex_unlock(&img->mutex);
+
+    for (i = 0; i < img->nb_threads; i++)
+        pthread_join(img->threads[i], NULL);
+    for (i = 0; i < img->write_threads; i++)
+        av_packet_unref(&img->jobs[i].pkt);
+    pthread_cond_destroy(&img->cond);
+    pthread_mutex_destroy(&img->mutex);
+    av_freep(&img->threads);
+    av_freep(&img->jobs);
+}
+
+static int start_write_threads(AVFormatContext *s)
+{
+    VideoMuxData *img = s->priv_data;
+    int i, ret = 0;
+
+    img->jobs    = av_calloc(img->write_threads, sizeof(*img->jobs));
+    img->threads = av_calloc(img->write_threads, sizeof(*img->threads));
+    if (!img->jobs || !img->threads) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (i = 0; i < img->write_threads; i++)
+        av_init_packet(&img->jobs[i].pkt);
+    if ((ret = pthread_mutex_init(&img->mutex, NULL))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&img->cond, NULL))) {
+        pthread_mutex_destroy(&img->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    for (i = 0; i < img->write_threads; i++) {
+        if ((ret = pthread_create(&img->threads[i], NULL, write_thread, s))) {
+            av_log(s, AV_LOG_WARNING, "Unable to start a write thread: %s\n",
+                   av_err2str(AVERROR(ret)));
+            break;
+        }
+        img->nb_threads++;
+    }
+    if (!img->nb_threads) {
+        stop_write_threads(s);
+        return AVERROR(ret);
+    }
+    return 0;
+fail:
+    av_freep(&img->jobs);
+    av_freep(&img->threads);
+    return ret;
+}
+
+/* Hand the packet over to the first free write thread, waiting for one
+ * if all of them are busy. The files are independent, so they may be
+ * completed in any order. */
+static int write_packet_threaded(AVFormatContext *s, AVPacket *pkt,
+                                 const char *filename)
+{
+    VideoMuxData *img = s->priv_data;
+    ImageWriteJob *job = NULL;
+    int i, ret;
+
+    pthread_mutex_lock(&img->mutex);
+    while (!img->write_error) {
+        for (i = 0; i < img->write_threads; i++) {
+            if (img->jobs[i].state == WRITE_FREE) {
+                job = &img->jobs[i];
+                break;
+            }
+        }
+        if (job)
+            break;
+        pthread_cond_wait(&img->cond, &img->mutex);
+    }
+    ret = img->write_error;
+    if (!ret && (ret = av_packet_ref(&job->pkt, pkt)) >= 0) {
+        av_strlcpy(job->filename, filename, sizeof(job->filename));
+        job->state = WRITE_QUEUED;
+        pthread_cond_broadcast(&img->cond);
+    }
+    pthread_mutex_unlock(&img->mutex);
+    if (ret < 0)
+        return ret;
+
+    img->img_number++;
+    return 0;
+}
+#endif
+
 static int write_header(AVFormatContext *s)
 {
     VideoMuxData *img = s->priv_data;
@@ -72,6 +260,11 @@ static int write_header(AVFormatContext *s)
                              && desc->nb_components >= 3;
     }
 
+#if HAVE_THREADS
+    if (img->write_threads && !img->is_pipe && !img->split_planes &&
+        !img->muxer && !img->update && !img->use_strftime)
+        return start_write_threads(s);
+#endif
     return 0;
 }
 
@@ -104,8 +297,16 @@ static int write_packet(AVFormatContext *s, AVPacket *pkt)
                    img->img_number, img->path);
             return AVERROR(EINVAL);
         }
+#if HAVE_THREADS
+        if (img->jobs)
+            return write_packet_threaded(s, pkt, filename);
+#endif
         for (i = 0; i < 4; i++) {
-            snprintf(img->tmp[i], sizeof(img->tmp[i]), "%s.tmp", filename);
+            if (snprintf(img->tmp[i], sizeof(img->tmp[i]), "%s.tmp",
+                         filename) >= sizeof(img->tmp[i])) {
+                av_log(s, AV_LOG_ERROR, "Filename too long: %s\n", filename);
+                return AVERROR(EINVAL);
+            }
             av_strlcpy(img->target[i], filename, sizeof(img->target[i]));
             if (s->io_open(s, &pb[i], img->use_rename ? img->tmp[i] : filename, AVIO_FLAG_WRITE, NULL) < 0) {
                 av_log(s, AV_LOG_ERROR, "Could not open file : %s\n", img->use_rename ? img->tmp[i] : filename);
@@ -186,6 +387,33 @@ static int write_packet(AVFormatContext *s, AVPacket *pkt)
     return 0;
 }
 
+static int write_trailer(AVFormatContext *s)
+{
+#if HAVE_THREADS
+    VideoMuxData *img = s->priv_data;
+    int i, ret = 0;
+
+    if (img->jobs) {
+        pthread_mutex_lock(&img->mutex);
+        for (i = 0; i < img->write_threads; i++)
+            while (img->jobs[i].state != WRITE_FREE)
+                pthread_cond_wait(&img->cond, &img->mutex);
+        ret = img->write_error;
+        pthread_mutex_unlock(&img->mutex);
+    }
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+static void img_deinit(AVFormatContext *s)
+{
+#if HAVE_THREADS
+    stop_write_threads(s);
+#endif
+}
+
 static int query_codec(enum AVCodecID id, int std_compliance)
 {
     int i;
@@ -205,6 +433,7 @@ static const AVOption muxoptions[] = {
     { "start_number", "set first number in the sequence", OFFSET(img_number), AV_OPT_TYPE_INT,  { .i64 = 1 }, 0, INT_MAX, ENC },
     { "strftime",     "use strftime for filename", OFFSET(use_strftime),  AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, ENC },
     { "atomic_writing", "write files atomically (using temporary files and renames)", OFFSET(use_rename), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, ENC },
+    { "write_threads", "number of files to write in parallel", OFFSET(write_threads), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, ENC },
     { NULL },
 };
 
@@ -226,6 +455,8 @@ AVOutputFormat ff_image2_muxer = {
     .video_codec    = AV_CODEC_ID_MJPEG,
     .write_header   = write_header,
     .write_packet   = write_packet,
+    .write_trailer  = write_trailer,
+    .deinit         = img_deinit,
     .query_codec    = query_codec,
     .flags          = AVFMT_NOTIMESTAMPS | AVFMT_NODIMENSIONS | AVFMT_NOFILE,
     .priv_class     = &img2mux_class,
@@ -239,6 +470,8 @@ AVOutputFormat ff_image2pipe_muxer = {
     .video_codec    = AV_CODEC_ID_MJPEG,
     .write_header   = write_header,
     .write_packet   = write_packet,
+    .write_trailer  = write_trailer,
+    .deinit         = img_deinit,
     .query_codec    = query_codec,
     .flags          = AVFMT_NOTIMESTAMPS | AVFMT_NODIMENSIONS
 };
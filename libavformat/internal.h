@@ -78,6 +78,13 @@ struct AVFormatInternal {
     struct AVPacketList *packet_buffer;
     struct AVPacketList *packet_buffer_end;
 
+    /**
+     * Unused packet_buffer list entries, reused so that queueing a packet
+     * for interleaving does not allocate.
+     * Muxing only.
+     */
+    struct AVPacketList *packet_buffer_pool;
+
     /* av_seek_frame() support */
     int64_t data_offset; /**< offset of the first packet */
 
@@ -162,6 +169,17 @@ struct AVStreamInternal {
      * Whether the internal avctx needs to be updated from codecpar (after a late change to codecpar)
      */
     int need_context_update;
+
+    /**
+     * State of the AVFMT_FLAG_FAST_START mode of avformat_find_stream_info().
+     * info_decode_pos is the last packet buffer entry the stream has been
+     * scanned up to for decoding, info_nb_pending the number of its packets
+     * buffered after it and info_needs_decode whether the stream still
+     * needs a decoder to complete its parameters.
+     */
+    AVPacketList *info_decode_pos;
+    int info_nb_pending;
+    int info_needs_decode;
 };
 
 #ifdef __GNUC__
@@ -315,6 +333,21 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
                        unsigned int *index_entries_allocated_size,
                        int64_t pos, int64_t timestamp, int size, int distance, int flags);
 
+/**
+ * Add a run of index entries to a stream with a single move of the entries
+ * following them, instead of one per entry.
+ *
+ * The entries must have strictly increasing timestamps and all go between
+ * the same two existing entries, as when a fragment is indexed before
+ * fragments that follow it. The fields are used as in av_add_index_entry(),
+ * with min_distance as the distance.
+ *
+ * @return the index of the first added entry, or a negative AVERROR code
+ *         if the entries cannot be added as one run; the stream index is
+ *         unchanged then and the entries can be added one by one
+ */
+int ff_add_index_entries(AVStream *st, const AVIndexEntry *entries, int nb_entries);
+
 void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance);
 
 /**
@@ -569,6 +602,13 @@ int ffio_open2_wrapper(struct AVFormatContext *s, AVIOContext **pb, const char *
  */
 void ff_format_io_close(AVFormatContext *s, AVIOContext **pb);
 
+/**
+ * Check whether s opens and closes its files with the default
+ * AVFormatContext.io_open and io_close callbacks, i.e. whether opening a
+ * file with ffio_open_whitelist() directly is equivalent.
+ */
+int ff_format_io_open_is_default(AVFormatContext *s);
+
 /**
  * Parse creation_time in AVFormatContext metadata if exists and warn if the
  * parsing fails.
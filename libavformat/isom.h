@@ -87,6 +87,7 @@ typedef struct MOVFragment {
     unsigned size;
     unsigned flags;
     int64_t time;
+    int time_from_tfra;   ///< time is a tfra presentation time, only used without tfdt
 } MOVFragment;
 
 typedef struct MOVTrackExt {
@@ -112,6 +113,7 @@ typedef struct MOVFragmentIndex {
     unsigned track_id;
     unsigned item_count;
     unsigned current_item;
+    int from_tfra;        ///< index was read from a tfra box
     MOVFragmentIndexItem *items;
 } MOVFragmentIndex;
 
@@ -219,6 +221,9 @@ typedef struct MOVContext {
     MOVFragmentIndex** fragment_index_data;
     unsigned fragment_index_count;
     int fragment_index_complete;
+    int lazy_fragment_index; ///< parse fragments on demand from the sidx/mfra index
+    AVIndexEntry *frag_index_entries; ///< index entries of the trun being read
+    unsigned int frag_index_entries_allocated_size;
     int atom_depth;
     unsigned int aax_mode;  ///< 'aax' file has been detected
     uint8_t file_key[20];
@@ -1134,15 +1134,20 @@ static int mov_read_moov(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 
 static int mov_read_moof(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
-    if (!c->has_looked_for_mfra && c->use_mfra_for > 0) {
+    int lazy_index = 0, ret;
+
+    if (!c->has_looked_for_mfra &&
+        (c->use_mfra_for > 0 ||
+         (c->lazy_fragment_index && !c->fragment_index_complete))) {
         c->has_looked_for_mfra = 1;
         if (pb->seekable) {
-            int ret;
             av_log(c->fc, AV_LOG_VERBOSE, "stream has moof boxes, will look "
                     "for a mfra\n");
             if ((ret = mov_read_mfra(c, pb)) < 0) {
                 av_log(c->fc, AV_LOG_VERBOSE, "found a moof box but failed to "
                         "read the mfra (may be a live ismv)\n");
+            } else if (c->lazy_fragment_index && c->fragment_index_count) {
+                lazy_index = 1;
             }
         } else {
             av_log(c->fc, AV_LOG_VERBOSE, "found a moof box but stream is not "
@@ -1151,7 +1156,12 @@ static int mov_read_moof(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     }
     c->fragment.moof_offset = c->fragment.implicit_offset = avio_tell(pb) - 8;
     av_log(c->fc, AV_LOG_TRACE, "moof offset %"PRIx64"\n", c->fragment.moof_offset);
-    return mov_read_default(c, pb, atom);
+    ret = mov_read_default(c, pb, atom);
+    /* only set once this moof is parsed, the remaining fragments are then
+     * parsed when reached */
+    if (lazy_index)
+        c->fragment_index_complete = 1;
+    return ret;
 }
 
 static void mov_metadata_creation_time(AVDictionary **metadata, int64_t time)
@@ -3474,6 +3484,7 @@ static int mov_read_tfhd(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     MOVFragment *frag = &c->fragment;
     MOVTrackExt *trex = NULL;
     MOVFragmentIndex* index = NULL;
+    int64_t moof_offset;
     int flags, track_id, i, found = 0;
 
     avio_r8(pb); /* version */
@@ -3505,6 +3516,10 @@ static int mov_read_tfhd(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     frag->flags    = flags & MOV_TFHD_DEFAULT_FLAGS ?
                      avio_rb32(pb) : trex->flags;
     frag->time     = AV_NOPTS_VALUE;
+    frag->time_from_tfra = 0;
+    /* fragments are entered out of order with a lazy index, the implicit
+     * offset is then the one after the previously parsed fragment */
+    moof_offset = c->lazy_fragment_index ? frag->moof_offset : frag->implicit_offset;
     for (i = 0; i < c->fragment_index_count; i++) {
         int j;
         MOVFragmentIndex* candidate = c->fragment_index_data[i];
@@ -3513,11 +3528,18 @@ static int mov_read_tfhd(MOVContext *c, AVIOContext *pb, MOVAtom atom)
                    "found fragment index for track %u\n", frag->track_id);
             index = candidate;
             for (j = index->current_item; j < index->item_count; j++) {
-                if (frag->implicit_offset == index->items[j].moof_offset) {
+                if (moof_offset == index->items[j].moof_offset) {
                     av_log(c->fc, AV_LOG_DEBUG, "found fragment index entry "
                             "for track %u and moof_offset %"PRId64"\n",
                             frag->track_id, index->items[j].moof_offset);
-                    frag->time = index->items[j].time;
+                    if (!index->from_tfra || c->use_mfra_for > 0) {
+                        frag->time = index->items[j].time;
+                    } else if (c->lazy_fragment_index) {
+                        frag->time = index->items[j].time;
+                        frag->time_from_tfra = 1;
+                    }
+                    if (c->lazy_fragment_index)
+                        index->items[j].headers_read = 1;
                     index->current_item = j + 1;
                     found = 1;
                     break;
@@ -3530,7 +3552,7 @@ static int mov_read_tfhd(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     if (index && !found) {
         av_log(c->fc, AV_LOG_DEBUG, "track %u has a fragment index but "
                "it doesn't have an (in-order) entry for moof_offset "
-               "%"PRId64"\n", frag->track_id, frag->implicit_offset);
+               "%"PRId64"\n", frag->track_id, moof_offset);
     }
     av_log(c->fc, AV_LOG_TRACE, "frag flags 0x%x\n", frag->flags);
     return 0;
@@ -3588,6 +3610,9 @@ static int mov_read_tfdt(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     sc = st->priv_data;
     if (sc->pseudo_stream_id + 1 != frag->stsd_id)
         return 0;
+    /* the decode time is exact, unlike the time of a lazily used tfra */
+    if (frag->time_from_tfra)
+        frag->time = AV_NOPTS_VALUE;
     version = avio_r8(pb);
     avio_rb24(pb); /* flags */
     if (version) {
@@ -3598,6 +3623,97 @@ static int mov_read_tfdt(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     return 0;
 }
 
+/**
+ * Move the last nb entries of ctts_data, one per sample, before the entries
+ * of the later samples preceding them. The entries of the moov can cover
+ * several samples each, an entry straddling the insertion point is split.
+ * The tail entries allocated after ctts_count are kept after it.
+ */
+static int mov_move_ctts_entries(MOVStreamContext *sc, unsigned nb,
+                                 unsigned later, unsigned tail)
+{
+    unsigned end   = sc->ctts_count;
+    unsigned mid   = end - nb;
+    unsigned start = mid;
+    unsigned a, b;
+    uint64_t samples = 0;
+
+    if (nb > sc->ctts_count)
+        return 0;
+    while (start > 0 && samples < later)
+        samples += sc->ctts_data[--start].count;
+    if (samples < later)
+        return 0;
+    if (samples > later) {
+        unsigned before = samples - later;
+        int err;
+
+        if ((uint64_t)sc->ctts_count + tail + 1 >= UINT_MAX / sizeof(*sc->ctts_data))
+            return AVERROR_INVALIDDATA;
+        if ((err = av_reallocp_array(&sc->ctts_data, sc->ctts_count + tail + 1,
+                                     sizeof(*sc->ctts_data))) < 0) {
+            sc->ctts_count = 0;
+            return err;
+        }
+        memmove(&sc->ctts_data[start + 1], &sc->ctts_data[start],
+                (end + tail - start) * sizeof(*sc->ctts_data));
+        sc->ctts_data[start].count      = before;
+        sc->ctts_data[start + 1].count -= before;
+        sc->ctts_count++;
+        start++;
+        mid++;
+        end++;
+    }
+    /* rotate in place by reversing both parts and then the whole range */
+    for (a = start, b = mid; a + 1 < b; a++, b--)
+        FFSWAP(MOVStts, sc->ctts_data[a], sc->ctts_data[b - 1]);
+    for (a = mid, b = end; a + 1 < b; a++, b--)
+        FFSWAP(MOVStts, sc->ctts_data[a], sc->ctts_data[b - 1]);
+    for (a = start, b = end; a + 1 < b; a++, b--)
+        FFSWAP(MOVStts, sc->ctts_data[a], sc->ctts_data[b - 1]);
+    return 0;
+}
+
+/**
+ * Add the index entries of the nb samples of a trun, whose ctts entries are
+ * the last ones of ctts_data. When a fragment before already parsed ones is
+ * entered (seek into a lazily indexed file) the samples are inserted before
+ * others, and their ctts entries are moved along to keep ctts_data in sample
+ * order.
+ */
+static int mov_add_frag_index_entries(MOVContext *c, AVStream *st,
+                                      MOVStreamContext *sc, int nb)
+{
+    AVIndexEntry *ie = c->frag_index_entries;
+    int nb_index_entries = st->nb_index_entries;
+    int index, i, err;
+
+    index = ff_add_index_entries(st, ie, nb);
+    if (index >= 0) {
+        if (index < nb_index_entries)
+            return mov_move_ctts_entries(sc, nb, nb_index_entries - index, 0);
+        return 0;
+    }
+    if (index == AVERROR(ENOMEM))
+        return index;
+
+    /* overlapping or unordered samples, add them one by one */
+    sc->ctts_count -= nb;
+    for (i = 0; i < nb; i++) {
+        sc->ctts_count++;
+        nb_index_entries = st->nb_index_entries;
+        index = av_add_index_entry(st, ie[i].pos, ie[i].timestamp, ie[i].size,
+                                   ie[i].min_distance, ie[i].flags);
+        if (index < 0)
+            av_log(c->fc, AV_LOG_ERROR, "Failed to add index entry\n");
+        else if (st->nb_index_entries > nb_index_entries && index < nb_index_entries &&
+                 (err = mov_move_ctts_entries(sc, 1, nb_index_entries - index,
+                                               nb - i - 1)) < 0)
+            return err;
+    }
+    return 0;
+}
+
 static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
     MOVFragment *frag = &c->fragment;
@@ -3608,6 +3724,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     int64_t dts;
     int data_offset = 0;
     unsigned entries, first_sample_flags = frag->flags;
+    AVIndexEntry *ie;
     int flags, distance, i, err;
 
     for (i = 0; i < c->fc->nb_streams; i++) {
@@ -3671,7 +3788,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
                                                   avio_rb32(pb) : 0;
         mov_update_dts_shift(sc, sc->ctts_data[sc->ctts_count].duration);
         if (frag->time != AV_NOPTS_VALUE) {
-            if (c->use_mfra_for == FF_MOV_FLAG_MFRA_PTS) {
+            if (c->use_mfra_for == FF_MOV_FLAG_MFRA_PTS || frag->time_from_tfra) {
                 int64_t pts = frag->time;
                 av_log(c->fc, AV_LOG_DEBUG, "found frag time %"PRId64
                         " sc->dts_shift %d ctts.duration %d"
@@ -3701,11 +3818,18 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
                                   MOV_FRAG_SAMPLE_FLAG_DEPENDS_YES));
         if (keyframe)
             distance = 0;
-        err = av_add_index_entry(st, offset, dts, sample_size, distance,
-                                 keyframe ? AVINDEX_KEYFRAME : 0);
-        if (err < 0) {
-            av_log(c->fc, AV_LOG_ERROR, "Failed to add index entry\n");
-        }
+        ie = av_fast_realloc(c->frag_index_entries,
+                             &c->frag_index_entries_allocated_size,
+                             (i + 1) * sizeof(*ie));
+        if (!ie)
+            return AVERROR(ENOMEM);
+        c->frag_index_entries = ie;
+        ie[i].pos          = offset;
+        /* an invalid size makes av_add_index_entry() reject the sample */
+        ie[i].timestamp    = sample_size > 0x3FFFFFFF ? AV_NOPTS_VALUE : dts;
+        ie[i].size         = sample_size;
+        ie[i].min_distance = distance;
+        ie[i].flags        = keyframe ? AVINDEX_KEYFRAME : 0;
         av_log(c->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %d, offset %"PRIx64", dts %"PRId64", "
                 "size %d, distance %d, keyframe %d\n", st->index, sc->sample_count+i,
                 offset, dts, sample_size, distance, keyframe);
@@ -3717,6 +3841,9 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         sc->nb_frames_for_fps ++;
     }
 
+    if (i && (err = mov_add_frag_index_entries(c, st, sc, i)) < 0)
+        return err;
+
     if (pb->eof_reached)
         return AVERROR_EOF;
 
@@ -4775,6 +4902,7 @@ static int mov_read_close(AVFormatContext *s)
         av_freep(&mov->fragment_index_data[i]);
     }
     av_freep(&mov->fragment_index_data);
+    av_freep(&mov->frag_index_entries);
 
     av_freep(&mov->aes_decrypt);
 
@@ -4845,6 +4973,7 @@ static int read_tfra(MOVContext *mov, AVIOContext *f)
     version = avio_r8(f);
     avio_rb24(f);
     index->track_id = avio_rb32(f);
+    index->from_tfra = 1;
     fieldlength = avio_rb32(f);
     index->item_count = avio_rb32(f);
     index->items = av_mallocz_array(
@@ -4960,6 +5089,22 @@ static int mov_read_header(AVFormatContext *s)
     }
     av_log(mov->fc, AV_LOG_TRACE, "on_parse_exit_offset=%"PRId64"\n", avio_tell(pb));
 
+    /* with a lazily used mfra only the first fragment has been parsed, the
+     * last indexed fragment gives a better duration estimate */
+    if (mov->lazy_fragment_index && mov->fragment_index_complete) {
+        for (i = 0; i < mov->fragment_index_count; i++) {
+            MOVFragmentIndex *index = mov->fragment_index_data[i];
+            if (!index->from_tfra || !index->item_count)
+                continue;
+            for (j = 0; j < s->nb_streams; j++) {
+                AVStream *st = s->streams[j];
+                if (st->id == index->track_id)
+                    st->duration = FFMAX(st->duration,
+                                         index->items[index->item_count - 1].time);
+            }
+        }
+    }
+
     if (pb->seekable) {
         if (mov->chapter_track > 0 && !mov->ignore_chapters)
             mov_read_chapters(s);
@@ -5117,6 +5262,26 @@ static int should_retry(AVIOContext *pb, int error_code) {
     return 1;
 }
 
+/* Samples which are not modified in place below are returned as references
+ * to the input when it is mapped in memory, instead of being copied. */
+static int mov_get_packet(MOVContext *mov, MOVStreamContext *sc, AVPacket *pkt, int size)
+{
+    AVBufferRef *buf;
+    int64_t pos = avio_tell(sc->pb);
+
+    if (!mov->aax_mode && !sc->cenc.aes_ctr &&
+        !(mov->dv_demux && sc->dv_audio_container) &&
+        ffio_read_mapped(sc->pb, size, &buf) >= 0) {
+        av_init_packet(pkt);
+        pkt->buf  = buf;
+        pkt->data = buf->data;
+        pkt->size = size;
+        pkt->pos  = pos;
+        return size;
+    }
+    return av_get_packet(sc->pb, pkt, size);
+}
+
 static int mov_switch_root(AVFormatContext *s, int64_t target)
 {
     MOVContext *mov = s->priv_data;
@@ -5197,7 +5362,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             sc->current_sample -= should_retry(sc->pb, ret64);
             return AVERROR_INVALIDDATA;
         }
-        ret = av_get_packet(sc->pb, pkt, sample->size);
+        ret = mov_get_packet(mov, sc, pkt, sample->size);
         if (ret < 0) {
             sc->current_sample -= should_retry(sc->pb, ret);
             return ret;
@@ -5269,22 +5434,62 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
 static int mov_seek_fragment(AVFormatContext *s, AVStream *st, int64_t timestamp)
 {
     MOVContext *mov = s->priv_data;
+    unsigned track_id = st->id;
     int i, j;
 
     if (!mov->fragment_index_complete)
         return 0;
 
+    /* an mfra often only has a tfra for some of the tracks, fall back to
+     * the index of another track for the others */
+    if (mov->lazy_fragment_index && mov->fragment_index_count) {
+        for (i = 0; i < mov->fragment_index_count; i++)
+            if (mov->fragment_index_data[i]->track_id == track_id)
+                break;
+        if (i == mov->fragment_index_count) {
+            track_id = mov->fragment_index_data[0]->track_id;
+            for (i = 0; i < s->nb_streams; i++) {
+                if (s->streams[i]->id == track_id) {
+                    timestamp = av_rescale_q(timestamp, st->time_base,
+                                             s->streams[i]->time_base);
+                    break;
+                }
+            }
+            if (i == s->nb_streams)
+                return 0;
+        }
+    }
+
     for (i = 0; i < mov->fragment_index_count; i++) {
-        if (mov->fragment_index_data[i]->track_id == st->id) {
+        if (mov->fragment_index_data[i]->track_id == track_id) {
             MOVFragmentIndex *index = mov->fragment_index_data[i];
-            for (j = index->item_count - 1; j >= 0; j--) {
-                if (index->items[j].time <= timestamp) {
-                    if (index->items[j].headers_read)
-                        return 0;
+            if (!mov->lazy_fragment_index) {
+                for (j = index->item_count - 1; j >= 0; j--) {
+                    if (index->items[j].time <= timestamp) {
+                        if (index->items[j].headers_read)
+                            return 0;
 
-                    return mov_switch_root(s, index->items[j].moof_offset);
+                        return mov_switch_root(s, index->items[j].moof_offset);
+                    }
                 }
+                continue;
+            }
+            if (!index->item_count)
+                continue;
+            for (j = index->item_count - 1; j > 0; j--)
+                if (index->items[j].time <= timestamp)
+                    break;
+            /* tfra times are presentation times, the sample decoded at
+             * timestamp may be in the next fragment */
+            if (index->from_tfra && j + 1 < index->item_count &&
+                !index->items[j + 1].headers_read) {
+                int ret = mov_switch_root(s, index->items[j + 1].moof_offset);
+                if (ret < 0)
+                    return ret;
             }
+            /* also done for a fragment that was already read, so that
+             * reading continues with the fragment after it */
+            return mov_switch_root(s, index->items[j].moof_offset);
         }
     }
 
@@ -5331,6 +5536,39 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     return sample;
 }
 
+/* continue reading after the fragment of the first sample to be read */
+static int mov_seek_next_root_atom(AVFormatContext *s)
+{
+    MOVContext *mov = s->priv_data;
+    int64_t pos = INT64_MAX, moof_offset = INT64_MAX;
+    int i, j, found = 0;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        MOVStreamContext *sc = st->priv_data;
+        if (sc->current_sample < st->nb_index_entries)
+            pos = FFMIN(pos, st->index_entries[sc->current_sample].pos);
+    }
+    for (i = 0; i < mov->fragment_index_count; i++) {
+        MOVFragmentIndex *index = mov->fragment_index_data[i];
+        for (j = 0; j < index->item_count; j++) {
+            int64_t offset = index->items[j].moof_offset;
+            if (offset <= pos && (!found || offset > moof_offset)) {
+                moof_offset = offset;
+                found = 1;
+            } else if (!found) {
+                moof_offset = FFMIN(moof_offset, offset);
+            }
+        }
+    }
+    if (!found) {
+        /* samples from the moov, the first fragment is next */
+        mov->next_root_atom = moof_offset != INT64_MAX ? moof_offset : 0;
+        return 0;
+    }
+    return mov_switch_root(s, moof_offset);
+}
+
 static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_time, int flags)
 {
     MOVContext *mc = s->priv_data;
@@ -5349,18 +5587,37 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
     if (mc->seek_individually) {
         /* adjust seek timestamp to found sample timestamp */
         int64_t seek_timestamp = st->index_entries[sample].timestamp;
+        int nb_index_entries, prev_nb_index_entries = -1;
 
-        for (i = 0; i < s->nb_streams; i++) {
-            int64_t timestamp;
-            MOVStreamContext *sc = s->streams[i]->priv_data;
-            st = s->streams[i];
-            st->skip_samples = (sample_time <= 0) ? sc->start_pad : 0;
+        for (;;) {
+            nb_index_entries = 0;
+            for (i = 0; i < s->nb_streams; i++) {
+                int64_t timestamp;
+                MOVStreamContext *sc = s->streams[i]->priv_data;
+                st = s->streams[i];
+                st->skip_samples = (sample_time <= 0) ? sc->start_pad : 0;
 
-            if (stream_index == i)
-                continue;
+                if (stream_index == i)
+                    continue;
 
-            timestamp = av_rescale_q(seek_timestamp, s->streams[stream_index]->time_base, st->time_base);
-            mov_seek_stream(s, st, timestamp, flags);
+                timestamp = av_rescale_q(seek_timestamp, s->streams[stream_index]->time_base, st->time_base);
+                mov_seek_stream(s, st, timestamp, flags);
+            }
+            for (i = 0; i < s->nb_streams; i++)
+                nb_index_entries += s->streams[i]->nb_index_entries;
+            /* fragments entered for the other streams can have inserted
+             * index entries before the samples found so far */
+            if (!mc->lazy_fragment_index || nb_index_entries == prev_nb_index_entries)
+                break;
+            prev_nb_index_entries = nb_index_entries;
+            sample = mov_seek_stream(s, s->streams[stream_index], sample_time, flags);
+            if (sample < 0)
+                return sample;
+        }
+        if (mc->lazy_fragment_index && mc->fragment_index_complete) {
+            int ret = mov_seek_next_root_atom(s);
+            if (ret < 0)
+                return ret;
         }
     } else {
         for (i = 0; i < s->nb_streams; i++) {
@@ -5422,6 +5679,8 @@ static const AVOption mov_options[] = {
     { "decryption_key", "The media decryption key (hex)", OFFSET(decryption_key), AV_OPT_TYPE_BINARY, .flags = AV_OPT_FLAG_DECODING_PARAM },
     { "enable_drefs", "Enable external track support.", OFFSET(enable_drefs), AV_OPT_TYPE_BOOL,
         {.i64 = 0}, 0, 1, FLAGS },
+    { "lazy_fragment_index", "Parse fragments on demand using the sidx/mfra fragment index",
+        OFFSET(lazy_fragment_index), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS },
 
     { NULL },
 };
@@ -54,7 +54,8 @@
 static const AVOption options[] = {
     { "movflags", "MOV muxer flags", offsetof(MOVMuxContext, flags), AV_OPT_TYPE_FLAGS, {.i64 = 0}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "rtphint", "Add RTP hint tracks", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RTP_HINT}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
-    { "moov_size", "maximum moov size so it can be placed at the begin", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, 0 },
+    { "moov_size", "maximum moov size so it can be placed at the begin", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, -1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "moov_size" },
+    { "auto", "estimate the moov size from the stream durations", 0, AV_OPT_TYPE_CONST, {.i64 = -1}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "moov_size" },
     { "empty_moov", "Make the initial moov atom empty", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_EMPTY_MOOV}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "frag_keyframe", "Fragment at video keyframes", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_KEYFRAME}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "separate_moof", "Write separate moof/mdat atoms for each track", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_SEPARATE_MOOF}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
@@ -4342,25 +4343,36 @@ static void mov_parse_vc1_frame(AVPacket *pkt, MOVTrack *trk)
     }
 }
 
+/* Fragment data is buffered in chunks shared by all the fragments, which
+ * avoids reallocating and copying the buffers as they grow. */
+static int mov_open_mdat_buf(MOVMuxContext *mov, AVIOContext **pb)
+{
+    if (!mov->chunk_pool &&
+        !(mov->chunk_pool = av_buffer_pool_init(FFIO_DYN_CHUNK_SIZE, NULL)))
+        return AVERROR(ENOMEM);
+    return ffio_open_chained_dyn_buf(pb, mov->chunk_pool);
+}
+
 static int mov_flush_fragment_interleaving(AVFormatContext *s, MOVTrack *track)
 {
     MOVMuxContext *mov = s->priv_data;
-    int ret, buf_size;
-    uint8_t *buf;
+    int ret, buf_size, nb_bufs;
+    AVBufferRef **bufs;
     int i, offset;
 
     if (!track->mdat_buf)
         return 0;
     if (!mov->mdat_buf) {
-        if ((ret = avio_open_dyn_buf(&mov->mdat_buf)) < 0)
+        if ((ret = mov_open_mdat_buf(mov, &mov->mdat_buf)) < 0)
             return ret;
     }
-    buf_size = avio_close_dyn_buf(track->mdat_buf, &buf);
+    buf_size = ffio_close_chained_dyn_buf(track->mdat_buf, &bufs, &nb_bufs);
     track->mdat_buf = NULL;
+    if (buf_size < 0)
+        return buf_size;
 
     offset = avio_tell(mov->mdat_buf);
-    avio_write(mov->mdat_buf, buf, buf_size);
-    av_free(buf);
+    ffio_write_buffers(mov->mdat_buf, &bufs, nb_bufs);
 
     for (i = track->entries_flushed; i < track->entry; i++)
         track->cluster[i].pos += offset;
@@ -4429,8 +4441,8 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
 
     if (!mov->moov_written) {
         int64_t pos = avio_tell(s->pb);
-        uint8_t *buf;
-        int buf_size, moov_size;
+        AVBufferRef **bufs;
+        int buf_size, nb_bufs, moov_size;
 
         for (i = 0; i < mov->nb_streams; i++)
             if (!mov->tracks[i].entry)
@@ -4457,12 +4469,13 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
             return 0;
         }
 
-        buf_size = avio_close_dyn_buf(mov->mdat_buf, &buf);
+        buf_size = ffio_close_chained_dyn_buf(mov->mdat_buf, &bufs, &nb_bufs);
         mov->mdat_buf = NULL;
+        if (buf_size < 0)
+            return buf_size;
         avio_wb32(s->pb, buf_size + 8);
         ffio_wfourcc(s->pb, "mdat");
-        avio_write(s->pb, buf, buf_size);
-        av_free(buf);
+        ffio_write_buffers(s->pb, &bufs, nb_bufs);
 
         if (mov->flags & FF_MOV_FLAG_GLOBAL_SIDX)
             mov->reserved_header_pos = avio_tell(s->pb);
@@ -4525,8 +4538,8 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
 
     for (i = 0; i < mov->nb_streams; i++) {
         MOVTrack *track = &mov->tracks[i];
-        int buf_size, write_moof = 1, moof_tracks = -1;
-        uint8_t *buf;
+        int buf_size, nb_bufs, write_moof = 1, moof_tracks = -1;
+        AVBufferRef **bufs;
         int64_t duration = 0;
 
         if (track->entry)
@@ -4559,17 +4572,18 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
         if (!mov->frag_interleave) {
             if (!track->mdat_buf)
                 continue;
-            buf_size = avio_close_dyn_buf(track->mdat_buf, &buf);
+            buf_size = ffio_close_chained_dyn_buf(track->mdat_buf, &bufs, &nb_bufs);
             track->mdat_buf = NULL;
         } else {
             if (!mov->mdat_buf)
                 continue;
-            buf_size = avio_close_dyn_buf(mov->mdat_buf, &buf);
+            buf_size = ffio_close_chained_dyn_buf(mov->mdat_buf, &bufs, &nb_bufs);
             mov->mdat_buf = NULL;
         }
+        if (buf_size < 0)
+            return buf_size;
 
-        avio_write(s->pb, buf, buf_size);
-        av_free(buf);
+        ffio_write_buffers(s->pb, &bufs, nb_bufs);
     }
 
     mov->mdat_size = 0;
@@ -4628,13 +4642,13 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
             }
 
             if (!trk->mdat_buf) {
-                if ((ret = avio_open_dyn_buf(&trk->mdat_buf)) < 0)
+                if ((ret = mov_open_mdat_buf(mov, &trk->mdat_buf)) < 0)
                     return ret;
             }
             pb = trk->mdat_buf;
         } else {
             if (!mov->mdat_buf) {
-                if ((ret = avio_open_dyn_buf(&mov->mdat_buf)) < 0)
+                if ((ret = mov_open_mdat_buf(mov, &mov->mdat_buf)) < 0)
                     return ret;
             }
             pb = mov->mdat_buf;
@@ -5253,9 +5267,12 @@ static void mov_free(AVFormatContext *s)
             av_freep(&mov->tracks[i].vos_data);
 
         ff_mov_cenc_free(&mov->tracks[i].cenc);
+        ffio_free_chained_dyn_buf(&mov->tracks[i].mdat_buf);
     }
 
     av_freep(&mov->tracks);
+    ffio_free_chained_dyn_buf(&mov->mdat_buf);
+    av_buffer_pool_uninit(&mov->chunk_pool);
 }
 
 static uint32_t rgb_to_yuv(uint32_t rgb)
@@ -5323,6 +5340,43 @@ static int mov_create_dvd_sub_decoder_specific_info(MOVTrack *track,
     return 0;
 }
 
+/**
+ * Estimate the size of the moov atom from the number of frames of the
+ * streams, assuming one chunk and one composition offset per video frame.
+ *
+ * @return the estimated size, 0 if the length of a stream is unknown
+ */
+static int estimate_moov_size(AVFormatContext *s)
+{
+    int64_t size = 16384 + s->nb_chapters * 64;
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        int64_t nb_frames = st->nb_frames;
+
+        if (nb_frames <= 0 && st->duration > 0) {
+            if (par->codec_type == AVMEDIA_TYPE_VIDEO && st->avg_frame_rate.num)
+                nb_frames = av_rescale_q(st->duration, st->time_base,
+                                         av_inv_q(st->avg_frame_rate));
+            else if (par->codec_type == AVMEDIA_TYPE_AUDIO && par->sample_rate)
+                nb_frames = av_rescale(st->duration,
+                                       (int64_t)par->sample_rate * st->time_base.num,
+                                       (int64_t)st->time_base.den *
+                                       (par->frame_size > 0 ? par->frame_size : 1024));
+        }
+        if (nb_frames <= 0)
+            return 0;
+
+        /* stsz and chunk offsets, plus ctts and stss for video */
+        size += 1024 + nb_frames * (par->codec_type == AVMEDIA_TYPE_VIDEO ? 24 : 12);
+        if (size > INT_MAX)
+            return 0;
+    }
+    return size;
+}
+
 static int mov_write_header(AVFormatContext *s)
 {
     AVIOContext *pb = s->pb;
@@ -5364,7 +5418,15 @@ static int mov_write_header(AVFormatContext *s)
         mov->flags |= FF_MOV_FLAG_FRAGMENT | FF_MOV_FLAG_EMPTY_MOOV |
                       FF_MOV_FLAG_DEFAULT_BASE_MOOF;
 
-    if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+    if (mov->reserved_moov_size == -1) {
+        mov->reserved_moov_size = estimate_moov_size(s);
+        if (!mov->reserved_moov_size)
+            av_log(s, AV_LOG_WARNING, "Cannot estimate the moov size, "
+                   "the number of frames or duration of a stream is unknown\n");
+    }
+
+    /* Without reserved space, faststart always runs the second pass. */
+    if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size <= 0) {
         mov->reserved_moov_size = -1;
     }
 
@@ -5687,7 +5749,7 @@ static int mov_write_header(AVFormatContext *s)
             !mov->max_fragment_duration && !mov->max_fragment_size)
             mov->flags |= FF_MOV_FLAG_FRAG_KEYFRAME;
     } else {
-        if (mov->flags & FF_MOV_FLAG_FASTSTART)
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size < 0)
             mov->reserved_header_pos = avio_tell(pb);
         mov_write_mdat_tag(pb, mov);
     }
@@ -5780,13 +5842,23 @@ static int get_sidx_size(AVFormatContext *s)
     return ffio_close_null_buf(buf);
 }
 
+/*
+ * Distance the data has to be moved by to make room for the moov. If space
+ * was reserved for the moov but is too small, the data is moved past it
+ * plus a free atom, so that the moov never ends exactly where the data starts.
+ */
+static int moov_shift(int moov_size, int reserved)
+{
+    return reserved > 0 ? moov_size + 8 - reserved : moov_size;
+}
+
 /*
  * This function gets the moov size if moved to the top of the file: the chunk
  * offset table can switch between stco (32-bit entries) to co64 (64-bit
  * entries) when the moov is moved to the beginning, so the size of the moov
  * would change. It also updates the chunk offset tables.
  */
-static int compute_moov_size(AVFormatContext *s)
+static int compute_moov_size(AVFormatContext *s, int reserved)
 {
     int i, moov_size, moov_size2;
     MOVMuxContext *mov = s->priv_data;
@@ -5796,7 +5868,7 @@ static int compute_moov_size(AVFormatContext *s)
         return moov_size;
 
     for (i = 0; i < mov->nb_streams; i++)
-        mov->tracks[i].data_offset += moov_size;
+        mov->tracks[i].data_offset += moov_shift(moov_size, reserved);
 
     moov_size2 = get_moov_size(s);
     if (moov_size2 < 0)
@@ -5828,7 +5900,7 @@ static int compute_sidx_size(AVFormatContext *s)
 
 static int shift_data(AVFormatContext *s)
 {
-    int ret = 0, moov_size;
+    int ret = 0, moov_size, shift, block_size, reserved = 0;
     MOVMuxContext *mov = s->priv_data;
     int64_t pos, pos_end = avio_tell(s->pb);
     uint8_t *buf, *read_buf[2];
@@ -5836,18 +5908,25 @@ static int shift_data(AVFormatContext *s)
     int read_size[2];
     AVIOContext *read_pb;
 
-    if (mov->flags & FF_MOV_FLAG_FRAGMENT)
+    if (mov->flags & FF_MOV_FLAG_FRAGMENT) {
         moov_size = compute_sidx_size(s);
-    else
-        moov_size = compute_moov_size(s);
+    } else {
+        /* the data already follows the space reserved for the moov */
+        reserved  = FFMAX(mov->reserved_moov_size, 0);
+        moov_size = compute_moov_size(s, reserved);
+    }
     if (moov_size < 0)
         return moov_size;
+    shift      = moov_shift(moov_size, reserved);
+    /* blocks must not be smaller than the shift, as a block is read before
+     * the previous one is written */
+    block_size = FFMAX(moov_size, shift);
 
-    buf = av_malloc(moov_size * 2);
+    buf = av_malloc(block_size * 2);
     if (!buf)
         return AVERROR(ENOMEM);
     read_buf[0] = buf;
-    read_buf[1] = buf + moov_size;
+    read_buf[1] = buf + block_size;
 
     /* Shift the data: the AVIO context of the output can only be used for
      * writing, so we re-open the same output, but for reading. It also avoids
@@ -5863,18 +5942,19 @@ static int shift_data(AVFormatContext *s)
     /* mark the end of the shift to up to the last data we wrote, and get ready
      * for writing */
     pos_end = avio_tell(s->pb);
-    avio_seek(s->pb, mov->reserved_header_pos + moov_size, SEEK_SET);
+    avio_seek(s->pb, mov->reserved_header_pos + reserved + shift, SEEK_SET);
 
-    /* start reading at where the new moov will be placed */
-    avio_seek(read_pb, mov->reserved_header_pos, SEEK_SET);
+    /* start reading at where the new moov will be placed, past the space
+     * reserved for it */
+    avio_seek(read_pb, mov->reserved_header_pos + reserved, SEEK_SET);
     pos = avio_tell(read_pb);
 
 #define READ_BLOCK do {                                                             \
-    read_size[read_buf_id] = avio_read(read_pb, read_buf[read_buf_id], moov_size);  \
+    read_size[read_buf_id] = avio_read(read_pb, read_buf[read_buf_id], block_size); \
     read_buf_id ^= 1;                                                               \
 } while (0)
 
-    /* shift data by chunk of at most moov_size */
+    /* shift data by chunk of at most block_size */
     READ_BLOCK;
     do {
         int n;
@@ -5897,7 +5977,7 @@ static int mov_write_trailer(AVFormatContext *s)
     MOVMuxContext *mov = s->priv_data;
     AVIOContext *pb = s->pb;
     int res = 0;
-    int i;
+    int i, second_pass = mov->flags & FF_MOV_FLAG_FASTSTART;
     int64_t moov_pos;
 
     /*
@@ -5940,9 +6020,25 @@ static int mov_write_trailer(AVFormatContext *s)
             ffio_wfourcc(pb, "mdat");
             avio_wb64(pb, mov->mdat_size + 16);
         }
-        avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
-        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+        /* With faststart, the reserved space is only used if the moov fits,
+         * otherwise the data is moved as without it. */
+        if (second_pass && mov->reserved_moov_size > 0) {
+            int moov_size = get_moov_size(s);
+            if (moov_size < 0) {
+                res = moov_size;
+                goto error;
+            }
+            second_pass = moov_size != mov->reserved_moov_size &&
+                          moov_size >  mov->reserved_moov_size - 8;
+            if (second_pass)
+                av_log(s, AV_LOG_WARNING, "The moov atom needs %d bytes, more "
+                       "than the %d reserved\n", moov_size, mov->reserved_moov_size);
+        }
+
+        avio_seek(pb, mov->reserved_moov_size > 0 && !second_pass ? mov->reserved_header_pos : moov_pos, SEEK_SET);
+
+        if (second_pass) {
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
             res = shift_data(s);
             if (res < 0)
@@ -5950,19 +6046,25 @@ static int mov_write_trailer(AVFormatContext *s)
             avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
             if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
                 goto error;
+            if (mov->reserved_moov_size > 0) {
+                avio_wb32(pb, 8);
+                ffio_wfourcc(pb, "free");
+            }
         } else if (mov->reserved_moov_size > 0) {
             int64_t size;
             if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
                 goto error;
             size = mov->reserved_moov_size - (avio_tell(pb) - mov->reserved_header_pos);
-            if (size < 8){
+            if (size < 8 && size) {
                 av_log(s, AV_LOG_ERROR, "reserved_moov_size is too small, needed %"PRId64" additional\n", 8-size);
                 res = AVERROR(EINVAL);
                 goto error;
             }
-            avio_wb32(pb, size);
-            ffio_wfourcc(pb, "free");
-            ffio_fill(pb, 0, size - 8);
+            if (size) {
+                avio_wb32(pb, size);
+                ffio_wfourcc(pb, "free");
+                ffio_fill(pb, 0, size - 8);
+            }
             avio_seek(pb, moov_pos, SEEK_SET);
         } else {
             if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
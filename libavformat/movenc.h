@@ -190,6 +190,7 @@ typedef struct MOVMuxContext {
     int max_fragment_size;
     int ism_lookahead;
     AVIOContext *mdat_buf;
+    AVBufferPool *chunk_pool;   ///< chunks of the mdat_buf of the fragments
     int first_trun;
 
     int video_track_timescale;
@@ -159,6 +159,14 @@ struct MpegTSContext {
     /** filters for various streams specified by PMT + for the PAT and PMT */
     MpegTSFilter *pids[NB_PID_MAX];
     int current_pid;
+
+    /** discard_pid() of each pid, see update_discard_pids() */
+    uint8_t discard_pids[NB_PID_MAX];
+    /** the programs changed since discard_pids was computed */
+    int discard_pids_dirty;
+    /** AVProgram.discard == AVDISCARD_ALL when discard_pids was computed */
+    uint8_t *discard_programs;
+    int nb_discard_programs;
 };
 
 #define MPEGTS_OPTIONS \
@@ -275,6 +283,7 @@ static void clear_program(MpegTSContext *ts, unsigned int programid)
 {
     int i;
 
+    ts->discard_pids_dirty = 1;
     clear_avprogram(ts, programid);
     for (i = 0; i < ts->nb_prg; i++)
         if (ts->prg[i].id == programid) {
@@ -285,6 +294,7 @@ static void clear_program(MpegTSContext *ts, unsigned int programid)
 
 static void clear_programs(MpegTSContext *ts)
 {
+    ts->discard_pids_dirty = 1;
     av_freep(&ts->prg);
     ts->nb_prg = 0;
 }
@@ -301,6 +311,7 @@ static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
     p->nb_pids = 0;
     p->pmt_found = 0;
     ts->nb_prg++;
+    ts->discard_pids_dirty = 1;
 }
 
 static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
@@ -319,6 +330,7 @@ static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
             return;
 
     p->pids[p->nb_pids++] = pid;
+    ts->discard_pids_dirty = 1;
 }
 
 static void set_pmt_found(MpegTSContext *ts, unsigned int programid)
@@ -383,6 +395,47 @@ static int discard_pid(MpegTSContext *ts, unsigned int pid)
     return !used && discarded;
 }
 
+/**
+ * Cache discard_pid() for all the pids, so that handle_packet() only has
+ * to look it up. The cache is refreshed when the programs change, which
+ * sets discard_pids_dirty, or when the discard flags of the AVPrograms
+ * differ from the ones it was computed with; the latter are only changed
+ * by the caller between two reads.
+ */
+static void update_discard_pids(MpegTSContext *ts)
+{
+    AVFormatContext *s = ts->stream;
+    int i, j;
+
+    if (!ts->discard_pids_dirty && ts->nb_discard_programs == s->nb_programs) {
+        for (i = 0; i < s->nb_programs; i++)
+            if (ts->discard_programs[i] != (s->programs[i]->discard == AVDISCARD_ALL))
+                break;
+        if (i == s->nb_programs)
+            return;
+    }
+
+    if (av_reallocp_array(&ts->discard_programs, s->nb_programs,
+                          sizeof(*ts->discard_programs)) < 0) {
+        /* fall back to no discarding, and try again next time */
+        ts->nb_discard_programs = 0;
+        memset(ts->discard_pids, 0, sizeof(ts->discard_pids));
+        return;
+    }
+    ts->nb_discard_programs = s->nb_programs;
+    for (i = 0; i < s->nb_programs; i++)
+        ts->discard_programs[i] = s->programs[i]->discard == AVDISCARD_ALL;
+    ts->discard_pids_dirty = 0;
+
+    memset(ts->discard_pids, 0, sizeof(ts->discard_pids));
+    /* pids not listed in any program are never discarded */
+    for (i = 0; i < ts->nb_prg; i++) {
+        struct Program *p = &ts->prg[i];
+        for (j = 0; j < p->nb_pids; j++)
+            ts->discard_pids[p->pids[j]] = discard_pid(ts, p->pids[j]);
+    }
+}
+
 /**
  *  Assemble PES packets out of TS packets, and then call the "section_cb"
  *  function when they are complete.
@@ -2211,7 +2264,9 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet)
     int64_t pos;
 
     pid = AV_RB16(packet + 1) & 0x1fff;
-    if (pid && discard_pid(ts, pid))
+    if (ts->discard_pids_dirty)
+        update_discard_pids(ts);
+    if (pid && ts->discard_pids[pid])
         return 0;
     is_start = packet[1] & 0x40;
     tss = ts->pids[pid];
@@ -2423,6 +2478,38 @@ static int read_packet(AVFormatContext *s, uint8_t *buf, int raw_packet_size,
     return 0;
 }
 
+/**
+ * Skip the packets at the current position of the buffer of pb that
+ * handle_packet() would ignore, i.e. the ones of discarded pids and of
+ * pids without a filter, without copying them or going through
+ * read_packet(). Stops at the first packet to handle or without sync byte.
+ * @return number of packets skipped, at most max_packets
+ */
+static int skip_ignored_packets(MpegTSContext *ts, int64_t max_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    uint8_t *p = pb->buf_ptr;
+    int nb_packets = 0;
+
+    if (pb->write_flag)
+        return 0;
+
+    while (nb_packets < max_packets && pb->buf_end - p >= ts->raw_packet_size) {
+        int pid;
+
+        if (p[0] != 0x47)
+            break;
+        pid = AV_RB16(p + 1) & 0x1fff;
+        if (!(pid && ts->discard_pids[pid]) &&
+            (ts->pids[pid] || ts->auto_guess && (p[1] & 0x40)))
+            break;
+        p += ts->raw_packet_size;
+        nb_packets++;
+    }
+    pb->buf_ptr = p;
+    return nb_packets;
+}
+
 static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
 {
     AVIOContext *pb = s->pb;
@@ -2459,10 +2546,15 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         }
     }
 
+    /* the discard flags of the programs may have changed since last time */
+    update_discard_pids(ts);
+
     ts->stop_parse = 0;
     packet_num = 0;
     memset(packet + TS_PACKET_SIZE, 0, AV_INPUT_BUFFER_PADDING_SIZE);
     for (;;) {
+        int skipped;
+
         packet_num++;
         if (nb_packets != 0 && packet_num >= nb_packets ||
             ts->stop_parse > 1) {
@@ -2472,6 +2564,16 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        if (ts->discard_pids_dirty)
+            update_discard_pids(ts);
+        skipped = skip_ignored_packets(ts, nb_packets ? nb_packets - packet_num
+                                                      : INT64_MAX);
+        if (skipped) {
+            /* each skipped packet counts as one iteration */
+            packet_num += skipped - 1;
+            continue;
+        }
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
@@ -2743,6 +2845,7 @@ static void mpegts_free(MpegTSContext *ts)
     int i;
 
     clear_programs(ts);
+    av_freep(&ts->discard_programs);
 
     for (i = 0; i < NB_PID_MAX; i++)
         if (ts->pids[i])
@@ -2853,6 +2956,7 @@ int avpriv_mpegts_parse_packet(MpegTSContext *ts, AVPacket *pkt,
 
     len1 = len;
     ts->pkt = pkt;
+    update_discard_pids(ts);
     for (;;) {
         ts->stop_parse = 0;
         if (len < TS_PACKET_SIZE)
@@ -860,6 +860,23 @@ int av_write_frame(AVFormatContext *s, AVPacket *pkt)
 
 #define CHUNK_START 0x1000
 
+static AVPacketList *packet_buffer_entry_alloc(AVFormatContext *s)
+{
+    AVPacketList *pktl = s->internal->packet_buffer_pool;
+
+    if (!pktl)
+        return av_mallocz(sizeof(AVPacketList));
+    s->internal->packet_buffer_pool = pktl->next;
+    memset(pktl, 0, sizeof(*pktl));
+    return pktl;
+}
+
+static void packet_buffer_entry_free(AVFormatContext *s, AVPacketList *pktl)
+{
+    pktl->next = s->internal->packet_buffer_pool;
+    s->internal->packet_buffer_pool = pktl;
+}
+
 int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
                              int (*compare)(AVFormatContext *, AVPacket *, AVPacket *))
 {
@@ -868,7 +885,7 @@ int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
     AVStream *st   = s->streams[pkt->stream_index];
     int chunked    = s->max_chunk_size || s->max_chunk_duration;
 
-    this_pktl      = av_mallocz(sizeof(AVPacketList));
+    this_pktl      = packet_buffer_entry_alloc(s);
     if (!this_pktl)
         return AVERROR(ENOMEM);
     if ((pkt->flags & AV_PKT_FLAG_UNCODED_FRAME)) {
@@ -880,7 +897,7 @@ int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
         pkt->side_data_elems = 0;
     } else {
         if ((ret = av_packet_ref(&this_pktl->pkt, pkt)) < 0) {
-            av_free(this_pktl);
+            packet_buffer_entry_free(s, this_pktl);
             return ret;
         }
     }
@@ -998,17 +1015,27 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
                                        s->streams[top_pkt->stream_index]->time_base,
                                        AV_TIME_BASE_Q);
 
-        for (i = 0; i < s->nb_streams; i++) {
-            int64_t last_dts;
-            const AVPacketList *last = s->streams[i]->last_in_packet_buffer;
+        if (!s->audio_preload && !s->max_chunk_size && !s->max_chunk_duration &&
+            !s->oformat->interleave_packet) {
+            /* The buffer is sorted by dts, its last packet is the last one
+             * of its stream and has the largest dts. */
+            AVPacket *last_pkt = &s->internal->packet_buffer_end->pkt;
+            delta_dts = av_rescale_q(last_pkt->dts,
+                                     s->streams[last_pkt->stream_index]->time_base,
+                                     AV_TIME_BASE_Q) - top_dts;
+        } else {
+            for (i = 0; i < s->nb_streams; i++) {
+                int64_t last_dts;
+                const AVPacketList *last = s->streams[i]->last_in_packet_buffer;
 
-            if (!last)
-                continue;
+                if (!last)
+                    continue;
 
-            last_dts = av_rescale_q(last->pkt.dts,
-                                    s->streams[i]->time_base,
-                                    AV_TIME_BASE_Q);
-            delta_dts = FFMAX(delta_dts, last_dts - top_dts);
+                last_dts = av_rescale_q(last->pkt.dts,
+                                        s->streams[i]->time_base,
+                                        AV_TIME_BASE_Q);
+                delta_dts = FFMAX(delta_dts, last_dts - top_dts);
+            }
         }
 
         if (delta_dts > s->max_interleave_delta) {
@@ -1032,7 +1059,7 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
 
         if (st->last_in_packet_buffer == pktl)
             st->last_in_packet_buffer = NULL;
-        av_freep(&pktl);
+        packet_buffer_entry_free(s, pktl);
 
         return 1;
     } else {
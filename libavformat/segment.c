@@ -226,10 +226,16 @@ static int set_segment_filename(AVFormatContext *s)
     return 0;
 }
 
+static void set_http_options(AVDictionary **options)
+{
+    av_dict_set(options, "connection_pool", "1", AV_DICT_DONT_OVERWRITE);
+}
+
 static int segment_start(AVFormatContext *s, int write_header)
 {
     SegmentContext *seg = s->priv_data;
     AVFormatContext *oc = seg->avf;
+    AVDictionary *options = NULL;
     int err = 0;
 
     if (write_header) {
@@ -247,7 +253,10 @@ static int segment_start(AVFormatContext *s, int write_header)
     if ((err = set_segment_filename(s)) < 0)
         return err;
 
-    if ((err = s->io_open(s, &oc->pb, oc->filename, AVIO_FLAG_WRITE, NULL)) < 0) {
+    set_http_options(&options);
+    err = s->io_open(s, &oc->pb, oc->filename, AVIO_FLAG_WRITE, &options);
+    av_dict_free(&options);
+    if (err < 0) {
         av_log(s, AV_LOG_ERROR, "Failed to open segment '%s'\n", oc->filename);
         return err;
     }
@@ -273,10 +282,13 @@ static int segment_start(AVFormatContext *s, int write_header)
 static int segment_list_open(AVFormatContext *s)
 {
     SegmentContext *seg = s->priv_data;
+    AVDictionary *options = NULL;
     int ret;
 
     snprintf(seg->temp_list_filename, sizeof(seg->temp_list_filename), seg->use_rename ? "%s.tmp" : "%s", seg->list);
-    ret = s->io_open(s, &seg->list_pb, seg->temp_list_filename, AVIO_FLAG_WRITE, NULL);
+    set_http_options(&options);
+    ret = s->io_open(s, &seg->list_pb, seg->temp_list_filename, AVIO_FLAG_WRITE, &options);
+    av_dict_free(&options);
     if (ret < 0) {
         av_log(s, AV_LOG_ERROR, "Failed to open segment list '%s'\n", seg->list);
         return ret;
@@ -22,7 +22,10 @@
 
 #include "libavutil/avutil.h"
 #include "libavutil/avstring.h"
+#include "libavutil/fifo.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "internal.h"
 #include "avformat.h"
 #include "avio_internal.h"
@@ -34,6 +37,20 @@ typedef enum {
 
 #define DEFAULT_SLAVE_FAILURE_POLICY ON_SLAVE_FAILURE_ABORT
 
+typedef enum {
+    ON_SLAVE_FULL_BLOCK = 1,
+    ON_SLAVE_FULL_DROP  = 2,
+    ON_SLAVE_FULL_FAIL  = 3
+} SlaveFullPolicy;
+
+#define DEFAULT_SLAVE_FULL_POLICY ON_SLAVE_FULL_BLOCK
+#define DEFAULT_SLAVE_QUEUE_SIZE  128
+
+typedef struct {
+    AVPacket pkt;
+    int64_t queued; ///< time the packet was queued, for lag statistics
+} TeeQueuedPacket;
+
 typedef struct {
     AVFormatContext *avf;
     AVBitStreamFilterContext **bsfs; ///< bitstream filters per stream
@@ -44,6 +61,34 @@ typedef struct {
      * disabled output streams are set to -1 */
     int *stream_map;
     int header_written;
+
+    /**
+     * Asynchronous output: packets are queued as references and written
+     * by a dedicated thread, so that a stalled slave does not block the
+     * others.
+     */
+    int async;
+    int queue_size;
+    SlaveFullPolicy on_full;
+    AVFifoBuffer *queue;            ///< TeeQueuedPacket entries
+    int *need_keyframe;             ///< per output stream, set while dropping
+    AVIOInterruptCB interrupt_cb;   ///< interrupt callback of the tee muxer
+#if HAVE_THREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int thread_started;
+#endif
+    int eof;                        ///< no more packets will be queued
+    int abort;                      ///< stop writing, discard queued packets
+    int error;                      ///< error returned by the writer thread
+
+    /* statistics */
+    int64_t nb_written;
+    int64_t nb_dropped;
+    int max_depth;
+    int64_t max_lag;
+    int64_t total_lag;
 } TeeSlave;
 
 typedef struct TeeContext {
@@ -51,6 +96,8 @@ typedef struct TeeContext {
     unsigned nb_slaves;
     unsigned nb_alive;
     TeeSlave *slaves;
+    int64_t stats_period;
+    int64_t last_stats;             ///< time the statistics were last logged
 } TeeContext;
 
 static const char *const slave_delim     = "|";
@@ -60,9 +107,18 @@ static const char *const slave_opt_delim = ":]"; /* must have the close too */
 static const char *const slave_bsfs_spec_sep = "/";
 static const char *const slave_select_sep = ",";
 
+#define OFFSET(x) offsetof(TeeContext, x)
+#define E AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption options[] = {
+    { "stats_period", "period of the statistics logged for asynchronous slaves, 0 to disable",
+      OFFSET(stats_period), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT64_MAX, E },
+    { NULL }
+};
+
 static const AVClass tee_muxer_class = {
     .class_name = "Tee muxer",
     .item_name  = av_default_item_name,
+    .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
@@ -144,6 +200,24 @@ end:
     return ret;
 }
 
+static inline int parse_slave_full_policy_option(const char *opt, TeeSlave *tee_slave)
+{
+    if (!opt) {
+        tee_slave->on_full = DEFAULT_SLAVE_FULL_POLICY;
+        return 0;
+    } else if (!av_strcasecmp("block", opt)) {
+        tee_slave->on_full = ON_SLAVE_FULL_BLOCK;
+        return 0;
+    } else if (!av_strcasecmp("drop", opt)) {
+        tee_slave->on_full = ON_SLAVE_FULL_DROP;
+        return 0;
+    } else if (!av_strcasecmp("fail", opt)) {
+        tee_slave->on_full = ON_SLAVE_FULL_FAIL;
+        return 0;
+    }
+    return AVERROR(EINVAL);
+}
+
 static inline int parse_slave_failure_policy_option(const char *opt, TeeSlave *tee_slave)
 {
     if (!opt) {
@@ -161,6 +235,203 @@ static inline int parse_slave_failure_policy_option(const char *opt, TeeSlave *t
     return AVERROR(EINVAL);
 }
 
+/**
+ * Parse a slave option that must be an integer not lower than min.
+ */
+static int parse_slave_int_option(const char *opt, int min, int *val)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(opt, &end, 0);
+    if (end == opt || *end || errno || v < min || v > INT_MAX)
+        return AVERROR(EINVAL);
+    *val = v;
+    return 0;
+}
+
+static int write_slave_packet(TeeSlave *tee_slave, AVPacket *pkt)
+{
+    AVFormatContext *avf = tee_slave->avf;
+    int s = pkt->stream_index;
+    int ret;
+
+    if ((ret = av_apply_bitstream_filters(avf->streams[s]->codec, pkt,
+                                          tee_slave->bsfs[s])) < 0) {
+        av_packet_unref(pkt);
+        return ret;
+    }
+    return av_interleaved_write_frame(avf, pkt);
+}
+
+static int slave_interrupt_cb(void *opaque)
+{
+    TeeSlave *tee_slave = opaque;
+
+    return tee_slave->abort || ff_check_interrupt(&tee_slave->interrupt_cb);
+}
+
+#if HAVE_THREADS
+static void *slave_writer_thread(void *arg)
+{
+    TeeSlave *tee_slave = arg;
+    TeeQueuedPacket qpkt;
+    int64_t lag;
+    int ret;
+
+    pthread_mutex_lock(&tee_slave->mutex);
+    while (!tee_slave->abort) {
+        if (!av_fifo_size(tee_slave->queue)) {
+            if (tee_slave->eof)
+                break;
+            pthread_cond_wait(&tee_slave->cond, &tee_slave->mutex);
+            continue;
+        }
+        av_fifo_generic_read(tee_slave->queue, &qpkt, sizeof(qpkt), NULL);
+        pthread_cond_broadcast(&tee_slave->cond);
+        pthread_mutex_unlock(&tee_slave->mutex);
+
+        ret = write_slave_packet(tee_slave, &qpkt.pkt);
+        lag = av_gettime_relative() - qpkt.queued;
+
+        pthread_mutex_lock(&tee_slave->mutex);
+        if (ret < 0) {
+            tee_slave->error = ret;
+            pthread_cond_broadcast(&tee_slave->cond);
+            break;
+        }
+        tee_slave->nb_written++;
+        tee_slave->total_lag += lag;
+        tee_slave->max_lag    = FFMAX(tee_slave->max_lag, lag);
+    }
+    pthread_mutex_unlock(&tee_slave->mutex);
+    return NULL;
+}
+#endif
+
+static int start_slave_thread(TeeSlave *tee_slave)
+{
+#if HAVE_THREADS
+    int ret;
+
+    tee_slave->queue = av_fifo_alloc_array(tee_slave->queue_size, sizeof(TeeQueuedPacket));
+    tee_slave->need_keyframe = av_calloc(tee_slave->avf->nb_streams,
+                                         sizeof(*tee_slave->need_keyframe));
+    if (!tee_slave->queue || !tee_slave->need_keyframe)
+        return AVERROR(ENOMEM);
+
+    if ((ret = pthread_mutex_init(&tee_slave->mutex, NULL)))
+        return AVERROR(ret);
+    if ((ret = pthread_cond_init(&tee_slave->cond, NULL))) {
+        pthread_mutex_destroy(&tee_slave->mutex);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_create(&tee_slave->thread, NULL, slave_writer_thread, tee_slave))) {
+        pthread_cond_destroy(&tee_slave->cond);
+        pthread_mutex_destroy(&tee_slave->mutex);
+        return AVERROR(ret);
+    }
+    tee_slave->thread_started = 1;
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+static void stop_slave_thread(TeeSlave *tee_slave)
+{
+#if HAVE_THREADS
+    if (!tee_slave->thread_started)
+        return;
+    pthread_mutex_lock(&tee_slave->mutex);
+    tee_slave->eof = 1;
+    pthread_cond_broadcast(&tee_slave->cond);
+    pthread_mutex_unlock(&tee_slave->mutex);
+    pthread_join(tee_slave->thread, NULL);
+    pthread_cond_destroy(&tee_slave->cond);
+    pthread_mutex_destroy(&tee_slave->mutex);
+    tee_slave->thread_started = 0;
+#endif
+}
+
+/**
+ * Queue a packet to an asynchronous slave, taking ownership of it.
+ * Return a negative error if the slave failed or overflowed with the
+ * fail policy.
+ */
+static int queue_slave_packet(TeeSlave *tee_slave, AVPacket *pkt)
+{
+#if HAVE_THREADS
+    TeeQueuedPacket qpkt;
+    int s = pkt->stream_index;
+    int key = pkt->flags & AV_PKT_FLAG_KEY;
+    int ret = 0;
+
+    pthread_mutex_lock(&tee_slave->mutex);
+    if (tee_slave->need_keyframe[s] && !key)
+        goto drop;
+    while (!tee_slave->error && !av_fifo_space(tee_slave->queue)) {
+        if (tee_slave->on_full == ON_SLAVE_FULL_DROP) {
+            tee_slave->need_keyframe[s] = 1;
+            goto drop;
+        } else if (tee_slave->on_full == ON_SLAVE_FULL_FAIL) {
+            ret = AVERROR(ENOBUFS);
+            goto end;
+        }
+        pthread_cond_wait(&tee_slave->cond, &tee_slave->mutex);
+    }
+    if ((ret = tee_slave->error) < 0)
+        goto end;
+
+    tee_slave->need_keyframe[s] = 0;
+    qpkt.pkt    = *pkt;
+    qpkt.queued = av_gettime_relative();
+    av_fifo_generic_write(tee_slave->queue, &qpkt, sizeof(qpkt), NULL);
+    tee_slave->max_depth = FFMAX(tee_slave->max_depth,
+                                 av_fifo_size(tee_slave->queue) / sizeof(qpkt));
+    pthread_cond_broadcast(&tee_slave->cond);
+    pthread_mutex_unlock(&tee_slave->mutex);
+    return 0;
+
+drop:
+    tee_slave->nb_dropped++;
+end:
+    pthread_mutex_unlock(&tee_slave->mutex);
+    av_packet_unref(pkt);
+    return ret;
+#else
+    av_packet_unref(pkt);
+    return AVERROR(ENOSYS);
+#endif
+}
+
+static void log_slave_stats(TeeSlave *tee_slave, void *log_ctx, int log_level)
+{
+    int64_t nb_written, nb_dropped, max_lag, total_lag;
+    int depth, max_depth;
+
+#if HAVE_THREADS
+    if (tee_slave->thread_started)
+        pthread_mutex_lock(&tee_slave->mutex);
+#endif
+    depth      = tee_slave->queue ? av_fifo_size(tee_slave->queue) / sizeof(TeeQueuedPacket) : 0;
+    max_depth  = tee_slave->max_depth;
+    nb_written = tee_slave->nb_written;
+    nb_dropped = tee_slave->nb_dropped;
+    max_lag    = tee_slave->max_lag;
+    total_lag  = tee_slave->total_lag;
+#if HAVE_THREADS
+    if (tee_slave->thread_started)
+        pthread_mutex_unlock(&tee_slave->mutex);
+#endif
+
+    av_log(log_ctx, log_level, "%"PRId64" packets written, %"PRId64" dropped, "
+           "queue depth %d max %d/%d, lag avg %"PRId64" max %"PRId64" us\n",
+           nb_written, nb_dropped, depth, max_depth, tee_slave->queue_size,
+           nb_written ? total_lag / nb_written : 0, max_lag);
+}
+
 static int close_slave(TeeSlave *tee_slave)
 {
     AVFormatContext *avf;
@@ -171,8 +442,26 @@ static int close_slave(TeeSlave *tee_slave)
     if (!avf)
         return 0;
 
-    if (tee_slave->header_written)
-        ret = av_write_trailer(avf);
+    if (tee_slave->async) {
+        TeeQueuedPacket qpkt;
+
+        stop_slave_thread(tee_slave);
+        log_slave_stats(tee_slave, avf, AV_LOG_VERBOSE);
+        while (tee_slave->queue && av_fifo_size(tee_slave->queue)) {
+            av_fifo_generic_read(tee_slave->queue, &qpkt, sizeof(qpkt), NULL);
+            av_packet_unref(&qpkt.pkt);
+        }
+        av_fifo_freep(&tee_slave->queue);
+        av_freep(&tee_slave->need_keyframe);
+        if (tee_slave->error < 0)
+            ret = tee_slave->error;
+    }
+
+    if (tee_slave->header_written && !tee_slave->abort) {
+        int err = av_write_trailer(avf);
+        if (!ret)
+            ret = err;
+    }
 
     if (tee_slave->bsfs) {
         for (i = 0; i < avf->nb_streams; ++i) {
@@ -211,6 +500,7 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     AVDictionaryEntry *entry;
     char *filename;
     char *format = NULL, *select = NULL, *on_fail = NULL;
+    char *async = NULL, *queue_size = NULL, *on_full = NULL;
     AVFormatContext *avf2 = NULL;
     AVStream *st, *st2;
     int stream_count;
@@ -231,6 +521,9 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     STEAL_OPTION("f", format);
     STEAL_OPTION("select", select);
     STEAL_OPTION("onfail", on_fail);
+    STEAL_OPTION("async", async);
+    STEAL_OPTION("queue_size", queue_size);
+    STEAL_OPTION("onfull", on_full);
 
     ret = parse_slave_failure_policy_option(on_fail, tee_slave);
     if (ret < 0) {
@@ -239,6 +532,32 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
         goto end;
     }
 
+    ret = parse_slave_full_policy_option(on_full, tee_slave);
+    if (ret < 0) {
+        av_log(avf, AV_LOG_ERROR,
+               "Invalid onfull option value, valid options are 'block', 'drop' and 'fail'\n");
+        goto end;
+    }
+
+    tee_slave->async = 0;
+    if (async && (ret = parse_slave_int_option(async, 0, &tee_slave->async)) < 0) {
+        av_log(avf, AV_LOG_ERROR, "Invalid async option value '%s'\n", async);
+        goto end;
+    }
+    tee_slave->queue_size = DEFAULT_SLAVE_QUEUE_SIZE;
+    if (queue_size &&
+        (ret = parse_slave_int_option(queue_size, 1, &tee_slave->queue_size)) < 0) {
+        av_log(avf, AV_LOG_ERROR, "Invalid queue_size option value '%s'\n", queue_size);
+        goto end;
+    }
+#if !HAVE_THREADS
+    if (tee_slave->async) {
+        av_log(avf, AV_LOG_ERROR, "async option requires threading support\n");
+        ret = AVERROR(ENOSYS);
+        goto end;
+    }
+#endif
+
     ret = avformat_alloc_output_context2(&avf2, NULL, format, filename);
     if (ret < 0)
         goto end;
@@ -247,6 +566,12 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     avf2->opaque   = avf->opaque;
     avf2->io_open  = avf->io_open;
     avf2->io_close = avf->io_close;
+    if (tee_slave->async) {
+        /* allow aborting a slave stuck in I/O when it is closed */
+        tee_slave->interrupt_cb          = avf->interrupt_callback;
+        avf2->interrupt_callback.callback = slave_interrupt_cb;
+        avf2->interrupt_callback.opaque   = tee_slave;
+    }
 
     tee_slave->stream_map = av_calloc(avf->nb_streams, sizeof(*tee_slave->stream_map));
     if (!tee_slave->stream_map) {
@@ -382,10 +707,19 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
         goto end;
     }
 
+    if (tee_slave->async && (ret = start_slave_thread(tee_slave)) < 0) {
+        av_log(avf, AV_LOG_ERROR, "Slave '%s': error starting writer thread: %s\n",
+               slave, av_err2str(ret));
+        goto end;
+    }
+
 end:
     av_free(format);
     av_free(select);
     av_free(on_fail);
+    av_free(async);
+    av_free(queue_size);
+    av_free(on_full);
     av_dict_free(&options);
     av_freep(&tmp_select);
     return ret;
@@ -422,6 +756,9 @@ static int tee_process_slave_failure(AVFormatContext *avf, unsigned slave_idx, i
 
     tee->nb_alive--;
 
+    /* discard what is still queued and do not wait for a stalled slave */
+    if (tee_slave->async)
+        tee_slave->abort = 1;
     close_slave(tee_slave);
 
     if (!tee->nb_alive) {
@@ -546,14 +883,32 @@ static int tee_write_packet(AVFormatContext *avf, AVPacket *pkt)
         pkt2.duration = av_rescale_q(pkt->duration, tb, tb2);
         pkt2.stream_index = s2;
 
-        if ((ret = av_apply_bitstream_filters(avf2->streams[s2]->codec, &pkt2,
-                                              tee->slaves[i].bsfs[s2])) < 0 ||
-            (ret = av_interleaved_write_frame(avf2, &pkt2)) < 0) {
+        if (tee->slaves[i].async)
+            ret = queue_slave_packet(&tee->slaves[i], &pkt2);
+        else
+            ret = write_slave_packet(&tee->slaves[i], &pkt2);
+        if (ret < 0) {
             ret = tee_process_slave_failure(avf, i, ret);
             if (!ret_all && ret < 0)
                 ret_all = ret;
         }
     }
+
+    if (tee->stats_period) {
+        int64_t now = av_gettime_relative();
+
+        if (!tee->last_stats) {
+            tee->last_stats = now;
+        } else if (now - tee->last_stats >= tee->stats_period) {
+            tee->last_stats = now;
+            for (i = 0; i < tee->nb_slaves; i++) {
+                if (!tee->slaves[i].avf || !tee->slaves[i].async)
+                    continue;
+                av_log(avf, AV_LOG_INFO, "Slave #%u: ", i);
+                log_slave_stats(&tee->slaves[i], avf, AV_LOG_INFO);
+            }
+        }
+    }
     return ret_all;
 }
 
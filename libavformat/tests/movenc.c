@@ -75,6 +75,12 @@ int fake_pkt_duration;
 
 int num_warnings;
 
+/* seekable output in memory, for the modes needing to go back */
+int seekable_out;
+uint8_t *mem_buf;
+int mem_size, mem_alloc, mem_pos;
+int num_reopens;
+
 int check_faults;
 
 
@@ -133,6 +139,83 @@ static int io_write_data_type(void *opaque, uint8_t *buf, int size,
     return io_write(opaque, buf, size);
 }
 
+static int io_mem_write(void *opaque, uint8_t *buf, int size)
+{
+    int *pos = opaque;
+    if (*pos + size > mem_alloc) {
+        int new_alloc = FFMAX(*pos + size, 2 * mem_alloc);
+        if (av_reallocp(&mem_buf, new_alloc) < 0)
+            exit(1);
+        /* what is skipped over reads back as zeros */
+        memset(mem_buf + mem_alloc, 0, new_alloc - mem_alloc);
+        mem_alloc = new_alloc;
+    }
+    memcpy(mem_buf + *pos, buf, size);
+    *pos += size;
+    mem_size = FFMAX(mem_size, *pos);
+    return size;
+}
+
+static int io_mem_read(void *opaque, uint8_t *buf, int size)
+{
+    int *pos = opaque;
+    size = FFMIN(size, mem_size - *pos);
+    if (size <= 0)
+        return AVERROR_EOF;
+    memcpy(buf, mem_buf + *pos, size);
+    *pos += size;
+    return size;
+}
+
+static int64_t io_mem_seek(void *opaque, int64_t offset, int whence)
+{
+    int *pos = opaque;
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE)
+        return mem_size;
+    if (whence == SEEK_CUR)
+        offset += *pos;
+    else if (whence == SEEK_END)
+        offset += mem_size;
+    else if (whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if (offset < 0 || offset > INT_MAX)
+        return AVERROR(EINVAL);
+    *pos = offset;
+    return offset;
+}
+
+/* The faststart second pass reads the output back through io_open(). */
+static int io_open_mem(AVFormatContext *s, AVIOContext **pb, const char *url,
+                       int flags, AVDictionary **options)
+{
+    uint8_t *buf = av_malloc(4096);
+    int *pos = av_mallocz(sizeof(*pos));
+    if (!buf || !pos || flags != AVIO_FLAG_READ)
+        exit(1);
+    *pb = avio_alloc_context(buf, 4096, 0, pos, io_mem_read, NULL, io_mem_seek);
+    if (!*pb)
+        exit(1);
+    num_reopens++;
+    return 0;
+}
+
+static void io_close_mem(AVFormatContext *s, AVIOContext *pb)
+{
+    av_free(pb->opaque);
+    av_free(pb->buffer);
+    av_free(pb);
+}
+
+/* Return the size of the atom at pos in the memory output if it is tag,
+ * 0 otherwise. */
+static int mem_atom(int pos, const char *tag)
+{
+    if (pos < 0 || pos + 8 > mem_size || memcmp(mem_buf + pos + 4, tag, 4))
+        return 0;
+    return AV_RB32(mem_buf + pos);
+}
+
 static void init_out(const char *name)
 {
     char buf[100];
@@ -146,11 +229,19 @@ static void init_out(const char *name)
             perror(buf);
     }
     out_size = 0;
+    mem_size = mem_pos = 0;
+    num_reopens = 0;
 }
 
 static void close_out(void)
 {
     int i;
+    if (seekable_out) {
+        av_md5_update(md5, mem_buf, mem_size);
+        out_size = mem_size;
+        if (out)
+            fwrite(mem_buf, 1, mem_size, out);
+    }
     av_md5_final(md5, hash);
     for (i = 0; i < HASH_SIZE; i++)
         printf("%02x", hash[i]);
@@ -184,10 +275,18 @@ static void init_fps(int bf, int audio_preroll, int fps)
     ctx->oformat = av_guess_format(format, NULL, NULL);
     if (!ctx->oformat)
         exit(1);
-    ctx->pb = avio_alloc_context(iobuf, iobuf_size, AVIO_FLAG_WRITE, NULL, NULL, io_write, NULL);
+    if (seekable_out) {
+        ctx->pb = avio_alloc_context(iobuf, iobuf_size, AVIO_FLAG_WRITE, &mem_pos,
+                                     io_mem_read, io_mem_write, io_mem_seek);
+        ctx->io_open  = io_open_mem;
+        ctx->io_close = io_close_mem;
+    } else {
+        ctx->pb = avio_alloc_context(iobuf, iobuf_size, AVIO_FLAG_WRITE, NULL, NULL, io_write, NULL);
+    }
     if (!ctx->pb)
         exit(1);
-    ctx->pb->write_data_type = io_write_data_type;
+    if (!seekable_out)
+        ctx->pb->write_data_type = io_write_data_type;
     ctx->flags |= AVFMT_FLAG_BITEXACT;
 
     st = avformat_new_stream(ctx, NULL);
@@ -356,6 +455,8 @@ int main(int argc, char **argv)
     uint8_t content[HASH_SIZE];
     int empty_moov_pos;
     int prev_pos;
+    int ftyp_size, moov_size;
+    char moov_size_str[20];
 
     for (;;) {
         c = getopt(argc, argv, "wh");
@@ -745,7 +846,54 @@ int main(int argc, char **argv)
     clear_duration = 0;
     do_interleave = 0;
 
+    // Write a faststart file into space reserved for the moov, on a
+    // seekable output. The moov fits, the rest of the space is a free atom.
+    seekable_out = 1;
+    init_out("moov-size-free");
+    av_dict_set(&opts, "movflags", "faststart", 0);
+    av_dict_set(&opts, "moov_size", "8192", 0);
+    init(1, 1);
+    mux_gops(2);
+    finish();
+    close_out();
+    ftyp_size = mem_atom(0, "ftyp");
+    moov_size = mem_atom(ftyp_size, "moov");
+    check(moov_size > 0 && moov_size < 8192 - 8, "No moov in the reserved space");
+    check(mem_atom(ftyp_size + moov_size, "free") == 8192 - moov_size,
+          "The free atom does not fill the reserved space");
+    // the mdat is preceded by its 8 byte free placeholder for a 64 bit size
+    check(mem_atom(ftyp_size + 8192 + 8, "mdat"), "No mdat after the reserved space");
+    check(num_reopens == 0, "Second pass run although the moov fits");
+
+    // Reserve exactly the size of the moov, no free atom is needed.
+    init_out("moov-size-exact");
+    snprintf(moov_size_str, sizeof(moov_size_str), "%d", moov_size);
+    av_dict_set(&opts, "movflags", "faststart", 0);
+    av_dict_set(&opts, "moov_size", moov_size_str, 0);
+    init(1, 1);
+    mux_gops(2);
+    finish();
+    close_out();
+    check(mem_atom(ftyp_size, "moov") == moov_size, "Moov differs from the reserved size");
+    check(mem_atom(ftyp_size + moov_size + 8, "mdat"), "No mdat right after the moov");
+    check(num_reopens == 0, "Second pass run although the moov fits");
+
+    // Reserve too little: faststart falls back to moving the data, by the
+    // missing amount plus an 8 byte free atom.
+    init_out("moov-size-fallback");
+    av_dict_set(&opts, "movflags", "faststart", 0);
+    av_dict_set(&opts, "moov_size", "256", 0);
+    init(1, 1);
+    mux_gops(2);
+    finish();
+    close_out();
+    check(mem_atom(ftyp_size, "moov") == moov_size, "No moov at the start");
+    check(mem_atom(ftyp_size + moov_size, "free") == 8, "No free atom after the moov");
+    check(mem_atom(ftyp_size + moov_size + 16, "mdat"), "No mdat after the free atom");
+    check(num_reopens == 1, "No second pass");
+    seekable_out = 0;
 
+    av_freep(&mem_buf);
     av_free(md5);
 
     return check_faults > 0 ? 1 : 0;
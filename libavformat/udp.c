@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -72,6 +73,10 @@
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_BATCH_SIZE 1024
+/* a batch slot holds the 4 bytes length prefix used in the circular buffer
+ * followed by the datagram */
+#define UDP_BATCH_SLOT_SIZE (UDP_MAX_PKT_SIZE + 4)
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -101,6 +106,15 @@ typedef struct UDPContext {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int thread_started;
+#endif
+    /* Batched I/O: number of datagrams per system call, and the buffers
+     * the receiving or sending thread uses for a batch */
+    int batch_size;
+    uint8_t *batch_buf;             ///< batch_size slots of UDP_BATCH_SLOT_SIZE bytes
+    int *batch_len;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct mmsghdr *batch_msgs;
+    struct iovec *batch_iov;
 #endif
     uint8_t tmp[UDP_MAX_PKT_SIZE+4];
     int remaining_in_dg;
@@ -129,6 +143,7 @@ static const AVOption options[] = {
     { "ttl",            "Time to live (multicast only)",                   OFFSET(ttl),            AV_OPT_TYPE_INT,    { .i64 = 16 },     0, INT_MAX, E },
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
+    { "batch_size",     "Number of datagrams received or sent per system call", OFFSET(batch_size), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, UDP_MAX_BATCH_SIZE, D|E },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -492,6 +507,72 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+static int udp_alloc_batch(UDPContext *s)
+{
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    int i;
+#endif
+
+    s->batch_buf = av_malloc_array(s->batch_size, UDP_BATCH_SLOT_SIZE);
+    s->batch_len = av_malloc_array(s->batch_size, sizeof(*s->batch_len));
+    if (!s->batch_buf || !s->batch_len)
+        return AVERROR(ENOMEM);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    s->batch_msgs = av_mallocz_array(s->batch_size, sizeof(*s->batch_msgs));
+    s->batch_iov  = av_mallocz_array(s->batch_size, sizeof(*s->batch_iov));
+    if (!s->batch_msgs || !s->batch_iov)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->batch_size; i++) {
+        s->batch_iov[i].iov_base = s->batch_buf + i * UDP_BATCH_SLOT_SIZE + 4;
+        s->batch_iov[i].iov_len  = UDP_MAX_PKT_SIZE;
+        s->batch_msgs[i].msg_hdr.msg_iov    = &s->batch_iov[i];
+        s->batch_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+    return 0;
+}
+
+static void udp_free_batch(UDPContext *s)
+{
+    av_freep(&s->batch_buf);
+    av_freep(&s->batch_len);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    av_freep(&s->batch_msgs);
+    av_freep(&s->batch_iov);
+#endif
+}
+
+/**
+ * Add a received datagram to the circular buffer. dgram points to 4 bytes
+ * reserved for the length, followed by the datagram.
+ * Must be called with the mutex held.
+ *
+ * @return 0 if the datagram was queued or dropped, a negative error code
+ *         if the circular buffer overran
+ */
+static int circular_buffer_queue(URLContext *h, uint8_t *dgram, int len)
+{
+    UDPContext *s = h->priv_data;
+
+    AV_WL32(dgram, len);
+
+    if(av_fifo_space(s->fifo) < len + 4) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            return AVERROR(EIO);
+        }
+    }
+    av_fifo_generic_write(s->fifo, dgram, len+4, NULL);
+    return 0;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -506,14 +587,24 @@ static void *circular_buffer_task_rx( void *_URLContext)
         goto end;
     }
     while(1) {
-        int len;
+        int len, n, i, ret;
 
         pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recv(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0);
+#if HAVE_RECVMMSG
+        if (s->batch_msgs)
+            /* wait for one datagram, then take what else is pending */
+            n = len = recvmmsg(s->udp_fd, s->batch_msgs, s->batch_size,
+                               MSG_WAITFORONE, NULL);
+        else
+#endif
+        {
+            len = recv(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0);
+            n   = 1;
+        }
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
         if (len < 0) {
@@ -523,23 +614,22 @@ static void *circular_buffer_task_rx( void *_URLContext)
             }
             continue;
         }
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
+
+        for (i = 0; i < n; i++) {
+            uint8_t *dgram = s->tmp;
+#if HAVE_RECVMMSG
+            if (s->batch_msgs) {
+                dgram = s->batch_buf + i * UDP_BATCH_SLOT_SIZE;
+                len   = s->batch_msgs[i].msg_len;
+                if (s->batch_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                    av_log(h, AV_LOG_WARNING, "Datagram truncated\n");
+            }
+#endif
+            if ((ret = circular_buffer_queue(h, dgram, len)) < 0) {
+                s->circular_buffer_error = ret;
                 goto end;
             }
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
         pthread_cond_signal(&s->cond);
     }
 
@@ -549,6 +639,53 @@ end:
     return NULL;
 }
 
+/**
+ * Send the n datagrams of the current batch.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int udp_send_batch(UDPContext *s, int n)
+{
+    int i = 0, ret;
+
+#if HAVE_SENDMMSG
+    for (i = 0; i < n; i++) {
+        s->batch_iov[i].iov_len = s->batch_len[i];
+        s->batch_msgs[i].msg_hdr.msg_name    = s->is_connected ? NULL : &s->dest_addr;
+        s->batch_msgs[i].msg_hdr.msg_namelen = s->is_connected ? 0 : s->dest_addr_len;
+    }
+    i = 0;
+    while (i < n) {
+        ret = sendmmsg(s->udp_fd, s->batch_msgs + i, n - i, 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                return ret;
+            continue;
+        }
+        i += ret;
+    }
+#else
+    while (i < n) {
+        const uint8_t *p = s->batch_buf + i * UDP_BATCH_SLOT_SIZE + 4;
+        if (!s->is_connected) {
+            ret = sendto (s->udp_fd, p, s->batch_len[i], 0,
+                        (struct sockaddr *) &s->dest_addr,
+                        s->dest_addr_len);
+        } else
+            ret = send(s->udp_fd, p, s->batch_len[i], 0);
+        if (ret < 0) {
+            ret = ff_neterrno();
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                return ret;
+            continue;
+        }
+        i++;
+    }
+#endif
+    return 0;
+}
+
 static void *circular_buffer_task_tx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -570,7 +707,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
     }
 
     for(;;) {
-        int len;
+        int len, n = 0;
         const uint8_t *p;
         uint8_t tmp[4];
         int64_t timestamp;
@@ -586,13 +723,35 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len=av_fifo_size(s->fifo);
         }
 
-        av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-        len=AV_RL32(tmp);
+        if (s->batch_buf) {
+            /* coalesce the queued datagrams into one batch */
+            int64_t now = s->bitrate ? av_gettime_relative() : 0;
+
+            len = 0;
+            while (n < s->batch_size && av_fifo_size(s->fifo) >= 4) {
+                /* with a bitrate, only add the datagrams which are already
+                 * due, so that each one is paced and not the whole batch */
+                if (n && s->bitrate &&
+                    start_timestamp + (sent_bits + len * 8) * 1000000 / s->bitrate > now)
+                    break;
+                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+                s->batch_len[n] = AV_RL32(tmp);
+                av_assert0(s->batch_len[n] >= 0 && s->batch_len[n] <= UDP_MAX_PKT_SIZE);
+                av_fifo_generic_read(s->fifo, s->batch_buf + n * UDP_BATCH_SLOT_SIZE + 4,
+                                     s->batch_len[n], NULL);
+                len += s->batch_len[n++];
+            }
+            /* wake up udp_write() if it waits for space */
+            pthread_cond_signal(&s->cond);
+        } else {
+            av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+            len=AV_RL32(tmp);
 
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
+            av_assert0(len >= 0);
+            av_assert0(len <= sizeof(s->tmp));
 
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+            av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+        }
 
         pthread_mutex_unlock(&s->mutex);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
@@ -617,6 +776,18 @@ static void *circular_buffer_task_tx( void *_URLContext)
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
+        if (n) {
+            int ret = udp_send_batch(s, n);
+            if (ret < 0) {
+                pthread_mutex_lock(&s->mutex);
+                s->circular_buffer_error = ret;
+                pthread_cond_signal(&s->cond);
+                pthread_mutex_unlock(&s->mutex);
+                return NULL;
+            }
+            len = 0;
+        }
+
         p = s->tmp;
         while (len) {
             int ret;
@@ -759,6 +930,13 @@ static int udp_open(URLContext *h, const char *uri, int flags)
                        "'circular_buffer_size' option was set but it is not supported "
                        "on this build (pthread support is required)\n");
         }
+        if (av_find_info_tag(buf, sizeof(buf), "batch_size", p)) {
+            s->batch_size = av_clip(strtol(buf, NULL, 10), 1, UDP_MAX_BATCH_SIZE);
+            if (!HAVE_PTHREAD_CANCEL)
+                av_log(h, AV_LOG_WARNING,
+                       "'batch_size' option was set but it is not supported "
+                       "on this build (pthread support is required)\n");
+        }
         if (av_find_info_tag(buf, sizeof(buf), "bitrate", p)) {
             s->bitrate = strtoll(buf, NULL, 10);
             if (!HAVE_PTHREAD_CANCEL)
@@ -951,19 +1129,27 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     /*
       Create thread in case of:
       1. Input and circular_buffer_size is set
-      2. Output and bitrate and circular_buffer_size is set
+      2. Output and bitrate or batch_size and circular_buffer_size is set
     */
 
     if (is_output && s->bitrate && !s->circular_buffer_size) {
         /* Warn user in case of 'circular_buffer_size' is not set */
         av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
     }
+    if (s->batch_size > 1 && !s->circular_buffer_size)
+        av_log(h, AV_LOG_WARNING, "'batch_size' option was set but 'circular_buffer_size' is not, but required\n");
+    if (!is_output && s->batch_size > 1 && !HAVE_RECVMMSG)
+        av_log(h, AV_LOG_WARNING, "'batch_size' is not supported for reading on this system\n");
 
-    if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
+    if ((!is_output && s->circular_buffer_size) ||
+        (is_output && (s->bitrate || s->batch_size > 1) && s->circular_buffer_size)) {
         int ret;
 
         /* start the task going */
         s->fifo = av_fifo_alloc(s->circular_buffer_size);
+        if (s->batch_size > 1 && (is_output || HAVE_RECVMMSG) &&
+            udp_alloc_batch(s) < 0)
+            goto fail;
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -994,6 +1180,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_PTHREAD_CANCEL
+    udp_free_batch(s);
+#endif
     for (i = 0; i < num_include_sources; i++)
         av_freep(&include_sources[i]);
     for (i = 0; i < num_exclude_sources; i++)
@@ -1091,10 +1280,23 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
             return err;
         }
 
-        if(av_fifo_space(s->fifo) < size + 4) {
+        while (av_fifo_space(s->fifo) < size + 4) {
             /* What about a partial packet tx ? */
-            pthread_mutex_unlock(&s->mutex);
-            return AVERROR(ENOMEM);
+            if (s->bitrate || size + 4 > s->circular_buffer_size) {
+                pthread_mutex_unlock(&s->mutex);
+                return AVERROR(ENOMEM);
+            }
+            /* Without bitrate, wait for the sending thread to make room */
+            if (h->flags & AVIO_FLAG_NONBLOCK) {
+                pthread_mutex_unlock(&s->mutex);
+                return AVERROR(EAGAIN);
+            }
+            pthread_cond_wait(&s->cond, &s->mutex);
+            if (s->circular_buffer_error < 0) {
+                int err = s->circular_buffer_error;
+                pthread_mutex_unlock(&s->mutex);
+                return err;
+            }
         }
         AV_WL32(tmp, size);
         av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
@@ -1148,6 +1350,7 @@ static int udp_close(URLContext *h)
         pthread_mutex_destroy(&s->mutex);
         pthread_cond_destroy(&s->cond);
     }
+    udp_free_batch(s);
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
@@ -27,6 +27,7 @@
 #include "avio.h"
 #include "libavformat/version.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/dict.h"
 #include "libavutil/log.h"
 
@@ -95,6 +96,13 @@ typedef struct URLProtocol {
     int (*url_delete)(URLContext *h);
     int (*url_move)(URLContext *h_src, URLContext *h_dst);
     const char *default_whitelist;
+    /**
+     * Return a reference to size bytes of the resource starting at pos,
+     * directly backed by the protocol's storage (e.g. a memory mapping),
+     * followed by AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes.
+     * The read position of the protocol is not changed.
+     */
+    int (*url_get_mapped)(URLContext *h, int64_t pos, int size, AVBufferRef **buf);
 } URLProtocol;
 
 /**
@@ -248,6 +256,22 @@ int ffurl_get_file_handle(URLContext *h);
  */
 int ffurl_get_multi_file_handle(URLContext *h, int **handles, int *numhandles);
 
+/**
+ * Get a reference to a range of the resource without copying it.
+ *
+ * The returned buffer is read-only from the point of view of the caller
+ * and is followed by AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes, as required
+ * for packet data.
+ *
+ * @param pos  absolute position of the range
+ * @param size size of the range
+ * @param buf  set to a new reference to the range on success
+ * @return 0 on success, AVERROR(ENOSYS) if the protocol does not provide
+ *         mapped access, another negative error code if the range is not
+ *         available
+ */
+int ffurl_get_mapped(URLContext *h, int64_t pos, int size, AVBufferRef **buf);
+
 /**
  * Signal the URLContext that we are done reading or writing the stream.
  *
@@ -26,12 +26,14 @@
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
+#include "libavutil/cpu.h"
 #include "libavutil/dict.h"
 #include "libavutil/internal.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "libavutil/time_internal.h"
 #include "libavutil/timestamp.h"
@@ -43,6 +45,7 @@
 #include "audiointerleave.h"
 #include "avformat.h"
 #include "avio_internal.h"
+#include "http.h"
 #include "id3v2.h"
 #include "internal.h"
 #include "metadata.h"
@@ -1915,6 +1918,61 @@ int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp,
                               timestamp, size, distance, flags);
 }
 
+static int64_t index_entry_timestamp(AVStream *st, int64_t timestamp)
+{
+    timestamp = wrap_timestamp(st, timestamp);
+    if (is_relative(timestamp))
+        timestamp -= RELATIVE_TS_BASE;
+    return timestamp;
+}
+
+int ff_add_index_entries(AVStream *st, const AVIndexEntry *entries, int nb_entries)
+{
+    AVIndexEntry *index_entries;
+    int64_t timestamp, prev_timestamp = INT64_MIN;
+    int index, i;
+
+    if (nb_entries <= 0 ||
+        (unsigned) st->nb_index_entries + nb_entries >= UINT_MAX / sizeof(AVIndexEntry))
+        return AVERROR(EINVAL);
+
+    for (i = 0; i < nb_entries; i++) {
+        if (entries[i].timestamp == AV_NOPTS_VALUE || entries[i].size < 0)
+            return AVERROR(EINVAL);
+        timestamp = index_entry_timestamp(st, entries[i].timestamp);
+        if (timestamp <= prev_timestamp)
+            return AVERROR(EINVAL);
+        prev_timestamp = timestamp;
+    }
+
+    /* all the entries must go between the same two existing ones */
+    index = ff_index_search_timestamp(st->index_entries, st->nb_index_entries,
+                                      index_entry_timestamp(st, entries[0].timestamp),
+                                      AVSEEK_FLAG_ANY);
+    if (index < 0)
+        index = st->nb_index_entries;
+    else if (st->index_entries[index].timestamp <= prev_timestamp)
+        return AVERROR(EINVAL);
+
+    index_entries = av_fast_realloc(st->index_entries,
+                                    &st->index_entries_allocated_size,
+                                    (st->nb_index_entries + nb_entries) *
+                                    sizeof(AVIndexEntry));
+    if (!index_entries)
+        return AVERROR(ENOMEM);
+    st->index_entries = index_entries;
+
+    memmove(index_entries + index + nb_entries, index_entries + index,
+            sizeof(AVIndexEntry) * (st->nb_index_entries - index));
+    for (i = 0; i < nb_entries; i++) {
+        index_entries[index + i]           = entries[i];
+        index_entries[index + i].timestamp = index_entry_timestamp(st, entries[i].timestamp);
+    }
+    st->nb_index_entries += nb_entries;
+
+    return index;
+}
+
 int ff_index_search_timestamp(const AVIndexEntry *entries, int nb_entries,
                               int64_t wanted_timestamp, int flags)
 {
@@ -2855,6 +2913,10 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st, AVPacket *avpkt,
     AVPacket pkt = *avpkt;
     int do_skip_frame = 0;
     enum AVDiscard skip_frame;
+    /* In fast start mode packets are decoded after they have been counted
+     * in codec_info_nb_frames, so look at the decoded frames instead. */
+    int first_frame = s->flags & AVFMT_FLAG_FAST_START ? !st->nb_decoded_frames
+                                                       : !st->codec_info_nb_frames;
 
     if (!frame)
         return AVERROR(ENOMEM);
@@ -2902,7 +2964,7 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st, AVPacket *avpkt,
     while ((pkt.size > 0 || (!pkt.data && got_picture)) &&
            ret >= 0 &&
            (!has_codec_parameters(st, NULL) || !has_decode_delay_been_guessed(st) ||
-            (!st->codec_info_nb_frames &&
+            (first_frame &&
              (avctx->codec->capabilities & AV_CODEC_CAP_CHANNEL_CONF)))) {
         got_picture = 0;
         if (avctx->codec_type == AVMEDIA_TYPE_VIDEO ||
@@ -2942,6 +3004,321 @@ fail:
     return ret;
 }
 
+/**
+ * Fill in the codec parameters the parser has found in the bitstream
+ * headers, and the sample format of decoders that only have one, so that
+ * no decoder needs to be opened for them.
+ */
+static void fill_params_from_parser(AVFormatContext *s, AVStream *st)
+{
+    AVCodecContext *avctx    = st->internal->avctx;
+    AVCodecParserContext *pc = st->parser;
+
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO && pc) {
+        if (!avctx->width && pc->width > 0 && pc->height > 0) {
+            avctx->width  = pc->width;
+            avctx->height = pc->height;
+            if (pc->coded_width > 0 && pc->coded_height > 0) {
+                avctx->coded_width  = pc->coded_width;
+                avctx->coded_height = pc->coded_height;
+            }
+        }
+        if (avctx->pix_fmt == AV_PIX_FMT_NONE && pc->format >= 0)
+            avctx->pix_fmt = pc->format;
+    } else if (avctx->codec_type == AVMEDIA_TYPE_AUDIO &&
+               avctx->sample_fmt == AV_SAMPLE_FMT_NONE) {
+        const AVCodec *codec = find_decoder(s, st, st->codecpar->codec_id);
+
+        if (codec && codec->sample_fmts &&
+            codec->sample_fmts[0] != AV_SAMPLE_FMT_NONE &&
+            codec->sample_fmts[1] == AV_SAMPLE_FMT_NONE)
+            avctx->sample_fmt = codec->sample_fmts[0];
+    }
+}
+
+/**
+ * Return 1 if the stream needs more decoded data to complete its
+ * parameters in fast start mode, 0 otherwise.
+ */
+static int fast_start_needs_decode(AVFormatContext *s, AVStream *st)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    const AVCodec *codec;
+
+    if (st->info->found_decoder < 0)
+        return 0;
+    codec = avctx->codec ? avctx->codec : find_decoder(s, st, st->codecpar->codec_id);
+    if (!codec)
+        return 0;
+
+    return !has_codec_parameters(st, NULL) ||
+           !has_decode_delay_been_guessed(st) ||
+           (codec->capabilities & AV_CODEC_CAP_CHANNEL_CONF &&
+            !st->nb_decoded_frames);
+}
+
+/* Number of packets a stream may buffer in fast start mode before its
+ * decoding is started without waiting for the other streams. */
+#define FAST_START_MAX_PENDING 16
+
+/**
+ * Return 1 if the buffered packets should be decoded now: either every
+ * stream that needs decoding has new packets, or one of them has
+ * accumulated enough to not wait for the others.
+ */
+static int fast_start_decode_ready(AVFormatContext *ic)
+{
+    int i, pending = 0;
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStreamInternal *sti = ic->streams[i]->internal;
+
+        if (!sti->info_needs_decode)
+            continue;
+        if (sti->info_nb_pending >= FAST_START_MAX_PENDING)
+            return 1;
+        if (!sti->info_nb_pending)
+            return 0;
+        pending = 1;
+    }
+    return pending;
+}
+
+/* Minimum duration analyzed in fast start mode on formats without a header
+ * before trusting that no more streams will appear. */
+#define FAST_START_NOHEADER_DURATION AV_TIME_BASE
+
+/**
+ * Return 1 if every stream found so far has returned packets and the
+ * longest of them has been analyzed for at least min_duration, so that a
+ * format without a header can be considered to have shown all its streams.
+ */
+static int fast_start_streams_settled(AVFormatContext *ic, int64_t min_duration)
+{
+    int64_t duration = 0;
+    int i;
+
+    if (!ic->nb_streams)
+        return 0;
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+
+        if (!st->codec_info_nb_frames)
+            return 0;
+        if (st->time_base.den <= 0)
+            continue;
+        duration = FFMAX(duration, av_rescale_q(st->info->codec_info_duration,
+                                                st->time_base, AV_TIME_BASE_Q));
+        if (st->info->fps_first_dts != AV_NOPTS_VALUE &&
+            st->info->fps_last_dts  != AV_NOPTS_VALUE)
+            duration = FFMAX(duration,
+                             av_rescale_q(st->info->fps_last_dts - st->info->fps_first_dts,
+                                          st->time_base, AV_TIME_BASE_Q));
+    }
+    return duration >= min_duration;
+}
+
+typedef struct FastStartDecodeThread {
+    struct FastStartDecodeContext *ctx;
+    int index;
+#if HAVE_THREADS
+    pthread_t thread;
+#endif
+} FastStartDecodeThread;
+
+typedef struct FastStartDecodeContext {
+    AVFormatContext *ic;
+    AVDictionary **options;
+    int orig_nb_streams;
+    AVStream **streams;     ///< streams decoded in the current batch
+    int nb_streams;
+    int nb_threads;         ///< including the calling thread, 0 until the first batch
+#if HAVE_THREADS
+    FastStartDecodeThread *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t batch_cond;  ///< signaled when a batch starts or on exit
+    pthread_cond_t done_cond;   ///< signaled when a thread is done with a batch
+    int batch;              ///< number of batches started
+    int nb_done;            ///< threads done with the current batch
+    int exit;
+#endif
+} FastStartDecodeContext;
+
+/**
+ * Decode the buffered packets of one stream that have not been seen yet,
+ * until its parameters are complete.
+ */
+static void fast_start_decode_stream(FastStartDecodeContext *c, AVStream *st)
+{
+    AVFormatContext *ic = c->ic;
+    AVPacketList *pktl  = st->internal->info_decode_pos ?
+                          st->internal->info_decode_pos->next :
+                          ic->internal->packet_buffer;
+    AVDictionary **opts = c->options && st->index < c->orig_nb_streams ?
+                          &c->options[st->index] : NULL;
+
+    for (; pktl; pktl = pktl->next) {
+        if (pktl->pkt.stream_index != st->index)
+            continue;
+        if (!fast_start_needs_decode(ic, st))
+            break;
+        try_decode_frame(ic, st, &pktl->pkt, opts);
+    }
+}
+
+#if HAVE_THREADS
+static void *fast_start_decode_thread(void *arg)
+{
+    FastStartDecodeThread *t = arg;
+    FastStartDecodeContext *c = t->ctx;
+    int batch = 0, i;
+
+    pthread_mutex_lock(&c->mutex);
+    for (;;) {
+        while (!c->exit && c->batch == batch)
+            pthread_cond_wait(&c->batch_cond, &c->mutex);
+        if (c->exit)
+            break;
+        batch = c->batch;
+        pthread_mutex_unlock(&c->mutex);
+
+        for (i = t->index; i < c->nb_streams; i += c->nb_threads)
+            fast_start_decode_stream(c, c->streams[i]);
+
+        pthread_mutex_lock(&c->mutex);
+        c->nb_done++;
+        pthread_cond_signal(&c->done_cond);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return NULL;
+}
+
+/**
+ * Start the threads decoding the batches, which are kept until
+ * avformat_find_stream_info() returns. If some of them cannot be started,
+ * the others are used.
+ */
+static int fast_start_init_threads(FastStartDecodeContext *c)
+{
+    AVFormatContext *ic = c->ic;
+    int nb_threads = ic->fast_start_threads ? ic->fast_start_threads
+                                            : av_cpu_count();
+    int i, ret;
+
+    c->nb_threads = 1;
+    nb_threads = FFMIN(nb_threads, ic->nb_streams);
+    if (nb_threads <= 1)
+        return 0;
+
+    c->threads = av_mallocz_array(nb_threads, sizeof(*c->threads));
+    if (!c->threads)
+        return AVERROR(ENOMEM);
+    if ((ret = pthread_mutex_init(&c->mutex, NULL))) {
+        av_freep(&c->threads);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&c->batch_cond, NULL))) {
+        pthread_mutex_destroy(&c->mutex);
+        av_freep(&c->threads);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&c->done_cond, NULL))) {
+        pthread_cond_destroy(&c->batch_cond);
+        pthread_mutex_destroy(&c->mutex);
+        av_freep(&c->threads);
+        return AVERROR(ret);
+    }
+
+    for (i = 1; i < nb_threads; i++) {
+        c->threads[i].ctx   = c;
+        c->threads[i].index = i;
+        if (pthread_create(&c->threads[i].thread, NULL,
+                           fast_start_decode_thread, &c->threads[i]))
+            break;
+    }
+    c->nb_threads = i;
+    return 0;
+}
+#endif
+
+static void fast_start_uninit(FastStartDecodeContext *c)
+{
+#if HAVE_THREADS
+    int i;
+
+    if (c->threads) {
+        pthread_mutex_lock(&c->mutex);
+        c->exit = 1;
+        pthread_cond_broadcast(&c->batch_cond);
+        pthread_mutex_unlock(&c->mutex);
+        for (i = 1; i < c->nb_threads; i++)
+            pthread_join(c->threads[i].thread, NULL);
+
+        pthread_cond_destroy(&c->done_cond);
+        pthread_cond_destroy(&c->batch_cond);
+        pthread_mutex_destroy(&c->mutex);
+        av_freep(&c->threads);
+    }
+#endif
+    av_freep(&c->streams);
+}
+
+/**
+ * Decode the packets buffered since the last call for all streams that
+ * still need it, one stream per thread. Every stream only touches its own
+ * codec context and the packet buffer is not modified while this runs.
+ */
+static int fast_start_decode(FastStartDecodeContext *c)
+{
+    AVFormatContext *ic = c->ic;
+    AVStream **streams;
+    int i;
+
+    streams = av_realloc_array(c->streams, ic->nb_streams, sizeof(*streams));
+    if (!streams)
+        return AVERROR(ENOMEM);
+    c->streams    = streams;
+    c->nb_streams = 0;
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        if (st->internal->info_needs_decode && st->internal->info_nb_pending)
+            c->streams[c->nb_streams++] = st;
+    }
+
+#if HAVE_THREADS
+    if (!c->nb_threads && c->nb_streams > 1) {
+        int ret = fast_start_init_threads(c);
+        if (ret < 0)
+            return ret;
+    }
+    if (c->nb_threads > 1 && c->nb_streams > 1) {
+        pthread_mutex_lock(&c->mutex);
+        c->nb_done = 0;
+        c->batch++;
+        pthread_cond_broadcast(&c->batch_cond);
+        pthread_mutex_unlock(&c->mutex);
+
+        for (i = 0; i < c->nb_streams; i += c->nb_threads)
+            fast_start_decode_stream(c, c->streams[i]);
+
+        pthread_mutex_lock(&c->mutex);
+        while (c->nb_done < c->nb_threads - 1)
+            pthread_cond_wait(&c->done_cond, &c->mutex);
+        pthread_mutex_unlock(&c->mutex);
+    } else
+#endif
+    for (i = 0; i < c->nb_streams; i++)
+        fast_start_decode_stream(c, c->streams[i]);
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        st->internal->info_decode_pos   = ic->internal->packet_buffer_end;
+        st->internal->info_nb_pending   = 0;
+        st->internal->info_needs_decode = fast_start_needs_decode(ic, st);
+    }
+    return 0;
+}
+
 unsigned int ff_codec_get_tag(const AVCodecTag *tags, enum AVCodecID id)
 {
     while (tags->id != AV_CODEC_ID_NONE) {
@@ -3290,6 +3667,8 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t max_subtitle_analyze_duration;
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
+    int fast_start = ic->flags & AVFMT_FLAG_FAST_START;
+    FastStartDecodeContext fast_start_ctx = { ic, options, orig_nb_streams };
 
     flush_codecs = probesize > 0;
 
@@ -3377,7 +3756,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
 
         // Try to just open decoders, in case this is enough to get parameters.
-        if (!has_codec_parameters(st, NULL) && st->request_probe <= 0) {
+        // In fast start mode they are only opened once a decode is needed.
+        if (!fast_start && !has_codec_parameters(st, NULL) && st->request_probe <= 0) {
             if (codec && !avctx->codec)
                 if (avcodec_open2(avctx, codec, options ? &options[i] : &thread_opt) < 0)
                     av_log(ic, AV_LOG_WARNING,
@@ -3393,6 +3773,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
 #endif
         ic->streams[i]->info->fps_first_dts = AV_NOPTS_VALUE;
         ic->streams[i]->info->fps_last_dts  = AV_NOPTS_VALUE;
+        if (fast_start) {
+            st = ic->streams[i];
+            st->internal->info_decode_pos   = NULL;
+            st->internal->info_nb_pending   = 0;
+            st->internal->info_needs_decode = fast_start_needs_decode(ic, st);
+        }
     }
 
     read_size = 0;
@@ -3411,6 +3797,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
             st = ic->streams[i];
             if (!has_codec_parameters(st, NULL))
                 break;
+            if (fast_start && st->internal->info_needs_decode)
+                break;
             /* If the timebase is coarse (like the usual millisecond precision
              * of mkv), we need to analyze more frames to reliably arrive at
              * the correct fps. */
@@ -3422,6 +3810,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
                 fps_analyze_framecount = ic->fps_probe_size;
             if (st->disposition & AV_DISPOSITION_ATTACHED_PIC)
                 fps_analyze_framecount = 0;
+            /* In fast start mode any guess at the frame rate is enough. */
+            if (fast_start && (st->r_frame_rate.num || st->avg_frame_rate.num))
+                fps_analyze_framecount = 0;
             /* variable fps and no guess at the real fps */
             if (!(st->r_frame_rate.num && st->avg_frame_rate.num) &&
                 st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
@@ -3432,7 +3823,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
                     break;
             }
             if (st->parser && st->parser->parser->split &&
-                !st->codecpar->extradata)
+                !(fast_start ? st->internal->avctx->extradata : st->codecpar->extradata))
                 break;
             if (st->first_dts == AV_NOPTS_VALUE &&
                 !(ic->iformat->flags & AVFMT_NOTIMESTAMPS) &&
@@ -3445,8 +3836,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
         if (i == ic->nb_streams) {
             analyzed_all_streams = 1;
             /* NOTE: If the format has no header, then we need to read some
-             * packets to get most of the streams, so we cannot stop here. */
-            if (!(ic->ctx_flags & AVFMTCTX_NOHEADER)) {
+             * packets to get most of the streams, so we cannot stop here.
+             * In fast start mode a shorter part of the input is enough. */
+            if (!(ic->ctx_flags & AVFMTCTX_NOHEADER) ||
+                (fast_start &&
+                 fast_start_streams_settled(ic, FFMIN(FAST_START_NOHEADER_DURATION,
+                                                      max_analyze_duration)))) {
                 /* If we found the info for all the codecs, we can stop. */
                 ret = count;
                 av_log(ic, AV_LOG_DEBUG, "All info found\n");
@@ -3503,6 +3898,11 @@ FF_ENABLE_DEPRECATION_WARNINGS
             st->internal->avctx_inited = 1;
         }
 
+        if (fast_start) {
+            fill_params_from_parser(ic, st);
+            st->internal->info_needs_decode = fast_start_needs_decode(ic, st);
+        }
+
         if (pkt->dts != AV_NOPTS_VALUE && st->codec_info_nb_frames > 1) {
             /* check for non-increasing dts */
             if (st->info->fps_last_dts != AV_NOPTS_VALUE &&
@@ -3602,15 +4002,43 @@ FF_ENABLE_DEPRECATION_WARNINGS
          * If AV_CODEC_CAP_CHANNEL_CONF is set this will force decoding of at
          * least one frame of codec data, this makes sure the codec initializes
          * the channel configuration and does not only trust the values from
-         * the container. */
-        try_decode_frame(ic, st, pkt,
-                         (options && i < orig_nb_streams) ? &options[i] : NULL);
+         * the container.
+         *
+         * In fast start mode only the streams that still need it are
+         * decoded, in batches running in parallel on the buffered packets. */
+        if (!fast_start) {
+            try_decode_frame(ic, st, pkt,
+                             (options && i < orig_nb_streams) ? &options[i] : NULL);
+        } else if (st->internal->info_needs_decode) {
+            if (ic->flags & AVFMT_FLAG_NOBUFFER) {
+                try_decode_frame(ic, st, pkt,
+                                 (options && st->index < orig_nb_streams) ? &options[st->index] : NULL);
+                st->internal->info_needs_decode = fast_start_needs_decode(ic, st);
+            } else
+                st->internal->info_nb_pending++;
+        }
 
         if (ic->flags & AVFMT_FLAG_NOBUFFER)
             av_packet_unref(pkt);
 
         st->codec_info_nb_frames++;
         count++;
+
+        if (fast_start && !(ic->flags & AVFMT_FLAG_NOBUFFER) &&
+            fast_start_decode_ready(ic)) {
+            ret = fast_start_decode(&fast_start_ctx);
+            if (ret < 0)
+                goto find_stream_info_err;
+        }
+    }
+
+    /* decode what is left from the last batch */
+    if (fast_start && !(ic->flags & AVFMT_FLAG_NOBUFFER)) {
+        int err = fast_start_decode(&fast_start_ctx);
+        if (err < 0) {
+            ret = err;
+            goto find_stream_info_err;
+        }
     }
 
     if (eof_reached) {
@@ -3840,6 +4268,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
     }
 
 find_stream_info_err:
+    fast_start_uninit(&fast_start_ctx);
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
         if (st->info)
@@ -4038,6 +4467,11 @@ void avformat_free_context(AVFormatContext *s)
     av_freep(&s->chapters);
     av_dict_free(&s->metadata);
     av_freep(&s->streams);
+    while (s->internal && s->internal->packet_buffer_pool) {
+        AVPacketList *pktl = s->internal->packet_buffer_pool;
+        s->internal->packet_buffer_pool = pktl->next;
+        av_free(pktl);
+    }
     av_freep(&s->internal);
     flush_packet_queue(s);
     av_free(s);
@@ -4559,6 +4993,9 @@ int avformat_network_init(void)
 int avformat_network_deinit(void)
 {
 #if CONFIG_NETWORK
+#if CONFIG_HTTP_PROTOCOL || CONFIG_HTTPS_PROTOCOL
+    ff_http_flush_connection_pool();
+#endif
     ff_network_close();
     ff_tls_deinit();
     ff_network_inited_globally = 0;
@@ -22,9 +22,11 @@
 #include "common.h"
 #include "aes_ctr.h"
 #include "aes.h"
+#include "intreadwrite.h"
 #include "random_seed.h"
 
 #define AES_BLOCK_SIZE (16)
+#define AES_CTR_BATCH_BLOCKS (8)
 
 typedef struct AVAESCTR {
     struct AVAES* aes;
@@ -102,6 +104,25 @@ void av_aes_ctr_increment_iv(struct AVAESCTR *a)
     a->block_offset = 0;
 }
 
+/* Encrypt several counter blocks with a single av_aes_crypt() call, so
+ * that they can be processed in parallel. */
+static void aes_ctr_crypt_blocks(struct AVAESCTR *a, uint8_t *dst,
+                                 const uint8_t *src, int blocks)
+{
+    DECLARE_ALIGNED(16, uint8_t, keystream)[AES_CTR_BATCH_BLOCKS * AES_BLOCK_SIZE];
+    int i;
+
+    for (i = 0; i < blocks; i++) {
+        memcpy(keystream + i * AES_BLOCK_SIZE, a->counter, AES_BLOCK_SIZE);
+        av_aes_ctr_increment_be64(a->counter + 8);
+    }
+
+    av_aes_crypt(a->aes, keystream, keystream, blocks, NULL, 0);
+
+    for (i = 0; i < blocks * AES_BLOCK_SIZE; i += 8)
+        AV_WN64(dst + i, AV_RN64(src + i) ^ AV_RN64(keystream + i));
+}
+
 void av_aes_ctr_crypt(struct AVAESCTR *a, uint8_t *dst, const uint8_t *src, int count)
 {
     const uint8_t* src_end = src + count;
@@ -110,6 +131,15 @@ void av_aes_ctr_crypt(struct AVAESCTR *a, uint8_t *dst, const uint8_t *src, int
 
     while (src < src_end) {
         if (a->block_offset == 0) {
+            int blocks = FFMIN((src_end - src) / AES_BLOCK_SIZE, AES_CTR_BATCH_BLOCKS);
+
+            if (blocks > 1) {
+                aes_ctr_crypt_blocks(a, dst, src, blocks);
+                src += blocks * AES_BLOCK_SIZE;
+                dst += blocks * AES_BLOCK_SIZE;
+                continue;
+            }
+
             av_aes_crypt(a->aes, a->encrypted_counter, a->counter, 1, NULL, 0);
 
             av_aes_ctr_increment_be64(a->counter + 8);
@@ -22,6 +22,7 @@
 #include "atomic.h"
 #include "buffer_internal.h"
 #include "common.h"
+#include "cpu.h"
 #include "mem.h"
 #include "thread.h"
 
@@ -254,15 +255,28 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
  * This function gets called when the pool has been uninited and
  * all the buffers returned to it.
  */
-static void buffer_pool_free(AVBufferPool *pool)
+static void free_entries(BufferPoolEntry *buf)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    while (buf) {
+        BufferPoolEntry *next = buf->next;
 
         buf->free(buf->opaque, buf->data);
-        av_freep(&buf);
+        av_free(buf);
+        buf = next;
     }
+}
+
+static void buffer_pool_free(AVBufferPool *pool)
+{
+    int i;
+
+    free_entries(pool->pool);
+    for (i = 0; i < pool->nb_magazines; i++) {
+        free_entries(pool->magazines[i]->entries);
+        ff_mutex_destroy(&pool->magazines[i]->mutex);
+        av_free(pool->magazines[i]);
+    }
+    av_freep(&pool->magazines);
     ff_mutex_destroy(&pool->mutex);
 
     if (pool->pool_free)
@@ -322,6 +336,159 @@ static void add_to_pool(BufferPoolEntry *buf)
 }
 #endif
 
+#if HAVE_PTHREADS
+static pthread_key_t thread_id_key;
+static AVOnce thread_id_once = AV_ONCE_INIT;
+static volatile int nb_thread_ids;
+
+static void thread_id_init(void)
+{
+    pthread_key_create(&thread_id_key, NULL);
+}
+
+/* small integer identifying the calling thread, assigned on first use */
+static int get_thread_id(void)
+{
+    intptr_t id;
+
+    ff_thread_once(&thread_id_once, thread_id_init);
+    id = (intptr_t)pthread_getspecific(thread_id_key);
+    if (!id) {
+        id = avpriv_atomic_int_add_and_fetch(&nb_thread_ids, 1);
+        pthread_setspecific(thread_id_key, (void *)id);
+    }
+    return id - 1;
+}
+
+static BufferPoolMagazine *get_magazine(AVBufferPool *pool)
+{
+    return pool->magazines[get_thread_id() % pool->nb_magazines];
+}
+
+/* take a buffer from the magazine of the calling thread, refilling it from
+ * the shared list when it is empty */
+static BufferPoolEntry *magazine_get(AVBufferPool *pool)
+{
+    BufferPoolMagazine *mag = get_magazine(pool);
+    BufferPoolEntry *buf;
+
+    ff_mutex_lock(&mag->mutex);
+    if (!mag->entries) {
+        BufferPoolEntry *last = NULL;
+        int n = 0;
+
+        ff_mutex_lock(&pool->mutex);
+        buf = pool->pool;
+        while (buf && n < (pool->magazine_size + 1) / 2) {
+            last = buf;
+            buf  = buf->next;
+            n++;
+        }
+        if (last) {
+            mag->entries   = pool->pool;
+            mag->nb_entries = n;
+            pool->pool     = buf;
+            last->next     = NULL;
+        }
+        ff_mutex_unlock(&pool->mutex);
+    }
+
+    buf = mag->entries;
+    if (buf) {
+        mag->entries = buf->next;
+        mag->nb_entries--;
+        mag->nb_hits++;
+        buf->next = NULL;
+    }
+    ff_mutex_unlock(&mag->mutex);
+
+    return buf;
+}
+
+/* put a buffer in the magazine of the calling thread, moving the least
+ * recently used half of it to the shared list when it overflows */
+static void magazine_put(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    BufferPoolMagazine *mag = get_magazine(pool);
+    BufferPoolEntry *first, *last;
+    int i;
+
+    ff_mutex_lock(&mag->mutex);
+    buf->next    = mag->entries;
+    mag->entries = buf;
+    if (++mag->nb_entries > pool->magazine_size) {
+        last = mag->entries;
+        for (i = 1; i < pool->magazine_size / 2; i++)
+            last = last->next;
+        first      = last->next;
+        last->next = NULL;
+        mag->nb_entries = i;
+
+        for (last = first; last->next; last = last->next)
+            ;
+        ff_mutex_lock(&pool->mutex);
+        last->next = pool->pool;
+        pool->pool = first;
+        ff_mutex_unlock(&pool->mutex);
+    }
+    ff_mutex_unlock(&mag->mutex);
+}
+#endif
+
+int av_buffer_pool_set_thread_cache(AVBufferPool *pool, int size)
+{
+#if HAVE_PTHREADS
+    int i, nb_magazines = av_cpu_count();
+
+    if (size < 2 || pool->magazines || avpriv_atomic_int_get(&pool->nb_allocated))
+        return AVERROR(EINVAL);
+
+    pool->magazines = av_mallocz_array(nb_magazines, sizeof(*pool->magazines));
+    if (!pool->magazines)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb_magazines; i++) {
+        pool->magazines[i] = av_mallocz(sizeof(*pool->magazines[i]));
+        if (!pool->magazines[i]) {
+            while (i--) {
+                ff_mutex_destroy(&pool->magazines[i]->mutex);
+                av_free(pool->magazines[i]);
+            }
+            av_freep(&pool->magazines);
+            return AVERROR(ENOMEM);
+        }
+        ff_mutex_init(&pool->magazines[i]->mutex, NULL);
+    }
+    pool->nb_magazines  = nb_magazines;
+    pool->magazine_size = size;
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void av_buffer_pool_get_stats(AVBufferPool *pool, AVBufferPoolStats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < pool->nb_magazines; i++) {
+        ff_mutex_lock(&pool->magazines[i]->mutex);
+        stats->nb_hits += pool->magazines[i]->nb_hits;
+        ff_mutex_unlock(&pool->magazines[i]->mutex);
+    }
+    ff_mutex_lock(&pool->mutex);
+    stats->nb_hits   += pool->nb_hits;
+    ff_mutex_unlock(&pool->mutex);
+
+    stats->nb_misses    = avpriv_atomic_int_get(&pool->nb_allocated);
+    stats->nb_requests  = stats->nb_hits + stats->nb_misses;
+    stats->nb_allocated = stats->nb_misses;
+    /* the caller holds one reference to the pool until it is uninited */
+    stats->nb_in_use    = FFMAX(avpriv_atomic_int_get(&pool->refcount) - 1, 0);
+    stats->max_in_use   = FFMAX(avpriv_atomic_int_get(&pool->max_refcount) - 1, 0);
+}
+
 static void pool_release_buffer(void *opaque, uint8_t *data)
 {
     BufferPoolEntry *buf = opaque;
@@ -333,16 +500,34 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
 #if USE_ATOMICS
     add_to_pool(buf);
 #else
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+#if HAVE_PTHREADS
+    if (pool->magazines) {
+        magazine_put(pool, buf);
+    } else
+#endif
+    {
+        ff_mutex_lock(&pool->mutex);
+        buf->next = pool->pool;
+        pool->pool = buf;
+        ff_mutex_unlock(&pool->mutex);
+    }
 #endif
 
     if (!avpriv_atomic_int_add_and_fetch(&pool->refcount, -1))
         buffer_pool_free(pool);
 }
 
+static void update_max_refcount(AVBufferPool *pool, int refcount)
+{
+    /* only lock when the high-water mark has to be raised */
+    if (refcount > avpriv_atomic_int_get(&pool->max_refcount)) {
+        ff_mutex_lock(&pool->mutex);
+        if (refcount > pool->max_refcount)
+            pool->max_refcount = refcount;
+        ff_mutex_unlock(&pool->mutex);
+    }
+}
+
 /* allocate a new buffer and override its free() callback so that
  * it is returned to the pool on free */
 static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
@@ -370,18 +555,44 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
     ret->buffer->free   = pool_release_buffer;
 
 #if USE_ATOMICS
-    avpriv_atomic_int_add_and_fetch(&pool->refcount, 1);
-    avpriv_atomic_int_add_and_fetch(&pool->nb_allocated, 1);
+    update_max_refcount(pool, avpriv_atomic_int_add_and_fetch(&pool->refcount, 1));
 #endif
+    avpriv_atomic_int_add_and_fetch(&pool->nb_allocated, 1);
 
     return ret;
 }
 
+#if HAVE_PTHREADS
+static AVBufferRef *pool_get_cached(AVBufferPool *pool)
+{
+    BufferPoolEntry *buf = magazine_get(pool);
+    AVBufferRef *ret;
+
+    if (!buf)
+        return pool_alloc_buffer(pool);
+
+    ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
+                           buf, 0);
+    if (!ret)
+        magazine_put(pool, buf);
+    return ret;
+}
+#endif
+
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 {
     AVBufferRef *ret;
     BufferPoolEntry *buf;
 
+#if HAVE_PTHREADS
+    if (pool->magazines) {
+        ret = pool_get_cached(pool);
+        if (ret)
+            update_max_refcount(pool, avpriv_atomic_int_add_and_fetch(&pool->refcount, 1));
+        return ret;
+    }
+#endif
+
 #if USE_ATOMICS
     /* check whether the pool is empty */
     buf = get_pool(pool);
@@ -404,6 +615,8 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
         add_to_pool(buf);
         return NULL;
     }
+    /* without thread support the statistics are not synchronized */
+    pool->nb_hits++;
 #else
     ff_mutex_lock(&pool->mutex);
     buf = pool->pool;
@@ -413,6 +626,7 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
         if (ret) {
             pool->pool = buf->next;
             buf->next = NULL;
+            pool->nb_hits++;
         }
     } else {
         ret = pool_alloc_buffer(pool);
@@ -421,7 +635,7 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 #endif
 
     if (ret)
-        avpriv_atomic_int_add_and_fetch(&pool->refcount, 1);
+        update_max_refcount(pool, avpriv_atomic_int_add_and_fetch(&pool->refcount, 1));
 
     return ret;
 }
@@ -283,6 +283,42 @@ void av_buffer_pool_uninit(AVBufferPool **pool);
  */
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool);
 
+/**
+ * Give each thread using the pool a small cache of free buffers.
+ *
+ * av_buffer_pool_get() and buffer releases then work on the cache of the
+ * calling thread, and free buffers are moved between the caches and the
+ * shared free list in batches. This reduces contention when many threads
+ * use the same pool, at the cost of a few more buffers being allocated.
+ *
+ * This function must be called before the first av_buffer_pool_get().
+ *
+ * @param size maximum number of free buffers kept by each thread, at least 2
+ * @return 0 on success, a negative AVERROR on failure;
+ *         AVERROR(ENOSYS) if libavutil was built without pthreads
+ */
+int av_buffer_pool_set_thread_cache(AVBufferPool *pool, int size);
+
+/**
+ * Usage statistics of an AVBufferPool, see av_buffer_pool_get_stats().
+ * New fields may be added to the end with minor version bumps.
+ */
+typedef struct AVBufferPoolStats {
+    int64_t nb_requests;  ///< buffers returned by av_buffer_pool_get()
+    int64_t nb_hits;      ///< requests served with a buffer from the pool
+    int64_t nb_misses;    ///< requests for which a new buffer was allocated
+    int     nb_allocated; ///< buffers currently owned by the pool, in use or free
+    int     nb_in_use;    ///< buffers currently in use
+    int     max_in_use;   ///< highest number of buffers in use at the same time
+} AVBufferPoolStats;
+
+/**
+ * Get usage statistics of the pool, e.g. to pick a pool size.
+ * This function may be called while other threads use the pool, in which
+ * case the statistics are not an atomic snapshot.
+ */
+void av_buffer_pool_get_stats(AVBufferPool *pool, AVBufferPoolStats *stats);
+
 /**
  * @}
  */
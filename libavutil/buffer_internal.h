@@ -72,10 +72,27 @@ typedef struct BufferPoolEntry {
     struct BufferPoolEntry *next;
 } BufferPoolEntry;
 
+/*
+ * A small per-thread cache of free buffers, see
+ * av_buffer_pool_set_thread_cache(). Entries move between a magazine and the
+ * shared list of the pool in batches, so that the pool mutex is only taken
+ * once every few av_buffer_pool_get() or buffer release calls.
+ */
+typedef struct BufferPoolMagazine {
+    AVMutex mutex;
+    BufferPoolEntry *entries;
+    int nb_entries;
+    int64_t nb_hits;
+} BufferPoolMagazine;
+
 struct AVBufferPool {
     AVMutex mutex;
     BufferPoolEntry *pool;
 
+    BufferPoolMagazine **magazines;
+    int nb_magazines;
+    int magazine_size;
+
     /*
      * This is used to track when the pool is to be freed.
      * The pointer to the pool itself held by the caller is considered to
@@ -89,6 +106,10 @@ struct AVBufferPool {
 
     volatile int nb_allocated;
 
+    /* statistics, see av_buffer_pool_get_stats() */
+    int64_t nb_hits;
+    volatile int max_refcount;
+
     int size;
     void *opaque;
     AVBufferRef* (*alloc)(int size);
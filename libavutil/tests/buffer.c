@@ -0,0 +1,90 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+
+static void print_stats(AVBufferPool *pool)
+{
+    AVBufferPoolStats stats;
+
+    av_buffer_pool_get_stats(pool, &stats);
+    printf("requests:%"PRId64" hits:%"PRId64" misses:%"PRId64" "
+           "allocated:%d in_use:%d max_in_use:%d\n",
+           stats.nb_requests, stats.nb_hits, stats.nb_misses,
+           stats.nb_allocated, stats.nb_in_use, stats.max_in_use);
+}
+
+static int test_pool(int thread_cache)
+{
+    AVBufferRef *bufs[8] = { NULL };
+    AVBufferPool *pool = av_buffer_pool_init(64, NULL);
+    int i, ret;
+
+    if (!pool)
+        return AVERROR(ENOMEM);
+
+    if (thread_cache) {
+        ret = av_buffer_pool_set_thread_cache(pool, 4);
+        if (ret < 0 && ret != AVERROR(ENOSYS))
+            goto end;
+    }
+
+    for (i = 0; i < 5; i++)
+        if (!(bufs[i] = av_buffer_pool_get(pool)))
+            goto fail;
+    print_stats(pool);
+
+    for (i = 0; i < 3; i++)
+        av_buffer_unref(&bufs[i]);
+    print_stats(pool);
+
+    for (i = 0; i < 4; i++)
+        if (!(bufs[i < 3 ? i : 5] = av_buffer_pool_get(pool)))
+            goto fail;
+    print_stats(pool);
+
+    for (i = 0; i < FF_ARRAY_ELEMS(bufs); i++)
+        av_buffer_unref(&bufs[i]);
+    print_stats(pool);
+
+    ret = 0;
+    goto end;
+fail:
+    ret = AVERROR(ENOMEM);
+    for (i = 0; i < FF_ARRAY_ELEMS(bufs); i++)
+        av_buffer_unref(&bufs[i]);
+end:
+    av_buffer_pool_uninit(&pool);
+    return ret;
+}
+
+int main(void)
+{
+    printf("shared pool\n");
+    if (test_pool(0) < 0)
+        return 1;
+    printf("pool with thread cache\n");
+    if (test_pool(1) < 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,178 @@
+;******************************************************************************
+;* AES-NI accelerated AES
+;*
+;* This file is part of FFmpeg.
+;*
+;* FFmpeg is free software; you can redistribute it and/or
+;* modify it under the terms of the GNU Lesser General Public
+;* License as published by the Free Software Foundation; either
+;* version 2.1 of the License, or (at your option) any later version.
+;*
+;* FFmpeg is distributed in the hope that it will be useful,
+;* but WITHOUT ANY WARRANTY; without even the implied warranty of
+;* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;* Lesser General Public License for more details.
+;*
+;* You should have received a copy of the GNU Lesser General Public
+;* License along with FFmpeg; if not, write to the Free Software
+;* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+;******************************************************************************
+
+%include "x86util.asm"
+
+SECTION .text
+
+; The round keys are the first member of AVAES. round_key[rounds] is
+; applied first and round_key[0] last, for both directions; the decryption
+; keys are already in the form expected by aesdec.
+; r0 = AVAES, r5 = 2 * rounds
+
+; %1 = instruction, %2 = offset of the round key, %3 = number of blocks in m0..
+%macro AES_ROUND 3
+%assign %%i 0
+%rep %3
+    %1       m %+ %%i, [r0 + %2]
+%assign %%i %%i+1
+%endrep
+%endmacro
+
+; %1 = enc/dec, %2 = number of blocks in m0..
+%macro AES_BLOCKS 2
+%assign %%i 0
+%rep %2
+    pxor     m %+ %%i, [r0 + r5 * 8]
+%assign %%i %%i+1
+%endrep
+    cmp      r5d, 24
+    je       %%rounds12
+    jl       %%rounds10
+    AES_ROUND aes%1, 13 * 16, %2
+    AES_ROUND aes%1, 12 * 16, %2
+%%rounds12:
+    AES_ROUND aes%1, 11 * 16, %2
+    AES_ROUND aes%1, 10 * 16, %2
+%%rounds10:
+%assign %%r 9
+%rep 9
+    AES_ROUND aes%1, %%r * 16, %2
+%assign %%r %%r-1
+%endrep
+    AES_ROUND aes%1last, 0, %2
+%endmacro
+
+; Without an iv the blocks are independent and 4 of them are processed
+; at once to hide the latency of the aes instructions.
+; %1 = enc/dec
+%macro AES_ECB 1
+    sub      r3d, 4
+    jl .ecb_tail
+.ecb4:
+    movu     m0, [r2]
+    movu     m1, [r2 + 16]
+    movu     m2, [r2 + 32]
+    movu     m3, [r2 + 48]
+    AES_BLOCKS %1, 4
+    movu     [r1],      m0
+    movu     [r1 + 16], m1
+    movu     [r1 + 32], m2
+    movu     [r1 + 48], m3
+    add      r1, 64
+    add      r2, 64
+    sub      r3d, 4
+    jge .ecb4
+.ecb_tail:
+    add      r3d, 4
+    jle .ecb_end
+.ecb1:
+    movu     m0, [r2]
+    AES_BLOCKS %1, 1
+    movu     [r1], m0
+    add      r1, 16
+    add      r2, 16
+    dec      r3d
+    jg .ecb1
+.ecb_end:
+    RET
+%endmacro
+
+;-----------------------------------------------------------------------------
+; void ff_aes_encrypt(AVAES *a, uint8_t *dst, const uint8_t *src,
+;                     int count, uint8_t *iv, int rounds)
+;-----------------------------------------------------------------------------
+INIT_XMM aesni
+cglobal aes_encrypt, 6, 6, 5
+    add      r5d, r5d
+    test     r4, r4
+    jnz .cbc
+    AES_ECB enc
+.cbc:
+    test     r3d, r3d
+    jle .cbc_end
+    movu     m4, [r4]
+.cbc1:
+    movu     m0, [r2]
+    pxor     m0, m4
+    AES_BLOCKS enc, 1
+    movu     [r1], m0
+    mova     m4, m0
+    add      r1, 16
+    add      r2, 16
+    dec      r3d
+    jg .cbc1
+    movu     [r4], m4
+.cbc_end:
+    RET
+
+;-----------------------------------------------------------------------------
+; void ff_aes_decrypt(AVAES *a, uint8_t *dst, const uint8_t *src,
+;                     int count, uint8_t *iv, int rounds)
+;-----------------------------------------------------------------------------
+cglobal aes_decrypt, 6, 6, 6
+    add      r5d, r5d
+    test     r4, r4
+    jnz .cbc
+    AES_ECB dec
+.cbc:
+    movu     m4, [r4]
+    sub      r3d, 4
+    jl .cbc_tail
+.cbc4:
+    movu     m0, [r2]
+    movu     m1, [r2 + 16]
+    movu     m2, [r2 + 32]
+    movu     m3, [r2 + 48]
+    AES_BLOCKS dec, 4
+    ; read all the ciphertext before writing, dst may be equal to src
+    pxor     m0, m4
+    movu     m5, [r2]
+    pxor     m1, m5
+    movu     m5, [r2 + 16]
+    pxor     m2, m5
+    movu     m5, [r2 + 32]
+    pxor     m3, m5
+    movu     m4, [r2 + 48]
+    movu     [r1],      m0
+    movu     [r1 + 16], m1
+    movu     [r1 + 32], m2
+    movu     [r1 + 48], m3
+    add      r1, 64
+    add      r2, 64
+    sub      r3d, 4
+    jge .cbc4
+.cbc_tail:
+    add      r3d, 4
+    jle .cbc_end
+.cbc1:
+    movu     m0, [r2]
+    mova     m5, m0
+    AES_BLOCKS dec, 1
+    pxor     m0, m4
+    mova     m4, m5
+    movu     [r1], m0
+    add      r1, 16
+    add      r2, 16
+    dec      r3d
+    jg .cbc1
+.cbc_end:
+    movu     [r4], m4
+    RET
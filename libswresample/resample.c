@@ -27,8 +27,36 @@
  */
 
 #include "libavutil/avassert.h"
+#include "libavutil/thread.h"
 #include "resample.h"
 
+#if HAVE_THREADS
+/**
+ * Worker threads resampling the channels of one multiple_resample() call
+ * concurrently. The channels only read the shared ResampleContext, except
+ * for the last one which updates the position, so that one works on a copy
+ * which is written back once all channels are done.
+ */
+typedef struct ResampleThreadContext {
+    pthread_t *threads;
+    int nb_threads;                 ///< number of worker threads, not counting the caller
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;       ///< signaled when channels are queued or on exit
+    pthread_cond_t done_cond;       ///< signaled when the last channel is done
+    unsigned execute;               ///< number of queued multiple_resample() calls
+    int exit;
+
+    ResampleContext *c;
+    ResampleContext last_ctx;       ///< copy of c used and updated by the last channel
+    AudioData *dst, *src;
+    int dst_size, src_size;
+    int nb_ch;
+    int next_ch;                    ///< next channel to be picked up by a thread
+    int nb_ch_done;
+    int ret, consumed;              ///< results of the last channel
+} ResampleThreadContext;
+#endif
+
 static inline double eval_poly(const double *coeff, int size, double x) {
     double sum = coeff[size-1];
     int i;
@@ -298,9 +326,135 @@ fail:
     return 0;
 }
 
+static int swri_resample(ResampleContext *c,
+                         uint8_t *dst, const uint8_t *src, int *consumed,
+                         int src_size, int dst_size, int update_ctx);
+
+#if HAVE_THREADS
+static void resample_thread_channel(ResampleThreadContext *t, int ch)
+{
+    int last = ch + 1 == t->nb_ch;
+    int consumed, ret;
+
+    ret = swri_resample(last ? &t->last_ctx : t->c, t->dst->ch[ch], t->src->ch[ch],
+                        &consumed, t->src_size, t->dst_size, last);
+    if (last) {
+        t->ret      = ret;
+        t->consumed = consumed;
+    }
+}
+
+/* must be called with t->mutex held */
+static void resample_thread_run(ResampleThreadContext *t)
+{
+    while (t->next_ch < t->nb_ch) {
+        int ch = t->next_ch++;
+
+        pthread_mutex_unlock(&t->mutex);
+        resample_thread_channel(t, ch);
+        pthread_mutex_lock(&t->mutex);
+
+        if (++t->nb_ch_done == t->nb_ch)
+            pthread_cond_signal(&t->done_cond);
+    }
+}
+
+static void *resample_thread_worker(void *arg)
+{
+    ResampleThreadContext *t = arg;
+    unsigned last_execute = 0;
+
+    pthread_mutex_lock(&t->mutex);
+    for (;;) {
+        while (last_execute == t->execute && !t->exit)
+            pthread_cond_wait(&t->work_cond, &t->mutex);
+        if (t->exit)
+            break;
+        last_execute = t->execute;
+        resample_thread_run(t);
+    }
+    pthread_mutex_unlock(&t->mutex);
+
+    return NULL;
+}
+#endif
+
+static void resample_threads_free(ResampleContext *c)
+{
+#if HAVE_THREADS
+    ResampleThreadContext *t = c->thread_ctx;
+    int i;
+
+    if (!t)
+        return;
+
+    pthread_mutex_lock(&t->mutex);
+    t->exit = 1;
+    pthread_cond_broadcast(&t->work_cond);
+    pthread_mutex_unlock(&t->mutex);
+
+    for (i = 0; i < t->nb_threads; i++)
+        pthread_join(t->threads[i], NULL);
+
+    pthread_mutex_destroy(&t->mutex);
+    pthread_cond_destroy(&t->work_cond);
+    pthread_cond_destroy(&t->done_cond);
+    av_freep(&t->threads);
+    av_freep(&c->thread_ctx);
+#endif
+    c->nb_threads = 1;
+}
+
+static int resample_threads_init(ResampleContext *c, int nb_threads)
+{
+#if HAVE_THREADS
+    ResampleThreadContext *t;
+    int i;
+
+    if (nb_threads <= 1)
+        return 0;
+
+    t = av_mallocz(sizeof(*t));
+    if (!t)
+        return AVERROR(ENOMEM);
+    t->threads = av_mallocz_array(nb_threads - 1, sizeof(*t->threads));
+    if (!t->threads) {
+        av_free(t);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_cond_init(&t->work_cond, NULL);
+    pthread_cond_init(&t->done_cond, NULL);
+    c->thread_ctx = t;
+
+    for (i = 0; i < nb_threads - 1; i++) {
+        if (pthread_create(&t->threads[i], NULL, resample_thread_worker, t)) {
+            av_log(NULL, AV_LOG_WARNING, "Could only create %d resampling threads\n", i + 1);
+            break;
+        }
+        t->nb_threads++;
+    }
+    if (!t->nb_threads) {
+        resample_threads_free(c);
+        return 0;
+    }
+    c->nb_threads = t->nb_threads + 1;
+#endif
+    return 0;
+}
+
+static void resample_free(ResampleContext **c){
+    if(!*c)
+        return;
+    resample_threads_free(*c);
+    av_freep(&(*c)->filter_bank);
+    av_freep(c);
+}
+
 static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_rate, int filter_size, int phase_shift, int linear,
                                     double cutoff0, enum AVSampleFormat format, enum SwrFilterType filter_type, double kaiser_beta,
-                                    double precision, int cheby, int exact_rational)
+                                    double precision, int cheby, int exact_rational, int nb_threads)
 {
     double cutoff = cutoff0? cutoff0 : 0.97;
     double factor= FFMIN(out_rate * cutoff / in_rate, 1.0);
@@ -320,11 +474,13 @@ static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_r
     if (!c || c->phase_count != phase_count || c->linear!=linear || c->factor != factor
            || c->filter_length != FFMAX((int)ceil(filter_size/factor), 1) || c->format != format
            || c->filter_type != filter_type || c->kaiser_beta != kaiser_beta) {
+        resample_free(&c);
         c = av_mallocz(sizeof(*c));
         if (!c)
             return NULL;
 
         c->format= format;
+        c->nb_threads = 1;
 
         c->felem_size= av_get_bytes_per_sample(c->format);
 
@@ -382,20 +538,18 @@ static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_r
 
     swri_resample_dsp_init(c);
 
+    if (c->nb_threads != nb_threads) {
+        resample_threads_free(c);
+        if (resample_threads_init(c, nb_threads) < 0)
+            goto error;
+    }
+
     return c;
 error:
-    av_freep(&c->filter_bank);
-    av_free(c);
+    resample_free(&c);
     return NULL;
 }
 
-static void resample_free(ResampleContext **c){
-    if(!*c)
-        return;
-    av_freep(&(*c)->filter_bank);
-    av_freep(c);
-}
-
 static int rebuild_filter_bank_with_compensation(ResampleContext *c)
 {
     uint8_t *new_filter_bank;
@@ -514,6 +668,34 @@ static int multiple_resample(ResampleContext *c, AudioData *dst, int dst_size, A
         dst_size = FFMIN(dst_size, c->compensation_distance);
     src_size = FFMIN(src_size, max_src_size);
 
+#if HAVE_THREADS
+    if (c->thread_ctx && dst->ch_count > 1 && !need_emms) {
+        ResampleThreadContext *t = c->thread_ctx;
+
+        pthread_mutex_lock(&t->mutex);
+        t->c          = c;
+        t->last_ctx   = *c;
+        t->dst        = dst;
+        t->src        = src;
+        t->dst_size   = dst_size;
+        t->src_size   = src_size;
+        t->nb_ch      = dst->ch_count;
+        t->next_ch    = 0;
+        t->nb_ch_done = 0;
+        t->execute++;
+        pthread_cond_broadcast(&t->work_cond);
+
+        resample_thread_run(t);
+        while (t->nb_ch_done < t->nb_ch)
+            pthread_cond_wait(&t->done_cond, &t->mutex);
+        pthread_mutex_unlock(&t->mutex);
+
+        c->index  = t->last_ctx.index;
+        c->frac   = t->last_ctx.frac;
+        *consumed = t->consumed;
+        ret       = t->ret;
+    } else
+#endif
     for(i=0; i<dst->ch_count; i++){
         ret= swri_resample(c, dst->ch[i], src->ch[i],
                            consumed, src_size, dst_size, i+1==dst->ch_count);
@@ -49,6 +49,8 @@ typedef struct ResampleContext {
     int felem_size;
     int filter_shift;
     int phase_count_compensation;      /* desired phase_count when compensation is enabled */
+    int nb_threads;                    ///< number of threads the channels are resampled with
+    struct ResampleThreadContext *thread_ctx;
 
     struct {
         void (*resample_one)(void *dst, const void *src,
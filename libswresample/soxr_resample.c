@@ -30,7 +30,8 @@
 #include <soxr.h>
 
 static struct ResampleContext *create(struct ResampleContext *c, int out_rate, int in_rate, int filter_size, int phase_shift, int linear,
-        double cutoff, enum AVSampleFormat format, enum SwrFilterType filter_type, double kaiser_beta, double precision, int cheby, int exact_rational){
+        double cutoff, enum AVSampleFormat format, enum SwrFilterType filter_type, double kaiser_beta, double precision, int cheby, int exact_rational,
+        int nb_threads){
     soxr_error_t error;
 
     soxr_datatype_t type =
@@ -46,6 +47,7 @@ static struct ResampleContext *create(struct ResampleContext *c, int out_rate, i
     soxr_io_spec_t io_spec = soxr_io_spec(type, type);
 
     soxr_quality_spec_t q_spec = soxr_quality_spec((int)((precision-2)/4), (SOXR_HI_PREC_CLOCK|SOXR_ROLLOFF_NONE)*!!cheby);
+    soxr_runtime_spec_t runtime_spec = soxr_runtime_spec(nb_threads);
     q_spec.precision = linear? 0 : precision;
 #if !defined SOXR_VERSION /* Deprecated @ March 2013: */
     q_spec.bw_pc = cutoff? FFMAX(FFMIN(cutoff,.995),.8)*100 : q_spec.bw_pc;
@@ -55,7 +57,7 @@ static struct ResampleContext *create(struct ResampleContext *c, int out_rate, i
 
     soxr_delete((soxr_t)c);
     c = (struct ResampleContext *)
-        soxr_create(in_rate, out_rate, 0, &error, &io_spec, &q_spec, 0);
+        soxr_create(in_rate, out_rate, 0, &error, &io_spec, &q_spec, &runtime_spec);
     if (!c)
         av_log(NULL, AV_LOG_ERROR, "soxr_create: %s\n", error);
     return c;
@@ -228,6 +228,48 @@ static void lumRangeFromJpeg16_c(int16_t *_dst, int width)
     if (DEBUG_SWSCALE_BUFFERS)                  \
         av_log(c, AV_LOG_DEBUG, __VA_ARGS__)
 
+static void output_band_line(SwsContext *c, SwsSlice *vout_slice, int dstY,
+                             int vStart, int vEnd)
+{
+    const int chrSkipMask = (1 << c->chrDstVSubSample) - 1;
+    const int nb_planes   = av_pix_fmt_count_planes(c->dstFormat);
+    uint8_t *tmp = (uint8_t *)FFALIGN((uintptr_t)c->band_tmp, BAND_TMP_ALIGN);
+    uint8_t *line[4];
+    int width[4], idx[4];
+    int i;
+
+    av_image_fill_linesizes(width, c->dstFormat, c->dstW);
+    for (i = 0; i < nb_planes; i++) {
+        SwsPlane *plane = &vout_slice->plane[i];
+        int y = i == 1 || i == 2 ? dstY >> c->chrDstVSubSample : dstY;
+
+        idx[i] = y - plane->sliceY;
+        if (idx[i] < 0 || idx[i] >= plane->sliceH) {
+            idx[i] = -1;
+            continue;
+        }
+        /* keep the alignment of the destination, the output functions
+         * may depend on it */
+        line[i] = plane->line[idx[i]];
+        plane->line[idx[i]] = tmp + i * c->band_tmp_stride +
+                              ((uintptr_t)line[i] & (BAND_TMP_ALIGN - 1));
+    }
+
+    for (i = vStart; i < vEnd; ++i)
+        c->desc[i].process(c, &c->desc[i], dstY, 1);
+
+    for (i = 0; i < nb_planes; i++) {
+        SwsPlane *plane = &vout_slice->plane[i];
+
+        if (idx[i] < 0)
+            continue;
+        if (!((i == 1 || i == 2) && (dstY & chrSkipMask)) &&
+            !(i == 3 && !c->needAlpha))
+            memcpy(line[i], plane->line[idx[i]], width[i]);
+        plane->line[idx[i]] = line[i];
+    }
+}
+
 static int swscale(SwsContext *c, const uint8_t *src[],
                    int srcStride[], int srcSliceY,
                    int srcSliceH, uint8_t *dst[], int dstStride[])
@@ -236,6 +278,8 @@ static int swscale(SwsContext *c, const uint8_t *src[],
      * and faster */
     const int dstW                   = c->dstW;
     const int dstH                   = c->dstH;
+    const int dstEnd                 = c->dstSliceH ? c->dstSliceY + c->dstSliceH
+                                                    : dstH;
 
     const enum AVPixelFormat dstFormat = c->dstFormat;
     const int flags                  = c->flags;
@@ -337,7 +381,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     if (srcSliceY == 0) {
         lumBufIndex  = -1;
         chrBufIndex  = -1;
-        dstY         = 0;
+        dstY         = c->dstSliceY;
         lastInLumBuf = -1;
         lastInChrBuf = -1;
     }
@@ -354,8 +398,8 @@ static int swscale(SwsContext *c, const uint8_t *src[],
             srcSliceY, srcSliceH, chrSrcSliceY, chrSrcSliceH, 1);
 
     ff_init_slice_from_src(vout_slice, (uint8_t**)dst, dstStride, c->dstW,
-            dstY, dstH, dstY >> c->chrDstVSubSample,
-            AV_CEIL_RSHIFT(dstH, c->chrDstVSubSample), 0);
+            dstY, dstEnd - dstY, dstY >> c->chrDstVSubSample,
+            AV_CEIL_RSHIFT(dstEnd, c->chrDstVSubSample) - (dstY >> c->chrDstVSubSample), 0);
     if (srcSliceY == 0) {
         hout_slice->plane[0].sliceY = lastInLumBuf + 1;
         hout_slice->plane[1].sliceY = lastInChrBuf + 1;
@@ -369,7 +413,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
         hout_slice->width = dstW;
     }
 
-    for (; dstY < dstH; dstY++) {
+    for (; dstY < dstEnd; dstY++) {
         const int chrDstY = dstY >> c->chrDstVSubSample;
         int use_mmx_vfilter= c->use_mmx_vfilter;
 
@@ -497,7 +541,14 @@ static int swscale(SwsContext *c, const uint8_t *src[],
                            yuv2packed1, yuv2packed2, yuv2packedX, yuv2anyX, use_mmx_vfilter);
         }
 
-        {
+        if (dstY >= dstEnd - 2 && dstY < dstH - 2) {
+            /* The tail of the last lines of a band may be overwritten in
+             * the same way, but the following line belongs to another band,
+             * which may be scaled concurrently. Output these lines to
+             * scratch memory and copy them, so that the same functions as
+             * without bands are used. */
+            output_band_line(c, vout_slice, dstY, vStart, vEnd);
+        } else {
             for (i = vStart; i < vEnd; ++i)
                 desc[i].process(c, &desc[i], dstY, 1);
         }
@@ -605,6 +656,17 @@ SwsFunc ff_getSwsFunc(SwsContext *c)
     return swscale;
 }
 
+int ff_sws_bands_supported(SwsContext *c)
+{
+    /* error diffusion carries state from one line to the next, and the
+     * pre/post conversions of sws_scale() work on the whole image */
+    return c->swscale == swscale        &&
+           !c->cascaded_context[0]      &&
+           c->dither != SWS_DITHER_ED   &&
+           !c->srcXYZ && !c->dstXYZ     &&
+           !(c->src0Alpha && !c->dst0Alpha && isALPHA(c->dstFormat));
+}
+
 static void reset_ptr(const uint8_t *src[], enum AVPixelFormat format)
 {
     if (!isALPHA(format))
@@ -998,3 +1060,38 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
     av_free(rgb0_tmp);
     return ret;
 }
+
+int attribute_align_arg sws_scale_band(struct SwsContext *c, int jobnr,
+                                       const uint8_t * const srcSlice[],
+                                       const int srcStride[],
+                                       uint8_t * const dst[],
+                                       const int dstStride[])
+{
+    SwsContext *band;
+    const int align = (1 << c->chrDstVSubSample) - 1;
+    int start, end;
+
+    if (jobnr < 0 || jobnr >= FFMAX(c->nb_slice_ctx, 1))
+        return AVERROR(EINVAL);
+
+    /* the colorspace details may have made the conversion unsplittable
+     * since initialization, let the first job do all the work then */
+    if (!c->nb_slice_ctx || !ff_sws_bands_supported(c))
+        return jobnr ? 0 : sws_scale(c, srcSlice, srcStride, 0, c->srcH,
+                                     dst, dstStride);
+
+    /* keep bands aligned to the chroma subsampling, so that no chroma
+     * line is shared by two bands */
+    start = (int)((int64_t)c->dstH *  jobnr      / c->nb_slice_ctx) & ~align;
+    end   = (int)((int64_t)c->dstH * (jobnr + 1) / c->nb_slice_ctx) & ~align;
+    if (jobnr == c->nb_slice_ctx - 1)
+        end = c->dstH;
+    if (start >= end)
+        return 0;
+
+    band            = c->slice_ctx[jobnr];
+    band->dstSliceY = start;
+    band->dstSliceH = end - start;
+
+    return sws_scale(band, srcSlice, srcStride, 0, c->srcH, dst, dstStride);
+}
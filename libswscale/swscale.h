@@ -216,6 +216,26 @@ int sws_scale(struct SwsContext *c, const uint8_t *const srcSlice[],
               const int srcStride[], int srcSliceY, int srcSliceH,
               uint8_t *const dst[], const int dstStride[]);
 
+/**
+ * Scale one horizontal band of the destination image.
+ *
+ * If the context was initialized with the "threads" option set to N > 1,
+ * the destination image is split into N horizontal bands, each with its
+ * own private scaler state. Calls with different jobnr, from 0 to N - 1,
+ * may then run concurrently on the same context; together they output the
+ * whole image. When the conversion cannot be split, the context is left
+ * with a single band and "threads" is reset to 1.
+ *
+ * Unlike sws_scale(), the whole source image has to be passed to every
+ * call. The other parameters are the same as for sws_scale().
+ *
+ * @param jobnr     index of the band to scale, 0 <= jobnr < "threads"
+ * @return          the height of the output band or a negative error code
+ */
+int sws_scale_band(struct SwsContext *c, int jobnr,
+                   const uint8_t *const srcSlice[], const int srcStride[],
+                   uint8_t *const dst[], const int dstStride[]);
+
 /**
  * @param dstRange flag indicating the while-black range of the output (1=jpeg / 0=mpeg)
  * @param srcRange flag indicating the while-black range of the input (1=jpeg / 0=mpeg)
@@ -64,6 +64,8 @@
 
 #define RETCODE_USE_CASCADE -12345
 
+#define BAND_TMP_ALIGN 64
+
 struct SwsContext;
 
 typedef enum SwsDither {
@@ -325,6 +327,18 @@ typedef struct SwsContext {
     uint8_t *cascaded1_tmp[4];
     int cascaded_mainindex;
 
+    /* The slice_* fields allow splitting the destination image into
+     * horizontal bands which are scaled concurrently, each by its own
+     * context with private line buffers, see sws_scale_band().
+     */
+    int nb_threads;               ///< Number of bands requested by the user, 0 for one per CPU.
+    struct SwsContext **slice_ctx;
+    int nb_slice_ctx;
+    int dstSliceY;                ///< First destination line output by this band context.
+    int dstSliceH;                ///< Number of destination lines output by this band context, 0 for all.
+    uint8_t *band_tmp;            ///< Scratch lines for the last lines of a band, one per plane.
+    int band_tmp_stride;          ///< Distance in bytes between the planes in band_tmp.
+
     double gamma_value;
     int gamma_flag;
     int is_internal_gamma;
@@ -880,6 +894,12 @@ void ff_get_unscaled_swscale_aarch64(SwsContext *c);
  */
 SwsFunc ff_getSwsFunc(SwsContext *c);
 
+/**
+ * Return 1 if the output of the initialized context c can be split into
+ * bands scaled independently of each other, 0 otherwise.
+ */
+int ff_sws_bands_supported(SwsContext *c);
+
 void ff_sws_init_input_funcs(SwsContext *c);
 void ff_sws_init_output_funcs(SwsContext *c,
                               yuv2planar1_fn *yuv2plane1,
@@ -852,6 +852,12 @@ int sws_setColorspaceDetails(struct SwsContext *c, const int inv_table[4],
     const AVPixFmtDescriptor *desc_dst;
     const AVPixFmtDescriptor *desc_src;
     int need_reinit = 0;
+    int i;
+
+    for (i = 0; i < c->nb_slice_ctx; i++)
+        sws_setColorspaceDetails(c->slice_ctx[i], inv_table, srcRange,
+                                 table, dstRange,
+                                 brightness, contrast, saturation);
 
     handle_formats(c);
     desc_dst = av_pix_fmt_desc_get(c->dstFormat);
@@ -1144,8 +1150,8 @@ static enum AVPixelFormat alphaless_fmt(enum AVPixelFormat fmt)
     }
 }
 
-av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
-                             SwsFilter *dstFilter)
+static av_cold int init_context(SwsContext *c, SwsFilter *srcFilter,
+                                SwsFilter *dstFilter)
 {
     int i;
     int usesVFilter, usesHFilter;
@@ -1826,6 +1832,80 @@ fail: // FIXME replace things by appropriate error codes
     return -1;
 }
 
+static void free_slice_contexts(SwsContext **slice_ctx, int nb_slice_ctx)
+{
+    int i;
+
+    if (!slice_ctx)
+        return;
+    for (i = 0; i < nb_slice_ctx; i++)
+        sws_freeContext(slice_ctx[i]);
+    av_free(slice_ctx);
+}
+
+av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
+                             SwsFilter *dstFilter)
+{
+    SwsContext **slice_ctx = NULL;
+    int nb_slice_ctx = c->nb_threads ? c->nb_threads : av_cpu_count();
+    int i, ret;
+
+    /* Copy the options before init_context() adjusts them, so that the
+     * band contexts are set up exactly like the main one. */
+    if (nb_slice_ctx > 1) {
+        slice_ctx = av_mallocz_array(nb_slice_ctx, sizeof(*slice_ctx));
+        if (!slice_ctx)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < nb_slice_ctx; i++) {
+            slice_ctx[i] = sws_alloc_context();
+            if (!slice_ctx[i] || av_opt_copy(slice_ctx[i], c) < 0) {
+                free_slice_contexts(slice_ctx, nb_slice_ctx);
+                return AVERROR(ENOMEM);
+            }
+            slice_ctx[i]->nb_threads = 1;
+            slice_ctx[i]->flags     &= ~SWS_PRINT_INFO;
+        }
+    }
+
+    c->nb_threads = 1;
+    ret = init_context(c, srcFilter, dstFilter);
+    if (ret < 0 || !slice_ctx)
+        goto end;
+
+    if (!ff_sws_bands_supported(c)) {
+        av_log(c, AV_LOG_VERBOSE, "Conversion cannot be split in bands, "
+               "scaling with a single thread\n");
+        goto end;
+    }
+
+    for (i = 0; i < nb_slice_ctx; i++) {
+        SwsContext *band = slice_ctx[i];
+        int linesize[4];
+
+        ret = init_context(band, srcFilter, dstFilter);
+        if (ret < 0)
+            goto end;
+
+        av_image_fill_linesizes(linesize, band->dstFormat, band->dstW);
+        band->band_tmp_stride = FFALIGN(FFMAX(FFMAX(linesize[0], linesize[1]),
+                                              FFMAX(linesize[2], linesize[3])),
+                                        BAND_TMP_ALIGN) + 2 * BAND_TMP_ALIGN;
+        band->band_tmp = av_mallocz(4 * band->band_tmp_stride + BAND_TMP_ALIGN);
+        if (!band->band_tmp) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+    c->slice_ctx    = slice_ctx;
+    c->nb_slice_ctx = nb_slice_ctx;
+    c->nb_threads   = nb_slice_ctx;
+    return 0;
+
+end:
+    free_slice_contexts(slice_ctx, nb_slice_ctx);
+    return ret;
+}
+
 SwsContext *sws_alloc_set_opts(int srcW, int srcH, enum AVPixelFormat srcFormat,
                                int dstW, int dstH, enum AVPixelFormat dstFormat,
                                int flags, const double *param)
@@ -2320,8 +2400,12 @@ void sws_freeContext(SwsContext *c)
     sws_freeContext(c->cascaded_context[1]);
     sws_freeContext(c->cascaded_context[2]);
     memset(c->cascaded_context, 0, sizeof(c->cascaded_context));
+    free_slice_contexts(c->slice_ctx, c->nb_slice_ctx);
+    c->slice_ctx    = NULL;
+    c->nb_slice_ctx = 0;
     av_freep(&c->cascaded_tmp[0]);
     av_freep(&c->cascaded1_tmp[0]);
+    av_freep(&c->band_tmp);
 
     av_freep(&c->gamma);
     av_freep(&c->inv_gamma);
@@ -109,6 +109,9 @@ static const struct {
     #if CONFIG_COLORSPACE_FILTER
         { "vf_colorspace", checkasm_check_colorspace },
     #endif
+#endif
+#if CONFIG_AVUTIL
+        { "aes", checkasm_check_aes },
 #endif
     { NULL }
 };
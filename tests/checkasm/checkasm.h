@@ -30,6 +30,7 @@
 #include "libavutil/lfg.h"
 #include "libavutil/timer.h"
 
+void checkasm_check_aes(void);
 void checkasm_check_alacdsp(void);
 void checkasm_check_blend(void);
 void checkasm_check_bswapdsp(void);
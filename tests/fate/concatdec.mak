@@ -3,6 +3,8 @@ FATE_CONCAT_DEMUXER_SIMPLE1_LAVF-$(call ENCDEC2, MPEG2VIDEO, PCM_S16LE, MXF)   +
 
 FATE_CONCAT_DEMUXER_SIMPLE2_LAVF-$(call ENCDEC2, MPEG2VIDEO, MP2, MPEGTS)      += ts
 
+FATE_CONCAT_DEMUXER_PREOPEN_LAVF-$(call ENCDEC2, MPEG2VIDEO, MP2, MPEGTS)      += ts
+
 FATE_CONCAT_DEMUXER_EXTENDED_LAVF-$(call ENCDEC2, MPEG2VIDEO, PCM_S16LE, MXF)  += mxf
 FATE_CONCAT_DEMUXER_EXTENDED_LAVF-$(call ENCDEC2, MPEG2VIDEO, PCM_S16LE, MXF)  += mxf_d10
 
@@ -18,4 +20,9 @@ $(foreach D,$(FATE_CONCAT_DEMUXER_EXTENDED_LAVF-yes),$(eval fate-concat-demuxer-
 $(foreach D,$(FATE_CONCAT_DEMUXER_EXTENDED_LAVF-yes),$(eval fate-concat-demuxer-extended-lavf-$(D): CMD = concat $(SRC_PATH)/tests/extended.ffconcat ../lavf/lavf.$(D) md5))
 FATE_CONCAT_DEMUXER-$(CONFIG_CONCAT_DEMUXER) += $(FATE_CONCAT_DEMUXER_EXTENDED_LAVF-yes:%=fate-concat-demuxer-extended-lavf-%)
 
+# same as simple2, with the next file opened in the background
+$(foreach D,$(FATE_CONCAT_DEMUXER_PREOPEN_LAVF-yes),$(eval fate-concat-demuxer-preopen-lavf-$(D): ffprobe$(PROGSSUF)$(EXESUF) fate-lavf-$(D)))
+$(foreach D,$(FATE_CONCAT_DEMUXER_PREOPEN_LAVF-yes),$(eval fate-concat-demuxer-preopen-lavf-$(D): CMD = concat $(SRC_PATH)/tests/simple2.ffconcat ../lavf/lavf.$(D) "" "-preopen 1"))
+FATE_CONCAT_DEMUXER-$(CONFIG_CONCAT_DEMUXER) += $(FATE_CONCAT_DEMUXER_PREOPEN_LAVF-yes:%=fate-concat-demuxer-preopen-lavf-%)
+
 FATE-$(CONFIG_FFPROBE) += $(FATE_CONCAT_DEMUXER-yes)
@@ -25,6 +25,12 @@ fate-ffmpeg-filter_colorkey: CMD = framecrc -idct simple -fflags +bitexact -flag
 FATE_FFMPEG-$(CONFIG_COLOR_FILTER) += fate-ffmpeg-lavfi
 fate-ffmpeg-lavfi: CMD = framecrc -lavfi color=d=1:r=5 -fflags +bitexact
 
+FATE_FFMPEG-$(call ALLYES, COLOR_FILTER SINE_FILTER) += fate-ffmpeg-encode_threads
+fate-ffmpeg-encode_threads: CMD = framecrc -encode_threads -filter_complex "color=d=1:r=5[v];sine=d=1[a]" -map "[v]" -map "[a]" -fflags +bitexact
+
+FATE_FFMPEG-$(call ALLYES, COLOR_FILTER SINE_FILTER) += fate-ffmpeg-filtergraph_threads
+fate-ffmpeg-filtergraph_threads: CMD = framecrc -filtergraph_threads -filter_complex "color=d=1:r=5,split[v1][v2]" -filter_complex "sine=d=1[a]" -map "[v1]" -map "[a]" -map "[v2]" -fflags +bitexact
+
 FATE_SAMPLES_FFMPEG-$(CONFIG_RAWVIDEO_DEMUXER) += fate-force_key_frames
 fate-force_key_frames: tests/data/vsynth_lena.yuv
 fate-force_key_frames: CMD = enc_dec \
@@ -29,6 +29,10 @@ FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_xml
 fate-ffprobe_xml: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xml: CMD = run $(FFPROBE_COMMAND) -of xml
 
+FATE_FFPROBE-$(call ENCDEC2, MPEG2VIDEO, MP2, MPEGTS) += fate-ffprobe-faststart
+fate-ffprobe-faststart: fate-lavf-ts
+fate-ffprobe-faststart: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 -fflags +faststart -show_entries stream=index,codec_name,width,height,pix_fmt,has_b_frames,r_frame_rate,sample_fmt,sample_rate,channels -of compact $(TARGET_PATH)/tests/data/lavf/lavf.ts
+
 FATE_FFPROBE += $(FATE_FFPROBE-yes)
 
 fate-ffprobe: $(FATE_FFPROBE)
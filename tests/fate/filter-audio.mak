@@ -94,6 +94,16 @@ FATE_AFILTER-$(call ALLYES, HLS_DEMUXER MPEGTS_MUXER MPEGTS_DEMUXER AEVALSRC_FIL
 fate-filter-hls: tests/data/hls-list.m3u8
 fate-filter-hls: CMD = framecrc -flags +bitexact -i $(TARGET_PATH)/tests/data/hls-list.m3u8
 
+# segments used as initialization sections larger than the prefetch buffer,
+# the second one is prefetched
+tests/data/hls-init-list.m3u8: TAG = GEN
+tests/data/hls-init-list.m3u8: tests/data/hls-list.m3u8
+	$(M)printf '#EXTM3U\n#EXT-X-TARGETDURATION:11\n#EXT-X-MAP:URI="hls-out-000.ts"\n#EXTINF:10,\nhls-out-001.ts\n#EXT-X-MAP:URI="hls-out-001.ts"\n#EXTINF:1,\nhls-out-002.ts\n#EXT-X-ENDLIST\n' > $@
+
+FATE_AFILTER-$(call ALLYES, HLS_DEMUXER MPEGTS_MUXER MPEGTS_DEMUXER AEVALSRC_FILTER LAVFI_INDEV MP2FIXED_ENCODER) += fate-filter-hls-prefetch
+fate-filter-hls-prefetch: tests/data/hls-init-list.m3u8
+fate-filter-hls-prefetch: CMD = framecrc -flags +bitexact -prefetch 2 -prefetch_buffer_size 32768 -i $(TARGET_PATH)/tests/data/hls-init-list.m3u8 -c copy
+
 FATE_AMIX += fate-filter-amix-simple
 fate-filter-amix-simple: CMD = ffmpeg -filter_complex amix -i $(SRC) -ss 3 -i $(SRC1) -f f32le -
 fate-filter-amix-simple: REF = $(SAMPLES)/filter/amix_simple.pcm
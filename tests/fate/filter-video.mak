@@ -77,6 +77,10 @@ FATE_FILTER-$(call ALLYES, AVDEVICE TESTSRC_FILTER FORMAT_FILTER CONCAT_FILTER S
 fate-filter-lavd-scalenorm: tests/data/filtergraphs/scalenorm
 fate-filter-lavd-scalenorm: CMD = framecrc -f lavfi -graph_file $(TARGET_PATH)/tests/data/filtergraphs/scalenorm -i dummy
 
+FATE_FILTER-$(call ALLYES, TESTSRC_FILTER FORMAT_FILTER SPLIT_FILTER SCALE_FILTER BLEND_FILTER) += fate-filter-scale-threads
+fate-filter-scale-threads: tests/data/filtergraphs/scale_threads
+fate-filter-scale-threads: CMD = framecrc -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/scale_threads -map "[yuv]" -map "[bgr24]" -map "[bgra]"
+
 
 FATE_FILTER_VSYNTH-$(CONFIG_BOXBLUR_FILTER) += fate-filter-boxblur
 fate-filter-boxblur: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf boxblur=2:1
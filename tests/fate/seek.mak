@@ -241,6 +241,12 @@ fate-seek-lavf-yuv4mpeg: SRC = lavf/lavf.y4m
 
 FATE_SEEK += $(FATE_SEEK_LAVF-yes:%=fate-seek-lavf-%)
 
+# fragmented file, the first seek goes to a fragment not indexed yet
+FATE_SEEK_LAZY-$(call ENCDEC2, MPEG4, PCM_ALAW, MOV) += fate-seek-lavf-ismv-lazy
+fate-seek-lavf-ismv-lazy: fate-lavf-ismv libavformat/tests/seek$(EXESUF)
+fate-seek-lavf-ismv-lazy: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/lavf/lavf.ismv -lazy_fragment_index 1 -seekforw 600000 -duration 2
+FATE_SEEK_LAZY += $(FATE_SEEK_LAZY-yes)
+
 # extra files
 
 FATE_SEEK_EXTRA-$(CONFIG_MP3_DEMUXER)   += fate-seek-extra-mp3
@@ -255,6 +261,6 @@ $(FATE_SEEK) $(FATE_SAMPLES_SEEK): CMD = run libavformat/tests/seek$(EXESUF) $(T
 $(FATE_SEEK) $(FATE_SAMPLES_SEEK): fate-seek-%: fate-%
 fate-seek-%: REF = $(SRC_PATH)/tests/ref/seek/$(@:fate-seek-%=%)
 
-FATE_AVCONV += $(FATE_SEEK)
+FATE_AVCONV += $(FATE_SEEK) $(FATE_SEEK_LAZY)
 FATE_SAMPLES_AVCONV += $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA)
-fate-seek:     $(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA)
+fate-seek:     $(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA) $(FATE_SEEK_LAZY)
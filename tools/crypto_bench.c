@@ -28,6 +28,7 @@
 #include <math.h>
 
 #include "libavutil/avutil.h"
+#include "libavutil/cpu.h"
 #include "libavutil/avstring.h"
 #include "libavutil/crc.h"
 #include "libavutil/intreadwrite.h"
@@ -75,6 +76,7 @@ struct hash_impl {
 #include "libavutil/sha512.h"
 #include "libavutil/ripemd.h"
 #include "libavutil/aes.h"
+#include "libavutil/aes_ctr.h"
 #include "libavutil/blowfish.h"
 #include "libavutil/camellia.h"
 #include "libavutil/cast5.h"
@@ -118,6 +120,29 @@ static void run_lavu_aes128(uint8_t *output,
     av_aes_crypt(aes, output, input, size >> 4, NULL, 0);
 }
 
+static void run_lavu_aes128cbc(uint8_t *output,
+                               const uint8_t *input, unsigned size)
+{
+    static struct AVAES *aes;
+    uint8_t iv[16];
+    if (!aes && !(aes = av_aes_alloc()))
+        fatal_error("out of memory");
+    memcpy(iv, hardcoded_key + 16, 16);
+    av_aes_init(aes, hardcoded_key, 128, 1);
+    av_aes_crypt(aes, output, input, size >> 4, iv, 1);
+}
+
+static void run_lavu_aes128ctr(uint8_t *output,
+                               const uint8_t *input, unsigned size)
+{
+    struct AVAESCTR *aes = av_aes_ctr_alloc();
+    if (!aes || av_aes_ctr_init(aes, hardcoded_key) < 0)
+        fatal_error("out of memory");
+    av_aes_ctr_set_iv(aes, hardcoded_key + 16);
+    av_aes_ctr_crypt(aes, output, input, size);
+    av_aes_ctr_free(aes);
+}
+
 static void run_lavu_blowfish(uint8_t *output,
                               const uint8_t *input, unsigned size)
 {
@@ -218,6 +243,17 @@ static void run_crypto_aes128(uint8_t *output,
         AES_encrypt(input + i, output + i, &aes);
 }
 
+static void run_crypto_aes128cbc(uint8_t *output,
+                                 const uint8_t *input, unsigned size)
+{
+    AES_KEY aes;
+    uint8_t iv[16];
+
+    memcpy(iv, hardcoded_key + 16, 16);
+    AES_set_decrypt_key(hardcoded_key, 128, &aes);
+    AES_cbc_encrypt(input, output, size & ~15, &aes, iv, AES_DECRYPT);
+}
+
 static void run_crypto_blowfish(uint8_t *output,
                                 const uint8_t *input, unsigned size)
 {
@@ -521,6 +557,9 @@ struct hash_impl implementations[] = {
     IMPL(tomcrypt, "RIPEMD-128", ripemd128, "9ab8bfba2ddccc5d99c9d4cdfb844a5f")
     IMPL_ALL("RIPEMD-160", ripemd160, "62a5321e4fc8784903bb43ab7752c75f8b25af00")
     IMPL_ALL("AES-128",    aes128,    "crc:ff6bc888")
+    IMPL(lavu,     "AES-128-CBC", aes128cbc, "crc:2ba8efb9")
+    IMPL(crypto,   "AES-128-CBC", aes128cbc, "crc:2ba8efb9")
+    IMPL(lavu,     "AES-128-CTR", aes128ctr, "crc:71dba440")
     IMPL_ALL("CAMELLIA",   camellia,  "crc:7abb59a7")
     IMPL_ALL("CAST-128",   cast128,   "crc:456aa584")
     IMPL_ALL("BLOWFISH",   blowfish,  "crc:33e8aa74")
@@ -540,8 +579,15 @@ int main(int argc, char **argv)
     unsigned i, impl, size;
     int opt;
 
-    while ((opt = getopt(argc, argv, "hl:a:r:")) != -1) {
+    while ((opt = getopt(argc, argv, "hl:a:r:c:")) != -1) {
         switch (opt) {
+        case 'c': {
+            unsigned cpu_flags = av_get_cpu_flags();
+            if (av_parse_cpu_caps(&cpu_flags, optarg) < 0)
+                fatal_error("invalid cpu flags");
+            av_force_cpu_flags(cpu_flags);
+            break;
+        }
         case 'l':
             enabled_libs = optarg;
             break;
@@ -553,7 +599,7 @@ int main(int argc, char **argv)
             break;
         case 'h':
         default:
-            fprintf(stderr, "Usage: %s [-l libs] [-a algos] [-r runs]\n",
+            fprintf(stderr, "Usage: %s [-l libs] [-a algos] [-r runs] [-c cpuflags]\n",
                     argv[0]);
             if ((USE_EXT_LIBS)) {
                 char buf[1024];
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 The FFmpeg developers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Demuxing throughput benchmark: reads all the packets of a file after
+ * avformat_find_stream_info(), optionally keeping a single program, and
+ * reports the input rate of the reading loop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-p program_id] [-r runs] [-f format] file\n", argv0);
+    return ret;
+}
+
+/* keep only the program with the given id and its streams */
+static int select_program(AVFormatContext *avf, int program_id)
+{
+    AVProgram *program = NULL;
+    int i, j;
+
+    for (i = 0; i < avf->nb_programs; i++)
+        if (avf->programs[i]->id == program_id)
+            program = avf->programs[i];
+    if (!program)
+        return AVERROR_STREAM_NOT_FOUND;
+
+    for (i = 0; i < avf->nb_streams; i++)
+        avf->streams[i]->discard = AVDISCARD_ALL;
+    for (i = 0; i < avf->nb_programs; i++)
+        avf->programs[i]->discard = AVDISCARD_ALL;
+    program->discard = AVDISCARD_DEFAULT;
+    for (j = 0; j < program->nb_stream_indexes; j++)
+        avf->streams[program->stream_index[j]]->discard = AVDISCARD_DEFAULT;
+    return 0;
+}
+
+static int run(const char *filename, AVInputFormat *ifmt, int program_id)
+{
+    AVFormatContext *avf = NULL;
+    AVPacket pkt;
+    int64_t start_time, elapsed, start_pos, nb_packets = 0, payload = 0;
+    int ret;
+
+    if ((ret = avformat_open_input(&avf, filename, ifmt, NULL)) < 0 ||
+        (ret = avformat_find_stream_info(avf, NULL)) < 0)
+        goto fail;
+    if (program_id >= 0 && (ret = select_program(avf, program_id)) < 0)
+        goto fail;
+
+    start_pos  = avio_tell(avf->pb);
+    start_time = av_gettime_relative();
+    av_init_packet(&pkt);
+    while ((ret = av_read_frame(avf, &pkt)) >= 0) {
+        if (avf->streams[pkt.stream_index]->discard != AVDISCARD_ALL) {
+            nb_packets++;
+            payload += pkt.size;
+        }
+        av_packet_unref(&pkt);
+    }
+    if (ret != AVERROR_EOF)
+        goto fail;
+    ret = 0;
+    elapsed = av_gettime_relative() - start_time;
+
+    printf("%8.1f MB/s %8.0f packets/s, %"PRId64" packets, %"PRId64" bytes of "
+           "payload in %.3f s\n",
+           (avio_tell(avf->pb) - start_pos) / (double)elapsed,
+           nb_packets * 1000000.0 / elapsed, nb_packets, payload,
+           elapsed / 1000000.0);
+
+fail:
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", filename, av_err2str(ret));
+    avformat_close_input(&avf);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    AVInputFormat *ifmt = NULL;
+    const char *filename = NULL;
+    int program_id = -1, runs = 3, i;
+
+    av_register_all();
+    av_log_set_level(AV_LOG_FATAL);
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            program_id = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            if (!(ifmt = av_find_input_format(argv[++i]))) {
+                fprintf(stderr, "Unknown format %s\n", argv[i]);
+                return 1;
+            }
+        } else if (!filename && argv[i][0] != '-') {
+            filename = argv[i];
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (!filename || runs <= 0)
+        return usage(argv[0], 1);
+
+    for (i = 0; i < runs; i++)
+        if (run(filename, ifmt, program_id) < 0)
+            return 1;
+    return 0;
+}
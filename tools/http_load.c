@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2016 The FFmpeg developers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Load generator for HTTP streaming servers such as ffserver: keeps many
+ * clients reading the same URL for a given time and reports how many of
+ * them were served and at which rate.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+typedef struct Client {
+    int64_t bytes;
+    int connected;
+} Client;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n clients] [-t seconds] [-a address] [-p port] path\n",
+            argv0);
+    return ret;
+}
+
+static int open_client(const struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    const char *address = "127.0.0.1", *path = NULL;
+    int nb_clients = 100, duration = 10, port = 8090;
+    int i, nb_open = 0, nb_connected = 0, nb_failed = 0, nb_starved = 0;
+    struct sockaddr_in addr = { 0 };
+    struct pollfd *fds;
+    Client *clients;
+    char request[1024];
+    uint8_t buf[65536];
+    int64_t start_time, elapsed, total = 0, min_bytes = INT64_MAX;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            nb_clients = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            duration = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+            address = argv[++i];
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (!path || nb_clients <= 0 || duration <= 0)
+        return usage(argv[0], 1);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", address);
+        return 1;
+    }
+    snprintf(request, sizeof(request), "GET /%s HTTP/1.0\r\n\r\n",
+             path[0] == '/' ? path + 1 : path);
+
+    fds     = av_malloc_array(nb_clients, sizeof(*fds));
+    clients = av_mallocz_array(nb_clients, sizeof(*clients));
+    if (!fds || !clients) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < nb_clients; i++) {
+        fds[i].fd     = open_client(&addr);
+        fds[i].events = POLLOUT;
+        if (fds[i].fd < 0)
+            nb_failed++;
+        else
+            nb_open++;
+    }
+
+    start_time = av_gettime_relative();
+    while (nb_open && (elapsed = av_gettime_relative() - start_time) <
+                      duration * 1000000LL) {
+        int timeout = (duration * 1000000LL - elapsed + 999) / 1000;
+
+        if (poll(fds, nb_clients, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        for (i = 0; i < nb_clients; i++) {
+            Client *client = &clients[i];
+            int len;
+
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+            if (!client->connected) {
+                /* the connection is established, send the request at once */
+                len = strlen(request);
+                if (send(fds[i].fd, request, len, 0) != len)
+                    goto fail;
+                client->connected = 1;
+                nb_connected++;
+                fds[i].events = POLLIN;
+                continue;
+            }
+            len = recv(fds[i].fd, buf, sizeof(buf), 0);
+            if (len > 0) {
+                client->bytes += len;
+                continue;
+            }
+            if (len < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+fail:
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            nb_open--;
+        }
+    }
+    elapsed = av_gettime_relative() - start_time;
+
+    for (i = 0; i < nb_clients; i++) {
+        total += clients[i].bytes;
+        if (clients[i].connected)
+            min_bytes = FFMIN(min_bytes, clients[i].bytes);
+        if (clients[i].connected && !clients[i].bytes)
+            nb_starved++;
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+    }
+    if (!nb_connected)
+        min_bytes = 0;
+
+    printf("%d clients: %d connected, %d still open after %.1fs, %d failed, "
+           "%d without data\n", nb_clients, nb_connected, nb_open,
+           elapsed / 1000000.0, nb_failed, nb_starved);
+    printf("%"PRId64" bytes received, %.2f MB/s total, "
+           "%.1f kbit/s for the slowest client\n",
+           total, total / (double)elapsed,
+           min_bytes * 8000.0 / elapsed);
+
+    av_free(fds);
+    av_free(clients);
+    return 0;
+}
@@ -30,6 +30,7 @@ static int score_array[MAX_FORMATS];
 static int64_t time_array[MAX_FORMATS];
 static int failures = 0;
 static const char *single_format;
+static const char *input_file;
 
 #ifndef AV_READ_TIME
 #define AV_READ_TIME(x) 0
@@ -62,7 +63,7 @@ static void probe(AVProbeData *pd, int type, int p, int size)
     }
 }
 
-static void print_times(void)
+static void print_times(int64_t min_time)
 {
     int i = 0;
     AVInputFormat *fmt = NULL;
@@ -70,7 +71,7 @@ static void print_times(void)
     while ((fmt = av_iformat_next(fmt))) {
         if (fmt->flags & AVFMT_NOFILE)
             continue;
-        if (time_array[i] > 1000000) {
+        if (time_array[i] > min_time) {
             fprintf(stderr, "%12"PRIu64" cycles, %12s\n",
                     time_array[i], fmt->name);
         }
@@ -78,6 +79,54 @@ static void print_times(void)
     }
 }
 
+static int probe_file(const char *filename, int iterations, int size)
+{
+    AVProbeData pd = { filename };
+    AVInputFormat *fmt, *found = NULL;
+    int64_t total_time = 0;
+    int i, n, score = 0;
+    FILE *f = fopen(filename, "rb");
+
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", filename);
+        return 1;
+    }
+    pd.buf = av_mallocz(size + AVPROBE_PADDING_SIZE);
+    if (!pd.buf) {
+        fclose(f);
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    pd.buf_size = fread(pd.buf, 1, size, f);
+    fclose(f);
+
+    for (n = 0; n < iterations; n++) {
+        int64_t start;
+
+        for (fmt = NULL, i = 0; (fmt = av_iformat_next(fmt)); ) {
+            if (fmt->flags & AVFMT_NOFILE)
+                continue;
+            if (fmt->read_probe &&
+                (!single_format || !strcmp(single_format, fmt->name))) {
+                start = AV_READ_TIME();
+                fmt->read_probe(&pd);
+                time_array[i] += AV_READ_TIME() - start;
+            }
+            i++;
+        }
+
+        start = AV_READ_TIME();
+        found = av_probe_input_format3(&pd, 1, &score);
+        total_time += AV_READ_TIME() - start;
+    }
+
+    print_times(0);
+    fprintf(stderr, "%12"PRId64" cycles, %12s score=%d size=%d (av_probe_input_format3)\n",
+            total_time, found ? found->name : "none", score, pd.buf_size);
+    av_free(pd.buf);
+    return 0;
+}
+
 static int read_int(char *arg) {
     int ret;
 
@@ -102,6 +151,8 @@ int main(int argc, char **argv)
     for (j = i = 1; i<argc; i++) {
         if (!strcmp(argv[i], "-f") && i+1<argc && !single_format) {
             single_format = argv[++i];
+        } else if (!strcmp(argv[i], "-i") && i+1<argc && !input_file) {
+            input_file = argv[++i];
         } else if (read_int(argv[i])>0 && j == 1) {
             retry_count = read_int(argv[i]);
             j++;
@@ -109,7 +160,9 @@ int main(int argc, char **argv)
             max_size = read_int(argv[i]);
             j++;
         } else {
-            fprintf(stderr, "probetest [-f <input format>] [<retry_count> [<max_size>]]\n");
+            fprintf(stderr, "probetest [-f <input format>] [-i <input file>] [<retry_count> [<max_size>]]\n"
+                            "With -i, the first max_size bytes of the file are probed retry_count times\n"
+                            "and the time spent per format is printed.\n");
             return 1;
         }
     }
@@ -127,6 +180,9 @@ int main(int argc, char **argv)
     avcodec_register_all();
     av_register_all();
 
+    if (input_file)
+        return probe_file(input_file, retry_count, max_size);
+
     av_lfg_init(&state, 0xdeadbeef);
 
     pd.buf = NULL;
@@ -198,6 +254,6 @@ int main(int argc, char **argv)
         }
     }
     if(AV_READ_TIME())
-        print_times();
+        print_times(1000000);
     return failures;
 }
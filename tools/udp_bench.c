@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 The FFmpeg developers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Loopback benchmark of the UDP protocol: sends packets from a writer to a
+ * reader on the local host, with and without batched system calls, and
+ * reports the packet rate, the throughput and the loss.
+ *
+ * Packets are written as fast as possible unless a bitrate is given with -r,
+ * in which case the UDP protocol paces every packet to that rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+#define PKT_SIZE 1316
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n packets] [-p port] [-b batch_size] [-r bitrate]\n",
+            argv0);
+    return ret;
+}
+
+static int64_t drain(AVIOContext *input, uint8_t *buf)
+{
+    int64_t received = 0;
+
+    while (avio_read(input, buf, PKT_SIZE) > 0)
+        received++;
+    /* the input is non-blocking, EAGAIN is not the end of the stream */
+    input->eof_reached = 0;
+    input->error       = 0;
+    return received;
+}
+
+static int run(int port, int batch_size, int64_t bitrate, int nb_packets)
+{
+    char url[256], errbuf[50];
+    uint8_t buf[PKT_SIZE];
+    AVIOContext *input = NULL, *output = NULL;
+    int64_t start_time, elapsed, received = 0;
+    int ret, i;
+
+    snprintf(url, sizeof(url),
+             "udp://127.0.0.1:%d?fifo_size=100000&overrun_nonfatal=1"
+             "&buffer_size=4194304&batch_size=%d", port, batch_size);
+    ret = avio_open2(&input, url, AVIO_FLAG_READ | AVIO_FLAG_NONBLOCK, NULL, NULL);
+    if (ret < 0)
+        goto fail;
+
+    snprintf(url, sizeof(url),
+             "udp://127.0.0.1:%d?buffer_size=4194304&batch_size=%d"
+             "&pkt_size=%d&bitrate=%"PRId64, port, batch_size, PKT_SIZE, bitrate);
+    ret = avio_open2(&output, url, AVIO_FLAG_WRITE, NULL, NULL);
+    if (ret < 0)
+        goto fail;
+
+    memset(buf, 0x47, sizeof(buf));
+    start_time = av_gettime_relative();
+    for (i = 0; i < nb_packets; i++) {
+        /* each flush sends one datagram */
+        avio_write(output, buf, PKT_SIZE);
+        avio_flush(output);
+        if ((ret = output->error) < 0)
+            goto fail;
+        if (!(i & 255))
+            received += drain(input, buf);
+    }
+    /* waits for the sending thread to empty its queue */
+    avio_closep(&output);
+    elapsed = av_gettime_relative() - start_time;
+
+    av_usleep(100 * 1000);
+    received += drain(input, buf);
+
+    printf("batch_size %4d: %8.0f packets/s %8.1f Mbit/s, %"PRId64"/%d received (%.2f%% lost)\n",
+           batch_size, nb_packets * 1000000.0 / elapsed,
+           nb_packets * PKT_SIZE * 8.0 / elapsed, received, nb_packets,
+           100.0 * (nb_packets - received) / nb_packets);
+
+fail:
+    if (ret < 0) {
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "Error with %s: %s\n", url, errbuf);
+    }
+    avio_closep(&output);
+    avio_closep(&input);
+    return ret < 0 ? ret : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int nb_packets = 100000, port = 12345, batch_size = 32, i;
+    int64_t bitrate = 0;
+
+    av_register_all();
+    avformat_network_init();
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            nb_packets = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            batch_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            bitrate = strtoll(argv[++i], NULL, 10);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (nb_packets <= 0 || batch_size <= 0 || bitrate < 0)
+        return usage(argv[0], 1);
+
+    if (run(port, 1, bitrate, nb_packets) < 0 ||
+        run(port, batch_size, bitrate, nb_packets) < 0)
+        return 1;
+
+    avformat_network_deinit();
+    return 0;
+}